@@ -0,0 +1,188 @@
+#include "AssimpIO.h"
+#include <assimp/config.h>
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <mutex>
+#include <vector>
+
+namespace
+{
+	// components no Model import reads. vertex colours, skinning, animations, cameras and lights are dropped by
+	// aiProcess_RemoveComponent right after the import instead of being carried through every later step
+	const int REMOVED_COMPONENTS = aiComponent_COLORS | aiComponent_BONEWEIGHTS | aiComponent_ANIMATIONS | aiComponent_CAMERAS | aiComponent_LIGHTS;
+
+	std::mutex poolMutex;
+	std::vector<std::unique_ptr<ImporterPool::PooledImporter>> idleImporters;
+
+	double millisecondsBetween(std::chrono::steady_clock::time_point from, std::chrono::steady_clock::time_point to)
+	{
+		return std::chrono::duration<double, std::milli>(to - from).count();
+	}
+}
+
+MappedIOStream::MappedIOStream(MappedFile&& file)
+	: file(std::move(file))
+{
+}
+
+size_t MappedIOStream::Read(void* buffer, size_t size, size_t count)
+{
+	if (size == 0 || count == 0)
+		return 0;
+	// whole elements only, like fread
+	size_t elements = std::min(count, (file.size() - position) / size);
+	std::memcpy(buffer, file.data() + position, elements * size);
+	position += elements * size;
+	return elements;
+}
+
+size_t MappedIOStream::Write(const void*, size_t, size_t)
+{
+	return 0;
+}
+
+aiReturn MappedIOStream::Seek(size_t offset, aiOrigin origin)
+{
+	size_t target;
+	switch (origin)
+	{
+	case aiOrigin_SET:
+		target = offset;
+		break;
+	case aiOrigin_CUR:
+		target = position + offset;
+		break;
+	case aiOrigin_END:
+		// Assimp passes the distance back from the end here
+		if (offset > file.size())
+			return aiReturn_FAILURE;
+		target = file.size() - offset;
+		break;
+	default:
+		return aiReturn_FAILURE;
+	}
+	if (target > file.size())
+		return aiReturn_FAILURE;
+	position = target;
+	return aiReturn_SUCCESS;
+}
+
+size_t MappedIOStream::Tell() const
+{
+	return position;
+}
+
+size_t MappedIOStream::FileSize() const
+{
+	return file.size();
+}
+
+void MappedIOStream::Flush()
+{
+}
+
+bool MappedIOSystem::Exists(const char* path) const
+{
+	std::error_code error;
+	return std::filesystem::is_regular_file(path, error);
+}
+
+char MappedIOSystem::getOsSeparator() const
+{
+#ifdef _WIN32
+	return '\\';
+#else
+	return '/';
+#endif
+}
+
+Assimp::IOStream* MappedIOSystem::Open(const char* path, const char* mode)
+{
+	if (std::strchr(mode, 'w') != nullptr || std::strchr(mode, 'a') != nullptr || std::strchr(mode, '+') != nullptr)
+		return nullptr;
+
+	// an empty file can't be mapped but is still a valid (empty) stream
+	MappedFile file;
+	if (!file.open(path) && !Exists(path))
+		return nullptr;
+	return new MappedIOStream(std::move(file));
+}
+
+void MappedIOSystem::Close(Assimp::IOStream* stream)
+{
+	delete stream;
+}
+
+void ImportTimer::reset()
+{
+	start = readEnd = std::chrono::steady_clock::now();
+	timings = AssimpImportTimings();
+}
+
+bool ImportTimer::Update(float)
+{
+	return true;
+}
+
+void ImportTimer::UpdateFileRead(int currentStep, int numberOfSteps)
+{
+	// called once before and once after the importer runs
+	if (currentStep >= numberOfSteps)
+	{
+		readEnd = std::chrono::steady_clock::now();
+		timings.readMs = millisecondsBetween(start, readEnd);
+	}
+}
+
+void ImportTimer::UpdatePostProcess(int currentStep, int numberOfSteps)
+{
+	// called before each step and with currentStep == numberOfSteps once all of them are done
+	timings.postProcessSteps = numberOfSteps;
+	if (currentStep >= numberOfSteps)
+		timings.postProcessMs = millisecondsBetween(readEnd, std::chrono::steady_clock::now());
+}
+
+namespace ImporterPool
+{
+	Lease::Lease(std::unique_ptr<PooledImporter> pooled)
+		: pooled(std::move(pooled))
+	{
+	}
+
+	Lease::~Lease()
+	{
+		if (!pooled)
+			return; // moved from
+
+		pooled->importer.FreeScene();
+		std::lock_guard<std::mutex> lock(poolMutex);
+		idleImporters.push_back(std::move(pooled));
+	}
+
+	Lease Acquire()
+	{
+		std::unique_ptr<PooledImporter> pooled;
+		{
+			std::lock_guard<std::mutex> lock(poolMutex);
+			if (!idleImporters.empty())
+			{
+				pooled = std::move(idleImporters.back());
+				idleImporters.pop_back();
+			}
+		}
+
+		if (!pooled)
+		{
+			// the importer takes ownership of both handlers
+			pooled = std::make_unique<PooledImporter>();
+			pooled->importer.SetIOHandler(new MappedIOSystem());
+			pooled->timer = new ImportTimer();
+			pooled->importer.SetProgressHandler(pooled->timer);
+			pooled->importer.SetPropertyInteger(AI_CONFIG_PP_RVC_FLAGS, REMOVED_COMPONENTS);
+		}
+
+		pooled->timer->reset();
+		return Lease(std::move(pooled));
+	}
+}
@@ -0,0 +1,95 @@
+#pragma once
+#include "MappedFile.h"
+#include <assimp/Importer.hpp>
+#include <assimp/IOStream.hpp>
+#include <assimp/IOSystem.hpp>
+#include <assimp/ProgressHandler.hpp>
+#include <chrono>
+#include <memory>
+#include <string>
+
+//Read-only stream over a memory mapped file, Read() is a memcpy out of the page cache instead of a buffered fread
+class MappedIOStream : public Assimp::IOStream
+{
+public:
+	explicit MappedIOStream(MappedFile&& file);
+
+	size_t Read(void* buffer, size_t size, size_t count) override;
+	size_t Write(const void* buffer, size_t size, size_t count) override;	// always 0, the stream is read-only
+	aiReturn Seek(size_t offset, aiOrigin origin) override;
+	size_t Tell() const override;
+	size_t FileSize() const override;
+	void Flush() override;
+
+private:
+	MappedFile file;
+	size_t position = 0;
+};
+
+//IOSystem that hands Assimp MappedIOStreams, including for the files an importer pulls in itself (.mtl, .bin, ...)
+class MappedIOSystem : public Assimp::IOSystem
+{
+public:
+	bool Exists(const char* path) const override;
+	char getOsSeparator() const override;
+	//read modes only, opening for writing fails
+	Assimp::IOStream* Open(const char* path, const char* mode = "rb") override;
+	void Close(Assimp::IOStream* stream) override;
+};
+
+//Wall clock time of each phase of one ReadFile, fed by the importer's progress callbacks
+struct AssimpImportTimings
+{
+	double readMs = 0.0;			// opening and parsing the file
+	double postProcessMs = 0.0;		// every post-processing step together
+	int postProcessSteps = 0;
+};
+
+class ImportTimer : public Assimp::ProgressHandler
+{
+public:
+	void reset();
+	const AssimpImportTimings& getTimings() const { return timings; }
+
+	bool Update(float percentage) override;
+	void UpdateFileRead(int currentStep, int numberOfSteps) override;
+	void UpdatePostProcess(int currentStep, int numberOfSteps) override;
+
+private:
+	std::chrono::steady_clock::time_point start;
+	std::chrono::steady_clock::time_point readEnd;
+	AssimpImportTimings timings;
+};
+
+//Assimp importers set up once (mapped IO, timing, the components we never read stripped by aiProcess_RemoveComponent)
+//and reused across imports. An Importer isn't thread safe, so every import leases one of its own and the pool grows
+//to the number of imports that ever ran at the same time.
+namespace ImporterPool
+{
+	struct PooledImporter
+	{
+		Assimp::Importer importer;
+		ImportTimer* timer = nullptr;	// owned by the importer
+	};
+
+	//Returns its importer to the pool, freeing the scene of the last ReadFile, when it goes out of scope
+	class Lease
+	{
+	public:
+		explicit Lease(std::unique_ptr<PooledImporter> pooled);
+		~Lease();
+
+		Lease(Lease&&) = default;
+		Lease(const Lease&) = delete;
+		Lease& operator=(const Lease&) = delete;
+
+		Assimp::Importer& importer() { return pooled->importer; }
+		const AssimpImportTimings& timings() const { return pooled->timer->getTimings(); }
+
+	private:
+		std::unique_ptr<PooledImporter> pooled;
+	};
+
+	//Timings are reset on every lease
+	Lease Acquire();
+}
@@ -0,0 +1,769 @@
+#include "BVH.h"
+#include "ThreadPool.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <numeric>
+
+namespace
+{
+	const int BIN_COUNT = 16;
+	const uint32_t MAX_LEAF_SIZE = 8;				// larger leaves are split even when SAH says they're cheaper whole
+	const float TRAVERSAL_COST = 1.0f;				// of one node step, relative to one primitive test
+	const size_t PARALLEL_SUBTREE_SIZE = 16384;		// subtrees up to this size are built as one task
+	const int STACK_SIZE = 128;						// traversal stacks, well past the depth of the trees built here
+
+	struct Bounds
+	{
+		glm::vec3 min = glm::vec3(FLT_MAX);
+		glm::vec3 max = glm::vec3(-FLT_MAX);
+
+		void grow(const glm::vec3& point) { min = glm::min(min, point); max = glm::max(max, point); }
+		void grow(const glm::vec3& otherMin, const glm::vec3& otherMax) { min = glm::min(min, otherMin); max = glm::max(max, otherMax); }
+		void grow(const Bounds& other) { grow(other.min, other.max); }
+		float area() const
+		{
+			if (min.x > max.x)
+				return 0.0f;
+			glm::vec3 size = max - min;
+			return 2.0f * (size.x * size.y + size.y * size.z + size.z * size.x);
+		}
+	};
+
+	// primitive boxes a BVH is built over, triangles or instances alike
+	struct BuildInput
+	{
+		const glm::vec3* boundsMin;
+		const glm::vec3* boundsMax;
+		std::vector<glm::vec3> centroids;
+	};
+
+	struct BuildTask
+	{
+		uint32_t node;
+		size_t first;
+		size_t count;
+	};
+
+	void computeBounds(const BuildInput& input, const std::vector<uint32_t>& order, size_t first, size_t count, Bounds& bounds, Bounds& centroidBounds)
+	{
+		for (size_t i = first; i < first + count; i++)
+		{
+			uint32_t primitive = order[i];
+			bounds.grow(input.boundsMin[primitive], input.boundsMax[primitive]);
+			centroidBounds.grow(input.centroids[primitive]);
+		}
+	}
+
+	// best binned SAH split of order[first, first + count), partitioned in place. Returns the size of the left half, 0 for a leaf
+	size_t partitionSAH(const BuildInput& input, std::vector<uint32_t>& order, size_t first, size_t count, const Bounds& bounds, const Bounds& centroidBounds)
+	{
+		if (count <= 1)
+			return 0;
+
+		float bestCost = FLT_MAX;
+		int bestAxis = -1;
+		int bestSplit = 0;
+		for (int axis = 0; axis < 3; axis++)
+		{
+			float extent = centroidBounds.max[axis] - centroidBounds.min[axis];
+			if (extent <= 0.0f)
+				continue;
+
+			Bounds bins[BIN_COUNT];
+			uint32_t binCounts[BIN_COUNT] = {};
+			float scale = BIN_COUNT / extent;
+			for (size_t i = first; i < first + count; i++)
+			{
+				uint32_t primitive = order[i];
+				int bin = std::min(BIN_COUNT - 1, int((input.centroids[primitive][axis] - centroidBounds.min[axis]) * scale));
+				bins[bin].grow(input.boundsMin[primitive], input.boundsMax[primitive]);
+				binCounts[bin]++;
+			}
+
+			// sweep from both ends, split s puts bins [0, s) on the left
+			float leftAreas[BIN_COUNT];
+			uint32_t leftCounts[BIN_COUNT];
+			Bounds left;
+			uint32_t leftCount = 0;
+			for (int i = 0; i < BIN_COUNT - 1; i++)
+			{
+				left.grow(bins[i]);
+				leftCount += binCounts[i];
+				leftAreas[i + 1] = left.area();
+				leftCounts[i + 1] = leftCount;
+			}
+			Bounds right;
+			uint32_t rightCount = 0;
+			for (int split = BIN_COUNT - 1; split > 0; split--)
+			{
+				right.grow(bins[split]);
+				rightCount += binCounts[split];
+				if (leftCounts[split] == 0 || rightCount == 0)
+					continue;
+				float cost = leftCounts[split] * leftAreas[split] + rightCount * right.area();
+				if (cost < bestCost)
+				{
+					bestCost = cost;
+					bestAxis = axis;
+					bestSplit = split;
+				}
+			}
+		}
+
+		float leafCost = count * bounds.area();
+		bool split = bestAxis >= 0 && (TRAVERSAL_COST * bounds.area() + bestCost < leafCost || count > MAX_LEAF_SIZE);
+		if (!split)
+		{
+			if (count <= MAX_LEAF_SIZE)
+				return 0;
+			// every centroid in one spot, SAH can't separate them: halve by index so the leaves stay small
+			return count / 2;
+		}
+
+		float scale = BIN_COUNT / (centroidBounds.max[bestAxis] - centroidBounds.min[bestAxis]);
+		auto middle = std::partition(order.begin() + first, order.begin() + first + count, [&](uint32_t primitive)
+			{
+				return std::min(BIN_COUNT - 1, int((input.centroids[primitive][bestAxis] - centroidBounds.min[bestAxis]) * scale)) < bestSplit;
+			});
+		return static_cast<size_t>(middle - (order.begin() + first));
+	}
+
+	// builds below task.node, which is already in nodes. With deferred set, ranges up to PARALLEL_SUBTREE_SIZE are
+	// handed back there instead, with only their root's bounds filled in
+	void buildNodes(const BuildInput& input, std::vector<uint32_t>& order, std::vector<BVHNode>& nodes, BuildTask root, std::vector<BuildTask>* deferred)
+	{
+		std::vector<BuildTask> stack{ root };
+		while (!stack.empty())
+		{
+			BuildTask task = stack.back();
+			stack.pop_back();
+
+			Bounds bounds, centroidBounds;
+			computeBounds(input, order, task.first, task.count, bounds, centroidBounds);
+			nodes[task.node].boundsMin = bounds.min;
+			nodes[task.node].boundsMax = bounds.max;
+			if (deferred && task.count <= PARALLEL_SUBTREE_SIZE)
+			{
+				deferred->push_back(task);
+				continue;
+			}
+
+			size_t leftCount = partitionSAH(input, order, task.first, task.count, bounds, centroidBounds);
+			if (leftCount == 0)
+			{
+				nodes[task.node].leftFirst = static_cast<uint32_t>(task.first);
+				nodes[task.node].count = static_cast<uint32_t>(task.count);
+				continue;
+			}
+
+			// children go in as a pair so the right one is always left + 1
+			uint32_t left = static_cast<uint32_t>(nodes.size());
+			nodes.emplace_back();
+			nodes.emplace_back();
+			nodes[task.node].leftFirst = left;
+			nodes[task.node].count = 0;
+			stack.push_back({ left + 1, task.first + leftCount, task.count - leftCount });
+			stack.push_back({ left, task.first, leftCount });
+		}
+	}
+
+	// SAH BVH over count boxes. The top of the tree is split on the calling thread, the subtrees below it are built on
+	// the pool and then appended to nodes. order maps leaf slots to primitives
+	void buildBVH(const glm::vec3* boundsMin, const glm::vec3* boundsMax, size_t count, std::vector<BVHNode>& nodes, std::vector<uint32_t>& order)
+	{
+		nodes.clear();
+		order.resize(count);
+		std::iota(order.begin(), order.end(), 0u);
+		if (count == 0)
+			return;
+
+		BuildInput input;
+		input.boundsMin = boundsMin;
+		input.boundsMax = boundsMax;
+		input.centroids.resize(count);
+		for (size_t i = 0; i < count; i++)
+			input.centroids[i] = (boundsMin[i] + boundsMax[i]) * 0.5f;
+
+		nodes.reserve(2 * count);
+		nodes.emplace_back();
+		std::vector<BuildTask> deferred;
+		buildNodes(input, order, nodes, { 0, 0, count }, &deferred);
+
+		// the deferred ranges don't overlap, so each task only touches its own slice of order
+		std::vector<std::vector<BVHNode>> subtrees(deferred.size());
+		ThreadPool::getShared().parallelFor(deferred.size(), [&](size_t i)
+			{
+				subtrees[i].reserve(2 * deferred[i].count);
+				subtrees[i].emplace_back();
+				buildNodes(input, order, subtrees[i], { 0, deferred[i].first, deferred[i].count }, nullptr);
+			});
+
+		// local node k > 0 lands at base + k - 1, the local root replaces the placeholder it was deferred from
+		for (size_t i = 0; i < deferred.size(); i++)
+		{
+			const std::vector<BVHNode>& subtree = subtrees[i];
+			uint32_t base = static_cast<uint32_t>(nodes.size());
+			auto relocate = [base](BVHNode node)
+				{
+					if (!node.isLeaf())
+						node.leftFirst = base + node.leftFirst - 1;
+					return node;
+				};
+			nodes[deferred[i].node] = relocate(subtree[0]);
+			for (size_t k = 1; k < subtree.size(); k++)
+				nodes.push_back(relocate(subtree[k]));
+		}
+		nodes.shrink_to_fit();
+	}
+
+	inline glm::vec3 inverseDirection(const glm::vec3& direction)
+	{
+		return glm::vec3(1.0f / direction.x, 1.0f / direction.y, 1.0f / direction.z);
+	}
+
+	// slab test, tEntry is where the ray enters the box
+	inline bool intersectBox(const glm::vec3& origin, const glm::vec3& invDirection, float tMin, float tMax, const BVHNode& node, float& tEntry)
+	{
+		glm::vec3 t0 = (node.boundsMin - origin) * invDirection;
+		glm::vec3 t1 = (node.boundsMax - origin) * invDirection;
+		glm::vec3 tNear = glm::min(t0, t1);
+		glm::vec3 tFar = glm::max(t0, t1);
+		tEntry = std::max(std::max(tNear.x, tNear.y), std::max(tNear.z, tMin));
+		float tExit = std::min(std::min(tFar.x, tFar.y), std::min(tFar.z, tMax));
+		return tEntry <= tExit;
+	}
+
+	// Moller-Trumbore
+	inline bool intersectTriangle(const Ray& ray, const glm::vec3* corner, float tMax, float& t, glm::vec2& barycentric)
+	{
+		glm::vec3 edge1 = corner[1] - corner[0];
+		glm::vec3 edge2 = corner[2] - corner[0];
+		glm::vec3 p = glm::cross(ray.direction, edge2);
+		float determinant = glm::dot(edge1, p);
+		if (determinant == 0.0f)
+			return false;
+		float inverse = 1.0f / determinant;
+
+		glm::vec3 s = ray.origin - corner[0];
+		float u = glm::dot(s, p) * inverse;
+		if (u < 0.0f || u > 1.0f)
+			return false;
+		glm::vec3 q = glm::cross(s, edge1);
+		float v = glm::dot(ray.direction, q) * inverse;
+		if (v < 0.0f || u + v > 1.0f)
+			return false;
+
+		t = glm::dot(edge2, q) * inverse;
+		barycentric = glm::vec2(u, v);
+		return t > ray.tMin && t < tMax;
+	}
+
+	// a ray moved into an instance's local space, t stays the same because the direction isn't renormalized
+	inline Ray toLocal(const Ray& ray, const glm::mat4& worldToLocal)
+	{
+		Ray local = ray;
+		local.origin = glm::vec3(worldToLocal * glm::vec4(ray.origin, 1.0f));
+		local.direction = glm::vec3(worldToLocal * glm::vec4(ray.direction, 0.0f));
+		return local;
+	}
+
+	enum class FrustumOverlap { Outside, Intersecting, Inside };
+
+	FrustumOverlap testFrustum(const Frustum& frustum, const glm::vec3& boundsMin, const glm::vec3& boundsMax)
+	{
+		glm::vec3 center = (boundsMin + boundsMax) * 0.5f;
+		glm::vec3 extent = (boundsMax - boundsMin) * 0.5f;
+		FrustumOverlap overlap = FrustumOverlap::Inside;
+		for (const glm::vec4& plane : frustum.planes)
+		{
+			float distance = glm::dot(glm::vec3(plane), center) + plane.w;
+			float radius = glm::dot(extent, glm::abs(glm::vec3(plane)));
+			if (distance + radius < 0.0f)
+				return FrustumOverlap::Outside;
+			if (distance - radius < 0.0f)
+				overlap = FrustumOverlap::Intersecting;
+		}
+		return overlap;
+	}
+
+	// Wald style packet traversal shared by both levels: a node is entered from the first ray that hits it, rays before
+	// that one missed it and are skipped for the whole subtree. leaf(node, firstActive) tests the primitives
+	template <typename LeafFunction>
+	void traversePacket(const std::vector<BVHNode>& nodes, const Ray* rays, const RayHit* hits, size_t count, LeafFunction leaf)
+	{
+		if (nodes.empty() || count == 0)
+			return;
+
+		std::vector<glm::vec3> invDirections(count);
+		for (size_t i = 0; i < count; i++)
+			invDirections[i] = inverseDirection(rays[i].direction);
+
+		struct Entry { uint32_t node; size_t firstActive; };
+		Entry stack[STACK_SIZE];
+		int stackSize = 0;
+		stack[stackSize++] = { 0, 0 };
+		while (stackSize > 0)
+		{
+			Entry entry = stack[--stackSize];
+			const BVHNode& node = nodes[entry.node];
+
+			size_t first = entry.firstActive;
+			float tEntry;
+			while (first < count && !intersectBox(rays[first].origin, invDirections[first], rays[first].tMin, hits[first].t, node, tEntry))
+				first++;
+			if (first == count)
+				continue;
+
+			if (node.isLeaf())
+			{
+				leaf(node, first);
+				continue;
+			}
+
+			// the nearer child for the first active ray goes on top
+			float tLeft, tRight;
+			bool hitLeft = intersectBox(rays[first].origin, invDirections[first], rays[first].tMin, hits[first].t, nodes[node.leftFirst], tLeft);
+			bool hitRight = intersectBox(rays[first].origin, invDirections[first], rays[first].tMin, hits[first].t, nodes[node.leftFirst + 1], tRight);
+			bool leftFirst = !hitRight || (hitLeft && tLeft <= tRight);
+			stack[stackSize++] = { leftFirst ? node.leftFirst + 1 : node.leftFirst, first };
+			stack[stackSize++] = { leftFirst ? node.leftFirst : node.leftFirst + 1, first };
+		}
+	}
+
+	// single ray traversal, nearer child first. leaf(node, tMax) tests the primitives and returns true to stop
+	template <typename LeafFunction>
+	void traverseRay(const std::vector<BVHNode>& nodes, const Ray& ray, const float& tMax, LeafFunction leaf)
+	{
+		if (nodes.empty())
+			return;
+
+		glm::vec3 invDirection = inverseDirection(ray.direction);
+		uint32_t stack[STACK_SIZE];
+		int stackSize = 0;
+		float tEntry;
+		if (!intersectBox(ray.origin, invDirection, ray.tMin, tMax, nodes[0], tEntry))
+			return;
+		stack[stackSize++] = 0;
+		while (stackSize > 0)
+		{
+			const BVHNode& node = nodes[stack[--stackSize]];
+			if (node.isLeaf())
+			{
+				if (leaf(node))
+					return;
+				continue;
+			}
+
+			float tLeft, tRight;
+			bool hitLeft = intersectBox(ray.origin, invDirection, ray.tMin, tMax, nodes[node.leftFirst], tLeft);
+			bool hitRight = intersectBox(ray.origin, invDirection, ray.tMin, tMax, nodes[node.leftFirst + 1], tRight);
+			if (hitLeft && hitRight)
+			{
+				bool leftNearer = tLeft <= tRight;
+				stack[stackSize++] = leftNearer ? node.leftFirst + 1 : node.leftFirst;
+				stack[stackSize++] = leftNearer ? node.leftFirst : node.leftFirst + 1;
+			}
+			else if (hitLeft)
+			{
+				stack[stackSize++] = node.leftFirst;
+			}
+			else if (hitRight)
+			{
+				stack[stackSize++] = node.leftFirst + 1;
+			}
+		}
+	}
+
+	glm::vec3 readPosition(const VertexStream& stream, size_t vertex)
+	{
+		float position[3];
+		std::memcpy(position, stream.data + vertex * stream.stride, sizeof(position));
+		return glm::vec3(position[0], position[1], position[2]);
+	}
+
+	uint32_t readIndex(const VertexStreams& streams, size_t i)
+	{
+		switch (streams.indexType)
+		{
+		case GL_UNSIGNED_BYTE: return streams.indices[i];
+		case GL_UNSIGNED_SHORT: { uint16_t index; std::memcpy(&index, streams.indices + i * sizeof(index), sizeof(index)); return index; }
+		default: { uint32_t index; std::memcpy(&index, streams.indices + i * sizeof(index), sizeof(index)); return index; }
+		}
+	}
+}
+
+std::shared_ptr<TriangleBVH> TriangleBVH::Build(const Vertex* vertices, size_t vertexCount, const unsigned int* indices, size_t indexCount)
+{
+	std::vector<glm::vec3> triangleCorners;
+	triangleCorners.reserve(indexCount);
+	for (size_t i = 0; i + 2 < indexCount; i += 3)
+	{
+		for (size_t corner = 0; corner < 3; corner++)
+			triangleCorners.push_back(indices[i + corner] < vertexCount ? vertices[indices[i + corner]].Position : glm::vec3(0.0f));
+	}
+
+	auto bvh = std::make_shared<TriangleBVH>();
+	bvh->build(std::move(triangleCorners));
+	return bvh;
+}
+
+std::shared_ptr<TriangleBVH> TriangleBVH::Build(const VertexStreams& streams)
+{
+	const VertexStream& position = streams.position;
+	if (position.data == nullptr || position.componentType != GL_FLOAT || position.components != 3 || streams.indices == nullptr)
+		return nullptr;
+
+	std::vector<glm::vec3> triangleCorners;
+	triangleCorners.reserve(streams.indexCount);
+	for (size_t i = 0; i + 2 < streams.indexCount; i += 3)
+	{
+		for (size_t corner = 0; corner < 3; corner++)
+		{
+			uint32_t index = readIndex(streams, i + corner);
+			triangleCorners.push_back(index < streams.vertexCount ? readPosition(position, index) : glm::vec3(0.0f));
+		}
+	}
+
+	auto bvh = std::make_shared<TriangleBVH>();
+	bvh->build(std::move(triangleCorners));
+	return bvh;
+}
+
+void TriangleBVH::build(std::vector<glm::vec3>&& triangleCorners)
+{
+	size_t triangleCount = triangleCorners.size() / 3;
+	std::vector<glm::vec3> boundsMin(triangleCount), boundsMax(triangleCount);
+	for (size_t i = 0; i < triangleCount; i++)
+	{
+		const glm::vec3* corner = &triangleCorners[i * 3];
+		boundsMin[i] = glm::min(corner[0], glm::min(corner[1], corner[2]));
+		boundsMax[i] = glm::max(corner[0], glm::max(corner[1], corner[2]));
+	}
+
+	buildBVH(boundsMin.data(), boundsMax.data(), triangleCount, nodes, triangleIds);
+
+	// corners in leaf order, so a leaf's triangles sit next to each other
+	corners.resize(triangleCorners.size());
+	for (size_t i = 0; i < triangleCount; i++)
+		std::copy_n(&triangleCorners[size_t(triangleIds[i]) * 3], 3, &corners[i * 3]);
+}
+
+bool TriangleBVH::intersect(const Ray& ray, RayHit& hit) const
+{
+	bool found = false;
+	traverseRay(nodes, ray, hit.t, [&](const BVHNode& leaf)
+		{
+			for (uint32_t i = leaf.leftFirst; i < leaf.leftFirst + leaf.count; i++)
+			{
+				float t;
+				glm::vec2 barycentric;
+				if (intersectTriangle(ray, &corners[size_t(i) * 3], hit.t, t, barycentric))
+				{
+					hit.t = t;
+					hit.triangle = triangleIds[i];
+					hit.barycentric = barycentric;
+					found = true;
+				}
+			}
+			return false;
+		});
+	return found;
+}
+
+bool TriangleBVH::occluded(const Ray& ray) const
+{
+	bool found = false;
+	traverseRay(nodes, ray, ray.tMax, [&](const BVHNode& leaf)
+		{
+			for (uint32_t i = leaf.leftFirst; i < leaf.leftFirst + leaf.count && !found; i++)
+			{
+				float t;
+				glm::vec2 barycentric;
+				found = intersectTriangle(ray, &corners[size_t(i) * 3], ray.tMax, t, barycentric);
+			}
+			return found;
+		});
+	return found;
+}
+
+void TriangleBVH::intersect(const Ray* rays, RayHit* hits, size_t count) const
+{
+	traversePacket(nodes, rays, hits, count, [&](const BVHNode& leaf, size_t firstActive)
+		{
+			for (size_t r = firstActive; r < count; r++)
+			{
+				for (uint32_t i = leaf.leftFirst; i < leaf.leftFirst + leaf.count; i++)
+				{
+					float t;
+					glm::vec2 barycentric;
+					if (intersectTriangle(rays[r], &corners[size_t(i) * 3], hits[r].t, t, barycentric))
+					{
+						hits[r].t = t;
+						hits[r].triangle = triangleIds[i];
+						hits[r].barycentric = barycentric;
+					}
+				}
+			}
+		});
+}
+
+size_t TriangleBVH::getMemoryBytes() const
+{
+	return nodes.size() * sizeof(BVHNode) + corners.size() * sizeof(glm::vec3) + triangleIds.size() * sizeof(uint32_t);
+}
+
+void SceneBVH::update(const std::vector<Model*>& models)
+{
+	bool rebuildNeeded = models.size() != builtModels.size();
+	for (size_t i = 0; i < models.size() && !rebuildNeeded; i++)
+	{
+		const Model& model = *models[i];
+		size_t meshCount = model.isLoading() ? 0 : model.meshes.size();
+		rebuildNeeded = builtModels[i] != &model || builtMeshCounts[i] != meshCount;
+	}
+	if (rebuildNeeded)
+	{
+		rebuild(models);
+		return;
+	}
+
+	for (size_t i = 0; i < models.size(); i++)
+	{
+		if (builtMatrices[i] != models[i]->modelMatrix)
+		{
+			builtMatrices[i] = models[i]->modelMatrix;
+			refit(i);
+		}
+	}
+}
+
+void SceneBVH::setInstanceTransform(BVHInstance& instance) const
+{
+	const Mesh& mesh = instance.model->meshes[instance.mesh];
+	instance.worldToLocal = glm::inverse(instance.model->modelMatrix * mesh.localTransform);
+	instance.boundsMin = mesh.worldBoundsMin;
+	instance.boundsMax = mesh.worldBoundsMax;
+}
+
+void SceneBVH::rebuild(const std::vector<Model*>& models)
+{
+	builtModels.assign(models.begin(), models.end());
+	builtMatrices.clear();
+	builtMeshCounts.clear();
+	modelFirstInstance.clear();
+	instances.clear();
+
+	for (const Model* model : models)
+	{
+		builtMatrices.push_back(model->modelMatrix);
+		builtMeshCounts.push_back(model->isLoading() ? 0 : model->meshes.size());
+		modelFirstInstance.push_back(instances.size());
+		if (model->isLoading())
+			continue;
+
+		for (size_t i = 0; i < model->meshes.size(); i++)
+		{
+			BVHInstance instance;
+			instance.model = model;
+			instance.mesh = static_cast<uint32_t>(i);
+			instance.triangles = model->meshes[i].getGeometry()->triangleBVH.get();
+			setInstanceTransform(instance);
+			instances.push_back(instance);
+		}
+	}
+
+	std::vector<glm::vec3> boundsMin(instances.size()), boundsMax(instances.size());
+	for (size_t i = 0; i < instances.size(); i++)
+	{
+		boundsMin[i] = instances[i].boundsMin;
+		boundsMax[i] = instances[i].boundsMax;
+	}
+	buildBVH(boundsMin.data(), boundsMax.data(), instances.size(), nodes, instanceOrder);
+
+	parents.assign(nodes.size(), RayHit::INVALID);
+	instanceLeaves.assign(instances.size(), 0);
+	for (uint32_t i = 0; i < nodes.size(); i++)
+	{
+		const BVHNode& node = nodes[i];
+		if (node.isLeaf())
+		{
+			for (uint32_t slot = node.leftFirst; slot < node.leftFirst + node.count; slot++)
+				instanceLeaves[instanceOrder[slot]] = i;
+		}
+		else
+		{
+			parents[node.leftFirst] = i;
+			parents[node.leftFirst + 1] = i;
+		}
+	}
+}
+
+void SceneBVH::refit(size_t modelIndex)
+{
+	size_t first = modelFirstInstance[modelIndex];
+	size_t count = builtMeshCounts[modelIndex];
+
+	std::vector<uint32_t> dirtyLeaves;
+	for (size_t i = first; i < first + count; i++)
+	{
+		setInstanceTransform(instances[i]);
+		dirtyLeaves.push_back(instanceLeaves[i]);
+	}
+	std::sort(dirtyLeaves.begin(), dirtyLeaves.end());
+	dirtyLeaves.erase(std::unique(dirtyLeaves.begin(), dirtyLeaves.end()), dirtyLeaves.end());
+
+	for (uint32_t leafIndex : dirtyLeaves)
+	{
+		BVHNode& leaf = nodes[leafIndex];
+		Bounds bounds;
+		for (uint32_t slot = leaf.leftFirst; slot < leaf.leftFirst + leaf.count; slot++)
+			bounds.grow(instances[instanceOrder[slot]].boundsMin, instances[instanceOrder[slot]].boundsMax);
+		leaf.boundsMin = bounds.min;
+		leaf.boundsMax = bounds.max;
+
+		// up the parents until one already covers the new bounds
+		for (uint32_t node = parents[leafIndex]; node != RayHit::INVALID; node = parents[node])
+		{
+			const BVHNode& left = nodes[nodes[node].leftFirst];
+			const BVHNode& right = nodes[nodes[node].leftFirst + 1];
+			glm::vec3 newMin = glm::min(left.boundsMin, right.boundsMin);
+			glm::vec3 newMax = glm::max(left.boundsMax, right.boundsMax);
+			if (newMin == nodes[node].boundsMin && newMax == nodes[node].boundsMax)
+				break;
+			nodes[node].boundsMin = newMin;
+			nodes[node].boundsMax = newMax;
+		}
+	}
+}
+
+void SceneBVH::queryFrustum(const Frustum& frustum, std::vector<uint32_t>& visibleInstances) const
+{
+	visibleInstances.clear();
+	if (nodes.empty())
+		return;
+
+	// a node fully inside takes its whole subtree, it's walked without any more plane tests
+	auto addSubtree = [&](uint32_t root)
+		{
+			uint32_t stack[STACK_SIZE];
+			int stackSize = 0;
+			stack[stackSize++] = root;
+			while (stackSize > 0)
+			{
+				const BVHNode& node = nodes[stack[--stackSize]];
+				if (node.isLeaf())
+				{
+					for (uint32_t slot = node.leftFirst; slot < node.leftFirst + node.count; slot++)
+						visibleInstances.push_back(instanceOrder[slot]);
+					continue;
+				}
+				stack[stackSize++] = node.leftFirst + 1;
+				stack[stackSize++] = node.leftFirst;
+			}
+		};
+
+	uint32_t stack[STACK_SIZE];
+	int stackSize = 0;
+	stack[stackSize++] = 0;
+	while (stackSize > 0)
+	{
+		uint32_t index = stack[--stackSize];
+		const BVHNode& node = nodes[index];
+		FrustumOverlap overlap = testFrustum(frustum, node.boundsMin, node.boundsMax);
+		if (overlap == FrustumOverlap::Outside)
+			continue;
+		if (overlap == FrustumOverlap::Inside)
+		{
+			addSubtree(index);
+			continue;
+		}
+
+		if (node.isLeaf())
+		{
+			for (uint32_t slot = node.leftFirst; slot < node.leftFirst + node.count; slot++)
+			{
+				const BVHInstance& instance = instances[instanceOrder[slot]];
+				if (testFrustum(frustum, instance.boundsMin, instance.boundsMax) != FrustumOverlap::Outside)
+					visibleInstances.push_back(instanceOrder[slot]);
+			}
+			continue;
+		}
+		stack[stackSize++] = node.leftFirst + 1;
+		stack[stackSize++] = node.leftFirst;
+	}
+}
+
+bool SceneBVH::intersect(const Ray& ray, RayHit& hit) const
+{
+	bool found = false;
+	traverseRay(nodes, ray, hit.t, [&](const BVHNode& leaf)
+		{
+			for (uint32_t slot = leaf.leftFirst; slot < leaf.leftFirst + leaf.count; slot++)
+			{
+				uint32_t index = instanceOrder[slot];
+				const BVHInstance& instance = instances[index];
+				if (instance.triangles && instance.triangles->intersect(toLocal(ray, instance.worldToLocal), hit))
+				{
+					hit.instance = index;
+					found = true;
+				}
+			}
+			return false;
+		});
+	return found;
+}
+
+bool SceneBVH::occluded(const Ray& ray) const
+{
+	bool found = false;
+	traverseRay(nodes, ray, ray.tMax, [&](const BVHNode& leaf)
+		{
+			for (uint32_t slot = leaf.leftFirst; slot < leaf.leftFirst + leaf.count && !found; slot++)
+			{
+				const BVHInstance& instance = instances[instanceOrder[slot]];
+				found = instance.triangles && instance.triangles->occluded(toLocal(ray, instance.worldToLocal));
+			}
+			return found;
+		});
+	return found;
+}
+
+void SceneBVH::intersect(RayPacket& packet) const
+{
+	const size_t count = packet.rays.size();
+	packet.hits.assign(count, RayHit());
+
+	std::vector<Ray> localRays;
+	std::vector<RayHit> localHits;
+	traversePacket(nodes, packet.rays.data(), packet.hits.data(), count, [&](const BVHNode& leaf, size_t firstActive)
+		{
+			for (uint32_t slot = leaf.leftFirst; slot < leaf.leftFirst + leaf.count; slot++)
+			{
+				uint32_t index = instanceOrder[slot];
+				const BVHInstance& instance = instances[index];
+				if (!instance.triangles)
+					continue;
+
+				// the active rays go down into the mesh together, in its local space
+				size_t active = count - firstActive;
+				localRays.resize(active);
+				localHits.resize(active);
+				for (size_t r = 0; r < active; r++)
+				{
+					localRays[r] = toLocal(packet.rays[firstActive + r], instance.worldToLocal);
+					localHits[r] = packet.hits[firstActive + r];
+				}
+				instance.triangles->intersect(localRays.data(), localHits.data(), active);
+				for (size_t r = 0; r < active; r++)
+				{
+					RayHit& hit = packet.hits[firstActive + r];
+					if (localHits[r].t < hit.t)
+					{
+						hit = localHits[r];
+						hit.instance = index;
+					}
+				}
+			}
+		});
+}
@@ -0,0 +1,126 @@
+#pragma once
+#include "FrustumCuller.h"
+#include <cfloat>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+//Node of a BVH, 32 bytes. Inner nodes have count 0 and their children at leftFirst and leftFirst + 1,
+//leaves cover count primitives from leftFirst in the tree's primitive order
+struct BVHNode
+{
+	glm::vec3 boundsMin;
+	uint32_t leftFirst;
+	glm::vec3 boundsMax;
+	uint32_t count;
+
+	bool isLeaf() const { return count > 0; }
+};
+
+struct Ray
+{
+	glm::vec3 origin = glm::vec3(0.0f);
+	float tMin = 0.0f;
+	glm::vec3 direction = glm::vec3(0.0f, 0.0f, -1.0f);
+	float tMax = FLT_MAX;
+};
+
+struct RayHit
+{
+	static const uint32_t INVALID = ~0u;
+
+	float t = FLT_MAX;							// along the ray's direction, as given (not normalized)
+	uint32_t instance = INVALID;				// SceneBVH instance, left alone by TriangleBVH
+	uint32_t triangle = INVALID;				// index / 3 into the mesh's indices
+	glm::vec2 barycentric = glm::vec2(0.0f);	// weights of the triangle's second and third corner
+
+	bool hasHit() const { return triangle != INVALID; }
+};
+
+//Rays traced through one traversal, so they should start close together and point roughly the same way (a tile of
+//camera rays, a fan of shadow rays). A node is visited when any of the rays still in play reaches it
+struct RayPacket
+{
+	std::vector<Ray> rays;
+	std::vector<RayHit> hits;	// resized to match rays by the query
+};
+
+//Binned SAH BVH over the triangles of one mesh, in the mesh's local space. Built on the loader threads at import
+//(subtrees of large meshes in parallel) from the CPU copy, which is gone once the mesh is uploaded, and shared
+//between meshes with the same geometry through MeshGeometry
+class TriangleBVH
+{
+public:
+	static std::shared_ptr<TriangleBVH> Build(const Vertex* vertices, size_t vertexCount, const unsigned int* indices, size_t indexCount);
+	//nullptr unless the positions are plain floats, quantized source streams get no BVH
+	static std::shared_ptr<TriangleBVH> Build(const VertexStreams& streams);
+
+	//Closest hit nearer than hit.t, fills hit and returns true if there is one
+	bool intersect(const Ray& ray, RayHit& hit) const;
+	//Any hit between tMin and tMax, stops at the first one found
+	bool occluded(const Ray& ray) const;
+	//intersect() for count rays at once, each hit only updated when closer
+	void intersect(const Ray* rays, RayHit* hits, size_t count) const;
+
+	const std::vector<BVHNode>& getNodes() const { return nodes; }
+	//Local space corners, 3 per triangle in tree order
+	const std::vector<glm::vec3>& getCorners() const { return corners; }
+	size_t getTriangleCount() const { return triangleIds.size(); }
+	size_t getMemoryBytes() const;
+
+private:
+	std::vector<BVHNode> nodes;
+	std::vector<glm::vec3> corners;		// 3 per triangle, in tree order
+	std::vector<uint32_t> triangleIds;	// original triangle of each
+
+	void build(std::vector<glm::vec3>&& triangleCorners);
+};
+
+//One mesh of a model in the scene BVH
+struct BVHInstance
+{
+	const Model* model;
+	uint32_t mesh;
+	glm::mat4 worldToLocal;			// inverse of modelMatrix * localTransform
+	glm::vec3 boundsMin;			// world space
+	glm::vec3 boundsMax;
+	const TriangleBVH* triangles;	// nullptr for meshes without one, ray queries skip them
+};
+
+//Top level BVH over every mesh of a set of models, for frustum queries and ray casts against the whole scene.
+//update() rebuilds it when models finish loading and refits it in place when a model moves (setPosition, setRotation,
+//...): leaf boxes are recomputed and the change is propagated up the parents, the tree's shape is kept
+class SceneBVH
+{
+public:
+	void update(const std::vector<Model*>& models);
+
+	//Instances whose bounds touch the frustum, whole subtrees are taken without testing once a node is fully inside
+	void queryFrustum(const Frustum& frustum, std::vector<uint32_t>& visibleInstances) const;
+	//Closest hit in world space, hit.instance tells which mesh
+	bool intersect(const Ray& ray, RayHit& hit) const;
+	bool occluded(const Ray& ray) const;
+	//Closest hits of a coherent packet, traced together through both levels
+	void intersect(RayPacket& packet) const;
+
+	const BVHInstance& getInstance(uint32_t index) const { return instances[index]; }
+	size_t getInstanceCount() const { return instances.size(); }
+	size_t getNodeCount() const { return nodes.size(); }
+
+private:
+	std::vector<BVHNode> nodes;
+	std::vector<uint32_t> instanceOrder;	// instance of each leaf slot
+	std::vector<uint32_t> parents;			// per node, the root's is INVALID
+	std::vector<uint32_t> instanceLeaves;	// leaf node of each instance
+	std::vector<BVHInstance> instances;
+
+	// what the tree was built from, to spot changes
+	std::vector<const Model*> builtModels;
+	std::vector<glm::mat4> builtMatrices;
+	std::vector<size_t> builtMeshCounts;
+	std::vector<size_t> modelFirstInstance;
+
+	void rebuild(const std::vector<Model*>& models);
+	void refit(size_t modelIndex);
+	void setInstanceTransform(BVHInstance& instance) const;
+};
@@ -0,0 +1,400 @@
+#include "BlockCompression.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+namespace
+{
+	//BC7 4 bit index interpolation weights, out of 64
+	const int BC7_WEIGHTS4[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+
+	//little endian bit stream over one 128 bit block, fields are written from bit 0 upwards
+	class BitWriter
+	{
+	public:
+		explicit BitWriter(uint8_t* block) : block(block) { std::memset(block, 0, 16); }
+
+		void write(uint32_t value, int bitCount)
+		{
+			for (int i = 0; i < bitCount; i++, position++)
+			{
+				if (value & (1u << i))
+					block[position >> 3] |= uint8_t(1u << (position & 7));
+			}
+		}
+
+	private:
+		uint8_t* block;
+		int position = 0;
+	};
+
+	class BitReader
+	{
+	public:
+		explicit BitReader(const uint8_t* block) : block(block) {}
+
+		uint32_t read(int bitCount)
+		{
+			uint32_t value = 0;
+			for (int i = 0; i < bitCount; i++, position++)
+			{
+				if (block[position >> 3] & (1u << (position & 7)))
+					value |= 1u << i;
+			}
+			return value;
+		}
+
+	private:
+		const uint8_t* block;
+		int position = 0;
+	};
+
+	void bc4Palette(int red0, int red1, int palette[8])
+	{
+		palette[0] = red0;
+		palette[1] = red1;
+		if (red0 > red1)
+		{
+			for (int i = 1; i < 7; i++)
+				palette[i + 1] = ((7 - i) * red0 + i * red1 + 3) / 7;
+		}
+		else
+		{
+			for (int i = 1; i < 5; i++)
+				palette[i + 1] = ((5 - i) * red0 + i * red1 + 2) / 5;
+			palette[6] = 0;
+			palette[7] = 255;
+		}
+	}
+
+	//picks the nearest palette entry for every value, returns the squared error
+	int bc4FitIndices(const uint8_t values[16], const int palette[8], uint8_t indices[16])
+	{
+		int totalError = 0;
+		for (int i = 0; i < 16; i++)
+		{
+			int bestError = 1 << 30;
+			for (int p = 0; p < 8; p++)
+			{
+				int difference = int(values[i]) - palette[p];
+				int error = difference * difference;
+				if (error < bestError)
+				{
+					bestError = error;
+					indices[i] = uint8_t(p);
+				}
+			}
+			totalError += bestError;
+		}
+		return totalError;
+	}
+
+	int bc7Interpolate(int endpoint0, int endpoint1, int weight)
+	{
+		return ((64 - weight) * endpoint0 + weight * endpoint1 + 32) >> 6;
+	}
+
+	//quantizes an 8 bit RGBA endpoint to 7 bits per channel plus a shared p bit, picking the p bit that fits best
+	void bc7QuantizeEndpoint(const float endpoint[4], int quantized[4], int& pBit)
+	{
+		int bestError = 1 << 30;
+		for (int p = 0; p < 2; p++)
+		{
+			int candidate[4];
+			int error = 0;
+			for (int c = 0; c < 4; c++)
+			{
+				int value = int(std::lround((endpoint[c] - p) * 0.5f));
+				candidate[c] = std::clamp(value, 0, 127);
+				int difference = int(std::lround(endpoint[c])) - ((candidate[c] << 1) | p);
+				error += difference * difference;
+			}
+			if (error < bestError)
+			{
+				bestError = error;
+				pBit = p;
+				std::memcpy(quantized, candidate, sizeof(candidate));
+			}
+		}
+	}
+
+	int bc7FitIndices(const uint8_t rgba[16][4], const int endpoint0[4], const int endpoint1[4], uint8_t indices[16])
+	{
+		int palette[16][4];
+		for (int i = 0; i < 16; i++)
+		{
+			for (int c = 0; c < 4; c++)
+				palette[i][c] = bc7Interpolate(endpoint0[c], endpoint1[c], BC7_WEIGHTS4[i]);
+		}
+
+		int totalError = 0;
+		for (int i = 0; i < 16; i++)
+		{
+			int bestError = 1 << 30;
+			for (int p = 0; p < 16; p++)
+			{
+				int error = 0;
+				for (int c = 0; c < 4; c++)
+				{
+					int difference = int(rgba[i][c]) - palette[p][c];
+					error += difference * difference;
+				}
+				if (error < bestError)
+				{
+					bestError = error;
+					indices[i] = uint8_t(p);
+				}
+			}
+			totalError += bestError;
+		}
+		return totalError;
+	}
+}
+
+namespace BlockCompression
+{
+	void EncodeBC4(const uint8_t values[16], uint8_t* outBlock)
+	{
+		int minValue = 255;
+		int maxValue = 0;
+		for (int i = 0; i < 16; i++)
+		{
+			minValue = std::min(minValue, int(values[i]));
+			maxValue = std::max(maxValue, int(values[i]));
+		}
+
+		//the min/max endpoints are usually best, but pulling them in slightly often lowers the error of the interpolated entries
+		int bestRed0 = maxValue;
+		int bestRed1 = minValue;
+		uint8_t bestIndices[16] = {};
+		int bestError = 1 << 30;
+		for (int inset0 = 0; inset0 <= 2; inset0++)
+		{
+			for (int inset1 = 0; inset1 <= 2; inset1++)
+			{
+				int red0 = maxValue - inset0;
+				int red1 = minValue + inset1;
+				if (red0 <= red1)
+					continue;
+
+				int palette[8];
+				uint8_t indices[16];
+				bc4Palette(red0, red1, palette);
+				int error = bc4FitIndices(values, palette, indices);
+				if (error < bestError)
+				{
+					bestError = error;
+					bestRed0 = red0;
+					bestRed1 = red1;
+					std::memcpy(bestIndices, indices, sizeof(indices));
+				}
+			}
+		}
+
+		//flat block: equal endpoints with every index on the first one
+		if (bestError == (1 << 30))
+		{
+			bestRed0 = bestRed1 = maxValue;
+			std::memset(bestIndices, 0, sizeof(bestIndices));
+		}
+
+		outBlock[0] = uint8_t(bestRed0);
+		outBlock[1] = uint8_t(bestRed1);
+		uint64_t bits = 0;
+		for (int i = 0; i < 16; i++)
+			bits |= uint64_t(bestIndices[i]) << (3 * i);
+		for (int i = 0; i < 6; i++)
+			outBlock[2 + i] = uint8_t(bits >> (8 * i));
+	}
+
+	void DecodeBC4(const uint8_t* block, uint8_t outValues[16])
+	{
+		int palette[8];
+		bc4Palette(block[0], block[1], palette);
+
+		uint64_t bits = 0;
+		for (int i = 0; i < 6; i++)
+			bits |= uint64_t(block[2 + i]) << (8 * i);
+		for (int i = 0; i < 16; i++)
+			outValues[i] = uint8_t(palette[(bits >> (3 * i)) & 7]);
+	}
+
+	void EncodeBC5(const uint8_t red[16], const uint8_t green[16], uint8_t* outBlock)
+	{
+		EncodeBC4(red, outBlock);
+		EncodeBC4(green, outBlock + BC4_BLOCK_BYTES);
+	}
+
+	void DecodeBC5(const uint8_t* block, uint8_t outRed[16], uint8_t outGreen[16])
+	{
+		DecodeBC4(block, outRed);
+		DecodeBC4(block + BC4_BLOCK_BYTES, outGreen);
+	}
+
+	void EncodeBC7(const uint8_t rgba[16][4], uint8_t* outBlock)
+	{
+		//principal axis of the block's colours through a few rounds of power iteration on the covariance
+		float mean[4] = {};
+		for (int i = 0; i < 16; i++)
+		{
+			for (int c = 0; c < 4; c++)
+				mean[c] += rgba[i][c] / 16.0f;
+		}
+
+		float covariance[4][4] = {};
+		for (int i = 0; i < 16; i++)
+		{
+			float d[4];
+			for (int c = 0; c < 4; c++)
+				d[c] = rgba[i][c] - mean[c];
+			for (int r = 0; r < 4; r++)
+			{
+				for (int c = 0; c < 4; c++)
+					covariance[r][c] += d[r] * d[c];
+			}
+		}
+
+		float axis[4] = { 1.0f, 1.0f, 1.0f, 1.0f };
+		for (int iteration = 0; iteration < 8; iteration++)
+		{
+			float next[4] = {};
+			for (int r = 0; r < 4; r++)
+			{
+				for (int c = 0; c < 4; c++)
+					next[r] += covariance[r][c] * axis[c];
+			}
+			float length = std::sqrt(next[0] * next[0] + next[1] * next[1] + next[2] * next[2] + next[3] * next[3]);
+			if (length < 1e-6f)
+				break;
+			for (int c = 0; c < 4; c++)
+				axis[c] = next[c] / length;
+		}
+
+		float minProjection = 0.0f;
+		float maxProjection = 0.0f;
+		for (int i = 0; i < 16; i++)
+		{
+			float projection = 0.0f;
+			for (int c = 0; c < 4; c++)
+				projection += (rgba[i][c] - mean[c]) * axis[c];
+			minProjection = std::min(minProjection, projection);
+			maxProjection = std::max(maxProjection, projection);
+		}
+
+		float endpoints[2][4];
+		for (int c = 0; c < 4; c++)
+		{
+			endpoints[0][c] = std::clamp(mean[c] + minProjection * axis[c], 0.0f, 255.0f);
+			endpoints[1][c] = std::clamp(mean[c] + maxProjection * axis[c], 0.0f, 255.0f);
+		}
+
+		//alternate index fitting and a least squares refit of the endpoints, keeping the best quantized result
+		int bestError = 1 << 30;
+		int bestQuantized[2][4] = {};
+		int bestPBits[2] = {};
+		uint8_t bestIndices[16] = {};
+		for (int iteration = 0; iteration < 3; iteration++)
+		{
+			int quantized[2][4];
+			int pBits[2];
+			bc7QuantizeEndpoint(endpoints[0], quantized[0], pBits[0]);
+			bc7QuantizeEndpoint(endpoints[1], quantized[1], pBits[1]);
+
+			int expanded[2][4];
+			for (int e = 0; e < 2; e++)
+			{
+				for (int c = 0; c < 4; c++)
+					expanded[e][c] = (quantized[e][c] << 1) | pBits[e];
+			}
+
+			uint8_t indices[16];
+			int error = bc7FitIndices(rgba, expanded[0], expanded[1], indices);
+			if (error < bestError)
+			{
+				bestError = error;
+				std::memcpy(bestQuantized, quantized, sizeof(quantized));
+				std::memcpy(bestPBits, pBits, sizeof(pBits));
+				std::memcpy(bestIndices, indices, sizeof(indices));
+			}
+			if (error == 0)
+				break;
+
+			//solve min sum((1-w)e0 + w e1 - x)^2 per channel, the 2x2 system is shared by all channels
+			float aa = 0.0f, ab = 0.0f, bb = 0.0f;
+			float ax[4] = {}, bx[4] = {};
+			for (int i = 0; i < 16; i++)
+			{
+				float w = BC7_WEIGHTS4[indices[i]] / 64.0f;
+				float a = 1.0f - w;
+				aa += a * a;
+				ab += a * w;
+				bb += w * w;
+				for (int c = 0; c < 4; c++)
+				{
+					ax[c] += a * rgba[i][c];
+					bx[c] += w * rgba[i][c];
+				}
+			}
+			float determinant = aa * bb - ab * ab;
+			if (std::fabs(determinant) < 1e-6f)
+				break;
+			for (int c = 0; c < 4; c++)
+			{
+				endpoints[0][c] = std::clamp((bb * ax[c] - ab * bx[c]) / determinant, 0.0f, 255.0f);
+				endpoints[1][c] = std::clamp((aa * bx[c] - ab * ax[c]) / determinant, 0.0f, 255.0f);
+			}
+		}
+
+		//the anchor index is stored with its top bit implied to be zero, swap the endpoints if it isn't
+		if (bestIndices[0] & 8)
+		{
+			for (int c = 0; c < 4; c++)
+				std::swap(bestQuantized[0][c], bestQuantized[1][c]);
+			std::swap(bestPBits[0], bestPBits[1]);
+			for (int i = 0; i < 16; i++)
+				bestIndices[i] = uint8_t(15 - bestIndices[i]);
+		}
+
+		BitWriter writer(outBlock);
+		writer.write(1u << 6, 7);  // mode 6
+		for (int c = 0; c < 4; c++)
+		{
+			writer.write(bestQuantized[0][c], 7);
+			writer.write(bestQuantized[1][c], 7);
+		}
+		writer.write(bestPBits[0], 1);
+		writer.write(bestPBits[1], 1);
+		writer.write(bestIndices[0], 3);
+		for (int i = 1; i < 16; i++)
+			writer.write(bestIndices[i], 4);
+	}
+
+	bool DecodeBC7(const uint8_t* block, uint8_t outRgba[16][4])
+	{
+		BitReader reader(block);
+		if (reader.read(7) != (1u << 6))
+			return false;
+
+		int endpoints[2][4];
+		for (int c = 0; c < 4; c++)
+		{
+			endpoints[0][c] = int(reader.read(7)) << 1;
+			endpoints[1][c] = int(reader.read(7)) << 1;
+		}
+		int pBit0 = int(reader.read(1));
+		int pBit1 = int(reader.read(1));
+		for (int c = 0; c < 4; c++)
+		{
+			endpoints[0][c] |= pBit0;
+			endpoints[1][c] |= pBit1;
+		}
+
+		for (int i = 0; i < 16; i++)
+		{
+			int index = int(reader.read(i == 0 ? 3 : 4));
+			for (int c = 0; c < 4; c++)
+				outRgba[i][c] = uint8_t(bc7Interpolate(endpoints[0][c], endpoints[1][c], BC7_WEIGHTS4[index]));
+		}
+		return true;
+	}
+}
@@ -0,0 +1,24 @@
+#pragma once
+#include <cstdint>
+
+//CPU encoders for the block compressed formats the texture cache stores. Every function works on one 4x4 block,
+//pixels are row major. Only plain C++, so the offline compressor runs on machines without a GPU.
+namespace BlockCompression
+{
+	const int BC4_BLOCK_BYTES = 8;
+	const int BC5_BLOCK_BYTES = 16;
+	const int BC7_BLOCK_BYTES = 16;
+
+	//single channel, 8 bytes per block (GL_COMPRESSED_RED_RGTC1)
+	void EncodeBC4(const uint8_t values[16], uint8_t* outBlock);
+	void DecodeBC4(const uint8_t* block, uint8_t outValues[16]);
+
+	//two independent BC4 channels, 16 bytes per block (GL_COMPRESSED_RG_RGTC2)
+	void EncodeBC5(const uint8_t red[16], const uint8_t green[16], uint8_t* outBlock);
+	void DecodeBC5(const uint8_t* block, uint8_t outRed[16], uint8_t outGreen[16]);
+
+	//RGBA, 16 bytes per block (GL_COMPRESSED_RGBA_BPTC_UNORM). The encoder only emits mode 6
+	//(one subset, 7777.1 endpoints, 4 bit indices) and the decoder only understands what the encoder writes.
+	void EncodeBC7(const uint8_t rgba[16][4], uint8_t* outBlock);
+	bool DecodeBC7(const uint8_t* block, uint8_t outRgba[16][4]);
+}
@@ -0,0 +1,356 @@
+#include "FrustumCuller.h"
+#include "PotentiallyVisibleSet.h"
+#include "SoftwareOcclusion.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+
+#if defined(_M_X64) || defined(__x86_64__)
+#include <immintrin.h>
+#define FRUSTUM_CULLER_AVX2 1
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define AVX2_TARGET
+#else
+#define AVX2_TARGET __attribute__((target("avx2")))
+#endif
+#endif
+
+namespace
+{
+	const size_t BATCH = 8;	// boxes per AVX2 iteration
+
+#ifdef FRUSTUM_CULLER_AVX2
+	//Same arithmetic in the same order as CullBoxesScalar, so both give identical results
+	AVX2_TARGET void cullBoxesAVX2(const Frustum& frustum, const FrustumBoxes& boxes, uint8_t* visible)
+	{
+		__m256 planeX[6], planeY[6], planeZ[6], planeW[6], absX[6], absY[6], absZ[6];
+		for (int p = 0; p < 6; p++)
+		{
+			const glm::vec4& plane = frustum.planes[p];
+			planeX[p] = _mm256_set1_ps(plane.x);
+			planeY[p] = _mm256_set1_ps(plane.y);
+			planeZ[p] = _mm256_set1_ps(plane.z);
+			planeW[p] = _mm256_set1_ps(plane.w);
+			absX[p] = _mm256_set1_ps(std::abs(plane.x));
+			absY[p] = _mm256_set1_ps(std::abs(plane.y));
+			absZ[p] = _mm256_set1_ps(std::abs(plane.z));
+		}
+
+		const __m256 zero = _mm256_setzero_ps();
+		const size_t count = boxes.paddedCount();
+		for (size_t i = 0; i < count; i += BATCH)
+		{
+			__m256 centerX = _mm256_loadu_ps(&boxes.centerX[i]);
+			__m256 centerY = _mm256_loadu_ps(&boxes.centerY[i]);
+			__m256 centerZ = _mm256_loadu_ps(&boxes.centerZ[i]);
+			__m256 extentX = _mm256_loadu_ps(&boxes.extentX[i]);
+			__m256 extentY = _mm256_loadu_ps(&boxes.extentY[i]);
+			__m256 extentZ = _mm256_loadu_ps(&boxes.extentZ[i]);
+
+			// a box is outside once its nearest corner is behind any plane
+			__m256 outside = zero;
+			for (int p = 0; p < 6; p++)
+			{
+				__m256 distance = _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(centerX, planeX[p]), _mm256_mul_ps(centerY, planeY[p])),
+					_mm256_mul_ps(centerZ, planeZ[p])), planeW[p]);
+				__m256 radius = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(extentX, absX[p]), _mm256_mul_ps(extentY, absY[p])),
+					_mm256_mul_ps(extentZ, absZ[p]));
+				outside = _mm256_or_ps(outside, _mm256_cmp_ps(_mm256_add_ps(distance, radius), zero, _CMP_LT_OQ));
+			}
+
+			int mask = _mm256_movemask_ps(outside);
+			for (size_t b = 0; b < BATCH; b++)
+				visible[i + b] = ((mask >> b) & 1) ? 0 : 1;
+		}
+	}
+#endif
+}
+
+Frustum Frustum::FromViewProjection(const glm::mat4& viewProjection)
+{
+	// rows of the matrix are the columns of its transpose
+	glm::mat4 m = glm::transpose(viewProjection);
+	Frustum frustum;
+	frustum.planes[0] = m[3] + m[0];
+	frustum.planes[1] = m[3] - m[0];
+	frustum.planes[2] = m[3] + m[1];
+	frustum.planes[3] = m[3] - m[1];
+	frustum.planes[4] = m[3] + m[2];
+	frustum.planes[5] = m[3] - m[2];
+	return frustum;
+}
+
+void FrustumBoxes::clear()
+{
+	for (std::vector<float>* component : { &centerX, &centerY, &centerZ, &extentX, &extentY, &extentZ })
+		component->clear();
+	count = 0;
+}
+
+void FrustumBoxes::push(const glm::vec3& boundsMin, const glm::vec3& boundsMax)
+{
+	glm::vec3 center = (boundsMin + boundsMax) * 0.5f;
+	glm::vec3 extent = (boundsMax - boundsMin) * 0.5f;
+	centerX.push_back(center.x);
+	centerY.push_back(center.y);
+	centerZ.push_back(center.z);
+	extentX.push_back(extent.x);
+	extentY.push_back(extent.y);
+	extentZ.push_back(extent.z);
+	count++;
+}
+
+void FrustumBoxes::finish()
+{
+	size_t padded = (count + BATCH - 1) / BATCH * BATCH;
+	for (std::vector<float>* component : { &centerX, &centerY, &centerZ, &extentX, &extentY, &extentZ })
+		component->resize(padded, 0.0f);
+}
+
+void FrustumCuller::update(const std::vector<Model*>& models)
+{
+	bool changed = models.size() != builtModels.size();
+	for (size_t i = 0; i < models.size() && !changed; i++)
+	{
+		const Model& model = *models[i];
+		size_t meshCount = model.isLoading() ? 0 : model.meshes.size();
+		changed = builtModels[i] != &model || builtMeshCounts[i] != meshCount || builtMatrices[i] != model.modelMatrix;
+	}
+	if (changed)
+		rebuild(models);
+}
+
+void FrustumCuller::rebuild(const std::vector<Model*>& models)
+{
+	builtModels.assign(models.begin(), models.end());
+	builtMatrices.clear();
+	builtMeshCounts.clear();
+	modelOffsets.clear();
+	triangleCounts.clear();
+	boxes.clear();
+
+	for (const Model* model : models)
+	{
+		builtMatrices.push_back(model->modelMatrix);
+		builtMeshCounts.push_back(model->isLoading() ? 0 : model->meshes.size());
+		modelOffsets.push_back(model->isLoading() ? SIZE_MAX : boxes.count);
+		if (model->isLoading())
+			continue;
+
+		for (const Mesh& mesh : model->meshes)
+		{
+			boxes.push(mesh.worldBoundsMin, mesh.worldBoundsMax);
+			triangleCounts.push_back(static_cast<uint32_t>(mesh.getGeometry()->indexCount / 3));
+		}
+	}
+	boxes.finish();
+	visibility.assign(boxes.paddedCount(), 1);
+
+	stats = CullStats();
+	stats.meshes = boxes.count;
+	for (uint32_t triangles : triangleCounts)
+		stats.triangles += triangles;
+}
+
+void FrustumCuller::cull(const Frustum& frustum)
+{
+	CullBoxes(frustum, boxes, visibility.data());
+
+	stats.culledMeshes = 0;
+	stats.culledTriangles = 0;
+	stats.occludedMeshes = 0;
+	stats.occludedTriangles = 0;
+	stats.pvsHiddenMeshes = 0;
+	stats.pvsHiddenTriangles = 0;
+	for (size_t i = 0; i < boxes.count; i++)
+	{
+		if (!visibility[i])
+		{
+			stats.culledMeshes++;
+			stats.culledTriangles += triangleCounts[i];
+		}
+	}
+}
+
+void FrustumCuller::occlude(SoftwareOcclusion& occlusion)
+{
+	std::vector<uint8_t> before(visibility.begin(), visibility.begin() + boxes.count);
+	occlusion.testBoxes(boxes, visibility.data());
+
+	stats.occludedMeshes = 0;
+	stats.occludedTriangles = 0;
+	for (size_t i = 0; i < boxes.count; i++)
+	{
+		if (before[i] && !visibility[i])
+		{
+			stats.occludedMeshes++;
+			stats.occludedTriangles += triangleCounts[i];
+		}
+	}
+}
+
+void FrustumCuller::restrict(const PotentiallyVisibleSet& pvs, const uint64_t* cell)
+{
+	for (size_t i = 0; i < builtModels.size(); i++)
+	{
+		if (modelOffsets[i] == SIZE_MAX)
+			continue;
+		for (size_t mesh = 0; mesh < builtMeshCounts[i]; mesh++)
+		{
+			size_t box = modelOffsets[i] + mesh;
+			if (!pvs.isVisible(cell, builtModels[i], mesh))
+			{
+				visibility[box] = 0;
+				stats.pvsHiddenMeshes++;
+				stats.pvsHiddenTriangles += triangleCounts[box];
+			}
+		}
+	}
+}
+
+const uint8_t* FrustumCuller::getVisibility(const Model* model) const
+{
+	for (size_t i = 0; i < builtModels.size(); i++)
+	{
+		if (builtModels[i] == model)
+			return modelOffsets[i] == SIZE_MAX ? nullptr : visibility.data() + modelOffsets[i];
+	}
+	return nullptr;
+}
+
+void FrustumCuller::CullBoxes(const Frustum& frustum, const FrustumBoxes& boxes, uint8_t* visible)
+{
+#ifdef FRUSTUM_CULLER_AVX2
+	if (HasAVX2())
+	{
+		cullBoxesAVX2(frustum, boxes, visible);
+		return;
+	}
+#endif
+	CullBoxesScalar(frustum, boxes, visible);
+}
+
+void FrustumCuller::CullBoxesScalar(const Frustum& frustum, const FrustumBoxes& boxes, uint8_t* visible)
+{
+	const size_t count = boxes.paddedCount();
+	for (size_t i = 0; i < count; i++)
+	{
+		bool outside = false;
+		for (const glm::vec4& plane : frustum.planes)
+		{
+			float distance = boxes.centerX[i] * plane.x + boxes.centerY[i] * plane.y + boxes.centerZ[i] * plane.z + plane.w;
+			float radius = boxes.extentX[i] * std::abs(plane.x) + boxes.extentY[i] * std::abs(plane.y) + boxes.extentZ[i] * std::abs(plane.z);
+			outside |= distance + radius < 0.0f;
+		}
+		visible[i] = outside ? 0 : 1;
+	}
+}
+
+bool FrustumCuller::HasAVX2()
+{
+#ifdef FRUSTUM_CULLER_AVX2
+#if defined(_MSC_VER)
+	static const bool supported = []()
+		{
+			int info[4];
+			__cpuid(info, 0);
+			if (info[0] < 7)
+				return false;
+			// the OS has to save the YMM registers too, not just the CPU support them
+			__cpuid(info, 1);
+			bool osxsave = (info[2] & (1 << 27)) != 0;
+			bool avx = (info[2] & (1 << 28)) != 0;
+			if (!osxsave || !avx || (_xgetbv(0) & 6) != 6)
+				return false;
+			__cpuidex(info, 7, 0);
+			return (info[1] & (1 << 5)) != 0;
+		}();
+#else
+	static const bool supported = __builtin_cpu_supports("avx2");
+#endif
+	return supported;
+#else
+	return false;
+#endif
+}
+
+int FrustumCuller::RunBenchmark(const std::vector<std::string>& arguments)
+{
+	size_t boxCount = 100000;
+	int runs = 20;
+	for (size_t i = 0; i < arguments.size(); i++)
+	{
+		if (arguments[i] == "--boxes" && i + 1 < arguments.size())
+			boxCount = std::max(1, std::atoi(arguments[++i].c_str()));
+		else if (arguments[i] == "--runs" && i + 1 < arguments.size())
+			runs = std::max(1, std::atoi(arguments[++i].c_str()));
+	}
+
+	// boxes scattered around a camera at the origin looking down -Z, so part of them is inside the frustum
+	std::mt19937 random(1234);
+	std::uniform_real_distribution<float> position(-150.0f, 150.0f);
+	std::uniform_real_distribution<float> size(0.1f, 4.0f);
+	FrustumBoxes boxes;
+	for (size_t i = 0; i < boxCount; i++)
+	{
+		glm::vec3 center(position(random), position(random), position(random));
+		glm::vec3 extent(size(random), size(random), size(random));
+		boxes.push(center - extent, center + extent);
+	}
+	boxes.finish();
+
+	glm::mat4 projection = glm::perspective(glm::radians(60.0f), 16.0f / 9.0f, 0.1f, 200.0f);
+	glm::mat4 view = glm::lookAt(glm::vec3(0.0f), glm::vec3(0.0f, 0.0f, -1.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+	Frustum frustum = Frustum::FromViewProjection(projection * view);
+
+	// best of the runs, the first one pays for faulting the arrays in
+	auto timeKernel = [&](void (*kernel)(const Frustum&, const FrustumBoxes&, uint8_t*), std::vector<uint8_t>& visible)
+	{
+		visible.assign(boxes.paddedCount(), 0);
+		double best = -1.0;
+		for (int run = 0; run < runs; run++)
+		{
+			auto start = std::chrono::steady_clock::now();
+			kernel(frustum, boxes, visible.data());
+			std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+			best = best < 0.0 ? elapsed.count() : std::min(best, elapsed.count());
+		}
+		return best;
+	};
+	auto countVisible = [&](const std::vector<uint8_t>& visible)
+	{
+		size_t count = 0;
+		for (size_t i = 0; i < boxes.count; i++)
+			count += visible[i];
+		return count;
+	};
+
+	std::vector<uint8_t> scalarVisible, simdVisible;
+	double scalarMs = timeKernel(&FrustumCuller::CullBoxesScalar, scalarVisible);
+	std::printf("%-8s %10s %10s %10s\n", "kernel", "ms", "ns/box", "visible");
+	std::printf("%-8s %10.3f %10.2f %10zu\n", "scalar", scalarMs, scalarMs * 1e6 / boxCount, countVisible(scalarVisible));
+
+	if (!HasAVX2())
+	{
+		std::printf("AVX2 not available on this CPU, CullBoxes runs the scalar kernel\n");
+		return 0;
+	}
+
+	double simdMs = timeKernel(&FrustumCuller::CullBoxes, simdVisible);
+	size_t mismatches = 0;
+	for (size_t i = 0; i < boxes.count; i++)
+		mismatches += scalarVisible[i] != simdVisible[i] ? 1 : 0;
+	std::printf("%-8s %10.3f %10.2f %10zu\n", "AVX2", simdMs, simdMs * 1e6 / boxCount, countVisible(simdVisible));
+	std::printf("%zu boxes, best of %d runs, AVX2 %.2fx faster, %zu mismatches\n", boxCount, runs, simdMs > 0.0 ? scalarMs / simdMs : 0.0, mismatches);
+
+	if (mismatches > 0)
+	{
+		std::cerr << "ERROR::BENCHMARK:: AVX2 and scalar culling disagree on " << mismatches << " boxes" << std::endl;
+		return 1;
+	}
+	return 0;
+}
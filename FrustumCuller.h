@@ -0,0 +1,86 @@
+#pragma once
+#include "Model.h"
+#include <cstdint>
+#include <string>
+#include <vector>
+
+class SoftwareOcclusion;
+class PotentiallyVisibleSet;
+
+//Planes of a view-projection's frustum, pointing inwards and not normalized (Gribb/Hartmann)
+struct Frustum
+{
+	glm::vec4 planes[6];
+
+	static Frustum FromViewProjection(const glm::mat4& viewProjection);
+};
+
+//World space AABBs as centre and extents per axis, one array each so 8 boxes load into one register per component.
+//Padded to a multiple of 8 with empty boxes, the kernel never needs a scalar tail
+struct FrustumBoxes
+{
+	std::vector<float> centerX, centerY, centerZ;
+	std::vector<float> extentX, extentY, extentZ;
+	size_t count = 0;
+
+	void clear();
+	void push(const glm::vec3& boundsMin, const glm::vec3& boundsMax);
+	//Pads the arrays, call once every box is pushed
+	void finish();
+	size_t paddedCount() const { return centerX.size(); }
+};
+
+//Meshes and triangles of the last FrustumCuller::cull
+struct CullStats
+{
+	size_t meshes = 0;
+	size_t culledMeshes = 0;
+	size_t triangles = 0;
+	size_t culledTriangles = 0;
+	size_t occludedMeshes = 0;		// of the frustum visible ones, set by FrustumCuller::occlude
+	size_t occludedTriangles = 0;
+	size_t pvsHiddenMeshes = 0;		// outside the camera cell's set, frustum culled or not, set by FrustumCuller::restrict
+	size_t pvsHiddenTriangles = 0;
+};
+
+//CPU frustum culling of whole meshes against their world bounds (Mesh::worldBoundsMin/Max), run every frame before
+//the draw loop. The boxes are gathered once per change of the models and tested 8 at a time with AVX2 when the CPU has it.
+//Models still loading aren't gathered and are drawn whole
+class FrustumCuller
+{
+public:
+	//Regathers the boxes if a model finished loading or was moved since the last call, otherwise does nothing
+	void update(const std::vector<Model*>& models);
+	void cull(const Frustum& frustum);
+	//After cull(), also hides the visible meshes behind the occluders of a rendered SoftwareOcclusion
+	void occlude(SoftwareOcclusion& occlusion);
+	//After cull(), also hides the meshes outside a baked cell's potentially visible set
+	void restrict(const PotentiallyVisibleSet& pvs, const uint64_t* cell);
+
+	//One byte per mesh of the model, 0 for culled, nullptr if the model isn't gathered
+	const uint8_t* getVisibility(const Model* model) const;
+	const CullStats& getStats() const { return stats; }
+
+	//visible[i] = 1 if box i is at least partly inside the frustum, for all paddedCount() boxes
+	static void CullBoxes(const Frustum& frustum, const FrustumBoxes& boxes, uint8_t* visible);
+	static void CullBoxesScalar(const Frustum& frustum, const FrustumBoxes& boxes, uint8_t* visible);
+	static bool HasAVX2();
+
+	//AJGL --benchmark-culling [--boxes N] [--runs N]
+	//Times the scalar and AVX2 kernels on random boxes, best of N runs each, and checks both agree
+	static int RunBenchmark(const std::vector<std::string>& arguments);
+
+private:
+	FrustumBoxes boxes;
+	std::vector<uint8_t> visibility;
+	std::vector<uint32_t> triangleCounts;
+	std::vector<size_t> modelOffsets;	// first box of each built model
+	CullStats stats;
+
+	// what the boxes were gathered from, to spot changes
+	std::vector<const Model*> builtModels;
+	std::vector<glm::mat4> builtMatrices;
+	std::vector<size_t> builtMeshCounts;
+
+	void rebuild(const std::vector<Model*>& models);
+};
@@ -0,0 +1,272 @@
+#include "GeometryArena.h"
+#include "Mesh.h"
+#include <algorithm>
+#include <cstdio>
+#include <iterator>
+
+GeometryArena* GeometryArena::fullArena = nullptr;
+GeometryArena* GeometryArena::packedArena = nullptr;
+
+namespace
+{
+	// first allocation of each buffer, grown by doubling from there
+	const size_t INITIAL_VERTEX_BYTES = 32 * 1024 * 1024;
+	const size_t INITIAL_INDEX_BYTES = 16 * 1024 * 1024;
+
+	void setAttribute(GLuint vertexArray, VertexAttribute attribute, GLint components, GLenum type, GLboolean normalized, size_t offset)
+	{
+		GLuint location = static_cast<GLuint>(attribute);
+		glEnableVertexArrayAttrib(vertexArray, location);
+		glVertexArrayAttribFormat(vertexArray, location, components, type, normalized, static_cast<GLuint>(offset));
+		glVertexArrayAttribBinding(vertexArray, location, 0);
+	}
+}
+
+size_t RangeAllocator::allocate(size_t size)
+{
+	if (size == 0)
+		return 0;
+
+	auto best = freeBySize.lower_bound(size);
+	if (best == freeBySize.end())
+		return INVALID;
+
+	size_t offset = best->second;
+	size_t rangeSize = best->first;
+	eraseFree(freeByOffset.find(offset));
+	if (rangeSize > size)
+		insertFree(offset + size, rangeSize - size);
+	used += size;
+	return offset;
+}
+
+void RangeAllocator::free(size_t offset, size_t size)
+{
+	if (size == 0)
+		return;
+	used -= size;
+
+	auto next = freeByOffset.lower_bound(offset);
+	if (next != freeByOffset.end() && next->first == offset + size)
+	{
+		size += next->second;
+		next = std::next(next);
+		eraseFree(std::prev(next));
+	}
+	if (next != freeByOffset.begin())
+	{
+		auto previous = std::prev(next);
+		if (previous->first + previous->second == offset)
+		{
+			offset = previous->first;
+			size += previous->second;
+			eraseFree(previous);
+		}
+	}
+	insertFree(offset, size);
+}
+
+void RangeAllocator::grow(size_t newCapacity)
+{
+	if (newCapacity <= capacity)
+		return;
+
+	// the new tail goes in like a freed block so it merges with a free range at the old end
+	size_t added = newCapacity - capacity;
+	size_t start = capacity;
+	capacity = newCapacity;
+	used += added;
+	free(start, added);
+}
+
+void RangeAllocator::insertFree(size_t offset, size_t size)
+{
+	freeByOffset.emplace(offset, size);
+	freeBySize.emplace(size, offset);
+}
+
+void RangeAllocator::eraseFree(std::map<size_t, size_t>::iterator range)
+{
+	auto sized = freeBySize.equal_range(range->second);
+	for (auto it = sized.first; it != sized.second; ++it)
+	{
+		if (it->second == range->first)
+		{
+			freeBySize.erase(it);
+			break;
+		}
+	}
+	freeByOffset.erase(range);
+}
+
+void GeometryArena::init()
+{
+	if (fullArena != nullptr)
+		return;
+
+	fullArena = new GeometryArena(VertexFormat::Full);
+	packedArena = new GeometryArena(VertexFormat::Packed);
+}
+
+void GeometryArena::cleanup()
+{
+	delete fullArena;
+	delete packedArena;
+	fullArena = packedArena = nullptr;
+}
+
+GeometryArena* GeometryArena::getInstance(VertexFormat format)
+{
+	switch (format)
+	{
+	case VertexFormat::Full: return fullArena;
+	case VertexFormat::Packed: return packedArena;
+	default: return nullptr;
+	}
+}
+
+void GeometryArena::printReport()
+{
+	const double MB = 1024.0 * 1024.0;
+	for (GeometryArena* arena : { fullArena, packedArena })
+	{
+		if (arena == nullptr || arena->vertexBuffer == 0)
+			continue;
+
+		GeometryArenaStats stats = arena->getStats();
+		std::printf("GeometryArena %s: %zu meshes, vertices %.2f / %.2f MB, indices %.2f / %.2f MB, %zu free ranges, %.1f%% fragmented\n",
+			arena->format == VertexFormat::Packed ? "packed" : "full", stats.allocations,
+			stats.vertexBytesUsed / MB, stats.vertexBytesCapacity / MB, stats.indexBytesUsed / MB, stats.indexBytesCapacity / MB,
+			stats.freeRanges, stats.fragmentation * 100.0f);
+	}
+}
+
+GLsizei GeometryArena::VertexStride(VertexFormat format)
+{
+	return format == VertexFormat::Packed ? sizeof(PackedVertex) : sizeof(Vertex);
+}
+
+void GeometryArena::SetupVertexLayout(GLuint vertexArray, GLuint vertexBuffer, GLuint indexBuffer, VertexFormat format)
+{
+	if (format == VertexFormat::Packed)
+	{
+		// the vertex shader takes the tangent handedness from position.w
+		setAttribute(vertexArray, VertexAttribute::Position, 4, GL_UNSIGNED_SHORT, GL_TRUE, offsetof(PackedVertex, position));
+		setAttribute(vertexArray, VertexAttribute::Normal, 2, GL_SHORT, GL_TRUE, offsetof(PackedVertex, normal));
+		setAttribute(vertexArray, VertexAttribute::TexCoords, 2, GL_HALF_FLOAT, GL_FALSE, offsetof(PackedVertex, texCoords));
+		setAttribute(vertexArray, VertexAttribute::Tangent, 2, GL_SHORT, GL_TRUE, offsetof(PackedVertex, tangent));
+	}
+	else
+	{
+		setAttribute(vertexArray, VertexAttribute::Position, 3, GL_FLOAT, GL_FALSE, offsetof(Vertex, Position));
+		setAttribute(vertexArray, VertexAttribute::Normal, 3, GL_FLOAT, GL_FALSE, offsetof(Vertex, Normal));
+		setAttribute(vertexArray, VertexAttribute::TexCoords, 2, GL_FLOAT, GL_FALSE, offsetof(Vertex, TexCoords));
+		setAttribute(vertexArray, VertexAttribute::Tangent, 4, GL_FLOAT, GL_FALSE, offsetof(Vertex, Tangent));
+	}
+
+	if (vertexBuffer != 0)
+		glVertexArrayVertexBuffer(vertexArray, 0, vertexBuffer, 0, VertexStride(format));
+	if (indexBuffer != 0)
+		glVertexArrayElementBuffer(vertexArray, indexBuffer);
+}
+
+GeometryArena::GeometryArena(VertexFormat format)
+	: format(format),
+	stride(VertexStride(format))
+{
+	glCreateVertexArrays(1, &vertexArray);
+	SetupVertexLayout(vertexArray, 0, 0, format);
+}
+
+GeometryArena::~GeometryArena()
+{
+	glDeleteVertexArrays(1, &vertexArray);
+	glDeleteBuffers(1, &vertexBuffer);
+	glDeleteBuffers(1, &indexBuffer);
+}
+
+GeometryAllocation GeometryArena::allocate(size_t vertexCount, size_t indexBytes)
+{
+	indexBytes = (indexBytes + 3) & ~size_t(3);
+
+	size_t baseVertex = vertices.allocate(vertexCount);
+	if (baseVertex == RangeAllocator::INVALID)
+	{
+		growVertices(vertexCount);
+		baseVertex = vertices.allocate(vertexCount);
+	}
+	size_t indexOffset = indices.allocate(indexBytes);
+	if (indexOffset == RangeAllocator::INVALID)
+	{
+		growIndices(indexBytes);
+		indexOffset = indices.allocate(indexBytes);
+	}
+
+	allocationCount++;
+	GeometryAllocation allocation;
+	allocation.baseVertex = baseVertex;
+	allocation.vertexCount = vertexCount;
+	allocation.indexOffset = indexOffset;
+	allocation.indexBytes = indexBytes;
+	allocation.inArena = true;
+	return allocation;
+}
+
+void GeometryArena::free(const GeometryAllocation& allocation)
+{
+	if (!allocation.inArena)
+		return;
+	vertices.free(allocation.baseVertex, allocation.vertexCount);
+	indices.free(allocation.indexOffset, allocation.indexBytes);
+	allocationCount--;
+}
+
+GeometryArenaStats GeometryArena::getStats() const
+{
+	GeometryArenaStats stats;
+	stats.vertexBytesUsed = vertices.getUsed() * stride;
+	stats.vertexBytesCapacity = vertices.getCapacity() * stride;
+	stats.indexBytesUsed = indices.getUsed();
+	stats.indexBytesCapacity = indices.getCapacity();
+	stats.allocations = allocationCount;
+	stats.freeRanges = vertices.getFreeRangeCount() + indices.getFreeRangeCount();
+
+	size_t freeBytes = (stats.vertexBytesCapacity - stats.vertexBytesUsed) + (stats.indexBytesCapacity - stats.indexBytesUsed);
+	size_t largestBytes = vertices.getLargestFreeRange() * stride + indices.getLargestFreeRange();
+	stats.fragmentation = freeBytes > 0 ? 1.0f - float(largestBytes) / float(freeBytes) : 0.0f;
+	return stats;
+}
+
+void GeometryArena::growVertices(size_t minimumVertices)
+{
+	size_t oldCapacity = vertices.getCapacity();
+	size_t newCapacity = std::max({ oldCapacity * 2, INITIAL_VERTEX_BYTES / stride, oldCapacity + minimumVertices });
+
+	vertexBuffer = reallocate(vertexBuffer, oldCapacity * stride, newCapacity * stride);
+	vertices.grow(newCapacity);
+	glVertexArrayVertexBuffer(vertexArray, 0, vertexBuffer, 0, stride);
+}
+
+void GeometryArena::growIndices(size_t minimumBytes)
+{
+	size_t oldCapacity = indices.getCapacity();
+	size_t newCapacity = std::max({ oldCapacity * 2, INITIAL_INDEX_BYTES, oldCapacity + minimumBytes });
+
+	indexBuffer = reallocate(indexBuffer, oldCapacity, newCapacity);
+	indices.grow(newCapacity);
+	glVertexArrayElementBuffer(vertexArray, indexBuffer);
+}
+
+GLuint GeometryArena::reallocate(GLuint buffer, size_t oldBytes, size_t newBytes)
+{
+	// the copy is queued after every upload into the old buffer, so nothing in flight is lost and offsets stay valid
+	GLuint grown;
+	glCreateBuffers(1, &grown);
+	glNamedBufferData(grown, static_cast<GLsizeiptr>(newBytes), nullptr, GL_STATIC_DRAW);
+	if (buffer != 0)
+	{
+		glCopyNamedBufferSubData(buffer, grown, 0, 0, static_cast<GLsizeiptr>(oldBytes));
+		glDeleteBuffers(1, &buffer);
+	}
+	return grown;
+}
@@ -0,0 +1,110 @@
+#pragma once
+#include <glad/glad.h>
+#include <cstddef>
+#include <map>
+
+enum class VertexFormat;
+
+//Best fit sub-allocator over a range of units (vertices, bytes, ...). Freed ranges are merged with free neighbours,
+//so the free list only fragments where live allocations actually sit between the holes
+class RangeAllocator
+{
+public:
+	static const size_t INVALID = ~size_t(0);
+
+	//INVALID when no free range is large enough
+	size_t allocate(size_t size);
+	void free(size_t offset, size_t size);
+	//Appends [capacity, newCapacity) to the free ranges
+	void grow(size_t newCapacity);
+
+	size_t getCapacity() const { return capacity; }
+	size_t getUsed() const { return used; }
+	size_t getFreeRangeCount() const { return freeByOffset.size(); }
+	size_t getLargestFreeRange() const { return freeBySize.empty() ? 0 : freeBySize.rbegin()->first; }
+
+private:
+	std::map<size_t, size_t> freeByOffset;		// offset -> size
+	std::multimap<size_t, size_t> freeBySize;	// size -> offset
+	size_t capacity = 0;
+	size_t used = 0;
+
+	void insertFree(size_t offset, size_t size);
+	void eraseFree(std::map<size_t, size_t>::iterator range);
+};
+
+//Where a mesh's geometry sits inside its arena
+struct GeometryAllocation
+{
+	size_t baseVertex = 0;		// first vertex, the draw's BaseVertex
+	size_t vertexCount = 0;
+	size_t indexOffset = 0;		// bytes into the index buffer
+	size_t indexBytes = 0;
+	bool inArena = false;		// false for meshes with buffers of their own
+};
+
+//Fill of one arena's buffers, for the load reports and later batching decisions
+struct GeometryArenaStats
+{
+	size_t vertexBytesUsed = 0;
+	size_t vertexBytesCapacity = 0;
+	size_t indexBytesUsed = 0;
+	size_t indexBytesCapacity = 0;
+	size_t allocations = 0;
+	size_t freeRanges = 0;			// vertex and index holes together
+	float fragmentation = 0.0f;		// 1 - largest hole / all free space, over both buffers
+};
+
+//One large vertex buffer and one index buffer per GPU vertex layout (Full, Packed), shared by every mesh of that layout
+//and drawn through a single VAO with glDrawElementsBaseVertex. Meshes are sub-allocated from free lists; when a buffer
+//runs out it's reallocated at twice the size and copied on the GPU, so allocations never move and the buffers can feed
+//indirect draws. Source layout meshes (glTF streams) have per-mesh attribute formats and keep their own VAO.
+//GL thread only.
+class GeometryArena
+{
+public:
+	//Creates the arenas, call on the GL thread once the context is current. Buffers are only allocated on first use
+	static void init();
+	static void cleanup();
+	//Arena for a vertex layout or nullptr (Source layout, or before init), callers then create buffers of their own
+	static GeometryArena* getInstance(VertexFormat format);
+	//Utilisation and fragmentation of every arena in use
+	static void printReport();
+
+	//Vertex attribute formats of a layout on vertexArray, reading binding 0 from vertexBuffer and indices from indexBuffer.
+	//Used for the arenas' VAOs and for meshes that own their buffers
+	static void SetupVertexLayout(GLuint vertexArray, GLuint vertexBuffer, GLuint indexBuffer, VertexFormat format);
+	static GLsizei VertexStride(VertexFormat format);
+
+	GeometryArena(const GeometryArena&) = delete;
+	GeometryArena& operator=(const GeometryArena&) = delete;
+
+	//Grows the buffers when the geometry doesn't fit. indexBytes is rounded up to 4 so every allocation can hold either index type
+	GeometryAllocation allocate(size_t vertexCount, size_t indexBytes);
+	void free(const GeometryAllocation& allocation);
+
+	GLuint getVertexArray() const { return vertexArray; }
+	GLuint getVertexBuffer() const { return vertexBuffer; }
+	GLuint getIndexBuffer() const { return indexBuffer; }
+	GeometryArenaStats getStats() const;
+
+private:
+	explicit GeometryArena(VertexFormat format);
+	~GeometryArena();
+
+	VertexFormat format;
+	GLsizei stride;
+	GLuint vertexArray = 0;
+	GLuint vertexBuffer = 0;
+	GLuint indexBuffer = 0;
+	RangeAllocator vertices;	// in vertices
+	RangeAllocator indices;		// in bytes
+	size_t allocationCount = 0;
+
+	void growVertices(size_t minimumVertices);
+	void growIndices(size_t minimumBytes);
+	static GLuint reallocate(GLuint buffer, size_t oldBytes, size_t newBytes);
+
+	static GeometryArena* fullArena;
+	static GeometryArena* packedArena;
+};
@@ -0,0 +1,914 @@
+#include "GltfLoader.h"
+#include "Json.h"
+#include "MeshOptimizer.h"
+#include "MeshSimplifier.h"
+#include "MeshletBuilder.h"
+#include "TangentSpace.h"
+#include <glm/gtc/quaternion.hpp>
+#include <glm/gtc/type_ptr.hpp>
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <utility>
+
+namespace
+{
+	const uint32_t GLB_MAGIC = 0x46546C67;		// "glTF"
+	const uint32_t GLB_CHUNK_JSON = 0x4E4F534A;	// "JSON"
+	const uint32_t GLB_CHUNK_BIN = 0x004E4942;	// "BIN\0"
+
+	const int MODE_TRIANGLES = 4;
+	const int MODE_TRIANGLE_STRIP = 5;
+	const int MODE_TRIANGLE_FAN = 6;
+
+	//extensions this loader implements, an asset requiring anything else goes to Assimp
+	const char* SUPPORTED_EXTENSIONS[] = { "KHR_mesh_quantization", "KHR_texture_transform" };
+
+	struct BufferRange
+	{
+		const unsigned char* data = nullptr;
+		size_t size = 0;
+	};
+
+	//an accessor resolved to memory. glTF componentType values are the GL enums (GL_BYTE .. GL_FLOAT)
+	struct Accessor
+	{
+		const unsigned char* data = nullptr;	// null when the accessor has no bufferView (all zero, or sparse only)
+		size_t count = 0;
+		size_t stride = 0;
+		size_t elementSize = 0;
+		int components = 0;
+		GLenum componentType = GL_FLOAT;
+		bool normalized = false;
+		const JsonValue* sparse = nullptr;
+	};
+
+	int componentCount(const std::string& type)
+	{
+		if (type == "SCALAR") return 1;
+		if (type == "VEC2") return 2;
+		if (type == "VEC3") return 3;
+		if (type == "VEC4") return 4;
+		if (type == "MAT2") return 4;
+		if (type == "MAT3") return 9;
+		if (type == "MAT4") return 16;
+		return 0;
+	}
+
+	size_t componentSize(GLenum type)
+	{
+		switch (type)
+		{
+		case GL_BYTE:
+		case GL_UNSIGNED_BYTE:
+			return 1;
+		case GL_SHORT:
+		case GL_UNSIGNED_SHORT:
+			return 2;
+		case GL_UNSIGNED_INT:
+		case GL_FLOAT:
+			return 4;
+		default:
+			return 0;
+		}
+	}
+
+	//one component as float, with the glTF rules for normalized integers
+	float readComponent(const unsigned char* source, GLenum type, bool normalized)
+	{
+		switch (type)
+		{
+		case GL_BYTE:
+		{
+			int8_t value = static_cast<int8_t>(*source);
+			return normalized ? std::max(value / 127.0f, -1.0f) : float(value);
+		}
+		case GL_UNSIGNED_BYTE:
+			return normalized ? *source / 255.0f : float(*source);
+		case GL_SHORT:
+		{
+			int16_t value;
+			std::memcpy(&value, source, sizeof(value));
+			return normalized ? std::max(value / 32767.0f, -1.0f) : float(value);
+		}
+		case GL_UNSIGNED_SHORT:
+		{
+			uint16_t value;
+			std::memcpy(&value, source, sizeof(value));
+			return normalized ? value / 65535.0f : float(value);
+		}
+		case GL_UNSIGNED_INT:
+		{
+			uint32_t value;
+			std::memcpy(&value, source, sizeof(value));
+			return float(value);
+		}
+		default:
+		{
+			float value;
+			std::memcpy(&value, source, sizeof(value));
+			return value;
+		}
+		}
+	}
+
+	uint32_t readIndex(const unsigned char* source, GLenum type)
+	{
+		if (type == GL_UNSIGNED_BYTE)
+			return *source;
+		if (type == GL_UNSIGNED_SHORT)
+		{
+			uint16_t value;
+			std::memcpy(&value, source, sizeof(value));
+			return value;
+		}
+		uint32_t value;
+		std::memcpy(&value, source, sizeof(value));
+		return value;
+	}
+
+	int hexValue(char c)
+	{
+		if (c >= '0' && c <= '9') return c - '0';
+		if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+		if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+		return -1;
+	}
+
+	//URIs are percent encoded, texture and buffer paths on disk are not
+	std::string decodeUri(const std::string& uri)
+	{
+		std::string result;
+		result.reserve(uri.size());
+		for (size_t i = 0; i < uri.size(); i++)
+		{
+			if (uri[i] == '%' && i + 2 < uri.size() && hexValue(uri[i + 1]) >= 0 && hexValue(uri[i + 2]) >= 0)
+			{
+				result += char(hexValue(uri[i + 1]) * 16 + hexValue(uri[i + 2]));
+				i += 2;
+			}
+			else
+			{
+				result += uri[i];
+			}
+		}
+		return result;
+	}
+
+	bool decodeBase64(const std::string& text, size_t start, std::vector<unsigned char>& out)
+	{
+		auto sextet = [](char c) -> int
+		{
+			if (c >= 'A' && c <= 'Z') return c - 'A';
+			if (c >= 'a' && c <= 'z') return c - 'a' + 26;
+			if (c >= '0' && c <= '9') return c - '0' + 52;
+			if (c == '+') return 62;
+			if (c == '/') return 63;
+			return -1;
+		};
+
+		uint32_t bits = 0;
+		int bitCount = 0;
+		out.reserve((text.size() - start) * 3 / 4);
+		for (size_t i = start; i < text.size() && text[i] != '='; i++)
+		{
+			int value = sextet(text[i]);
+			if (value < 0)
+				return false;
+			bits = (bits << 6) | uint32_t(value);
+			bitCount += 6;
+			if (bitCount >= 8)
+			{
+				bitCount -= 8;
+				out.push_back(static_cast<unsigned char>((bits >> bitCount) & 0xFF));
+			}
+		}
+		return true;
+	}
+
+	glm::mat4 nodeMatrix(const JsonValue& node)
+	{
+		const JsonValue& matrix = node["matrix"];
+		if (matrix.size() == 16)
+		{
+			float values[16];
+			for (size_t i = 0; i < 16; i++)
+				values[i] = matrix[i].asFloat();
+			return glm::make_mat4(values);	// column major, like glm
+		}
+
+		const JsonValue& t = node["translation"];
+		const JsonValue& r = node["rotation"];
+		const JsonValue& s = node["scale"];
+		glm::vec3 translation(t[size_t(0)].asFloat(0.0f), t[1].asFloat(0.0f), t[2].asFloat(0.0f));
+		glm::quat rotation(r[3].asFloat(1.0f), r[size_t(0)].asFloat(0.0f), r[1].asFloat(0.0f), r[2].asFloat(0.0f));
+		glm::vec3 scale(s[size_t(0)].asFloat(1.0f), s[1].asFloat(1.0f), s[2].asFloat(1.0f));
+		return glm::translate(glm::mat4(1.0f), translation) * glm::mat4_cast(rotation) * glm::scale(glm::mat4(1.0f), scale);
+	}
+
+	//KHR_texture_transform as a UV matrix: translation * rotation * scale
+	glm::mat3 textureTransformMatrix(const JsonValue& transform)
+	{
+		const JsonValue& offset = transform["offset"];
+		const JsonValue& scale = transform["scale"];
+		float rotation = transform["rotation"].asFloat(0.0f);
+		float c = std::cos(rotation);
+		float s = std::sin(rotation);
+
+		glm::mat3 translationMatrix(1.0f);
+		translationMatrix[2] = glm::vec3(offset[size_t(0)].asFloat(0.0f), offset[1].asFloat(0.0f), 1.0f);
+		glm::mat3 rotationMatrix(c, -s, 0.0f, s, c, 0.0f, 0.0f, 0.0f, 1.0f);
+		glm::mat3 scaleMatrix(1.0f);
+		scaleMatrix[0][0] = scale[size_t(0)].asFloat(1.0f);
+		scaleMatrix[1][1] = scale[1].asFloat(1.0f);
+		return translationMatrix * rotationMatrix * scaleMatrix;
+	}
+
+	//state of one Load call
+	class GltfImporter
+	{
+	public:
+		GltfImporter(const std::string& path, bool decodeAll, GltfScene& scene)
+			: path(path), decodeAll(decodeAll), scene(scene)
+		{
+			size_t separator = path.find_last_of("/\\");
+			directory = separator == std::string::npos ? std::string() : path.substr(0, separator + 1);
+		}
+
+		bool run()
+		{
+			return parseDocument() && checkExtensions() && loadBuffers() && loadMaterials() && walkScene();
+		}
+
+		void listExternalBuffers(std::vector<std::string>& out)
+		{
+			if (!parseDocument())
+				return;
+			const JsonValue& bufferList = json["buffers"];
+			for (size_t i = 0; i < bufferList.size(); i++)
+			{
+				const std::string& uri = bufferList[i]["uri"].asString();
+				if (!uri.empty() && uri.compare(0, 5, "data:") != 0)
+					out.push_back(directory + decodeUri(uri));
+			}
+		}
+
+	private:
+		std::string path;
+		std::string directory;	// with the trailing separator
+		bool decodeAll;
+		GltfScene& scene;
+
+		JsonValue json;
+		BufferRange glbBinary;
+		std::vector<BufferRange> buffers;
+		std::vector<int> materialTexCoordSets;
+
+		//a primitive placed by a node, resolved to views once every vector stopped growing
+		struct Instance
+		{
+			bool sourceLayout;
+			size_t geometry;
+			size_t material;
+			glm::mat4 transform;
+		};
+		std::vector<Instance> instances;
+		std::map<std::pair<size_t, size_t>, std::pair<bool, size_t>> loadedPrimitives;	// (mesh, primitive) -> geometry
+		static const size_t SKIPPED = ~size_t(0);
+
+		bool fail(const std::string& reason)
+		{
+			std::cout << "ERROR::GLTF:: " << path << ": " << reason << std::endl;
+			return false;
+		}
+
+		bool parseDocument()
+		{
+			scene.files.emplace_back();
+			MappedFile& file = scene.files.back();
+			if (!file.open(path))
+				return fail("could not open file");
+
+			const unsigned char* text = file.data();
+			size_t textSize = file.size();
+
+			uint32_t magic = 0;
+			if (file.size() >= sizeof(magic))
+				std::memcpy(&magic, file.data(), sizeof(magic));
+			if (magic == GLB_MAGIC)
+			{
+				// 12 byte header, then chunks of { length, type, data } with the JSON first
+				uint32_t header[3];
+				if (file.size() < sizeof(header) + 8)
+					return fail("truncated GLB header");
+				std::memcpy(header, file.data(), sizeof(header));
+				if (header[1] != 2)
+					return fail("unsupported GLB version " + std::to_string(header[1]));
+				size_t fileLength = std::min<size_t>(header[2], file.size());
+
+				text = nullptr;
+				size_t offset = sizeof(header);
+				while (offset + 8 <= fileLength)
+				{
+					uint32_t chunk[2];
+					std::memcpy(chunk, file.data() + offset, sizeof(chunk));
+					offset += sizeof(chunk);
+					if (offset + chunk[0] > fileLength)
+						return fail("truncated GLB chunk");
+
+					if (chunk[1] == GLB_CHUNK_JSON && text == nullptr)
+					{
+						text = file.data() + offset;
+						textSize = chunk[0];
+					}
+					else if (chunk[1] == GLB_CHUNK_BIN && glbBinary.data == nullptr)
+					{
+						glbBinary.data = file.data() + offset;
+						glbBinary.size = chunk[0];
+					}
+					offset += (chunk[0] + 3) & ~3u;
+				}
+				if (text == nullptr)
+					return fail("GLB has no JSON chunk");
+			}
+
+			// skip a UTF-8 byte order mark
+			if (textSize >= 3 && text[0] == 0xEF && text[1] == 0xBB && text[2] == 0xBF)
+			{
+				text += 3;
+				textSize -= 3;
+			}
+
+			std::string error;
+			if (!JsonValue::Parse(reinterpret_cast<const char*>(text), textSize, json, error))
+				return fail("invalid JSON, " + error);
+
+			const std::string& version = json["asset"]["version"].asString();
+			if (version.empty() || version[0] != '2')
+				return fail("unsupported glTF version '" + version + "'");
+
+			// a .gltf has no further use for its mapping, a .glb keeps it for the binary chunk
+			if (glbBinary.data == nullptr)
+				scene.files.pop_back();
+			return true;
+		}
+
+		bool checkExtensions()
+		{
+			const JsonValue& required = json["extensionsRequired"];
+			for (size_t i = 0; i < required.size(); i++)
+			{
+				const std::string& name = required[i].asString();
+				bool supported = false;
+				for (const char* extension : SUPPORTED_EXTENSIONS)
+					supported = supported || name == extension;
+				if (!supported)
+					return fail("requires unsupported extension " + name);
+			}
+			return true;
+		}
+
+		bool loadBuffers()
+		{
+			const JsonValue& bufferList = json["buffers"];
+			for (size_t i = 0; i < bufferList.size(); i++)
+			{
+				const JsonValue& buffer = bufferList[i];
+				size_t byteLength = buffer["byteLength"].asSize();
+				BufferRange range;
+
+				if (!buffer.has("uri"))
+				{
+					// the GLB binary chunk, which may be padded past byteLength
+					if (glbBinary.data == nullptr || glbBinary.size < byteLength)
+						return fail("buffer " + std::to_string(i) + " has no data");
+					range = glbBinary;
+				}
+				else if (buffer["uri"].asString().compare(0, 5, "data:") == 0)
+				{
+					const std::string& uri = buffer["uri"].asString();
+					size_t comma = uri.find(";base64,");
+					scene.embeddedBuffers.emplace_back();
+					if (comma == std::string::npos || !decodeBase64(uri, comma + 8, scene.embeddedBuffers.back()))
+						return fail("buffer " + std::to_string(i) + " has an unsupported data URI");
+					range.data = scene.embeddedBuffers.back().data();
+					range.size = scene.embeddedBuffers.back().size();
+				}
+				else
+				{
+					std::string bufferPath = directory + decodeUri(buffer["uri"].asString());
+					scene.files.emplace_back();
+					if (!scene.files.back().open(bufferPath))
+						return fail("could not map buffer " + bufferPath);
+					range.data = scene.files.back().data();
+					range.size = scene.files.back().size();
+				}
+
+				if (range.size < byteLength)
+					return fail("buffer " + std::to_string(i) + " is shorter than its byteLength");
+				buffers.push_back(range);
+			}
+			return true;
+		}
+
+		//start of a bufferView plus an extra offset, range checked against the view
+		const unsigned char* viewPointer(size_t viewIndex, size_t byteOffset, size_t byteLength, size_t* byteStride = nullptr)
+		{
+			const JsonValue& view = json["bufferViews"][viewIndex];
+			size_t bufferIndex = view["buffer"].asSize(buffers.size());
+			if (!view.isObject() || bufferIndex >= buffers.size())
+				return nullptr;
+
+			size_t viewOffset = view["byteOffset"].asSize(0);
+			size_t viewLength = view["byteLength"].asSize(0);
+			if (byteOffset + byteLength > viewLength || viewOffset + viewLength > buffers[bufferIndex].size)
+				return nullptr;
+			if (byteStride != nullptr)
+				*byteStride = view["byteStride"].asSize(0);
+			return buffers[bufferIndex].data + viewOffset + byteOffset;
+		}
+
+		bool resolveAccessor(size_t index, Accessor& out)
+		{
+			const JsonValue& accessor = json["accessors"][index];
+			if (!accessor.isObject())
+				return fail("missing accessor " + std::to_string(index));
+
+			out.count = accessor["count"].asSize();
+			out.components = componentCount(accessor["type"].asString());
+			out.componentType = static_cast<GLenum>(accessor["componentType"].asInt());
+			out.normalized = accessor["normalized"].asBool();
+			out.elementSize = size_t(out.components) * componentSize(out.componentType);
+			out.stride = out.elementSize;
+			out.sparse = accessor.find("sparse");
+			if (out.elementSize == 0)
+				return fail("accessor " + std::to_string(index) + " has an invalid type");
+
+			if (accessor.has("bufferView") && out.count > 0)
+			{
+				size_t byteStride = 0;
+				size_t byteOffset = accessor["byteOffset"].asSize(0);
+				// the stride isn't known until the view is looked up, so check the tight range first and the real one after
+				out.data = viewPointer(accessor["bufferView"].asSize(), byteOffset, out.elementSize, &byteStride);
+				if (byteStride != 0)
+					out.stride = byteStride;
+				if (out.data == nullptr || viewPointer(accessor["bufferView"].asSize(), byteOffset, (out.count - 1) * out.stride + out.elementSize) == nullptr)
+					return fail("accessor " + std::to_string(index) + " is out of bounds");
+			}
+			return true;
+		}
+
+		//whole accessor as floats, sparse substitution included
+		bool readFloats(const Accessor& accessor, std::vector<float>& out)
+		{
+			const size_t componentBytes = componentSize(accessor.componentType);
+			out.assign(accessor.count * accessor.components, 0.0f);
+			if (accessor.data != nullptr)
+			{
+				for (size_t i = 0; i < accessor.count; i++)
+				{
+					const unsigned char* element = accessor.data + i * accessor.stride;
+					for (int c = 0; c < accessor.components; c++)
+						out[i * accessor.components + c] = readComponent(element + c * componentBytes, accessor.componentType, accessor.normalized);
+				}
+			}
+
+			if (accessor.sparse != nullptr)
+			{
+				const JsonValue& sparse = *accessor.sparse;
+				size_t count = sparse["count"].asSize();
+				const JsonValue& indices = sparse["indices"];
+				const JsonValue& values = sparse["values"];
+				GLenum indexType = static_cast<GLenum>(indices["componentType"].asInt());
+				size_t indexSize = componentSize(indexType);
+
+				const unsigned char* indexData = viewPointer(indices["bufferView"].asSize(), indices["byteOffset"].asSize(0), count * indexSize);
+				const unsigned char* valueData = viewPointer(values["bufferView"].asSize(), values["byteOffset"].asSize(0), count * accessor.elementSize);
+				if (count > 0 && (indexData == nullptr || valueData == nullptr || indexSize == 0))
+					return fail("sparse accessor is out of bounds");
+
+				for (size_t i = 0; i < count; i++)
+				{
+					uint32_t target = readIndex(indexData + i * indexSize, indexType);
+					if (target >= accessor.count)
+						return fail("sparse index out of range");
+					for (int c = 0; c < accessor.components; c++)
+						out[target * accessor.components + c] = readComponent(valueData + i * accessor.elementSize + c * componentBytes, accessor.componentType, accessor.normalized);
+				}
+			}
+			return true;
+		}
+
+		//image URI of a textureInfo, relative to the model directory like Assimp reports them
+		std::vector<std::string> texturePath(const JsonValue& textureInfo)
+		{
+			std::vector<std::string> paths;
+			if (!textureInfo.isObject())
+				return paths;
+
+			const JsonValue& texture = json["textures"][textureInfo["index"].asSize(~size_t(0))];
+			const JsonValue& image = json["images"][texture["source"].asSize(~size_t(0))];
+			const std::string& uri = image["uri"].asString();
+			if (uri.empty() || uri.compare(0, 5, "data:") == 0)
+			{
+				// the texture pipeline (decode, compression cache, dedupe) works on files only
+				std::cout << "WARNING::GLTF:: " << path << ": embedded images are not supported, the slot falls back to its default" << std::endl;
+				return paths;
+			}
+			paths.push_back(decodeUri(uri));
+			return paths;
+		}
+
+		bool loadMaterials()
+		{
+			const JsonValue& materials = json["materials"];
+			for (size_t i = 0; i <= materials.size(); i++)
+			{
+				// the extra entry at the end is the default material for primitives without one
+				const JsonValue& material = materials[i];
+				const JsonValue& pbr = material["pbrMetallicRoughness"];
+
+				MaterialTexturePaths textures;
+				textures.albedo = texturePath(pbr["baseColorTexture"]);
+				textures.normal = texturePath(material["normalTexture"]);
+				textures.roughnessMetallic = texturePath(pbr["metallicRoughnessTexture"]);
+				textures.ao = texturePath(material["occlusionTexture"]);
+
+				MaterialFactors factors;
+				const JsonValue& baseColor = pbr["baseColorFactor"];
+				if (baseColor.size() == 4)
+					factors.baseColor = glm::vec4(baseColor[size_t(0)].asFloat(), baseColor[1].asFloat(), baseColor[2].asFloat(), baseColor[3].asFloat());
+				factors.metallic = pbr["metallicFactor"].asFloat(1.0f);
+				factors.roughness = pbr["roughnessFactor"].asFloat(1.0f);
+
+				// the shader has one UV set and one transform for every map, both are taken from the first textured slot,
+				// which is the base colour for practically every asset
+				const JsonValue* slots[] = { &pbr["baseColorTexture"], &material["normalTexture"], &pbr["metallicRoughnessTexture"], &material["occlusionTexture"] };
+				int texCoordSet = 0;
+				for (const JsonValue* slot : slots)
+				{
+					if (!slot->isObject())
+						continue;
+					texCoordSet = (*slot)["texCoord"].asInt(0);
+					const JsonValue& transform = (*slot)["extensions"]["KHR_texture_transform"];
+					if (transform.isObject())
+					{
+						factors.uvTransform = textureTransformMatrix(transform);
+						texCoordSet = transform["texCoord"].asInt(texCoordSet);
+					}
+					break;
+				}
+
+				scene.materialTextures.push_back(std::move(textures));
+				scene.materialFactors.push_back(factors);
+				materialTexCoordSets.push_back(texCoordSet);
+			}
+			return true;
+		}
+
+		bool walkScene()
+		{
+			const JsonValue& nodes = json["nodes"];
+			std::vector<size_t> roots;
+			const JsonValue& scenes = json["scenes"];
+			if (scenes.size() > 0)
+			{
+				const JsonValue& rootList = scenes[json["scene"].asSize(0)]["nodes"];
+				for (size_t i = 0; i < rootList.size(); i++)
+					roots.push_back(rootList[i].asSize());
+			}
+			else
+			{
+				// no scene: every node that isn't somebody's child
+				std::vector<bool> isChild(nodes.size(), false);
+				for (size_t i = 0; i < nodes.size(); i++)
+				{
+					const JsonValue& children = nodes[i]["children"];
+					for (size_t c = 0; c < children.size(); c++)
+					{
+						if (children[c].asSize() < isChild.size())
+							isChild[children[c].asSize()] = true;
+					}
+				}
+				for (size_t i = 0; i < nodes.size(); i++)
+				{
+					if (!isChild[i])
+						roots.push_back(i);
+				}
+			}
+
+			for (size_t root : roots)
+			{
+				if (!walkNode(root, glm::mat4(1.0f), 0))
+					return false;
+			}
+
+			// decoded primitives get their levels of detail here, Model caches them when everything was decoded. the
+			// source layout ones are drawn as stored
+			if (!scene.meshData.empty())
+			{
+				MeshSimplifier::GenerateLods(scene.meshData, path);
+				MeshletBuilder::Build(scene.meshData, path);
+			}
+
+			// every vector is final now, so the views can point into them
+			scene.meshes.reserve(instances.size());
+			for (const Instance& instance : instances)
+			{
+				MeshView view;
+				if (instance.sourceLayout)
+				{
+					const VertexStreams& streams = scene.streams[instance.geometry];
+					view.streams = &streams;
+					view.vertexCount = streams.vertexCount;
+					view.indexCount = streams.indexCount;
+				}
+				else
+				{
+					const MeshData& data = scene.meshData[instance.geometry];
+					view.vertices = data.vertices.data();
+					view.vertexCount = data.vertices.size();
+					view.indices = data.indices.data();
+					view.indexCount = data.indices.size();
+					view.lodIndices = data.lodIndices.data();
+					view.lods = data.lods.data();
+					view.lodCount = data.lods.size();
+					view.meshlets = data.meshlets.data();
+					view.meshletCount = data.meshlets.size();
+				}
+				view.texturePaths = &scene.materialTextures[instance.material];
+				view.factors = &scene.materialFactors[instance.material];
+				view.transform = instance.transform;
+				scene.meshes.push_back(view);
+			}
+			return true;
+		}
+
+		bool walkNode(size_t nodeIndex, const glm::mat4& parentTransform, size_t depth)
+		{
+			const JsonValue& nodes = json["nodes"];
+			if (nodeIndex >= nodes.size() || depth > nodes.size())
+				return fail("invalid node hierarchy");
+
+			const JsonValue& node = nodes[nodeIndex];
+			glm::mat4 transform = parentTransform * nodeMatrix(node);
+
+			if (node.has("mesh"))
+			{
+				size_t meshIndex = node["mesh"].asSize();
+				const JsonValue& primitives = json["meshes"][meshIndex]["primitives"];
+				for (size_t p = 0; p < primitives.size(); p++)
+				{
+					// a mesh used by several nodes is only read once, every node gets its own view of it
+					auto key = std::make_pair(meshIndex, p);
+					auto loaded = loadedPrimitives.find(key);
+					if (loaded == loadedPrimitives.end())
+					{
+						std::pair<bool, size_t> geometry(false, SKIPPED);
+						if (!loadPrimitive(primitives[p], geometry))
+							geometry.second = SKIPPED;
+						loaded = loadedPrimitives.emplace(key, geometry).first;
+					}
+					if (loaded->second.second == SKIPPED)
+						continue;
+
+					size_t material = primitives[p]["material"].asSize(scene.materialFactors.size() - 1);
+					material = std::min(material, scene.materialFactors.size() - 1);
+					instances.push_back({ loaded->second.first, loaded->second.second, material, transform });
+				}
+			}
+
+			const JsonValue& children = node["children"];
+			for (size_t c = 0; c < children.size(); c++)
+			{
+				if (!walkNode(children[c].asSize(), transform, depth + 1))
+					return false;
+			}
+			return true;
+		}
+
+		//false skips the primitive (already reported), geometry receives (source layout, index into streams or meshData)
+		bool loadPrimitive(const JsonValue& primitive, std::pair<bool, size_t>& geometry)
+		{
+			const JsonValue& attributes = primitive["attributes"];
+			int mode = primitive["mode"].asInt(MODE_TRIANGLES);
+			if (mode != MODE_TRIANGLES && mode != MODE_TRIANGLE_STRIP && mode != MODE_TRIANGLE_FAN)
+			{
+				std::cout << "WARNING::GLTF:: " << path << ": skipping a point/line primitive" << std::endl;
+				return false;
+			}
+			if (!attributes.has("POSITION"))
+			{
+				std::cout << "WARNING::GLTF:: " << path << ": skipping a primitive without positions" << std::endl;
+				return false;
+			}
+
+			size_t materialIndex = std::min(primitive["material"].asSize(scene.materialFactors.size() - 1), scene.materialFactors.size() - 1);
+			std::string texCoordName = "TEXCOORD_" + std::to_string(materialTexCoordSets[materialIndex]);
+			if (!attributes.has(texCoordName.c_str()))
+				texCoordName = "TEXCOORD_0";
+
+			Accessor position, normal, texCoords, tangent, indices;
+			bool hasNormal = attributes.has("NORMAL");
+			bool hasTexCoords = attributes.has(texCoordName.c_str());
+			bool hasTangent = attributes.has("TANGENT");
+			bool hasIndices = primitive.has("indices");
+			if (!resolveAccessor(attributes["POSITION"].asSize(), position) ||
+				(hasNormal && !resolveAccessor(attributes["NORMAL"].asSize(), normal)) ||
+				(hasTexCoords && !resolveAccessor(attributes[texCoordName.c_str()].asSize(), texCoords)) ||
+				(hasTangent && !resolveAccessor(attributes["TANGENT"].asSize(), tangent)) ||
+				(hasIndices && !resolveAccessor(primitive["indices"].asSize(), indices)))
+				return false;
+
+			// the shader builds its TBN from the vertex tangent, so a normal mapped primitive without TANGENT is decoded to
+			// have one generated (the spec asks for MikkTSpace tangents in that case)
+			bool needsTangent = !scene.materialTextures[materialIndex].normal.empty();
+			if (!decodeAll && mode == MODE_TRIANGLES && hasNormal && hasIndices &&
+				canStream(position) && canStream(normal) && (!hasTexCoords || canStream(texCoords)) && (hasTangent ? canStream(tangent) : !needsTangent) &&
+				canStream(indices, std::max<size_t>(componentSize(indices.componentType), 1)) && indicesInRange(indices, position.count))
+			{
+				VertexStreams streams;
+				streams.position = toStream(position);
+				streams.normal = toStream(normal);
+				if (hasTexCoords)
+					streams.texCoords = toStream(texCoords);
+				if (hasTangent)
+					streams.tangent = toStream(tangent);
+				streams.vertexCount = position.count;
+				streams.indices = indices.data;
+				streams.indexCount = indices.count;
+				streams.indexType = indices.componentType;
+
+				std::vector<float> positions;
+				if (!readFloats(position, positions))
+					return false;
+				for (size_t i = 0; i < position.count; i++)
+				{
+					glm::vec3 p(positions[i * 3], positions[i * 3 + 1], positions[i * 3 + 2]);
+					streams.boundsMin = i == 0 ? p : glm::min(streams.boundsMin, p);
+					streams.boundsMax = i == 0 ? p : glm::max(streams.boundsMax, p);
+				}
+
+				geometry = std::make_pair(true, scene.streams.size());
+				scene.streams.push_back(streams);
+				return true;
+			}
+
+			MeshData data;
+			if (!decodePrimitive(mode, position, hasNormal ? &normal : nullptr, hasTexCoords ? &texCoords : nullptr,
+				hasTangent ? &tangent : nullptr, hasIndices ? &indices : nullptr, data))
+				return false;
+			data.texturePaths = scene.materialTextures[materialIndex];
+			MeshOptimizer::Optimize(data);
+
+			geometry = std::make_pair(false, scene.meshData.size());
+			scene.meshData.push_back(std::move(data));
+			return true;
+		}
+
+		//the GPU can fetch it as stored: backed by a buffer, not sparse, and on the 4 byte alignment glTF requires of
+		//vertex attributes (index data only needs its own component alignment)
+		static bool canStream(const Accessor& accessor, size_t alignment = 4)
+		{
+			return accessor.data != nullptr && accessor.sparse == nullptr && accessor.count > 0 && accessor.components <= 4 &&
+				reinterpret_cast<uintptr_t>(accessor.data) % alignment == 0 && accessor.stride % alignment == 0;
+		}
+
+		static VertexStream toStream(const Accessor& accessor)
+		{
+			VertexStream stream;
+			stream.data = accessor.data;
+			stream.byteLength = (accessor.count - 1) * accessor.stride + accessor.elementSize;
+			stream.stride = static_cast<GLsizei>(accessor.stride);
+			stream.components = accessor.components;
+			stream.componentType = accessor.componentType;
+			stream.normalized = accessor.normalized ? GL_TRUE : GL_FALSE;
+			return stream;
+		}
+
+		//an index past the vertex streams would read outside the GL buffer
+		static bool indicesInRange(const Accessor& indices, size_t vertexCount)
+		{
+			if (indices.componentType != GL_UNSIGNED_BYTE && indices.componentType != GL_UNSIGNED_SHORT && indices.componentType != GL_UNSIGNED_INT)
+				return false;
+			for (size_t i = 0; i < indices.count; i++)
+			{
+				if (readIndex(indices.data + i * indices.stride, indices.componentType) >= vertexCount)
+					return false;
+			}
+			return true;
+		}
+
+		bool decodePrimitive(int mode, const Accessor& position, const Accessor* normal, const Accessor* texCoords, const Accessor* tangent,
+			const Accessor* indices, MeshData& data)
+		{
+			std::vector<float> positions, normals, uvs, tangents;
+			if (!readFloats(position, positions) ||
+				(normal && !readFloats(*normal, normals)) ||
+				(texCoords && !readFloats(*texCoords, uvs)) ||
+				(tangent && !readFloats(*tangent, tangents)))
+				return false;
+
+			std::vector<unsigned int> elements;
+			if (indices != nullptr)
+			{
+				// read as integers, 32 bit indices don't survive a round trip through float
+				if (indices->data == nullptr || indices->sparse != nullptr)
+					return fail("sparse or empty index accessors are not supported");
+				elements.reserve(indices->count);
+				for (size_t i = 0; i < indices->count; i++)
+				{
+					uint32_t index = readIndex(indices->data + i * indices->stride, indices->componentType);
+					if (index >= position.count)
+						return fail("index out of range");
+					elements.push_back(index);
+				}
+			}
+			else
+			{
+				for (size_t i = 0; i < position.count; i++)
+					elements.push_back(static_cast<unsigned int>(i));
+			}
+
+			// strips and fans to a plain list
+			std::vector<unsigned int>& triangles = data.indices;
+			if (mode == MODE_TRIANGLES)
+			{
+				triangles.assign(elements.begin(), elements.begin() + elements.size() / 3 * 3);
+			}
+			else
+			{
+				for (size_t i = 2; i < elements.size(); i++)
+				{
+					if (mode == MODE_TRIANGLE_STRIP)
+						triangles.insert(triangles.end(), { elements[i - 2 + (i % 2)], elements[i - 1 - (i % 2)], elements[i] });
+					else
+						triangles.insert(triangles.end(), { elements[i - 1], elements[i], elements[0] });
+				}
+			}
+
+			data.vertices.resize(position.count);
+			for (size_t i = 0; i < position.count; i++)
+			{
+				Vertex& vertex = data.vertices[i];
+				vertex.Position = glm::vec3(positions[i * 3], positions[i * 3 + 1], positions[i * 3 + 2]);
+				vertex.Normal = normal ? glm::vec3(normals[i * 3], normals[i * 3 + 1], normals[i * 3 + 2]) : glm::vec3(0.0f);
+				vertex.TexCoords = texCoords ? glm::vec2(uvs[i * 2], uvs[i * 2 + 1]) : glm::vec2(0.0f);
+				vertex.Tangent = tangent ? glm::vec4(tangents[i * 4], tangents[i * 4 + 1], tangents[i * 4 + 2], tangents[i * 4 + 3] < 0.0f ? -1.0f : 1.0f) : glm::vec4(0.0f);
+			}
+
+			// glTF asks for flat normals when there are none, which needs a vertex per corner
+			if (!normal)
+			{
+				std::vector<Vertex> corners;
+				corners.reserve(triangles.size());
+				for (size_t t = 0; t + 2 < triangles.size(); t += 3)
+				{
+					Vertex a = data.vertices[triangles[t]], b = data.vertices[triangles[t + 1]], c = data.vertices[triangles[t + 2]];
+					glm::vec3 faceNormal = glm::cross(b.Position - a.Position, c.Position - a.Position);
+					float length = glm::length(faceNormal);
+					faceNormal = length > 0.0f ? faceNormal / length : glm::vec3(0.0f, 1.0f, 0.0f);
+					a.Normal = b.Normal = c.Normal = faceNormal;
+					corners.insert(corners.end(), { a, b, c });
+				}
+				data.vertices.swap(corners);
+				for (size_t i = 0; i < triangles.size(); i++)
+					triangles[i] = static_cast<unsigned int>(i);
+			}
+
+			if (!tangent)
+				TangentSpace::Generate(data);
+			return true;
+		}
+	};
+}
+
+namespace GltfLoader
+{
+	bool IsGltfPath(const std::string& path)
+	{
+		size_t dot = path.find_last_of('.');
+		if (dot == std::string::npos)
+			return false;
+		std::string extension = path.substr(dot + 1);
+		std::transform(extension.begin(), extension.end(), extension.begin(), [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+		return extension == "gltf" || extension == "glb";
+	}
+
+	bool Load(const std::string& path, bool decodeAll, GltfScene& scene)
+	{
+		scene = GltfScene();
+		GltfImporter importer(path, decodeAll, scene);
+		return importer.run();
+	}
+
+	void ListExternalBuffers(const std::string& path, std::vector<std::string>& buffers)
+	{
+		GltfScene scene;
+		GltfImporter importer(path, false, scene);
+		importer.listExternalBuffers(buffers);
+	}
+}
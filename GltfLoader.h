@@ -0,0 +1,38 @@
+#pragma once
+#include "Mesh.h"
+#include "MappedFile.h"
+#include <string>
+#include <vector>
+
+//Result of a native glTF import. Owns the mapped files the stream views point into, so it has to stay alive until
+//every mesh has been uploaded
+struct GltfScene
+{
+	std::vector<MappedFile> files;							// the .glb itself or the external .bin buffers
+	std::vector<std::vector<unsigned char>> embeddedBuffers;	// base64 data: URIs
+	std::vector<VertexStreams> streams;						// primitives uploaded in their source layout
+	std::vector<MeshData> meshData;							// primitives that had to be decoded into Vertex
+	std::vector<MaterialTexturePaths> materialTextures;		// one per material plus the default material at the end
+	std::vector<MaterialFactors> materialFactors;
+	std::vector<MeshView> meshes;							// one per primitive per node referencing it, in scene order
+};
+
+//Native glTF 2.0 / GLB import, used by Model instead of Assimp for .gltf and .glb files. Buffers are memory mapped
+//and accessors the vertex shader can read as stored (float, or the normalized/integer types of KHR_mesh_quantization)
+//are handed to Mesh as VertexStreams, so their bytes go from the page cache to the GPU without any conversion.
+//Node transforms, the metallic-roughness factors and KHR_texture_transform are kept per mesh and applied when drawing.
+namespace GltfLoader
+{
+	//.gltf or .glb, case insensitive
+	bool IsGltfPath(const std::string& path);
+
+	//Parses the asset and walks its default scene. Primitives the GPU can't read directly (no indices, no normals,
+	//strips/fans, sparse accessors, normal mapped without tangents) are decoded into MeshData, optimised and given levels
+	//of detail (MeshSimplifier), as is every primitive with decodeAll, which vertex formats that repack the vertices need.
+//Those imports are slow enough that Model keeps them in the MeshCache.
+	//Returns false for anything it can't load, the caller then falls back to Assimp.
+	bool Load(const std::string& path, bool decodeAll, GltfScene& scene);
+
+	//Paths of the external buffers path references, for keying caches of its import. Images aren't included
+	void ListExternalBuffers(const std::string& path, std::vector<std::string>& buffers);
+}
@@ -0,0 +1,18 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace HashUtils
+{
+	//XXH64 - fast non-cryptographic hash, used to key the on-disk caches by file content
+	uint64_t XXHash64(const void* data, size_t length, uint64_t seed = 0);
+
+	//Hashes the full contents of a file through a read-only mapping, returns false if the file can't be opened
+	bool HashFile(const std::string& path, uint64_t& outHash, uint64_t seed = 0);
+
+	inline uint64_t HashCombine(uint64_t seed, uint64_t value)
+	{
+		return seed ^ (value + 0x9E3779B97F4A7C15ull + (seed << 6) + (seed >> 2));
+	}
+}
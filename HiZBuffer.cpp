@@ -0,0 +1,98 @@
+#include "HiZBuffer.h"
+#include <algorithm>
+#include <cstdio>
+
+namespace
+{
+	const GLuint GROUP_SIZE = 8;	// local_size_x/y of hiZDownsample.cs.txt
+}
+
+HiZBuffer::HiZBuffer()
+{
+	if (!GLAD_GL_VERSION_4_3)
+		return;
+
+	downsampleShader = std::make_unique<Shader>("ShaderFiles\\hiZDownsample.cs.txt");
+	GLint linked = GL_FALSE;
+	if (glIsProgram(downsampleShader->ID))
+		glGetProgramiv(downsampleShader->ID, GL_LINK_STATUS, &linked);
+	if (linked != GL_TRUE)
+	{
+		std::printf("HiZBuffer: downsampler unavailable, occlusion culling is off\n");
+		downsampleShader.reset();
+	}
+}
+
+HiZBuffer::~HiZBuffer()
+{
+	glDeleteTextures(1, &texture);
+}
+
+void HiZBuffer::allocate(int width, int height)
+{
+	glDeleteTextures(1, &texture);
+	depthWidth = width;
+	depthHeight = height;
+
+	int baseWidth = std::max(1, width / 2);
+	int baseHeight = std::max(1, height / 2);
+	levelCount = 1;
+	for (int size = std::max(baseWidth, baseHeight); size > 1; size /= 2)
+		levelCount++;
+
+	glCreateTextures(GL_TEXTURE_2D, 1, &texture);
+	glTextureStorage2D(texture, levelCount, GL_R32F, baseWidth, baseHeight);
+	glTextureParameteri(texture, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+	glTextureParameteri(texture, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTextureParameteri(texture, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTextureParameteri(texture, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+}
+
+void HiZBuffer::build()
+{
+	if (!downsampleShader || depthSource == 0)
+		return;
+	const GLuint depthTexture = depthSource;
+
+	// the size comes from the texture itself, whoever owns it may have reallocated it
+	GLint width = 0, height = 0;
+	glGetTextureLevelParameteriv(depthTexture, 0, GL_TEXTURE_WIDTH, &width);
+	glGetTextureLevelParameteriv(depthTexture, 0, GL_TEXTURE_HEIGHT, &height);
+	if (width <= 0 || height <= 0)
+		return;
+	if (width != depthWidth || height != depthHeight)
+		allocate(width, height);
+
+	GLint previousProgram = 0;
+	glGetIntegerv(GL_CURRENT_PROGRAM, &previousProgram);
+	downsampleShader->use();
+	downsampleShader->setInt("source", static_cast<int>(TextureUnit::HiZ));
+	glActiveTexture(GL_TEXTURE0 + static_cast<GLenum>(TextureUnit::HiZ));
+
+	// the depth of the frame so far has to land before it's read as a texture
+	glMemoryBarrier(GL_FRAMEBUFFER_BARRIER_BIT | GL_TEXTURE_FETCH_BARRIER_BIT);
+
+	int sourceWidth = width, sourceHeight = height;
+	for (int level = 0; level < levelCount; level++)
+	{
+		int destinationWidth = std::max(1, sourceWidth / 2);
+		int destinationHeight = std::max(1, sourceHeight / 2);
+
+		glBindTexture(GL_TEXTURE_2D, level == 0 ? depthTexture : texture);
+		downsampleShader->setInt("sourceLevel", level == 0 ? 0 : level - 1);
+		glUniform2i(downsampleShader->getUniformLocation("sourceSize"), sourceWidth, sourceHeight);
+		glUniform2i(downsampleShader->getUniformLocation("destinationSize"), destinationWidth, destinationHeight);
+		glBindImageTexture(0, texture, level, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32F);
+		glDispatchCompute((destinationWidth + GROUP_SIZE - 1) / GROUP_SIZE, (destinationHeight + GROUP_SIZE - 1) / GROUP_SIZE, 1);
+
+		// the next level reads this one
+		glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT | GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+		sourceWidth = destinationWidth;
+		sourceHeight = destinationHeight;
+	}
+
+	glBindImageTexture(0, 0, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32F);
+	glBindTexture(GL_TEXTURE_2D, 0);
+	glActiveTexture(GL_TEXTURE0);
+	glUseProgram(previousProgram);
+}
@@ -0,0 +1,37 @@
+#pragma once
+#include "Shader.h"
+#include <memory>
+
+//Hierarchical Z pyramid of a depth texture for occlusion culling: R32F, level 0 at half the depth's size, every texel
+//holding the farthest depth below it. Built with a compute downsampler (hiZDownsample.cs.txt), one dispatch per level.
+//GL thread only
+class HiZBuffer
+{
+public:
+	HiZBuffer();
+	~HiZBuffer();
+
+	HiZBuffer(const HiZBuffer&) = delete;
+	HiZBuffer& operator=(const HiZBuffer&) = delete;
+
+	//False when the downsampler didn't compile (no compute shaders), build() then does nothing
+	bool isSupported() const { return downsampleShader != nullptr; }
+
+	//Depth texture the pyramid is built from, e.g. SuperSamplingRenderer::getDepthTexture()
+	void setDepthSource(GLuint depthTexture) { depthSource = depthTexture; }
+	//Rebuilds every level from the depth source as it is now, reallocating the pyramid if the depth's size changed
+	void build();
+
+	GLuint getTexture() const { return texture; }
+	int getLevelCount() const { return levelCount; }
+
+private:
+	std::unique_ptr<Shader> downsampleShader;
+	GLuint depthSource = 0;
+	GLuint texture = 0;
+	int depthWidth = 0;
+	int depthHeight = 0;
+	int levelCount = 0;
+
+	void allocate(int width, int height);
+};
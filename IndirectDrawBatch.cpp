@@ -0,0 +1,707 @@
+#include "IndirectDrawBatch.h"
+#include "HashUtils.h"
+#include "HiZBuffer.h"
+#include "PotentiallyVisibleSet.h"
+#include <algorithm>
+#include <cfloat>
+#include <cstdio>
+#include <cstring>
+#include <tuple>
+#include <unordered_map>
+
+namespace
+{
+	// SSBO binding points of DrawDataBuffer and MaterialDataBuffer in the PBR shaders
+	const GLuint DRAW_DATA_BINDING = 0;
+	const GLuint MATERIAL_DATA_BINDING = 1;
+	// and of the culling pass, DrawIndexBuffer is read by the PBR vertex shader too
+	const GLuint DRAW_INDEX_BINDING = 2;
+	const GLuint CULL_DATA_BINDING = 3;
+	const GLuint SOURCE_COMMAND_BINDING = 4;
+	const GLuint COMMAND_BINDING = 5;
+	const GLuint DRAW_COUNT_BINDING = 6;
+	const GLuint VISIBILITY_BINDING = 7;
+	const GLuint OCCLUSION_STATS_BINDING = 8;
+	const GLuint PVS_BINDING = 9;
+	// the meshlet pass, its commands, draw indices and counts go to the same bindings as the draws'
+	const GLuint EXPAND_BINDING = 10;
+	const GLuint MESHLET_DATA_BINDING = 11;
+	const GLuint MESHLET_STATS_BINDING = 12;
+	const size_t OCCLUSION_STATS_COUNT = 5;
+	const size_t MESHLET_STATS_COUNT = 4;
+	const size_t STATS_COUNT = OCCLUSION_STATS_COUNT + MESHLET_STATS_COUNT;
+	const GLuint CULL_GROUP_SIZE = 64;	// local_size_x of frustumCull.cs.txt and meshletCull.cs.txt
+
+	struct PendingDraw
+	{
+		const Model* model;
+		const Mesh* mesh;
+		DrawElementsIndirectCommand command;
+		IndirectDrawData data;
+	};
+
+	// order that puts meshes which can share a multi-draw next to each other
+	auto drawKey(const PendingDraw& draw)
+	{
+		const Mesh& mesh = *draw.mesh;
+		return std::tie(mesh.getGeometry()->VAO, mesh.getGeometry()->indexType, mesh.albedoMapIDs, mesh.normalMapIDs, mesh.roughnessMetallicMapIDs, mesh.aoMapIDs);
+	}
+
+	bool sameMaterialMaps(const Mesh& a, const Mesh& b)
+	{
+		return a.albedoMapIDs == b.albedoMapIDs && a.normalMapIDs == b.normalMapIDs &&
+			a.roughnessMetallicMapIDs == b.roughnessMetallicMapIDs && a.aoMapIDs == b.aoMapIDs;
+	}
+
+	// count and first index of the level of detail the mesh has selected
+	void setLodRange(const Mesh& mesh, DrawElementsIndirectCommand& command)
+	{
+		const MeshGeometry& geometry = *mesh.getGeometry();
+		const MeshLod& level = geometry.lods[mesh.getLod()];
+		size_t indexSize = geometry.indexType == GL_UNSIGNED_SHORT ? sizeof(uint16_t) : sizeof(uint32_t);
+		command.count = static_cast<GLuint>(level.indexCount);
+		command.firstIndex = static_cast<GLuint>(geometry.allocation.indexOffset / indexSize) + level.firstIndex;
+	}
+
+	// a mesh's meshlets in world space. the sphere grows with the largest axis scale, and a cone can't be carried
+	// through a non-uniform scale so it's left wide open
+	void appendMeshlets(const MeshGeometry& geometry, const IndirectDrawData& data, uint32_t draw, uint32_t outputBase, uint32_t run,
+		std::vector<IndirectMeshletData>& meshlets)
+	{
+		glm::mat3 linear(data.model);
+		glm::vec3 scales(glm::length(linear[0]), glm::length(linear[1]), glm::length(linear[2]));
+		float maxScale = std::max(scales.x, std::max(scales.y, scales.z));
+		float minScale = std::min(scales.x, std::min(scales.y, scales.z));
+		bool uniform = maxScale - minScale <= maxScale * 1e-3f;
+		size_t indexSize = geometry.indexType == GL_UNSIGNED_SHORT ? sizeof(uint16_t) : sizeof(uint32_t);
+		GLuint firstIndex = static_cast<GLuint>(geometry.allocation.indexOffset / indexSize);
+		for (const Meshlet& meshlet : geometry.meshlets)
+		{
+			IndirectMeshletData entry = {};
+			entry.sphere = glm::vec4(glm::vec3(data.model * glm::vec4(meshlet.center, 1.0f)), meshlet.radius * maxScale);
+			glm::vec3 axis = glm::mat3(data.normalMatrix) * meshlet.coneAxis;
+			float axisLength = glm::length(axis);
+			bool cone = uniform && axisLength > 0.0f;
+			entry.cone = glm::vec4(cone ? axis / axisLength : meshlet.coneAxis, cone ? meshlet.coneCutoff : 1.0f);
+			entry.firstIndex = firstIndex + meshlet.firstIndex;
+			entry.count = meshlet.triangleCount * 3;
+			entry.baseVertex = static_cast<int32_t>(geometry.allocation.baseVertex);
+			entry.draw = draw;
+			entry.outputBase = outputBase;
+			entry.run = run;
+			meshlets.push_back(entry);
+		}
+	}
+
+	void uploadBuffer(GLuint buffer, const void* data, size_t size)
+	{
+		// an empty store still has to be a valid binding
+		glNamedBufferData(buffer, static_cast<GLsizeiptr>(std::max<size_t>(size, 16)), nullptr, GL_STATIC_DRAW);
+		if (size > 0)
+			glNamedBufferSubData(buffer, 0, static_cast<GLsizeiptr>(size), data);
+	}
+
+	// world space AABB of a local space box under a transform, from its 8 corners
+	void transformBounds(const glm::mat4& transform, const glm::vec3& localMin, const glm::vec3& localMax, glm::vec3& outMin, glm::vec3& outMax)
+	{
+		outMin = glm::vec3(FLT_MAX);
+		outMax = glm::vec3(-FLT_MAX);
+		for (int corner = 0; corner < 8; corner++)
+		{
+			glm::vec3 local((corner & 1) ? localMax.x : localMin.x, (corner & 2) ? localMax.y : localMin.y, (corner & 4) ? localMax.z : localMin.z);
+			glm::vec3 world = glm::vec3(transform * glm::vec4(local, 1.0f));
+			outMin = glm::min(outMin, world);
+			outMax = glm::max(outMax, world);
+		}
+	}
+
+	// same test as frustumCull.cs.txt
+	bool insideFrustum(const glm::mat4& viewProjection, const IndirectCullData& cull)
+	{
+		glm::mat4 m = glm::transpose(viewProjection);
+		const glm::vec4 planes[6] = { m[3] + m[0], m[3] - m[0], m[3] + m[1], m[3] - m[1], m[3] + m[2], m[3] - m[2] };
+		for (const glm::vec4& plane : planes)
+		{
+			float radius = glm::dot(glm::vec3(cull.extents), glm::abs(glm::vec3(plane)));
+			if (glm::dot(glm::vec3(plane), glm::vec3(cull.center)) + plane.w < -radius)
+				return false;
+		}
+		return true;
+	}
+
+	const char* cullingModeName(GpuCullingMode mode)
+	{
+		switch (mode)
+		{
+		case GpuCullingMode::Compact: return "compacted, glMultiDrawElementsIndirectCount";
+		case GpuCullingMode::ZeroInstances: return "zeroed instance counts, glMultiDrawElementsIndirect";
+		default: return "off";
+		}
+	}
+}
+
+IndirectDrawBatch::IndirectDrawBatch()
+{
+	glCreateBuffers(1, &sourceCommandBuffer);
+	glCreateBuffers(1, &commandBuffer);
+	glCreateBuffers(1, &drawIndexBuffer);
+	glCreateBuffers(1, &drawCountBuffer);
+	glCreateBuffers(1, &cullDataBuffer);
+	glCreateBuffers(1, &visibilityBuffer);
+	glCreateBuffers(1, &occlusionStatsBuffer);
+	glCreateBuffers(1, &pvsBuffer);
+	glCreateBuffers(1, &expandBuffer);
+	glCreateBuffers(1, &meshletDataBuffer);
+	glCreateBuffers(1, &meshletCommandBuffer);
+	glCreateBuffers(1, &meshletDrawIndexBuffer);
+	glCreateBuffers(1, &meshletCountBuffer);
+	glCreateBuffers(1, &meshletStatsBuffer);
+	glCreateBuffers(1, &drawDataBuffer);
+	glCreateBuffers(1, &materialBuffer);
+	glNamedBufferData(occlusionStatsBuffer, OCCLUSION_STATS_COUNT * sizeof(uint32_t), nullptr, GL_DYNAMIC_COPY);
+	glNamedBufferData(meshletStatsBuffer, MESHLET_STATS_COUNT * sizeof(uint32_t), nullptr, GL_DYNAMIC_COPY);
+	glCreateBuffers(STATS_READBACK_FRAMES, statsReadbackBuffers);
+	for (GLuint buffer : statsReadbackBuffers)
+		glNamedBufferData(buffer, STATS_COUNT * sizeof(uint32_t), nullptr, GL_STREAM_READ);
+
+	// compute shaders are core in 4.3, the draw count parameter in 4.6 (ARB_indirect_parameters before that)
+	if (GLAD_GL_VERSION_4_3)
+	{
+		cullShader = std::make_unique<Shader>("ShaderFiles\\frustumCull.cs.txt");
+		GLint linked = GL_FALSE;
+		if (glIsProgram(cullShader->ID))
+			glGetProgramiv(cullShader->ID, GL_LINK_STATUS, &linked);
+		if (linked == GL_TRUE)
+			cullingMode = (GLAD_GL_VERSION_4_6 && glMultiDrawElementsIndirectCount != nullptr) ? GpuCullingMode::Compact : GpuCullingMode::ZeroInstances;
+		else
+			cullShader.reset();
+	}
+	if (cullShader)
+	{
+		meshletCullShader = std::make_unique<Shader>("ShaderFiles\\meshletCull.cs.txt");
+		GLint linked = GL_FALSE;
+		if (glIsProgram(meshletCullShader->ID))
+			glGetProgramiv(meshletCullShader->ID, GL_LINK_STATUS, &linked);
+		if (linked != GL_TRUE)
+			meshletCullShader.reset();
+	}
+	meshletCulling = meshletCullShader != nullptr;
+	std::printf("IndirectDrawBatch: GPU frustum culling %s, meshlet culling %s\n", cullingModeName(cullingMode), meshletCullShader ? "on" : "unavailable");
+}
+
+IndirectDrawBatch::~IndirectDrawBatch()
+{
+	glDeleteBuffers(1, &sourceCommandBuffer);
+	glDeleteBuffers(1, &commandBuffer);
+	glDeleteBuffers(1, &drawIndexBuffer);
+	glDeleteBuffers(1, &drawCountBuffer);
+	glDeleteBuffers(1, &cullDataBuffer);
+	glDeleteBuffers(1, &visibilityBuffer);
+	glDeleteBuffers(1, &occlusionStatsBuffer);
+	glDeleteBuffers(1, &pvsBuffer);
+	glDeleteBuffers(1, &expandBuffer);
+	glDeleteBuffers(1, &meshletDataBuffer);
+	glDeleteBuffers(1, &meshletCommandBuffer);
+	glDeleteBuffers(1, &meshletDrawIndexBuffer);
+	glDeleteBuffers(1, &meshletCountBuffer);
+	glDeleteBuffers(1, &meshletStatsBuffer);
+	glDeleteBuffers(1, &drawDataBuffer);
+	glDeleteBuffers(1, &materialBuffer);
+	glDeleteBuffers(STATS_READBACK_FRAMES, statsReadbackBuffers);
+	for (GLsync fence : statsFences)
+	{
+		if (fence)
+			glDeleteSync(fence);
+	}
+}
+
+void IndirectDrawBatch::update(const std::vector<Model*>& models)
+{
+	bool changed = models.size() != builtModels.size();
+	for (size_t i = 0; i < models.size() && !changed; i++)
+	{
+		const Model& model = *models[i];
+		size_t meshCount = model.isLoading() ? 0 : model.meshes.size();
+		changed = builtModels[i] != &model || builtMeshCounts[i] != meshCount || builtMatrices[i] != model.modelMatrix;
+	}
+	if (changed)
+		rebuild(models);
+	updateLods();
+}
+
+void IndirectDrawBatch::updateLods()
+{
+	bool changed = false;
+	for (size_t i = 0; i < commandCount; i++)
+	{
+		const Mesh& mesh = drawMeshes[i].first->meshes[drawMeshes[i].second];
+		if (mesh.getLod() == drawLods[i])
+			continue;
+		drawLods[i] = mesh.getLod();
+		setLodRange(mesh, sourceCommands[i]);
+		changed = true;
+	}
+	if (!changed)
+		return;
+	updateMeshletCounts();
+
+	// the culling pass copies the commands every frame, without it they're drawn straight from both slices
+	glNamedBufferSubData(sourceCommandBuffer, 0, static_cast<GLsizeiptr>(commandCount * sizeof(DrawElementsIndirectCommand)), sourceCommands.data());
+	if (cullingMode == GpuCullingMode::None)
+	{
+		glNamedBufferSubData(commandBuffer, 0, static_cast<GLsizeiptr>(commandCount * sizeof(DrawElementsIndirectCommand)), sourceCommands.data());
+		glNamedBufferSubData(commandBuffer, static_cast<GLintptr>(commandCount * sizeof(DrawElementsIndirectCommand)),
+			static_cast<GLsizeiptr>(commandCount * sizeof(DrawElementsIndirectCommand)), sourceCommands.data());
+	}
+}
+
+void IndirectDrawBatch::updateMeshletCounts()
+{
+	// meshlets cover the full detail indices only, a reduced level is drawn whole
+	bool changed = false;
+	for (size_t i = 0; i < commandCount; i++)
+	{
+		const MeshGeometry& geometry = *drawMeshes[i].first->meshes[drawMeshes[i].second].getGeometry();
+		uint32_t meshletCount = meshletCulling && drawLods[i] == 0 ? static_cast<uint32_t>(geometry.meshlets.size()) : 0;
+		changed |= cullData[i].meshletCount != meshletCount;
+		cullData[i].meshletCount = meshletCount;
+	}
+	if (changed)
+		glNamedBufferSubData(cullDataBuffer, 0, static_cast<GLsizeiptr>(cullData.size() * sizeof(IndirectCullData)), cullData.data());
+}
+
+void IndirectDrawBatch::setMeshletCulling(bool enabled)
+{
+	enabled = enabled && meshletCullShader != nullptr;
+	if (enabled == meshletCulling)
+		return;
+	meshletCulling = enabled;
+	updateMeshletCounts();
+}
+
+void IndirectDrawBatch::rebuild(const std::vector<Model*>& models)
+{
+	builtModels.assign(models.begin(), models.end());
+	builtMatrices.clear();
+	builtMeshCounts.clear();
+	unbatched.clear();
+	runs.clear();
+
+	std::vector<PendingDraw> draws;
+	std::vector<IndirectMaterialData> materials;
+	std::unordered_map<uint64_t, uint32_t> materialIndices;
+	for (const Model* model : models)
+	{
+		builtMatrices.push_back(model->modelMatrix);
+		builtMeshCounts.push_back(model->isLoading() ? 0 : model->meshes.size());
+		if (model->isLoading())
+			continue;
+
+		for (const Mesh& mesh : model->meshes)
+		{
+			const MeshGeometry& geometry = *mesh.getGeometry();
+			if (!geometry.allocation.inArena)
+			{
+				unbatched.push_back({ model, &mesh });
+				continue;
+			}
+
+			// meshes with the same constants share a material entry
+			IndirectMaterialData material = {};
+			material.baseColorFactor = mesh.factors.baseColor;
+			material.uvTransform = glm::mat4(mesh.factors.uvTransform);
+			material.metallicRoughnessFactor = glm::vec4(mesh.factors.metallic, mesh.factors.roughness, 0.0f, 0.0f);
+			uint64_t materialHash = HashUtils::XXHash64(&material, sizeof(material));
+			auto found = materialIndices.find(materialHash);
+			if (found == materialIndices.end() || std::memcmp(&materials[found->second], &material, sizeof(material)) != 0)
+			{
+				found = materialIndices.insert_or_assign(materialHash, static_cast<uint32_t>(materials.size())).first;
+				materials.push_back(material);
+			}
+
+			// the normal matrix is worked out once here instead of per draw per frame
+			glm::mat4 drawModel = model->modelMatrix * mesh.localTransform;
+			PendingDraw draw = {};
+			draw.model = model;
+			draw.mesh = &mesh;
+			draw.data.model = drawModel;
+			draw.data.normalMatrix = glm::mat4(glm::transpose(glm::inverse(glm::mat3(drawModel))));
+			draw.data.positionOffset = glm::vec4(geometry.positionOffset, 0.0f);
+			draw.data.positionScale = glm::vec4(geometry.positionScale, 0.0f);
+			draw.data.materialIndex = found->second;
+			draw.data.packedVertex = geometry.vertexFormat == VertexFormat::Packed ? 1 : 0;
+
+			setLodRange(mesh, draw.command);
+			draw.command.instanceCount = 1;
+			draw.command.baseVertex = static_cast<GLint>(geometry.allocation.baseVertex);
+			draw.command.baseInstance = 0;
+			draws.push_back(draw);
+		}
+	}
+
+	std::stable_sort(draws.begin(), draws.end(), [](const PendingDraw& a, const PendingDraw& b) { return drawKey(a) < drawKey(b); });
+
+	std::vector<DrawElementsIndirectCommand> commands(draws.size());
+	std::vector<IndirectDrawData> drawData(draws.size());
+	std::vector<uint32_t> drawIndices(draws.size() * 2);
+	std::vector<IndirectMeshletData> meshlets;
+	cullData.assign(draws.size(), IndirectCullData{});
+	drawMeshes.resize(draws.size());
+	drawLods.resize(draws.size());
+	for (size_t i = 0; i < draws.size(); i++)
+	{
+		commands[i] = draws[i].command;
+		drawLods[i] = draws[i].mesh->getLod();
+		drawData[i] = draws[i].data;
+		drawIndices[i] = static_cast<uint32_t>(i);
+		drawIndices[draws.size() + i] = static_cast<uint32_t>(i);
+		drawMeshes[i] = { draws[i].model, static_cast<uint32_t>(draws[i].mesh - draws[i].model->meshes.data()) };
+
+		const Mesh& mesh = *draws[i].mesh;
+		const MeshGeometry& geometry = *mesh.getGeometry();
+		if (runs.empty() || runs.back().vertexArray != geometry.VAO || runs.back().indexType != geometry.indexType ||
+			!sameMaterialMaps(*runs.back().materialSource, mesh))
+		{
+			runs.push_back({ geometry.VAO, geometry.indexType, &mesh, i, 0, meshlets.size(), 0 });
+		}
+		runs.back().commandCount++;
+		if (meshletCullShader)
+		{
+			appendMeshlets(geometry, draws[i].data, static_cast<uint32_t>(i), static_cast<uint32_t>(runs.back().firstMeshlet),
+				static_cast<uint32_t>(runs.size() - 1), meshlets);
+			runs.back().meshletCount = meshlets.size() - runs.back().firstMeshlet;
+		}
+
+		glm::vec3 worldMin, worldMax;
+		transformBounds(draws[i].data.model, geometry.boundsMin, geometry.boundsMax, worldMin, worldMax);
+		cullData[i].center = glm::vec4((worldMin + worldMax) * 0.5f, 0.0f);
+		cullData[i].extents = glm::vec4((worldMax - worldMin) * 0.5f, 0.0f);
+		cullData[i].outputBase = static_cast<uint32_t>(runs.back().firstCommand);
+		cullData[i].run = static_cast<uint32_t>(runs.size() - 1);
+		cullData[i].meshletCount = meshletCulling && drawLods[i] == 0 ? static_cast<uint32_t>(geometry.meshlets.size()) : 0;
+	}
+	commandCount = commands.size();
+	sourceCommands = commands;
+	meshletTotal = meshlets.size();
+
+	// without culling the commands are drawn as built, and drawIndices stays the identity. the outputs have a second
+	// slice for the second occlusion phase, which is drawn while the first one's commands may still be read
+	std::vector<DrawElementsIndirectCommand> outputCommands(commands);
+	outputCommands.insert(outputCommands.end(), commands.begin(), commands.end());
+	uploadBuffer(sourceCommandBuffer, commands.data(), commands.size() * sizeof(DrawElementsIndirectCommand));
+	uploadBuffer(commandBuffer, outputCommands.data(), outputCommands.size() * sizeof(DrawElementsIndirectCommand));
+	uploadBuffer(drawIndexBuffer, drawIndices.data(), drawIndices.size() * sizeof(uint32_t));
+	uploadBuffer(cullDataBuffer, cullData.data(), cullData.size() * sizeof(IndirectCullData));
+	glNamedBufferData(drawCountBuffer, static_cast<GLsizeiptr>(std::max<size_t>(runs.size() * 2, 4) * sizeof(uint32_t)), nullptr, GL_DYNAMIC_DRAW);
+	// everything counts as visible last frame, so a rebuild doesn't pop
+	std::vector<uint32_t> visibility(commandCount, 1);
+	uploadBuffer(visibilityBuffer, visibility.data(), visibility.size() * sizeof(uint32_t));
+	pvsMask.assign((commandCount + 31) / 32, ~0u);
+	uploadBuffer(pvsBuffer, pvsMask.data(), pvsMask.size() * sizeof(uint32_t));
+	pvsMaskValid = false;
+	uploadBuffer(drawDataBuffer, drawData.data(), drawData.size() * sizeof(IndirectDrawData));
+	uploadBuffer(materialBuffer, materials.data(), materials.size() * sizeof(IndirectMaterialData));
+
+	// the meshlet outputs are only ever written by the meshlet pass, sized like the draws' with two slices
+	uploadBuffer(meshletDataBuffer, meshlets.data(), meshlets.size() * sizeof(IndirectMeshletData));
+	glNamedBufferData(expandBuffer, static_cast<GLsizeiptr>(std::max<size_t>(commandCount * 2, 4) * sizeof(uint32_t)), nullptr, GL_DYNAMIC_COPY);
+	glNamedBufferData(meshletCommandBuffer, static_cast<GLsizeiptr>(std::max<size_t>(meshletTotal * 2, 1) * sizeof(DrawElementsIndirectCommand)), nullptr, GL_DYNAMIC_COPY);
+	glNamedBufferData(meshletDrawIndexBuffer, static_cast<GLsizeiptr>(std::max<size_t>(meshletTotal * 2, 4) * sizeof(uint32_t)), nullptr, GL_DYNAMIC_COPY);
+	glNamedBufferData(meshletCountBuffer, static_cast<GLsizeiptr>(std::max<size_t>(runs.size() * 2, 4) * sizeof(uint32_t)), nullptr, GL_DYNAMIC_DRAW);
+
+	std::printf("IndirectDrawBatch: %zu meshes in %zu multi-draws, %zu materials, %zu meshes drawn one by one, %zu meshlets\n",
+		commandCount, runs.size(), materials.size(), unbatched.size(), meshletTotal);
+}
+
+size_t IndirectDrawBatch::draw(const Shader& shader, const IBLTextures& iblTextures, const std::vector<Model*>& models, HiZBuffer* occlusion) const
+{
+	size_t drawCalls = 0;
+
+	// the per-mesh path for whatever isn't in the commands
+	const Model* uniformsFor = nullptr;
+	GLuint boundVertexArray = 0;
+	auto setModelUniforms = [&](const Model* model)
+		{
+			if (uniformsFor == model)
+				return;
+			shader.setMat4("model", model->modelMatrix);
+			shader.setMat3("normalMatrix", glm::transpose(glm::inverse(glm::mat3(model->modelMatrix))));
+			uniformsFor = model;
+		};
+	for (const Model* model : models)
+	{
+		if (model->isLoading())
+		{
+			setModelUniforms(model);
+			drawCalls += model->DrawPBR(shader, iblTextures);
+		}
+	}
+	for (const UnbatchedMesh& entry : unbatched)
+	{
+		setModelUniforms(entry.model);
+		entry.mesh->DrawPBR(shader, iblTextures, boundVertexArray);
+		drawCalls++;
+	}
+
+	lastDrawOccluded = false;
+	if (!runs.empty())
+	{
+		if (cullingMode == GpuCullingMode::None)
+		{
+			drawCalls += drawRuns(shader, iblTextures, 0, boundVertexArray);
+		}
+		else if (occlusion == nullptr || !occlusion->isSupported())
+		{
+			cull(shader.uboCamera, 0, nullptr);
+			glUseProgram(shader.ID);
+			drawCalls += drawRuns(shader, iblTextures, 0, boundVertexArray);
+			if (meshletCulling)
+				readStats();
+		}
+		else
+		{
+			// phase 1 lays down the depth of what was visible last frame, the Hi-Z of that decides the rest
+			cull(shader.uboCamera, 1, nullptr);
+			glUseProgram(shader.ID);
+			drawCalls += drawRuns(shader, iblTextures, 0, boundVertexArray);
+
+			occlusion->build();
+			cull(shader.uboCamera, 2, occlusion);
+			glUseProgram(shader.ID);
+			drawCalls += drawRuns(shader, iblTextures, 1, boundVertexArray);
+
+			readStats();
+			lastDrawOccluded = true;
+		}
+	}
+
+	glBindVertexArray(0);
+	return drawCalls;
+}
+
+size_t IndirectDrawBatch::drawRuns(const Shader& shader, const IBLTextures& iblTextures, size_t slice, GLuint& boundVertexArray) const
+{
+	shader.setBool("indirectDraw", true);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, DRAW_DATA_BINDING, drawDataBuffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, MATERIAL_DATA_BINDING, materialBuffer);
+
+	// the whole draws and the meshlets of the split ones are laid out the same way, one multi-draw each per run
+	auto multiDraw = [&](GLuint commands, GLuint drawIndices, GLuint counts, size_t total, size_t runIndex, size_t first, size_t count)
+		{
+			glBindBuffer(GL_DRAW_INDIRECT_BUFFER, commands);
+			glBindBufferBase(GL_SHADER_STORAGE_BUFFER, DRAW_INDEX_BINDING, drawIndices);
+			size_t sliceCommand = slice * total + first;
+			shader.setInt("drawOffset", static_cast<int>(sliceCommand));
+			const void* firstCommand = (void*)(sliceCommand * sizeof(DrawElementsIndirectCommand));
+			if (cullingMode == GpuCullingMode::Compact)
+			{
+				// the run's slice is only filled up to its count, the rest is left over from earlier frames
+				glBindBuffer(GL_PARAMETER_BUFFER, counts);
+				GLintptr countOffset = static_cast<GLintptr>((slice * runs.size() + runIndex) * sizeof(uint32_t));
+				glMultiDrawElementsIndirectCount(GL_TRIANGLES, runs[runIndex].indexType, firstCommand, countOffset, static_cast<GLsizei>(count), 0);
+			}
+			else
+			{
+				glMultiDrawElementsIndirect(GL_TRIANGLES, runs[runIndex].indexType, firstCommand, static_cast<GLsizei>(count), 0);
+			}
+		};
+
+	size_t drawCalls = 0;
+	for (size_t runIndex = 0; runIndex < runs.size(); runIndex++)
+	{
+		const Run& run = runs[runIndex];
+		if (run.vertexArray != boundVertexArray)
+		{
+			glBindVertexArray(run.vertexArray);
+			boundVertexArray = run.vertexArray;
+		}
+		run.materialSource->bindMaterial(shader, iblTextures);
+		multiDraw(commandBuffer, drawIndexBuffer, drawCountBuffer, commandCount, runIndex, run.firstCommand, run.commandCount);
+		drawCalls++;
+		if (meshletCulling && run.meshletCount > 0)
+		{
+			multiDraw(meshletCommandBuffer, meshletDrawIndexBuffer, meshletCountBuffer, meshletTotal, runIndex, run.firstMeshlet, run.meshletCount);
+			drawCalls++;
+		}
+		run.materialSource->unbindMaterial();
+	}
+
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+	if (cullingMode == GpuCullingMode::Compact)
+		glBindBuffer(GL_PARAMETER_BUFFER, 0);
+	shader.setBool("indirectDraw", false);
+	return drawCalls;
+}
+
+void IndirectDrawBatch::cull(GLuint cameraBuffer, int phase, const HiZBuffer* occlusion) const
+{
+	size_t slice = phase == 2 ? 1 : 0;
+
+	// same camera as the PBR shader, its CameraMatrices block is at binding 0 as well
+	glUseProgram(cullShader->ID);
+	glBindBufferBase(GL_UNIFORM_BUFFER, 0, cameraBuffer);
+	cullShader->setInt("drawCount", static_cast<int>(commandCount));
+	cullShader->setBool("compact", cullingMode == GpuCullingMode::Compact);
+	cullShader->setInt("phase", phase);
+	cullShader->setBool("usePvs", pvsCell != nullptr);
+	glUniform1ui(cullShader->getUniformLocation("commandOffset"), static_cast<GLuint>(slice * commandCount));
+	glUniform1ui(cullShader->getUniformLocation("countOffset"), static_cast<GLuint>(slice * runs.size()));
+	if (occlusion != nullptr)
+	{
+		cullShader->setInt("hiZ", static_cast<int>(TextureUnit::HiZ));
+		glBindTextureUnit(static_cast<GLuint>(TextureUnit::HiZ), occlusion->getTexture());
+	}
+
+	// only this phase's counts, the other slice may still be waiting to be drawn
+	GLuint zero = 0;
+	glClearNamedBufferSubData(drawCountBuffer, GL_R32UI, static_cast<GLintptr>(slice * runs.size() * sizeof(uint32_t)),
+		static_cast<GLsizeiptr>(runs.size() * sizeof(uint32_t)), GL_RED_INTEGER, GL_UNSIGNED_INT, &zero);
+	if (phase == 2)
+		glClearNamedBufferData(occlusionStatsBuffer, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, &zero);
+	else if (meshletCulling)
+		glClearNamedBufferData(meshletStatsBuffer, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, &zero);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, DRAW_INDEX_BINDING, drawIndexBuffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, CULL_DATA_BINDING, cullDataBuffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, SOURCE_COMMAND_BINDING, sourceCommandBuffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, COMMAND_BINDING, commandBuffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, DRAW_COUNT_BINDING, drawCountBuffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, VISIBILITY_BINDING, visibilityBuffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, OCCLUSION_STATS_BINDING, occlusionStatsBuffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, PVS_BINDING, pvsBuffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, EXPAND_BINDING, expandBuffer);
+	glDispatchCompute(static_cast<GLuint>((commandCount + CULL_GROUP_SIZE - 1) / CULL_GROUP_SIZE), 1, 1);
+
+	if (meshletCulling && meshletTotal > 0)
+	{
+		// the meshlet pass reads which draws were split
+		glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+		cullMeshlets(slice);
+	}
+
+	// the commands and counts are read as indirect parameters, the draw indices by the vertex shader
+	glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_SHADER_STORAGE_BARRIER_BIT);
+	if (occlusion != nullptr)
+		glBindTextureUnit(static_cast<GLuint>(TextureUnit::HiZ), 0);
+}
+
+void IndirectDrawBatch::cullMeshlets(size_t slice) const
+{
+	// the camera is still bound from the per-draw pass
+	glUseProgram(meshletCullShader->ID);
+	meshletCullShader->setInt("meshletCount", static_cast<int>(meshletTotal));
+	meshletCullShader->setBool("compact", cullingMode == GpuCullingMode::Compact);
+	glUniform1ui(meshletCullShader->getUniformLocation("expandOffset"), static_cast<GLuint>(slice * commandCount));
+	glUniform1ui(meshletCullShader->getUniformLocation("commandOffset"), static_cast<GLuint>(slice * meshletTotal));
+	glUniform1ui(meshletCullShader->getUniformLocation("countOffset"), static_cast<GLuint>(slice * runs.size()));
+
+	GLuint zero = 0;
+	glClearNamedBufferSubData(meshletCountBuffer, GL_R32UI, static_cast<GLintptr>(slice * runs.size() * sizeof(uint32_t)),
+		static_cast<GLsizeiptr>(runs.size() * sizeof(uint32_t)), GL_RED_INTEGER, GL_UNSIGNED_INT, &zero);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, DRAW_INDEX_BINDING, meshletDrawIndexBuffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, COMMAND_BINDING, meshletCommandBuffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, DRAW_COUNT_BINDING, meshletCountBuffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, EXPAND_BINDING, expandBuffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, MESHLET_DATA_BINDING, meshletDataBuffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, MESHLET_STATS_BINDING, meshletStatsBuffer);
+	glDispatchCompute(static_cast<GLuint>((meshletTotal + CULL_GROUP_SIZE - 1) / CULL_GROUP_SIZE), 1, 1);
+}
+
+void IndirectDrawBatch::readStats() const
+{
+	// copy this frame's counters into the ring and read the oldest copy whose fence has passed, never waiting on it.
+	// each set only changes on frames that ran its pass, the other one reads back as it was
+	size_t slot = statsFrame % STATS_READBACK_FRAMES;
+	if (statsFences[slot])
+	{
+		if (glClientWaitSync(statsFences[slot], 0, 0) == GL_TIMEOUT_EXPIRED)
+			return;
+		uint32_t counters[STATS_COUNT] = {};
+		glGetNamedBufferSubData(statsReadbackBuffers[slot], 0, sizeof(counters), counters);
+		occlusionStats.frustumVisible = counters[0];
+		occlusionStats.drawnFirstPhase = counters[1];
+		occlusionStats.drawnSecondPhase = counters[2];
+		occlusionStats.occludedMeshes = counters[3];
+		occlusionStats.occludedTriangles = counters[4];
+		meshletStats.tested = counters[OCCLUSION_STATS_COUNT];
+		meshletStats.frustumCulled = counters[OCCLUSION_STATS_COUNT + 1];
+		meshletStats.coneCulled = counters[OCCLUSION_STATS_COUNT + 2];
+		meshletStats.culledTriangles = counters[OCCLUSION_STATS_COUNT + 3];
+		glDeleteSync(statsFences[slot]);
+		statsFences[slot] = nullptr;
+	}
+
+	glCopyNamedBufferSubData(occlusionStatsBuffer, statsReadbackBuffers[slot], 0, 0, OCCLUSION_STATS_COUNT * sizeof(uint32_t));
+	glCopyNamedBufferSubData(meshletStatsBuffer, statsReadbackBuffers[slot], 0, OCCLUSION_STATS_COUNT * sizeof(uint32_t), MESHLET_STATS_COUNT * sizeof(uint32_t));
+	statsFences[slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	statsFrame++;
+}
+
+void IndirectDrawBatch::setPotentiallyVisible(const PotentiallyVisibleSet* pvs, const uint64_t* cell)
+{
+	if (!pvs || cullingMode == GpuCullingMode::None)
+		cell = nullptr;
+	if (cell == pvsCell && pvsMaskValid)
+		return;
+	pvsCell = cell;
+	pvsMaskValid = true;
+	if (!cell)
+		return;
+
+	std::fill(pvsMask.begin(), pvsMask.end(), 0u);
+	pvsHiddenDraws = 0;
+	for (size_t i = 0; i < drawMeshes.size(); i++)
+	{
+		if (pvs->isVisible(cell, drawMeshes[i].first, drawMeshes[i].second))
+			pvsMask[i / 32] |= 1u << (i % 32);
+		else
+			pvsHiddenDraws++;
+	}
+	if (!pvsMask.empty())
+		glNamedBufferSubData(pvsBuffer, 0, static_cast<GLsizeiptr>(pvsMask.size() * sizeof(uint32_t)), pvsMask.data());
+}
+
+void IndirectDrawBatch::printCullingCheck(const glm::mat4& viewProjection) const
+{
+	if (cullingMode == GpuCullingMode::None || commandCount == 0)
+		return;
+
+	size_t cpuVisible = 0;
+	for (size_t i = 0; i < cullData.size(); i++)
+	{
+		bool inSet = !pvsCell || ((pvsMask[i / 32] >> (i % 32)) & 1) != 0;
+		cpuVisible += inSet && insideFrustum(viewProjection, cullData[i]) ? 1 : 0;
+	}
+
+	size_t gpuVisible = 0;
+	if (lastDrawOccluded)
+	{
+		// the stats lag a few frames behind, fine with a still camera
+		gpuVisible = occlusionStats.frustumVisible;
+	}
+	else if (cullingMode == GpuCullingMode::Compact)
+	{
+		std::vector<uint32_t> counts(runs.size());
+		glGetNamedBufferSubData(drawCountBuffer, 0, static_cast<GLsizeiptr>(counts.size() * sizeof(uint32_t)), counts.data());
+		for (uint32_t count : counts)
+			gpuVisible += count;
+	}
+	else
+	{
+		std::vector<DrawElementsIndirectCommand> commands(commandCount);
+		glGetNamedBufferSubData(commandBuffer, 0, static_cast<GLsizeiptr>(commands.size() * sizeof(DrawElementsIndirectCommand)), commands.data());
+		for (const DrawElementsIndirectCommand& command : commands)
+			gpuVisible += command.instanceCount;
+	}
+	if (!lastDrawOccluded && meshletCulling)
+	{
+		// draws split into meshlets passed but left their own command out
+		std::vector<uint32_t> expanded(commandCount);
+		glGetNamedBufferSubData(expandBuffer, 0, static_cast<GLsizeiptr>(expanded.size() * sizeof(uint32_t)), expanded.data());
+		for (uint32_t flag : expanded)
+			gpuVisible += flag;
+	}
+
+	// draws right on a plane can round either way, so a difference of one or two isn't a bug
+	std::printf("IndirectDrawBatch culling check: GPU kept %zu / %zu draws, CPU reference %zu%s\n",
+		gpuVisible, commandCount, cpuVisible, gpuVisible == cpuVisible ? "" : " (MISMATCH)");
+}
@@ -0,0 +1,215 @@
+#pragma once
+#include "Model.h"
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+//Layout of GL_DRAW_INDIRECT_BUFFER entries for glMultiDrawElementsIndirect
+struct DrawElementsIndirectCommand
+{
+	GLuint count;
+	GLuint instanceCount;
+	GLuint firstIndex;		// in indices, not bytes
+	GLint baseVertex;
+	GLuint baseInstance;
+};
+
+//Per-draw data, std430 DrawData in PBRShader.vc.txt
+struct IndirectDrawData
+{
+	glm::mat4 model;			// model matrix * mesh transform
+	glm::mat4 normalMatrix;		// mat3 in the upper left
+	glm::vec4 positionOffset;
+	glm::vec4 positionScale;
+	uint32_t materialIndex;
+	uint32_t packedVertex;
+	uint32_t padding[2];
+};
+
+//Material constants of batched draws, std430 MaterialData in both PBR shaders
+struct IndirectMaterialData
+{
+	glm::vec4 baseColorFactor;
+	glm::mat4 uvTransform;					// mat3 in the upper left
+	glm::vec4 metallicRoughnessFactor;		// x metallic, y roughness
+};
+
+//World space AABB of a batched draw and where the culling pass writes it, std430 CullData in frustumCull.cs.txt
+struct IndirectCullData
+{
+	glm::vec4 center;
+	glm::vec4 extents;
+	uint32_t outputBase;	// first command of the draw's run
+	uint32_t run;
+	uint32_t meshletCount;	// meshlets the draw is split into at its current level of detail, 0 to draw it whole
+	uint32_t padding;
+};
+
+//World space bounds of one meshlet of a batched draw and its command, std430 MeshletData in meshletCull.cs.txt
+struct IndirectMeshletData
+{
+	glm::vec4 sphere;		// center, radius
+	glm::vec4 cone;			// axis, cutoff. 1 never culls
+	uint32_t firstIndex;	// absolute, into the arena's index buffer
+	uint32_t count;
+	int32_t baseVertex;
+	uint32_t draw;
+	uint32_t outputBase;	// first meshlet command of the draw's run
+	uint32_t run;
+	uint32_t padding[2];
+};
+
+//How batched draws are culled, picked once from what the context supports
+enum class GpuCullingMode
+{
+	None,			// no compute shaders: every command is drawn
+	ZeroInstances,	// culled commands keep their slot with instanceCount 0, for contexts without glMultiDrawElementsIndirectCount
+	Compact			// survivors are compacted per run and drawn with glMultiDrawElementsIndirectCount
+};
+
+//What the occlusion pass of a frame did, read back a few frames late so nothing waits on the GPU
+struct OcclusionStats
+{
+	size_t frustumVisible = 0;
+	size_t drawnFirstPhase = 0;		// visible last frame, drawn before the Hi-Z is built
+	size_t drawnSecondPhase = 0;	// found visible against the new Hi-Z
+	size_t occludedMeshes = 0;		// frustum visible but hidden, not drawn at all
+	size_t occludedTriangles = 0;
+};
+
+//What the meshlet pass of a frame did, read back with the occlusion stats
+struct MeshletStats
+{
+	size_t tested = 0;				// meshlets of draws that survived the per-draw tests
+	size_t frustumCulled = 0;
+	size_t coneCulled = 0;			// facing away from the camera
+	size_t culledTriangles = 0;
+};
+
+class HiZBuffer;
+class PotentiallyVisibleSet;
+
+//Draws a group of static models with glMultiDrawElementsIndirect. Every arena mesh becomes one command, with its
+//transforms and material index in an SSBO the vertex shader reads through gl_DrawID. Commands are sorted so meshes
+//sharing a VAO, index type and material maps form one run, and each run is a single multi-draw.
+//Models still streaming in and meshes with buffers of their own (Source layout) are drawn the per-mesh way.
+//Before drawing, a compute pass (frustumCull.cs.txt) tests every command's bounds against the camera frustum from the
+//CameraMatrices UBO and writes the surviving commands, see GpuCullingMode.
+//Given a HiZBuffer the draws are also occlusion culled in two phases: what was visible last frame is drawn first, the
+//Hi-Z is built from that depth, and the rest is tested against it and drawn if it shows.
+//Draws at full detail that were split into meshlets (MeshletBuilder) aren't drawn whole once they pass: a second pass
+//(meshletCull.cs.txt) tests each of their meshlets by bounding sphere and normal cone and writes a command per surviving
+//index range, drawn with the same PBR shader and vertex layout as one more multi-draw per run.
+class IndirectDrawBatch
+{
+public:
+	IndirectDrawBatch();
+	~IndirectDrawBatch();
+
+	IndirectDrawBatch(const IndirectDrawBatch&) = delete;
+	IndirectDrawBatch& operator=(const IndirectDrawBatch&) = delete;
+
+	//Rebuilds the commands if a model finished loading or was moved since the last call, and points the commands of
+	//meshes whose level of detail changed (Model::selectLods) at the new level's indices
+	void update(const std::vector<Model*>& models);
+	//Expects the shader in use with the camera and lights set. Returns the number of GL draw calls issued.
+	//occlusion (optional) is built from the frame's depth between the two phases, so its source must be the bound depth
+	size_t draw(const Shader& shader, const IBLTextures& iblTextures, const std::vector<Model*>& models, HiZBuffer* occlusion = nullptr) const;
+
+	//Limits the culling pass to a baked cell's potentially visible set, a null cell lifts it. The per-draw mask is
+	//only rebuilt and uploaded when the cell or the batch changes
+	void setPotentiallyVisible(const PotentiallyVisibleSet* pvs, const uint64_t* cell);
+
+	//Reads back what the last draw's culling pass kept (a GPU sync, debugging only) and prints it next to the same
+	//test done on the CPU, which should agree on any conforming GL, Mesa's llvmpipe included
+	void printCullingCheck(const glm::mat4& viewProjection) const;
+
+	size_t getBatchedMeshCount() const { return commandCount; }
+	size_t getRunCount() const { return runs.size(); }
+	GpuCullingMode getCullingMode() const { return cullingMode; }
+	const OcclusionStats& getOcclusionStats() const { return occlusionStats; }
+	const MeshletStats& getMeshletStats() const { return meshletStats; }
+	size_t getMeshletCount() const { return meshletTotal; }
+	//Off draws every mesh whole, for comparison. Needs the culling pass, always off without it
+	void setMeshletCulling(bool enabled);
+	bool isMeshletCulling() const { return meshletCulling; }
+	//Draws outside the current cell's set, 0 without one
+	size_t getPvsHiddenDraws() const { return pvsCell ? pvsHiddenDraws : 0; }
+
+private:
+	struct Run
+	{
+		GLuint vertexArray;
+		GLenum indexType;
+		const Mesh* materialSource;		// any mesh of the run, they all bind the same maps
+		size_t firstCommand;
+		size_t commandCount;
+		size_t firstMeshlet;
+		size_t meshletCount;
+	};
+
+	struct UnbatchedMesh
+	{
+		const Model* model;
+		const Mesh* mesh;
+	};
+
+	GLuint sourceCommandBuffer = 0;	// every command, as built
+	GLuint commandBuffer = 0;		// what gets drawn, written by the culling pass
+	GLuint drawIndexBuffer = 0;		// draw data index of each command in commandBuffer
+	GLuint drawCountBuffer = 0;		// one count per run
+	GLuint cullDataBuffer = 0;
+	GLuint visibilityBuffer = 0;		// per draw, visible last frame
+	GLuint occlusionStatsBuffer = 0;
+	GLuint pvsBuffer = 0;				// one bit per draw, in the current cell's set
+	GLuint expandBuffer = 0;			// per draw and slice, 1 if its meshlets are drawn instead
+	GLuint meshletDataBuffer = 0;
+	GLuint meshletCommandBuffer = 0;	// the meshlet pass's commands, draw indices and counts, laid out like the draws'
+	GLuint meshletDrawIndexBuffer = 0;
+	GLuint meshletCountBuffer = 0;
+	GLuint meshletStatsBuffer = 0;
+	GLuint drawDataBuffer = 0;
+	GLuint materialBuffer = 0;
+	size_t commandCount = 0;
+	std::vector<Run> runs;
+	std::vector<UnbatchedMesh> unbatched;
+	std::vector<IndirectCullData> cullData;	// CPU copy for printCullingCheck
+	std::vector<std::pair<const Model*, uint32_t>> drawMeshes;	// model and mesh index of each draw
+	std::vector<DrawElementsIndirectCommand> sourceCommands;	// CPU copy of sourceCommandBuffer
+	std::vector<int> drawLods;									// level of detail each command draws
+	size_t meshletTotal = 0;
+	bool meshletCulling = true;
+
+	const uint64_t* pvsCell = nullptr;
+	bool pvsMaskValid = false;
+	std::vector<uint32_t> pvsMask;
+	size_t pvsHiddenDraws = 0;
+
+	GpuCullingMode cullingMode = GpuCullingMode::None;
+	std::unique_ptr<Shader> cullShader;
+	std::unique_ptr<Shader> meshletCullShader;
+
+	// occlusion and meshlet stats go through a small ring of readback buffers, each read once its fence has passed
+	static const int STATS_READBACK_FRAMES = 3;
+	mutable GLuint statsReadbackBuffers[STATS_READBACK_FRAMES] = {};
+	mutable GLsync statsFences[STATS_READBACK_FRAMES] = {};
+	mutable size_t statsFrame = 0;
+	mutable OcclusionStats occlusionStats;
+	mutable MeshletStats meshletStats;
+	mutable bool lastDrawOccluded = false;
+
+	// what the current commands were built from, to spot changes
+	std::vector<const Model*> builtModels;
+	std::vector<glm::mat4> builtMatrices;
+	std::vector<size_t> builtMeshCounts;
+
+	void rebuild(const std::vector<Model*>& models);
+	void updateLods();
+	//meshlet counts of the cull data from the current levels of detail and the toggle, uploaded if any changed
+	void updateMeshletCounts();
+	//phase 0 is frustum culling alone, 1 and 2 the occlusion phases. Phase 2 writes the second slice of the outputs
+	void cull(GLuint cameraBuffer, int phase, const HiZBuffer* occlusion) const;
+	void cullMeshlets(size_t slice) const;
+	size_t drawRuns(const Shader& shader, const IBLTextures& iblTextures, size_t slice, GLuint& boundVertexArray) const;
+	void readStats() const;
+};
@@ -0,0 +1,307 @@
+#include "Json.h"
+#include <cstdlib>
+#include <cstring>
+
+namespace
+{
+	const JsonValue NULL_VALUE;
+	const int MAX_DEPTH = 256;
+}
+
+//Recursive descent over the raw text, strings are unescaped as they are read
+class JsonParser
+{
+public:
+	JsonParser(const char* text, size_t length) : cursor(text), begin(text), end(text + length) {}
+
+	bool parseDocument(JsonValue& out, std::string& error)
+	{
+		skipWhitespace();
+		bool ok = parseValue(out, 0);
+		if (ok)
+		{
+			skipWhitespace();
+			if (cursor != end)
+				ok = fail("trailing characters");
+		}
+		if (!ok)
+			error = message + " at offset " + std::to_string(cursor - begin);
+		return ok;
+	}
+
+private:
+	const char* cursor;
+	const char* begin;
+	const char* end;
+	std::string message;
+
+	bool fail(const char* reason)
+	{
+		if (message.empty())
+			message = reason;
+		return false;
+	}
+
+	void skipWhitespace()
+	{
+		while (cursor < end && (*cursor == ' ' || *cursor == '\t' || *cursor == '\n' || *cursor == '\r'))
+			cursor++;
+	}
+
+	bool consume(const char* literal)
+	{
+		size_t length = std::strlen(literal);
+		if (size_t(end - cursor) < length || std::memcmp(cursor, literal, length) != 0)
+			return false;
+		cursor += length;
+		return true;
+	}
+
+	bool parseValue(JsonValue& out, int depth)
+	{
+		if (depth > MAX_DEPTH)
+			return fail("nested too deeply");
+		if (cursor >= end)
+			return fail("unexpected end of input");
+
+		switch (*cursor)
+		{
+		case '{':
+			return parseObject(out, depth);
+		case '[':
+			return parseArray(out, depth);
+		case '"':
+			out.type = JsonValue::Type::String;
+			return parseString(out.string);
+		case 't':
+			out.type = JsonValue::Type::Bool;
+			out.boolean = true;
+			return consume("true") || fail("invalid literal");
+		case 'f':
+			out.type = JsonValue::Type::Bool;
+			out.boolean = false;
+			return consume("false") || fail("invalid literal");
+		case 'n':
+			out.type = JsonValue::Type::Null;
+			return consume("null") || fail("invalid literal");
+		default:
+			return parseNumber(out);
+		}
+	}
+
+	bool parseNumber(JsonValue& out)
+	{
+		// strtod needs a terminated string, numbers are short so copy the candidate characters out first
+		char buffer[64];
+		size_t length = 0;
+		while (cursor + length < end && length < sizeof(buffer) - 1 && std::strchr("+-0123456789.eE", cursor[length]) != nullptr)
+		{
+			buffer[length] = cursor[length];
+			length++;
+		}
+		buffer[length] = '\0';
+
+		char* numberEnd = nullptr;
+		out.number = std::strtod(buffer, &numberEnd);
+		if (length == 0 || numberEnd != buffer + length)
+			return fail("invalid number");
+		out.type = JsonValue::Type::Number;
+		cursor += length;
+		return true;
+	}
+
+	bool parseHex4(unsigned int& value)
+	{
+		if (end - cursor < 4)
+			return fail("truncated escape");
+		value = 0;
+		for (int i = 0; i < 4; i++)
+		{
+			char c = *cursor++;
+			value <<= 4;
+			if (c >= '0' && c <= '9') value |= c - '0';
+			else if (c >= 'a' && c <= 'f') value |= c - 'a' + 10;
+			else if (c >= 'A' && c <= 'F') value |= c - 'A' + 10;
+			else return fail("invalid escape");
+		}
+		return true;
+	}
+
+	static void appendUtf8(std::string& out, unsigned int codePoint)
+	{
+		if (codePoint < 0x80)
+		{
+			out += char(codePoint);
+		}
+		else if (codePoint < 0x800)
+		{
+			out += char(0xC0 | (codePoint >> 6));
+			out += char(0x80 | (codePoint & 0x3F));
+		}
+		else if (codePoint < 0x10000)
+		{
+			out += char(0xE0 | (codePoint >> 12));
+			out += char(0x80 | ((codePoint >> 6) & 0x3F));
+			out += char(0x80 | (codePoint & 0x3F));
+		}
+		else
+		{
+			out += char(0xF0 | (codePoint >> 18));
+			out += char(0x80 | ((codePoint >> 12) & 0x3F));
+			out += char(0x80 | ((codePoint >> 6) & 0x3F));
+			out += char(0x80 | (codePoint & 0x3F));
+		}
+	}
+
+	bool parseString(std::string& out)
+	{
+		cursor++; // opening quote
+		while (cursor < end && *cursor != '"')
+		{
+			char c = *cursor++;
+			if (c != '\\')
+			{
+				out += c;
+				continue;
+			}
+			if (cursor >= end)
+				return fail("truncated escape");
+
+			char escape = *cursor++;
+			switch (escape)
+			{
+			case '"': out += '"'; break;
+			case '\\': out += '\\'; break;
+			case '/': out += '/'; break;
+			case 'b': out += '\b'; break;
+			case 'f': out += '\f'; break;
+			case 'n': out += '\n'; break;
+			case 'r': out += '\r'; break;
+			case 't': out += '\t'; break;
+			case 'u':
+			{
+				unsigned int codePoint;
+				if (!parseHex4(codePoint))
+					return false;
+				// surrogate pair
+				if (codePoint >= 0xD800 && codePoint < 0xDC00 && consume("\\u"))
+				{
+					unsigned int low;
+					if (!parseHex4(low))
+						return false;
+					codePoint = 0x10000 + ((codePoint - 0xD800) << 10) + (low - 0xDC00);
+				}
+				appendUtf8(out, codePoint);
+				break;
+			}
+			default:
+				return fail("invalid escape");
+			}
+		}
+		if (cursor >= end)
+			return fail("unterminated string");
+		cursor++; // closing quote
+		return true;
+	}
+
+	bool parseArray(JsonValue& out, int depth)
+	{
+		out.type = JsonValue::Type::Array;
+		cursor++;
+		skipWhitespace();
+		if (cursor < end && *cursor == ']')
+		{
+			cursor++;
+			return true;
+		}
+
+		while (true)
+		{
+			out.elements.emplace_back();
+			skipWhitespace();
+			if (!parseValue(out.elements.back(), depth + 1))
+				return false;
+			skipWhitespace();
+			if (cursor >= end)
+				return fail("unterminated array");
+			if (*cursor == ']')
+			{
+				cursor++;
+				return true;
+			}
+			if (*cursor++ != ',')
+				return fail("expected ',' or ']'");
+		}
+	}
+
+	bool parseObject(JsonValue& out, int depth)
+	{
+		out.type = JsonValue::Type::Object;
+		cursor++;
+		skipWhitespace();
+		if (cursor < end && *cursor == '}')
+		{
+			cursor++;
+			return true;
+		}
+
+		while (true)
+		{
+			skipWhitespace();
+			if (cursor >= end || *cursor != '"')
+				return fail("expected key");
+			out.members.emplace_back();
+			if (!parseString(out.members.back().first))
+				return false;
+			skipWhitespace();
+			if (cursor >= end || *cursor++ != ':')
+				return fail("expected ':'");
+			skipWhitespace();
+			if (!parseValue(out.members.back().second, depth + 1))
+				return false;
+			skipWhitespace();
+			if (cursor >= end)
+				return fail("unterminated object");
+			if (*cursor == '}')
+			{
+				cursor++;
+				return true;
+			}
+			if (*cursor++ != ',')
+				return fail("expected ',' or '}'");
+		}
+	}
+};
+
+const JsonValue* JsonValue::find(const char* key) const
+{
+	for (const auto& member : members)
+	{
+		if (member.first == key)
+			return &member.second;
+	}
+	return nullptr;
+}
+
+const JsonValue& JsonValue::operator[](const char* key) const
+{
+	const JsonValue* value = find(key);
+	return value != nullptr ? *value : NULL_VALUE;
+}
+
+const JsonValue& JsonValue::operator[](size_t index) const
+{
+	return index < elements.size() ? elements[index] : NULL_VALUE;
+}
+
+size_t JsonValue::size() const
+{
+	return type == Type::Object ? members.size() : elements.size();
+}
+
+bool JsonValue::Parse(const char* text, size_t length, JsonValue& out, std::string& error)
+{
+	out = JsonValue();
+	JsonParser parser(text, length);
+	return parser.parseDocument(out, error);
+}
@@ -0,0 +1,56 @@
+#pragma once
+#include <cstddef>
+#include <string>
+#include <utility>
+#include <vector>
+
+//Minimal read-only JSON document, enough for glTF. Lookups of missing keys or out of range indices return a shared
+//null value, so chains like json["a"]["b"].asInt(0) never need checking on the way down.
+class JsonValue
+{
+public:
+	enum class Type
+	{
+		Null,
+		Bool,
+		Number,
+		String,
+		Array,
+		Object
+	};
+
+	Type getType() const { return type; }
+	bool isNull() const { return type == Type::Null; }
+	bool isNumber() const { return type == Type::Number; }
+	bool isString() const { return type == Type::String; }
+	bool isArray() const { return type == Type::Array; }
+	bool isObject() const { return type == Type::Object; }
+
+	bool has(const char* key) const { return find(key) != nullptr; }
+	const JsonValue* find(const char* key) const;
+	const JsonValue& operator[](const char* key) const;
+	const JsonValue& operator[](size_t index) const;
+	//elements of an array or members of an object
+	size_t size() const;
+	const std::vector<std::pair<std::string, JsonValue>>& getMembers() const { return members; }
+
+	bool asBool(bool fallback = false) const { return type == Type::Bool ? boolean : fallback; }
+	double asNumber(double fallback = 0.0) const { return type == Type::Number ? number : fallback; }
+	float asFloat(float fallback = 0.0f) const { return type == Type::Number ? static_cast<float>(number) : fallback; }
+	int asInt(int fallback = 0) const { return type == Type::Number ? static_cast<int>(number) : fallback; }
+	size_t asSize(size_t fallback = 0) const { return type == Type::Number && number >= 0.0 ? static_cast<size_t>(number) : fallback; }
+	const std::string& asString() const { return string; }
+
+	//Parses a whole document, error receives the reason and byte offset on failure
+	static bool Parse(const char* text, size_t length, JsonValue& out, std::string& error);
+
+private:
+	friend class JsonParser;
+
+	Type type = Type::Null;
+	bool boolean = false;
+	double number = 0.0;
+	std::string string;
+	std::vector<JsonValue> elements;
+	std::vector<std::pair<std::string, JsonValue>> members;
+};
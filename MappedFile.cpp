@@ -0,0 +1,128 @@
+#include "MappedFile.h"
+#include <utility>
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+MappedFile::MappedFile(const std::string& path)
+{
+	open(path);
+}
+
+MappedFile::~MappedFile()
+{
+	close();
+}
+
+MappedFile::MappedFile(MappedFile&& other) noexcept
+	: mapped(std::exchange(other.mapped, nullptr)),
+	mappedSize(std::exchange(other.mappedSize, 0))
+#ifdef _WIN32
+	, fileHandle(std::exchange(other.fileHandle, nullptr)),
+	mappingHandle(std::exchange(other.mappingHandle, nullptr))
+#endif
+{
+}
+
+MappedFile& MappedFile::operator=(MappedFile&& other) noexcept
+{
+	if (this != &other)
+	{
+		close();
+		mapped = std::exchange(other.mapped, nullptr);
+		mappedSize = std::exchange(other.mappedSize, 0);
+#ifdef _WIN32
+		fileHandle = std::exchange(other.fileHandle, nullptr);
+		mappingHandle = std::exchange(other.mappingHandle, nullptr);
+#endif
+	}
+	return *this;
+}
+
+bool MappedFile::open(const std::string& path)
+{
+	close();
+
+#ifdef _WIN32
+	HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if (file == INVALID_HANDLE_VALUE)
+		return false;
+
+	LARGE_INTEGER fileSize;
+	if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0)
+	{
+		CloseHandle(file);
+		return false;
+	}
+
+	HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (mapping == nullptr)
+	{
+		CloseHandle(file);
+		return false;
+	}
+
+	void* view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+	if (view == nullptr)
+	{
+		CloseHandle(mapping);
+		CloseHandle(file);
+		return false;
+	}
+
+	fileHandle = file;
+	mappingHandle = mapping;
+	mapped = static_cast<const unsigned char*>(view);
+	mappedSize = static_cast<size_t>(fileSize.QuadPart);
+#else
+	int fd = ::open(path.c_str(), O_RDONLY);
+	if (fd < 0)
+		return false;
+
+	struct stat fileStat;
+	if (fstat(fd, &fileStat) != 0 || fileStat.st_size == 0)
+	{
+		::close(fd);
+		return false;
+	}
+
+	void* view = mmap(nullptr, static_cast<size_t>(fileStat.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+	::close(fd); // the mapping keeps its own reference to the file
+	if (view == MAP_FAILED)
+		return false;
+
+	mapped = static_cast<const unsigned char*>(view);
+	mappedSize = static_cast<size_t>(fileStat.st_size);
+#endif
+	return true;
+}
+
+void MappedFile::close()
+{
+	if (mapped == nullptr)
+		return;
+
+#ifdef _WIN32
+	UnmapViewOfFile(mapped);
+	CloseHandle(static_cast<HANDLE>(mappingHandle));
+	CloseHandle(static_cast<HANDLE>(fileHandle));
+	mappingHandle = nullptr;
+	fileHandle = nullptr;
+#else
+	munmap(const_cast<unsigned char*>(mapped), mappedSize);
+#endif
+	mapped = nullptr;
+	mappedSize = 0;
+}
@@ -0,0 +1,34 @@
+#pragma once
+#include <cstddef>
+#include <string>
+
+//Read-only memory mapping of a whole file, used by the caches so warm loads can read straight out of the page cache
+class MappedFile
+{
+public:
+	MappedFile() = default;
+	explicit MappedFile(const std::string& path);
+	~MappedFile();
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	MappedFile(MappedFile&& other) noexcept;
+	MappedFile& operator=(MappedFile&& other) noexcept;
+
+	bool open(const std::string& path);
+	void close();
+
+	bool isOpen() const { return mapped != nullptr; }
+	const unsigned char* data() const { return mapped; }
+	size_t size() const { return mappedSize; }
+
+private:
+	const unsigned char* mapped = nullptr;
+	size_t mappedSize = 0;
+
+#ifdef _WIN32
+	void* fileHandle = nullptr;
+	void* mappingHandle = nullptr;
+#endif
+};
@@ -1,19 +1,23 @@
 #include "Mesh.h"
 #include "OpenGLUtils.h"
-
-enum class VertexAttribute
-{
-	Position = 0,
-	Normal,
-	TexCoords,
-	Tangent,
-	Bitangent,
-	
-	MaxAttributes 
-};
+#include "StagingRing.h"
+#include <glm/gtc/packing.hpp>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
 
 TextureStateManager texState;
 
+// a coarser level of detail has to fit in this share of the pixel error before it's switched to
+static const float LOD_HYSTERESIS = 0.75f;
+// cameras inside a mesh's bounding sphere see it at full detail
+static const float LOD_MIN_DISTANCE = 1e-3f;
+
+static size_t indexTypeSize(GLenum type)
+{
+	return type == GL_UNSIGNED_BYTE ? 1 : type == GL_UNSIGNED_SHORT ? 2 : 4;
+}
+
 void TextureStateManager::bind2D(GLuint tex)
 {
 	if (tex != currentlyBound2D)
@@ -49,27 +53,174 @@ Mesh::Mesh(const std::vector<Vertex>& vertices, const std::vector<unsigned int>&
 	std::vector<unsigned int>& normalMapIds,
 	std::vector<unsigned int>& roughnessMetallicMapIds,
 	std::vector<unsigned int>& aoMapIds)
-	: vertices(vertices), indices(indices), textureIDs(textureIDs),
-	albedoMapIDs(albedoMapIds),
-	normalMapIDs(normalMapIds),
-	roughnessMetallicMapIDs(roughnessMetallicMapIds),
-	aoMapIDs(aoMapIds)
+	: Mesh(vertices.data(), vertices.size(), indices.data(), indices.size(),
+	albedoMapIds, normalMapIds, roughnessMetallicMapIds, aoMapIds)
+{
+}
+
+Mesh::Mesh(const Vertex* vertexData, size_t numVertices, const unsigned int* indexData, size_t numIndices,
+	std::vector<unsigned int> albedoMapIds,
+	std::vector<unsigned int> normalMapIds,
+	std::vector<unsigned int> roughnessMetallicMapIds,
+	std::vector<unsigned int> aoMapIds,
+	VertexFormat format,
+	const unsigned int* lodIndexData, const MeshLod* lods, size_t lodCount,
+	const Meshlet* meshlets, size_t meshletCount)
+	: albedoMapIDs(std::move(albedoMapIds)),
+	normalMapIDs(std::move(normalMapIds)),
+	roughnessMetallicMapIDs(std::move(roughnessMetallicMapIds)),
+	aoMapIDs(std::move(aoMapIds)),
+	geometry(std::make_shared<MeshGeometry>())
+{
+	geometry->vertexCount = static_cast<GLsizei>(numVertices);
+	geometry->indexCount = static_cast<GLsizei>(numIndices);
+	geometry->vertexFormat = format;
+	geometry->lods.push_back({ 0, static_cast<uint32_t>(numIndices), 0.0f });
+	geometry->meshlets.assign(meshlets, meshlets + meshletCount);
+	if (lodCount == 0 || lodIndexData == nullptr)
+	{
+		setupMesh(vertexData, indexData, numIndices);
+		return;
+	}
+
+	// the reduced levels go after the full detail indices, into one upload
+	size_t lodIndexCount = 0;
+	for (size_t i = 0; i < lodCount; i++)
+	{
+		geometry->lods.push_back({ static_cast<uint32_t>(numIndices) + lods[i].firstIndex, lods[i].indexCount, lods[i].error });
+		lodIndexCount = std::max(lodIndexCount, size_t(lods[i].firstIndex) + lods[i].indexCount);
+	}
+	std::vector<unsigned int> allIndices;
+	allIndices.reserve(numIndices + lodIndexCount);
+	allIndices.insert(allIndices.end(), indexData, indexData + numIndices);
+	allIndices.insert(allIndices.end(), lodIndexData, lodIndexData + lodIndexCount);
+	setupMesh(vertexData, allIndices.data(), allIndices.size());
+}
+
+Mesh::Mesh(const VertexStreams& streams,
+	std::vector<unsigned int> albedoMapIds,
+	std::vector<unsigned int> normalMapIds,
+	std::vector<unsigned int> roughnessMetallicMapIds,
+	std::vector<unsigned int> aoMapIds)
+	: albedoMapIDs(std::move(albedoMapIds)),
+	normalMapIDs(std::move(normalMapIds)),
+	roughnessMetallicMapIDs(std::move(roughnessMetallicMapIds)),
+	aoMapIDs(std::move(aoMapIds)),
+	geometry(std::make_shared<MeshGeometry>())
+{
+	geometry->vertexCount = static_cast<GLsizei>(streams.vertexCount);
+	geometry->indexCount = static_cast<GLsizei>(streams.indexCount);
+	geometry->vertexFormat = VertexFormat::Source;
+	geometry->indexType = streams.indexType;
+	geometry->lods.push_back({ 0, static_cast<uint32_t>(streams.indexCount), 0.0f });
+	geometry->boundsMin = streams.boundsMin;
+	geometry->boundsMax = streams.boundsMax;
+	// only the accessor's min/max are known here, the sphere encloses the whole box
+	geometry->boundingSphere = glm::vec4((streams.boundsMin + streams.boundsMax) * 0.5f, glm::length(streams.boundsMax - streams.boundsMin) * 0.5f);
+	setupStreams(streams);
+}
+
+Mesh::Mesh(std::shared_ptr<MeshGeometry> sharedGeometry,
+	std::vector<unsigned int> albedoMapIds,
+	std::vector<unsigned int> normalMapIds,
+	std::vector<unsigned int> roughnessMetallicMapIds,
+	std::vector<unsigned int> aoMapIds)
+	: albedoMapIDs(std::move(albedoMapIds)),
+	normalMapIDs(std::move(normalMapIds)),
+	roughnessMetallicMapIDs(std::move(roughnessMetallicMapIds)),
+	aoMapIDs(std::move(aoMapIds)),
+	geometry(std::move(sharedGeometry))
 {
-	setupMesh();
 }
 
-Mesh::~Mesh()
+MeshGeometry::~MeshGeometry()
 {
+	if (allocation.inArena)
+	{
+		// the arenas go before the last models on shutdown, the whole buffer is gone by then
+		if (GeometryArena* arena = GeometryArena::getInstance(vertexFormat))
+			arena->free(allocation);
+		return;
+	}
 	glDeleteVertexArrays(1, &VAO);
 	glDeleteBuffers(1, &VBO);
 	glDeleteBuffers(1, &EBO);
 }
 
+size_t Mesh::getGeometryBytes() const
+{
+	return geometry ? geometry->geometryBytes : 0;
+}
+
+void Mesh::updateWorldBounds(const glm::mat4& modelMatrix)
+{
+	glm::mat4 transform = modelMatrix * localTransform;
+	const glm::vec3 localMin = geometry->boundsMin;
+	const glm::vec3 localMax = geometry->boundsMax;
+
+	// the AABB of the transformed box: each axis of the matrix adds its smaller and larger contribution
+	glm::vec3 translation(transform[3]);
+	worldBoundsMin = worldBoundsMax = translation;
+	for (int axis = 0; axis < 3; axis++)
+	{
+		glm::vec3 column(transform[axis]);
+		glm::vec3 a = column * localMin[axis];
+		glm::vec3 b = column * localMax[axis];
+		worldBoundsMin += glm::min(a, b);
+		worldBoundsMax += glm::max(a, b);
+	}
+
+	// a non-uniform scale stretches the sphere by its largest axis
+	float maxScale = std::max({ glm::length(glm::vec3(transform[0])), glm::length(glm::vec3(transform[1])), glm::length(glm::vec3(transform[2])) });
+	glm::vec3 center(transform * glm::vec4(glm::vec3(geometry->boundingSphere), 1.0f));
+	worldSphere = glm::vec4(center, geometry->boundingSphere.w * maxScale);
+}
+
+bool Mesh::selectLod(const glm::vec3& cameraPosition, float pixelsPerUnit, float maxPixelError)
+{
+	const std::vector<MeshLod>& lods = geometry->lods;
+	int selected = 0;
+	if (maxPixelError > 0.0f && lods.size() > 1)
+	{
+		// the errors are local, the world sphere carries the transform's largest scale. measured from the nearest
+		// point of the sphere, so no part of the mesh is off by more than the limit
+		float localRadius = geometry->boundingSphere.w;
+		float worldScale = localRadius > 0.0f ? worldSphere.w / localRadius : 1.0f;
+		float distance = std::max(glm::length(glm::vec3(worldSphere) - cameraPosition) - worldSphere.w, LOD_MIN_DISTANCE);
+		float pixelsPerError = worldScale * pixelsPerUnit / distance;
+		for (int level = static_cast<int>(lods.size()) - 1; level > 0; level--)
+		{
+			float limit = level > lod ? maxPixelError * LOD_HYSTERESIS : maxPixelError;
+			if (lods[level].error * pixelsPerError <= limit)
+			{
+				selected = level;
+				break;
+			}
+		}
+	}
+
+	bool changed = selected != lod;
+	lod = selected;
+	return changed;
+}
+
 
 void Mesh::DrawPBR(const Shader& shader, const IBLTextures& iblTextures) const
 {
-	const int DIFFUSE = GL_TEXTURE0;
-	const int IRRADIANCE = DIFFUSE + albedoMapIDs.size() + normalMapIDs.size() + roughnessMetallicMapIDs.size() + aoMapIDs.size();
+	GLuint boundVertexArray = 0;
+	DrawPBR(shader, iblTextures, boundVertexArray);
+	glBindVertexArray(0);
+	CHECK_GL_ERROR("glBindVertexArray(0)");
+}
+
+int Mesh::irradianceUnit() const
+{
+	return GL_TEXTURE0 + static_cast<int>(albedoMapIDs.size() + normalMapIDs.size() + roughnessMetallicMapIDs.size() + aoMapIDs.size());
+}
+
+void Mesh::bindMaterial(const Shader& shader, const IBLTextures& iblTextures) const
+{
+	const int IRRADIANCE = irradianceUnit();
 	const int PREFILTER = IRRADIANCE + 1;
 	const int BRDF_LUT = PREFILTER + 1;
 
@@ -87,32 +238,56 @@ void Mesh::DrawPBR(const Shader& shader, const IBLTextures& iblTextures) const
 
 	//bind IBLs
 	bindIBLTextures(shader, iblTextures, IRRADIANCE, PREFILTER, BRDF_LUT);
+}
 
-	if (glIsVertexArray(VAO) == GL_FALSE)
-	{
-		std::cerr << "Error: VAO ID " << VAO << " is not a valid vertex array object." << std::endl;
-	}
+void Mesh::unbindMaterial() const
+{
+	const int IRRADIANCE = irradianceUnit();
+	resetTextures(GL_TEXTURE0, GL_TEXTURE0, IRRADIANCE, IRRADIANCE + 1);
+}
 
-	// Draw mesh
-	glBindVertexArray(VAO);
+void Mesh::DrawPBR(const Shader& shader, const IBLTextures& iblTextures, GLuint& boundVertexArray) const
+{
+	bindMaterial(shader, iblTextures);
 
-	// Check if the VAO has an EBO bound to it
-	GLint eboBound;
-	glGetVertexArrayiv(VAO, GL_ELEMENT_ARRAY_BUFFER_BINDING, &eboBound);
-	if (eboBound == 0)
+	// Draw mesh
+	const MeshGeometry& g = *geometry;
+	shader.setBool("packedVertex", g.vertexFormat == VertexFormat::Packed);
+	shader.setVec3("positionOffset", g.positionOffset);
+	shader.setVec3("positionScale", g.positionScale);
+	shader.setMat4("meshTransform", localTransform);
+	shader.setMat3("meshNormalMatrix", glm::transpose(glm::inverse(glm::mat3(localTransform))));
+	shader.setMat3("uvTransform", factors.uvTransform);
+	shader.setVec4("material.baseColorFactor", factors.baseColor);
+	shader.setFloat("material.metallicFactor", factors.metallic);
+	shader.setFloat("material.roughnessFactor", factors.roughness);
+
+	if (g.VAO != boundVertexArray)
 	{
-		std::cerr << "No EBO bound to VAO." << std::endl;
+		if (glIsVertexArray(g.VAO) == GL_FALSE)
+		{
+			std::cerr << "Error: VAO ID " << g.VAO << " is not a valid vertex array object." << std::endl;
+		}
+		glBindVertexArray(g.VAO);
+		CHECK_GL_ERROR("glBindVertexArray(VAO)");
+
+		// Check if the VAO has an EBO bound to it
+		GLint eboBound;
+		glGetVertexArrayiv(g.VAO, GL_ELEMENT_ARRAY_BUFFER_BINDING, &eboBound);
+		if (eboBound == 0)
+		{
+			std::cerr << "No EBO bound to VAO." << std::endl;
+		}
+		boundVertexArray = g.VAO;
 	}
 
-	CHECK_GL_ERROR("glBindVertexArray(VAO)");
-	glDrawElements(GL_TRIANGLES, indices.size(), GL_UNSIGNED_INT, 0);
-	CHECK_GL_ERROR("glDrawElements(GL_TRIANGLES, indices.size(), GL_UNSIGNED_INT, 0)");
-	glBindVertexArray(0);
-	CHECK_GL_ERROR("glBindVertexArray(0)");
+	const MeshLod& level = g.lods[lod];
+	size_t indexOffset = g.allocation.indexOffset + size_t(level.firstIndex) * indexTypeSize(g.indexType);
+	glDrawElementsBaseVertex(GL_TRIANGLES, static_cast<GLsizei>(level.indexCount), g.indexType, (void*)indexOffset, static_cast<GLint>(g.allocation.baseVertex));
+	CHECK_GL_ERROR("glDrawElementsBaseVertex(GL_TRIANGLES, indexCount, indexType, indexOffset, baseVertex)");
 
 	// Reset to default
-	resetTextures(DIFFUSE, GL_TEXTURE0, IRRADIANCE, PREFILTER);
-
+	unbindMaterial();
 }
 void Mesh::bindTextures(const Shader& shader, const std::vector<unsigned int>& textureIDs, TextureUnit textureUnit, const std::string& uniformName) const
 {
@@ -162,75 +337,243 @@ void Mesh::resetTextures(int startUnit, int endUnit, int irradianceUnit, int pre
 	texState.bindCubeMap(0);
 }
 
-void Mesh::setupMesh()
+// fills part of a buffer whose storage already exists with a copy out of the staging ring,
+// falls back to a plain glBufferSubData when the ring is unavailable or full
+static void uploadBufferRange(GLenum target, GLuint buffer, GLintptr offset, const void* data, GLsizeiptr size)
 {
-	// create buffers/arrays
-	glGenVertexArrays(1, &VAO);
-	glGenBuffers(1, &VBO);
-	glGenBuffers(1, &EBO);
+	StagingRing* ring = StagingRing::getInstance();
+	StagingAllocation allocation;
+	if (ring != nullptr && size > 0)
+	{
+		allocation = ring->allocate(size);
+		if (!allocation.isValid())
+		{
+			// recycle whatever the GPU has finished with and try once more
+			ring->endFrame();
+			allocation = ring->allocate(size);
+		}
+	}
 
-	glBindVertexArray(VAO);
-	
-	glBindBuffer(GL_ARRAY_BUFFER, VBO);
-	glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(Vertex), vertices.data(), GL_STATIC_DRAW);
+	if (!allocation.isValid())
+	{
+		glBufferSubData(target, offset, size, data);
+		return;
+	}
+
+	std::memcpy(allocation.cpuPointer, data, static_cast<size_t>(size));
+	ring->copyToBuffer(allocation, buffer, offset);
+}
+
+// allocates immutable-usage storage and fills it through the staging ring
+static void uploadStaticBuffer(GLenum target, GLuint buffer, const void* data, GLsizeiptr size)
+{
+	glBufferData(target, size, nullptr, GL_STATIC_DRAW);
+	uploadBufferRange(target, buffer, 0, data, size);
+}
 
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int), indices.data(), GL_STATIC_DRAW);
+void Mesh::setupMesh(const Vertex* vertexData, const unsigned int* indexData, size_t indexCount)
+{
+	MeshGeometry& g = *geometry;
 
-	// vertex attribute pointers setup
-	GLsizei stride = sizeof(Vertex); // distance between each vertex in the vertex buffer in bytes
+	// what goes to the GPU: the vertices as they are, or quantized with narrower indices
+	const void* vertexBytes = vertexData;
+	const void* indexBytes = indexData;
+	size_t vertexSize = size_t(g.vertexCount) * sizeof(Vertex);
+	size_t indexSize = indexCount * sizeof(unsigned int);
+	std::vector<PackedVertex> packed;
+	std::vector<uint16_t> shortIndices;
 
-	glEnableVertexAttribArray(static_cast<GLint>(VertexAttribute::Position));
-	glVertexAttribPointer(static_cast<GLint>(VertexAttribute::Position), 3, GL_FLOAT, GL_FALSE, stride, (void*)0);
+	for (GLsizei i = 0; i < g.vertexCount; i++)
+	{
+		g.boundsMin = i == 0 ? vertexData[i].Position : glm::min(g.boundsMin, vertexData[i].Position);
+		g.boundsMax = i == 0 ? vertexData[i].Position : glm::max(g.boundsMax, vertexData[i].Position);
+	}
+	glm::vec3 sphereCenter = (g.boundsMin + g.boundsMax) * 0.5f;
+	float radiusSquared = 0.0f;
+	for (GLsizei i = 0; i < g.vertexCount; i++)
+	{
+		glm::vec3 offset = vertexData[i].Position - sphereCenter;
+		radiusSquared = std::max(radiusSquared, glm::dot(offset, offset));
+	}
+	g.boundingSphere = glm::vec4(sphereCenter, std::sqrt(radiusSquared));
 
-	glEnableVertexAttribArray(static_cast<GLint>(VertexAttribute::Normal));
-	glVertexAttribPointer(static_cast<GLint>(VertexAttribute::Normal), 3, GL_FLOAT, GL_FALSE, stride, (void*)offsetof(Vertex, Normal));
+	if (g.vertexFormat == VertexFormat::Packed)
+	{
+		packVertices(vertexData, indexData, indexCount, packed, shortIndices);
+		vertexBytes = packed.data();
+		vertexSize = packed.size() * sizeof(PackedVertex);
+		if (g.indexType == GL_UNSIGNED_SHORT)
+		{
+			indexBytes = shortIndices.data();
+			indexSize = shortIndices.size() * sizeof(uint16_t);
+		}
+	}
+	g.geometryBytes = vertexSize + indexSize;
 
-	glEnableVertexAttribArray(static_cast<GLint>(VertexAttribute::TexCoords));
-	glVertexAttribPointer(static_cast<GLint>(VertexAttribute::TexCoords), 2, GL_FLOAT, GL_FALSE, stride, (void*)offsetof(Vertex, TexCoords));
+	// sub-allocated from the layout's arena and drawn through its VAO with a base vertex
+	if (GeometryArena* arena = GeometryArena::getInstance(g.vertexFormat))
+	{
+		g.allocation = arena->allocate(g.vertexCount, indexSize);
+		g.VAO = arena->getVertexArray();
+
+		glBindBuffer(GL_COPY_WRITE_BUFFER, arena->getVertexBuffer());
+		uploadBufferRange(GL_COPY_WRITE_BUFFER, arena->getVertexBuffer(), g.allocation.baseVertex * GeometryArena::VertexStride(g.vertexFormat), vertexBytes, vertexSize);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, arena->getIndexBuffer());
+		uploadBufferRange(GL_COPY_WRITE_BUFFER, arena->getIndexBuffer(), g.allocation.indexOffset, indexBytes, indexSize);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+		return;
+	}
 
-	glEnableVertexAttribArray(static_cast<GLint>(VertexAttribute::Tangent));
-	glVertexAttribPointer(static_cast<GLint>(VertexAttribute::Tangent), 3, GL_FLOAT, GL_FALSE, stride, (void*)offsetof(Vertex, Tangent));
+	// no arena, buffers of its own
+	glCreateVertexArrays(1, &g.VAO);
+	glCreateBuffers(1, &g.VBO);
+	glCreateBuffers(1, &g.EBO);
 
-	glEnableVertexAttribArray(static_cast<GLint>(VertexAttribute::Bitangent));
-	glVertexAttribPointer(static_cast<GLint>(VertexAttribute::Bitangent), 3, GL_FLOAT, GL_FALSE, stride, (void*)offsetof(Vertex, Bitangent));
+	glBindBuffer(GL_COPY_WRITE_BUFFER, g.VBO);
+	uploadStaticBuffer(GL_COPY_WRITE_BUFFER, g.VBO, vertexBytes, vertexSize);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, g.EBO);
+	uploadStaticBuffer(GL_COPY_WRITE_BUFFER, g.EBO, indexBytes, indexSize);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
 
-	glBindVertexArray(0);
+	GeometryArena::SetupVertexLayout(g.VAO, g.VBO, g.EBO, g.vertexFormat);
 }
 
-Mesh::Mesh(Mesh&& other) noexcept
-	: VAO(std::exchange(other.VAO, 0)),
-	VBO(std::exchange(other.VBO, 0)),
-	EBO(std::exchange(other.EBO, 0)),
-	vertices(std::move(other.vertices)),
-	indices(std::move(other.indices)),
-	albedoMapIDs(std::move(other.albedoMapIDs)),
-	normalMapIDs(std::move(other.normalMapIDs)),
-	roughnessMetallicMapIDs(std::move(other.roughnessMetallicMapIDs)),
-	aoMapIDs(std::move(other.aoMapIDs)),
-	textureIDs(std::move(other.textureIDs))
+// octahedral mapping of a unit vector onto [-1, 1]^2, stored as snorm16
+static void encodeOctahedral(glm::vec3 n, int16_t out[2])
 {
-	//std::cout << "MESH WAS MOVED" << std::endl;
+	float length = glm::length(n);
+	n = length > 0.0f ? n / length : glm::vec3(0.0f, 0.0f, 1.0f);
+	n /= std::abs(n.x) + std::abs(n.y) + std::abs(n.z);
+	glm::vec2 p(n.x, n.y);
+	if (n.z < 0.0f)
+	{
+		p.x = (1.0f - std::abs(n.y)) * (n.x >= 0.0f ? 1.0f : -1.0f);
+		p.y = (1.0f - std::abs(n.x)) * (n.y >= 0.0f ? 1.0f : -1.0f);
+	}
+	out[0] = static_cast<int16_t>(glm::packSnorm1x16(p.x));
+	out[1] = static_cast<int16_t>(glm::packSnorm1x16(p.y));
 }
 
-Mesh& Mesh::operator=(Mesh&& other) noexcept
+void Mesh::packVertices(const Vertex* vertexData, const unsigned int* indexData, size_t indexCount, std::vector<PackedVertex>& packed, std::vector<uint16_t>& shortIndices)
 {
-	if (this != &other)
+	MeshGeometry& g = *geometry;
+	const GLsizei vertexCount = g.vertexCount;
+
+	// quantize positions against the mesh bounds
+	const glm::vec3 boundsMin = g.boundsMin;
+	g.positionOffset = g.boundsMin;
+	g.positionScale = g.boundsMax - g.boundsMin;
+	const glm::vec3 inverseScale(g.positionScale.x > 0.0f ? 1.0f / g.positionScale.x : 0.0f,
+		g.positionScale.y > 0.0f ? 1.0f / g.positionScale.y : 0.0f,
+		g.positionScale.z > 0.0f ? 1.0f / g.positionScale.z : 0.0f);
+
+	packed.resize(vertexCount);
+	for (GLsizei i = 0; i < vertexCount; i++)
 	{
-		glDeleteVertexArrays(1, &VAO);
-		glDeleteBuffers(1, &VBO);
-		glDeleteBuffers(1, &EBO);
+		const Vertex& vertex = vertexData[i];
+		PackedVertex& out = packed[i];
+
+		glm::vec3 relative = (vertex.Position - boundsMin) * inverseScale;
+		out.position[0] = glm::packUnorm1x16(relative.x);
+		out.position[1] = glm::packUnorm1x16(relative.y);
+		out.position[2] = glm::packUnorm1x16(relative.z);
+		out.position[3] = vertex.Tangent.w >= 0.0f ? 65535 : 0;
+
+		encodeOctahedral(vertex.Normal, out.normal);
+		encodeOctahedral(glm::vec3(vertex.Tangent), out.tangent);
+		out.texCoords[0] = glm::packHalf1x16(vertex.TexCoords.x);
+		out.texCoords[1] = glm::packHalf1x16(vertex.TexCoords.y);
+	}
 
-		VAO = std::exchange(other.VAO, 0);
-		VBO = std::exchange(other.VBO, 0);
-		EBO = std::exchange(other.EBO, 0);
-		vertices = std::move(other.vertices);
-		indices = std::move(other.indices);
-		albedoMapIDs = std::move(other.albedoMapIDs);
-		normalMapIDs = std::move(other.normalMapIDs);
-		roughnessMetallicMapIDs = std::move(other.roughnessMetallicMapIDs);
-		aoMapIDs = std::move(other.aoMapIDs);
-		textureIDs = std::move(other.textureIDs);
+	if (vertexCount <= 65536)
+	{
+		shortIndices.assign(indexData, indexData + indexCount);
+		g.indexType = GL_UNSIGNED_SHORT;
+	}
+	else
+	{
+		g.indexType = GL_UNSIGNED_INT;
 	}
-	return *this;
-}
\ No newline at end of file
+}
+
+void Mesh::setupStreams(const VertexStreams& streams)
+{
+	const VertexStream* attributes[] = { &streams.position, &streams.normal, &streams.texCoords, &streams.tangent };
+	const VertexAttribute locations[] = { VertexAttribute::Position, VertexAttribute::Normal, VertexAttribute::TexCoords, VertexAttribute::Tangent };
+	const int attributeCount = 4;
+	MeshGeometry& g = *geometry;
+
+	// streams sharing a stretch of the file (interleaved accessors) are copied once, as one span
+	struct Span
+	{
+		const unsigned char* begin;
+		const unsigned char* end;
+		GLintptr bufferOffset;
+	};
+	std::vector<Span> spans;
+	for (const VertexStream* stream : attributes)
+	{
+		if (stream->data == nullptr)
+			continue;
+		const unsigned char* begin = stream->data;
+		const unsigned char* end = stream->data + stream->byteLength;
+
+		bool merged = false;
+		for (Span& span : spans)
+		{
+			if (begin < span.end && end > span.begin)
+			{
+				span.begin = std::min(span.begin, begin);
+				span.end = std::max(span.end, end);
+				merged = true;
+				break;
+			}
+		}
+		if (!merged)
+			spans.push_back({ begin, end, 0 });
+	}
+
+	// every attribute offset in a glTF buffer is a multiple of 4, keeping the spans 4 aligned preserves that
+	GLsizeiptr vertexBytes = 0;
+	for (Span& span : spans)
+	{
+		span.bufferOffset = vertexBytes;
+		vertexBytes += (static_cast<GLsizeiptr>(span.end - span.begin) + 3) & ~GLsizeiptr(3);
+	}
+
+	glGenVertexArrays(1, &g.VAO);
+	glGenBuffers(1, &g.VBO);
+	glGenBuffers(1, &g.EBO);
+	glBindVertexArray(g.VAO);
+
+	glBindBuffer(GL_ARRAY_BUFFER, g.VBO);
+	glBufferData(GL_ARRAY_BUFFER, vertexBytes, nullptr, GL_STATIC_DRAW);
+	for (const Span& span : spans)
+		uploadBufferRange(GL_ARRAY_BUFFER, g.VBO, span.bufferOffset, span.begin, static_cast<GLsizeiptr>(span.end - span.begin));
+
+	const GLsizeiptr indexBytes = static_cast<GLsizeiptr>(streams.indexCount * indexTypeSize(streams.indexType));
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, g.EBO);
+	uploadStaticBuffer(GL_ELEMENT_ARRAY_BUFFER, g.EBO, streams.indices, indexBytes);
+	g.geometryBytes = static_cast<size_t>(vertexBytes + indexBytes);
+
+	for (int i = 0; i < attributeCount; i++)
+	{
+		const VertexStream& stream = *attributes[i];
+		if (stream.data == nullptr)
+			continue; // missing attributes read the generic default (0, 0, 0, 1)
+
+		for (const Span& span : spans)
+		{
+			if (stream.data >= span.begin && stream.data < span.end)
+			{
+				GLintptr offset = span.bufferOffset + (stream.data - span.begin);
+				GLint location = static_cast<GLint>(locations[i]);
+				glEnableVertexAttribArray(location);
+				glVertexAttribPointer(location, stream.components, stream.componentType, stream.normalized, stream.stride, (void*)offset);
+				break;
+			}
+		}
+	}
+
+	glBindVertexArray(0);
+}
@@ -8,16 +8,173 @@
 #include <sstream>
 #include <iostream>
 #include <vector>
+#include <cstdint>
+#include <memory>
 #include "ResourceManager.h"
 #include "PBRHelper.h"
+#include "GeometryArena.h"
+
+class TriangleBVH;
 
 struct Vertex
 {
 	glm::vec3 Position;
 	glm::vec3 Normal;
 	glm::vec2 TexCoords;
-	glm::vec3 Tangent;
-	glm::vec3 Bitangent;
+	glm::vec4 Tangent;	// xyz unit tangent, w handedness: bitangent = w * cross(Normal, Tangent), see TangentSpace
+};
+
+//Attribute locations shared by every vertex layout and PBRShader.vc.txt
+enum class VertexAttribute
+{
+	Position = 0,
+	Normal,
+	TexCoords,
+	Tangent,
+	
+	MaxAttributes 
+};
+
+//GPU side vertex layout of a Mesh, picked per mesh at upload time
+enum class VertexFormat
+{
+	Full,	// Vertex as is, 48 bytes, 32 bit indices
+	Packed,	// PackedVertex, 20 bytes, 16 bit indices when the mesh has fewer than 65536 vertices
+	Source	// VertexStreams as laid out in the source file (glTF), uploaded without conversion
+};
+
+//Quantized vertex, decoded in PBRShader.vc.txt
+struct PackedVertex
+{
+	uint16_t position[4];	// unorm16 xyz inside the mesh bounds, w is the tangent handedness (0 = -1, 65535 = +1)
+	int16_t normal[2];		// snorm16 octahedral
+	int16_t tangent[2];		// snorm16 octahedral
+	uint16_t texCoords[2];	// half float
+};
+
+//Texture paths (relative to the model directory) referenced by a mesh's material, one list per PBR slot
+struct MaterialTexturePaths
+{
+	std::vector<std::string> albedo;
+	std::vector<std::string> normal;
+	std::vector<std::string> roughnessMetallic;
+	std::vector<std::string> ao;
+
+	//slots in the order albedo, normal, roughnessMetallic, ao
+	static const int SlotCount = 4;
+	std::vector<std::string>& slot(int index)
+	{
+		return const_cast<std::vector<std::string>&>(static_cast<const MaterialTexturePaths&>(*this).slot(index));
+	}
+	const std::vector<std::string>& slot(int index) const
+	{
+		switch (index)
+		{
+		case 0: return albedo;
+		case 1: return normal;
+		case 2: return roughnessMetallic;
+		default: return ao;
+		}
+	}
+};
+
+//Constant PBR material inputs, multiplied into the texture samples as in glTF's metallic-roughness model.
+//Assimp imports keep the defaults, which leave their textures as they are
+struct MaterialFactors
+{
+	glm::vec4 baseColor = glm::vec4(1.0f);	// linear
+	float metallic = 1.0f;
+	float roughness = 1.0f;
+	glm::mat3 uvTransform = glm::mat3(1.0f);	// KHR_texture_transform
+};
+
+//One vertex attribute as stored in the source file, read by the GPU in that layout
+struct VertexStream
+{
+	const unsigned char* data = nullptr;	// first element, null when the attribute is missing
+	size_t byteLength = 0;					// first element up to the end of the last one
+	GLsizei stride = 0;
+	GLint components = 0;
+	GLenum componentType = GL_FLOAT;
+	GLboolean normalized = GL_FALSE;
+};
+
+//Geometry whose layout the vertex shader can fetch directly (glTF accessors, KHR_mesh_quantization included),
+//each stream is bound to the attribute location of the matching Vertex field
+struct VertexStreams
+{
+	VertexStream position;
+	VertexStream normal;
+	VertexStream texCoords;
+	VertexStream tangent;
+	size_t vertexCount = 0;
+
+	const unsigned char* indices = nullptr;
+	size_t indexCount = 0;
+	GLenum indexType = GL_UNSIGNED_INT;
+
+	glm::vec3 boundsMin = glm::vec3(0.0f);
+	glm::vec3 boundsMax = glm::vec3(0.0f);
+};
+
+//Levels of detail per mesh, the full detail one included
+const int MAX_MESH_LODS = 4;
+
+//One reduced level of detail: a range of index data drawn over the same vertices as the full mesh. error is how far
+//the simplified surface strays from the original (MeshSimplifier), in the mesh's local units
+struct MeshLod
+{
+	uint32_t firstIndex;
+	uint32_t indexCount;
+	float error;
+};
+
+//Meshlet limits: 64 vertices and 124 triangles, the cluster size mesh shader hardware is tuned for
+const size_t MESHLET_MAX_VERTICES = 64;
+const size_t MESHLET_MAX_TRIANGLES = 124;
+
+//A cluster of neighbouring triangles of a mesh's full detail level, stored as a contiguous range of its indices so it
+//draws with the ordinary vertex layout. Culled on its own by its bounding sphere and its normal cone, which rules it
+//out when every triangle faces away from the camera. Local space, see MeshletBuilder
+struct Meshlet
+{
+	glm::vec3 center;
+	float radius;
+	glm::vec3 coneAxis;
+	float coneCutoff;		// sine of the cone's spread, 1 never cone culls
+	uint32_t firstIndex;
+	uint32_t triangleCount;
+};
+
+//CPU side result of importing a mesh, before anything is uploaded to the GPU
+struct MeshData
+{
+	std::vector<Vertex> vertices;
+	std::vector<unsigned int> indices;
+	MaterialTexturePaths texturePaths;
+	std::vector<unsigned int> lodIndices;	// the reduced levels' indices one after another
+	std::vector<MeshLod> lods;				// levels 1 and up, firstIndex into lodIndices
+	std::vector<Meshlet> meshlets;			// covering indices in order, empty if it wasn't split
+};
+
+//Non-owning view of one mesh worth of import output, pointing either into a MeshData or into the mapped mesh cache
+struct MeshView
+{
+	const Vertex* vertices = nullptr;
+	size_t vertexCount = 0;
+	const unsigned int* indices = nullptr;
+	size_t indexCount = 0;
+	const MaterialTexturePaths* texturePaths = nullptr;
+	const unsigned int* lodIndices = nullptr;	// as in MeshData, null without reduced levels
+	const MeshLod* lods = nullptr;
+	size_t lodCount = 0;
+	const Meshlet* meshlets = nullptr;			// as in MeshData
+	size_t meshletCount = 0;
+	const VertexStreams* streams = nullptr;		// set instead of vertices/indices when the source layout is uploaded as is
+	const MaterialFactors* factors = nullptr;	// null for Assimp imports
+	glm::mat4 transform = glm::mat4(1.0f);		// node transform inside the model
+	uint64_t contentHash = 0;					// geometry content and upload format, 0 keeps the mesh out of the geometry registry
+	std::shared_ptr<const TriangleBVH> triangleBVH;	// built with the hash, handed to the geometry on upload
 };
 
 
@@ -41,17 +198,67 @@ extern TextureStateManager texState;
 //};
 
 
+//GPU buffers of one mesh worth of geometry. Meshes with identical content share one through the ResourceManager's
+//geometry registry, the buffers are freed when the last Mesh holding it goes away.
+//Full and Packed geometry lives in its layout's GeometryArena and VAO is the arena's, Source geometry owns its objects
+struct MeshGeometry
+{
+	//geometry only lives on the GPU, the CPU copy stays with the importer (MeshData) or the mapped mesh cache
+	GLuint VAO = 0;
+	GLuint VBO = 0;
+	GLuint EBO = 0;
+	GeometryAllocation allocation;	// BaseVertex and index offset of the draw, all 0 outside an arena
+	GLsizei vertexCount = 0;
+	GLsizei indexCount = 0;
+
+	//Packed meshes store positions relative to their bounds, the vertex shader rebuilds them as offset + aPos * scale
+	VertexFormat vertexFormat = VertexFormat::Full;
+	GLenum indexType = GL_UNSIGNED_INT;
+	glm::vec3 positionOffset = glm::vec3(0.0f);
+	glm::vec3 positionScale = glm::vec3(1.0f);
+
+	//Local space bounds of the vertices, for culling. The sphere is centred on the box, xyz centre and w radius
+	glm::vec3 boundsMin = glm::vec3(0.0f);
+	glm::vec3 boundsMax = glm::vec3(0.0f);
+	glm::vec4 boundingSphere = glm::vec4(0.0f);
+
+	//Bytes of vertex and index data kept in VRAM
+	size_t geometryBytes = 0;
+
+	//Levels of detail, full detail first with error 0. The reduced levels' indices follow the full ones in the same
+	//index allocation, firstIndex counts from the geometry's first index
+	std::vector<MeshLod> lods;
+	//Full detail split into meshlets for IndirectDrawBatch's meshlet culling, empty when it wasn't
+	std::vector<Meshlet> meshlets;
+
+	//Local space triangle BVH for ray queries (SceneBVH), built at import while the CPU copy still exists. Null for
+	//geometry created without one (placeholders, quantized source streams)
+	std::shared_ptr<const TriangleBVH> triangleBVH;
+
+	MeshGeometry() = default;
+	~MeshGeometry();
+
+	MeshGeometry(const MeshGeometry&) = delete;
+	MeshGeometry& operator=(const MeshGeometry&) = delete;
+};
+
 class Mesh
 {
 public:
 	//Mesh Data
-	std::vector<Vertex> vertices;
-	std::vector<unsigned int> indices;
 	std::vector<unsigned int> albedoMapIDs;
 	std::vector<unsigned int> normalMapIDs;
 	std::vector<unsigned int> roughnessMetallicMapIDs;
 	std::vector<unsigned int> aoMapIDs;
-	unsigned int VAO;
+
+	//Placement inside the model and material constants, both left at identity for Assimp imports
+	glm::mat4 localTransform = glm::mat4(1.0f);
+	MaterialFactors factors;
+
+	//World space bounds under the owning model's matrix, kept current by Model::UpdateTransform
+	glm::vec3 worldBoundsMin = glm::vec3(0.0f);
+	glm::vec3 worldBoundsMax = glm::vec3(0.0f);
+	glm::vec4 worldSphere = glm::vec4(0.0f);
 
 	
 	Mesh(const std::vector<Vertex>& vertices, const std::vector<unsigned int>& indices,
@@ -59,13 +266,54 @@ public:
 	std::vector<unsigned int>& normalMapIds,
 	std::vector<unsigned int>& roughnessMetallicMapIds,
 	std::vector<unsigned int>& aoMapIds);
-	~Mesh();
+	//uploads straight from caller owned memory (e.g. a memory mapped cache), no intermediate copies are kept
+	Mesh(const Vertex* vertexData, size_t numVertices, const unsigned int* indexData, size_t numIndices,
+	std::vector<unsigned int> albedoMapIds,
+	std::vector<unsigned int> normalMapIds,
+	std::vector<unsigned int> roughnessMetallicMapIds,
+	std::vector<unsigned int> aoMapIds,
+	VertexFormat format = VertexFormat::Full,
+	const unsigned int* lodIndexData = nullptr, const MeshLod* lods = nullptr, size_t lodCount = 0,
+	const Meshlet* meshlets = nullptr, size_t meshletCount = 0);
+	//uploads the source file's bytes for every stream unconverted, the mesh keeps the source's component types
+	Mesh(const VertexStreams& streams,
+	std::vector<unsigned int> albedoMapIds,
+	std::vector<unsigned int> normalMapIds,
+	std::vector<unsigned int> roughnessMetallicMapIds,
+	std::vector<unsigned int> aoMapIds);
+	//draws geometry another mesh already uploaded, nothing new goes to the GPU
+	Mesh(std::shared_ptr<MeshGeometry> sharedGeometry,
+	std::vector<unsigned int> albedoMapIds,
+	std::vector<unsigned int> normalMapIds,
+	std::vector<unsigned int> roughnessMetallicMapIds,
+	std::vector<unsigned int> aoMapIds);
+
+	//Bytes of vertex and index data this mesh's geometry keeps in VRAM, shared or not
+	size_t getGeometryBytes() const;
+	const std::shared_ptr<MeshGeometry>& getGeometry() const { return geometry; }
+	//Recomputes the world bounds from the geometry's local ones under modelMatrix * localTransform
+	void updateWorldBounds(const glm::mat4& modelMatrix);
+
+	//Level of detail the draws use, an index into the geometry's lods
+	int getLod() const { return lod; }
+	//Picks the coarsest level whose error projects to at most maxPixelError pixels seen from cameraPosition, pixelsPerUnit
+	//being the projection's scale at a distance of 1. Going coarser than the current level needs some headroom, so a
+	//camera resting near a switching distance doesn't flicker between two levels. 0 or less picks full detail.
+	//Returns whether the level changed
+	bool selectLod(const glm::vec3& cameraPosition, float pixelsPerUnit, float maxPixelError);
 
 	void Draw(const Shader& shader) const;
 	void DrawPBR(const Shader& shader, const IBLTextures& iblTextures) const;
+	//For runs of meshes: only binds the VAO when it differs from boundVertexArray, which it updates, and leaves it bound.
+	//Meshes of one arena share a VAO, so a model drawn this way binds one per layout instead of one per mesh
+	void DrawPBR(const Shader& shader, const IBLTextures& iblTextures, GLuint& boundVertexArray) const;
+	//Binds the material maps and IBL textures, and resets them again. Batched draws of meshes sharing the same maps
+	//(IndirectDrawBatch) bind them through one of the meshes
+	void bindMaterial(const Shader& shader, const IBLTextures& iblTextures) const;
+	void unbindMaterial() const;
 
-	Mesh(Mesh&& other) noexcept;			// Move constructor
-	Mesh& operator=(Mesh&& other) noexcept; // Move assignment operator
+	Mesh(Mesh&& other) noexcept = default;				// Move constructor
+	Mesh& operator=(Mesh&& other) noexcept = default;	// Move assignment operator
 
 	Mesh(const Mesh&) = delete;				// Copy constructor
 	Mesh& operator=(const Mesh&) = delete;	// Copy assignment operator
@@ -73,11 +321,16 @@ public:
 private:
 	std::vector<unsigned int> textureIDs; // Stores texture IDs for this mesh
 	//Render data
-	unsigned int VBO, EBO;
+	std::shared_ptr<MeshGeometry> geometry;
+	int lod = 0;
 
-	//Initialises all the buffer objects/arrays
-	void setupMesh();
+	//Initialises all the buffer objects/arrays, indexData holds every level of detail
+	void setupMesh(const Vertex* vertexData, const unsigned int* indexData, size_t indexCount);
+	//quantizes into packed (PackedVertex) against the geometry bounds, and narrows the indices into shortIndices when they fit in 16 bits
+	void packVertices(const Vertex* vertexData, const unsigned int* indexData, size_t indexCount, std::vector<PackedVertex>& packed, std::vector<uint16_t>& shortIndices);
+	void setupStreams(const VertexStreams& streams);
 
+	int irradianceUnit() const;	// first unit after the material maps
 	void resetTextures(int startUnit, int endUnit, int irradianceUnit, int prefilterUnit) const;
 	void bindTextures(const Shader& shader, const std::vector<unsigned int>& textureIDs, TextureUnit textureUnit, const std::string& uniformName) const;
 	void bindIBLTextures(const Shader& shader, const IBLTextures& iblTextures, int irradianceUnit, int prefilterUnit, int brdfLUTUnit) const;
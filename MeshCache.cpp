@@ -0,0 +1,369 @@
+#include "MeshCache.h"
+#include "GltfLoader.h"
+#include "HashUtils.h"
+#include "ObjLoader.h"
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+
+namespace
+{
+	const char MESH_CACHE_MAGIC[4] = { 'A', 'J', 'M', 'C' };
+	const uint64_t DATA_ALIGNMENT = 16;
+
+	struct MeshCacheHeader
+	{
+		char magic[4];
+		uint32_t version;
+		uint64_t sourceHash;
+		uint32_t importFlags;
+		uint32_t vertexSize;
+		uint32_t meshCount;
+		uint32_t instanceCount;		// 0 draws every mesh once as stored
+		uint64_t meshTableOffset;
+		uint64_t instanceTableOffset;
+	};
+
+	struct MeshCacheRecord
+	{
+		uint64_t vertexOffset;
+		uint64_t indexOffset;
+		uint32_t vertexCount;
+		uint32_t indexCount;
+		uint32_t textureCounts[MaterialTexturePaths::SlotCount];
+		uint64_t texturePathsOffset;
+		uint32_t lodCount;
+		uint32_t lodIndexCount;
+		uint64_t lodOffset;		// MeshLod table, then the reduced levels' indices
+		uint32_t meshletCount;
+		uint32_t reserved;
+		uint64_t meshletOffset;
+	};
+
+	struct MeshCacheInstanceRecord
+	{
+		glm::mat4 transform;
+		MaterialFactors factors;
+		uint32_t mesh;
+	};
+
+	uint64_t alignUp(uint64_t value, uint64_t alignment)
+	{
+		return (value + alignment - 1) & ~(alignment - 1);
+	}
+
+	void writePadding(std::ofstream& out, uint64_t alignment)
+	{
+		static const char zeros[DATA_ALIGNMENT] = {};
+		uint64_t position = static_cast<uint64_t>(out.tellp());
+		out.write(zeros, static_cast<std::streamsize>(alignUp(position, alignment) - position));
+	}
+
+	// files the import reads besides the source itself
+	std::vector<std::string> referencedFiles(const std::string& sourcePath)
+	{
+		std::vector<std::string> files;
+		if (ObjLoader::IsObjPath(sourcePath))
+			ObjLoader::ListMaterialLibraries(sourcePath, files);
+		else if (GltfLoader::IsGltfPath(sourcePath))
+			GltfLoader::ListExternalBuffers(sourcePath, files);
+		return files;
+	}
+
+	// path, size and modification time, so a warm start never has to read a large buffer just to key it.
+	// a missing file still counts, creating it later changes the key
+	uint64_t fileStamp(const std::string& path)
+	{
+		uint64_t stamp = HashUtils::XXHash64(path.data(), path.size());
+		std::error_code error;
+		uintmax_t size = std::filesystem::file_size(path, error);
+		if (error)
+			return stamp;
+		auto modified = std::filesystem::last_write_time(path, error);
+		if (error)
+			return stamp;
+		stamp = HashUtils::HashCombine(stamp, static_cast<uint64_t>(size));
+		return HashUtils::HashCombine(stamp, static_cast<uint64_t>(modified.time_since_epoch().count()));
+	}
+}
+
+MeshCache::MeshCache(const std::string& sourcePath, unsigned int importFlags)
+	: sourcePath(sourcePath),
+	cachePath(sourcePath + ".ajmesh"),
+	importFlags(importFlags)
+{
+}
+
+bool MeshCache::computeSourceHash()
+{
+	if (sourceHashValid)
+		return true;
+	if (!HashUtils::HashFile(sourcePath, sourceHash))
+		return false;
+	for (const std::string& path : referencedFiles(sourcePath))
+		sourceHash = HashUtils::HashCombine(sourceHash, fileStamp(path));
+	sourceHashValid = true;
+	return true;
+}
+
+bool MeshCache::open()
+{
+	close();
+
+	if (!std::filesystem::exists(cachePath) || !computeSourceHash())
+		return false;
+
+	if (!file.open(cachePath))
+		return false;
+
+	const unsigned char* base = file.data();
+	const uint64_t size = file.size();
+
+	MeshCacheHeader header;
+	if (size < sizeof(header))
+	{
+		close();
+		return false;
+	}
+	std::memcpy(&header, base, sizeof(header));
+
+	if (std::memcmp(header.magic, MESH_CACHE_MAGIC, sizeof(header.magic)) != 0 ||
+		header.version != MESH_CACHE_VERSION ||
+		header.sourceHash != sourceHash ||
+		header.importFlags != importFlags ||
+		header.vertexSize != sizeof(Vertex) ||
+		header.meshTableOffset + uint64_t(header.meshCount) * sizeof(MeshCacheRecord) > size ||
+		header.instanceTableOffset + uint64_t(header.instanceCount) * sizeof(MeshCacheInstanceRecord) > size)
+	{
+		close();
+		return false;
+	}
+
+	//views point at their texture paths, so this must never reallocate
+	texturePaths.resize(header.meshCount);
+	meshViews.reserve(header.meshCount);
+	for (uint32_t i = 0; i < header.meshCount; i++)
+	{
+		MeshCacheRecord record;
+		std::memcpy(&record, base + header.meshTableOffset + i * sizeof(MeshCacheRecord), sizeof(record));
+
+		const uint64_t lodIndicesOffset = record.lodOffset + uint64_t(record.lodCount) * sizeof(MeshLod);
+		if (record.vertexOffset + uint64_t(record.vertexCount) * sizeof(Vertex) > size ||
+			record.indexOffset + uint64_t(record.indexCount) * sizeof(unsigned int) > size ||
+			record.lodCount >= MAX_MESH_LODS ||
+			lodIndicesOffset + uint64_t(record.lodIndexCount) * sizeof(unsigned int) > size ||
+			record.meshletOffset + uint64_t(record.meshletCount) * sizeof(Meshlet) > size)
+		{
+			std::cerr << "ERROR::MESH_CACHE:: Truncated cache file " << cachePath << std::endl;
+			close();
+			return false;
+		}
+
+		const MeshLod* lods = reinterpret_cast<const MeshLod*>(base + record.lodOffset);
+		for (uint32_t level = 0; level < record.lodCount; level++)
+		{
+			if (uint64_t(lods[level].firstIndex) + lods[level].indexCount > record.lodIndexCount)
+			{
+				std::cerr << "ERROR::MESH_CACHE:: Corrupt LOD table in " << cachePath << std::endl;
+				close();
+				return false;
+			}
+		}
+
+		const Meshlet* meshlets = reinterpret_cast<const Meshlet*>(base + record.meshletOffset);
+		for (uint32_t m = 0; m < record.meshletCount; m++)
+		{
+			if ((uint64_t(meshlets[m].firstIndex) + uint64_t(meshlets[m].triangleCount) * 3) > record.indexCount)
+			{
+				std::cerr << "ERROR::MESH_CACHE:: Corrupt meshlet table in " << cachePath << std::endl;
+				close();
+				return false;
+			}
+		}
+
+		MeshView view;
+		view.vertices = reinterpret_cast<const Vertex*>(base + record.vertexOffset);
+		view.vertexCount = record.vertexCount;
+		view.indices = reinterpret_cast<const unsigned int*>(base + record.indexOffset);
+		view.indexCount = record.indexCount;
+		if (record.lodCount > 0)
+		{
+			view.lods = lods;
+			view.lodCount = record.lodCount;
+			view.lodIndices = reinterpret_cast<const unsigned int*>(base + lodIndicesOffset);
+		}
+		if (record.meshletCount > 0)
+		{
+			view.meshlets = meshlets;
+			view.meshletCount = record.meshletCount;
+		}
+		view.texturePaths = &texturePaths[i];
+
+		//texture paths are stored as length prefixed strings, slot after slot
+		uint64_t cursor = record.texturePathsOffset;
+		for (int slot = 0; slot < MaterialTexturePaths::SlotCount; slot++)
+		{
+			std::vector<std::string>& paths = texturePaths[i].slot(slot);
+			for (uint32_t t = 0; t < record.textureCounts[slot]; t++)
+			{
+				uint32_t length;
+				if (cursor + sizeof(length) > size)
+				{
+					close();
+					return false;
+				}
+				std::memcpy(&length, base + cursor, sizeof(length));
+				cursor += sizeof(length);
+				if (cursor + length > size)
+				{
+					close();
+					return false;
+				}
+				paths.emplace_back(reinterpret_cast<const char*>(base + cursor), length);
+				cursor += length;
+			}
+		}
+
+		meshViews.push_back(view);
+	}
+
+	if (header.instanceCount == 0)
+		return true;
+
+	//placed views point at their factors, so like the texture paths these are sized up front
+	std::vector<MeshView> meshes;
+	meshes.swap(meshViews);
+	instanceFactors.resize(header.instanceCount);
+	meshViews.reserve(header.instanceCount);
+	const MeshCacheInstanceRecord* records = reinterpret_cast<const MeshCacheInstanceRecord*>(base + header.instanceTableOffset);
+	for (uint32_t i = 0; i < header.instanceCount; i++)
+	{
+		const MeshCacheInstanceRecord& record = records[i];
+		if (record.mesh >= meshes.size())
+		{
+			std::cerr << "ERROR::MESH_CACHE:: Corrupt instance table in " << cachePath << std::endl;
+			close();
+			return false;
+		}
+
+		instanceFactors[i] = record.factors;
+		MeshView view = meshes[record.mesh];
+		view.transform = record.transform;
+		view.factors = &instanceFactors[i];
+		meshViews.push_back(view);
+	}
+
+	return true;
+}
+
+void MeshCache::close()
+{
+	meshViews.clear();
+	texturePaths.clear();
+	instanceFactors.clear();
+	file.close();
+}
+
+bool MeshCache::write(const std::vector<MeshData>& meshes, const std::vector<MeshCacheInstance>& instances)
+{
+	if (!computeSourceHash())
+		return false;
+
+	const std::string tempPath = cachePath + ".tmp";
+	{
+		std::ofstream out(tempPath, std::ios::binary | std::ios::trunc);
+		if (!out)
+		{
+			std::cerr << "ERROR::MESH_CACHE:: Could not create " << tempPath << std::endl;
+			return false;
+		}
+
+		MeshCacheHeader header = {};
+		std::memcpy(header.magic, MESH_CACHE_MAGIC, sizeof(header.magic));
+		header.version = MESH_CACHE_VERSION;
+		header.sourceHash = sourceHash;
+		header.importFlags = importFlags;
+		header.vertexSize = sizeof(Vertex);
+		header.meshCount = static_cast<uint32_t>(meshes.size());
+		header.instanceCount = static_cast<uint32_t>(instances.size());
+		header.meshTableOffset = sizeof(MeshCacheHeader);
+		out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+		//reserve the record table, it's filled in once all the offsets are known
+		std::vector<MeshCacheRecord> records(meshes.size());
+		out.write(reinterpret_cast<const char*>(records.data()), static_cast<std::streamsize>(records.size() * sizeof(MeshCacheRecord)));
+
+		writePadding(out, DATA_ALIGNMENT);
+		header.instanceTableOffset = static_cast<uint64_t>(out.tellp());
+		for (const MeshCacheInstance& instance : instances)
+		{
+			MeshCacheInstanceRecord record = {};
+			record.transform = instance.transform;
+			record.factors = instance.factors;
+			record.mesh = instance.mesh;
+			out.write(reinterpret_cast<const char*>(&record), sizeof(record));
+		}
+
+		for (size_t i = 0; i < meshes.size(); i++)
+		{
+			const MeshData& mesh = meshes[i];
+			MeshCacheRecord& record = records[i];
+
+			record.texturePathsOffset = static_cast<uint64_t>(out.tellp());
+			for (int slot = 0; slot < MaterialTexturePaths::SlotCount; slot++)
+			{
+				const std::vector<std::string>& paths = mesh.texturePaths.slot(slot);
+				record.textureCounts[slot] = static_cast<uint32_t>(paths.size());
+				for (const std::string& path : paths)
+				{
+					uint32_t length = static_cast<uint32_t>(path.size());
+					out.write(reinterpret_cast<const char*>(&length), sizeof(length));
+					out.write(path.data(), length);
+				}
+			}
+
+			writePadding(out, DATA_ALIGNMENT);
+			record.vertexOffset = static_cast<uint64_t>(out.tellp());
+			record.vertexCount = static_cast<uint32_t>(mesh.vertices.size());
+			out.write(reinterpret_cast<const char*>(mesh.vertices.data()), static_cast<std::streamsize>(mesh.vertices.size() * sizeof(Vertex)));
+
+			writePadding(out, DATA_ALIGNMENT);
+			record.indexOffset = static_cast<uint64_t>(out.tellp());
+			record.indexCount = static_cast<uint32_t>(mesh.indices.size());
+			out.write(reinterpret_cast<const char*>(mesh.indices.data()), static_cast<std::streamsize>(mesh.indices.size() * sizeof(unsigned int)));
+
+			writePadding(out, DATA_ALIGNMENT);
+			record.lodOffset = static_cast<uint64_t>(out.tellp());
+			record.lodCount = static_cast<uint32_t>(mesh.lods.size());
+			record.lodIndexCount = static_cast<uint32_t>(mesh.lodIndices.size());
+			out.write(reinterpret_cast<const char*>(mesh.lods.data()), static_cast<std::streamsize>(mesh.lods.size() * sizeof(MeshLod)));
+			out.write(reinterpret_cast<const char*>(mesh.lodIndices.data()), static_cast<std::streamsize>(mesh.lodIndices.size() * sizeof(unsigned int)));
+
+			writePadding(out, DATA_ALIGNMENT);
+			record.meshletOffset = static_cast<uint64_t>(out.tellp());
+			record.meshletCount = static_cast<uint32_t>(mesh.meshlets.size());
+			out.write(reinterpret_cast<const char*>(mesh.meshlets.data()), static_cast<std::streamsize>(mesh.meshlets.size() * sizeof(Meshlet)));
+		}
+
+		out.seekp(0);
+		out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+		out.write(reinterpret_cast<const char*>(records.data()), static_cast<std::streamsize>(records.size() * sizeof(MeshCacheRecord)));
+
+		if (!out)
+		{
+			std::cerr << "ERROR::MESH_CACHE:: Failed writing " << tempPath << std::endl;
+			return false;
+		}
+	}
+
+	std::error_code ec;
+	std::filesystem::rename(tempPath, cachePath, ec);
+	if (ec)
+	{
+		std::cerr << "ERROR::MESH_CACHE:: Could not replace " << cachePath << ": " << ec.message() << std::endl;
+		std::filesystem::remove(tempPath, ec);
+		return false;
+	}
+	return true;
+}
@@ -0,0 +1,54 @@
+#pragma once
+#include "Mesh.h"
+#include "MappedFile.h"
+#include <cstdint>
+#include <string>
+#include <vector>
+
+//Bump whenever the file layout or anything baked into it (Vertex, post-processing, LOD or meshlet generation) changes
+const uint32_t MESH_CACHE_VERSION = 7;
+
+//Where a cached mesh is drawn, for sources whose scene places meshes with their own transform and material factors (glTF)
+struct MeshCacheInstance
+{
+	uint32_t mesh = 0;		// index into the cached meshes
+	glm::mat4 transform = glm::mat4(1.0f);
+	MaterialFactors factors;
+};
+
+//Versioned on-disk cache of post-processed model geometry, stored next to the source file as <model>.ajmesh.
+//Keyed by a content hash of the source file, the size and modification time of the files it references (OBJ material
+//libraries, glTF buffers) and the import flags, so editing the model or changing the post-processing falls back to a
+//cold import that rewrites the cache.
+class MeshCache
+{
+public:
+	MeshCache(const std::string& sourcePath, unsigned int importFlags);
+
+	//Maps the cache and validates it against the current source, returns false if it is missing or stale
+	bool open();
+	void close();
+
+	//Writes the cache for the current source, via a temporary file so a crash never leaves a torn cache behind.
+	//Without instances every mesh is drawn once, untransformed and without material factors
+	bool write(const std::vector<MeshData>& meshes, const std::vector<MeshCacheInstance>& instances = {});
+
+	//Views into the mapped file, one per instance when the cache has them, valid for as long as the MeshCache stays open
+	const std::vector<MeshView>& getMeshes() const { return meshViews; }
+	const std::string& getCachePath() const { return cachePath; }
+
+private:
+	std::string sourcePath;
+	std::string cachePath;
+	unsigned int importFlags;
+
+	uint64_t sourceHash = 0;
+	bool sourceHashValid = false;
+
+	MappedFile file;
+	std::vector<MaterialTexturePaths> texturePaths;
+	std::vector<MaterialFactors> instanceFactors;
+	std::vector<MeshView> meshViews;
+
+	bool computeSourceHash();
+};
@@ -0,0 +1,311 @@
+#include "MeshOptimizer.h"
+#include "HashUtils.h"
+#include <algorithm>
+#include <cstring>
+#include <unordered_map>
+
+namespace
+{
+	struct VertexBytesHash
+	{
+		size_t operator()(const Vertex& vertex) const
+		{
+			return static_cast<size_t>(HashUtils::XXHash64(&vertex, sizeof(Vertex)));
+		}
+	};
+
+	struct VertexBytesEqual
+	{
+		bool operator()(const Vertex& a, const Vertex& b) const
+		{
+			return std::memcmp(&a, &b, sizeof(Vertex)) == 0;
+		}
+	};
+
+	//vertex -> triangles that use it, as offsets into one flat array
+	struct TriangleAdjacency
+	{
+		std::vector<unsigned int> offsets;
+		std::vector<unsigned int> triangles;
+
+		TriangleAdjacency(const std::vector<unsigned int>& indices, size_t vertexCount)
+			: offsets(vertexCount + 1, 0), triangles(indices.size())
+		{
+			for (unsigned int index : indices)
+				offsets[index + 1]++;
+			for (size_t v = 0; v < vertexCount; v++)
+				offsets[v + 1] += offsets[v];
+
+			std::vector<unsigned int> cursor(offsets.begin(), offsets.end() - 1);
+			for (size_t i = 0; i < indices.size(); i++)
+				triangles[cursor[indices[i]]++] = static_cast<unsigned int>(i / 3);
+		}
+	};
+}
+
+namespace MeshOptimizer
+{
+	size_t WeldVertices(std::vector<Vertex>& vertices, std::vector<unsigned int>& indices)
+	{
+		std::unordered_map<Vertex, unsigned int, VertexBytesHash, VertexBytesEqual> unique;
+		unique.reserve(vertices.size());
+
+		std::vector<unsigned int> remap(vertices.size());
+		std::vector<Vertex> welded;
+		welded.reserve(vertices.size());
+		for (size_t i = 0; i < vertices.size(); i++)
+		{
+			auto inserted = unique.emplace(vertices[i], static_cast<unsigned int>(welded.size()));
+			if (inserted.second)
+				welded.push_back(vertices[i]);
+			remap[i] = inserted.first->second;
+		}
+
+		for (unsigned int& index : indices)
+			index = remap[index];
+
+		size_t removed = vertices.size() - welded.size();
+		vertices.swap(welded);
+		return removed;
+	}
+
+	void OptimizeVertexCache(std::vector<unsigned int>& indices, size_t vertexCount, std::vector<size_t>& clusterStarts)
+	{
+		clusterStarts.clear();
+		const size_t triangleCount = indices.size() / 3;
+		if (triangleCount == 0)
+			return;
+
+		const int cacheSize = static_cast<int>(VERTEX_CACHE_SIZE);
+		TriangleAdjacency adjacency(indices, vertexCount);
+
+		std::vector<int> liveTriangles(vertexCount);
+		for (size_t v = 0; v < vertexCount; v++)
+			liveTriangles[v] = static_cast<int>(adjacency.offsets[v + 1] - adjacency.offsets[v]);
+
+		std::vector<int> cacheTime(vertexCount, 0);
+		std::vector<bool> emitted(triangleCount, false);
+		std::vector<unsigned int> deadEndStack;
+		std::vector<unsigned int> candidates;
+		std::vector<unsigned int> output;
+		output.reserve(indices.size());
+
+		int timestamp = cacheSize + 1;
+		size_t cursor = 0;
+		long long fanningVertex = 0;
+
+		while (fanningVertex >= 0)
+		{
+			// emit every remaining triangle around the fanning vertex
+			candidates.clear();
+			const unsigned int v = static_cast<unsigned int>(fanningVertex);
+			for (unsigned int a = adjacency.offsets[v]; a < adjacency.offsets[v + 1]; a++)
+			{
+				unsigned int triangle = adjacency.triangles[a];
+				if (emitted[triangle])
+					continue;
+
+				for (int corner = 0; corner < 3; corner++)
+				{
+					unsigned int vertex = indices[triangle * 3 + corner];
+					output.push_back(vertex);
+					deadEndStack.push_back(vertex);
+					candidates.push_back(vertex);
+					liveTriangles[vertex]--;
+					if (timestamp - cacheTime[vertex] > cacheSize)
+						cacheTime[vertex] = timestamp++;
+				}
+				emitted[triangle] = true;
+			}
+
+			// next fanning vertex: the candidate that will still be in the cache after its remaining triangles, oldest first
+			long long next = -1;
+			int bestPriority = -1;
+			for (unsigned int candidate : candidates)
+			{
+				if (liveTriangles[candidate] <= 0)
+					continue;
+				int priority = 0;
+				if (timestamp - cacheTime[candidate] + 2 * liveTriangles[candidate] <= cacheSize)
+					priority = timestamp - cacheTime[candidate];
+				if (priority > bestPriority)
+				{
+					bestPriority = priority;
+					next = candidate;
+				}
+			}
+
+			if (next < 0)
+			{
+				// dead end: back up through recently used vertices, then fall back to scanning in input order
+				while (!deadEndStack.empty() && next < 0)
+				{
+					unsigned int vertex = deadEndStack.back();
+					deadEndStack.pop_back();
+					if (liveTriangles[vertex] > 0)
+						next = vertex;
+				}
+				while (next < 0 && cursor < vertexCount)
+				{
+					if (liveTriangles[cursor] > 0)
+						next = static_cast<long long>(cursor);
+					cursor++;
+				}
+			}
+			fanningVertex = next;
+		}
+
+		indices.swap(output);
+
+		// a triangle that misses the cache on all three vertices shares nothing with what came before it,
+		// so cutting the order there lets OptimizeOverdraw move the pieces around without hurting the cache
+		std::vector<size_t> loadedAt(vertexCount, 0);
+		size_t misses = 0;
+		for (size_t triangle = 0; triangle < triangleCount; triangle++)
+		{
+			int triangleMisses = 0;
+			for (int corner = 0; corner < 3; corner++)
+			{
+				unsigned int vertex = indices[triangle * 3 + corner];
+				if (loadedAt[vertex] == 0 || misses - loadedAt[vertex] >= VERTEX_CACHE_SIZE)
+				{
+					loadedAt[vertex] = ++misses;
+					triangleMisses++;
+				}
+			}
+			if (triangleMisses == 3)
+				clusterStarts.push_back(triangle);
+		}
+	}
+
+	void OptimizeOverdraw(std::vector<unsigned int>& indices, const std::vector<Vertex>& vertices, const std::vector<size_t>& clusterStarts)
+	{
+		const size_t triangleCount = indices.size() / 3;
+		if (clusterStarts.size() < 2)
+			return;
+
+		struct Cluster
+		{
+			size_t first;
+			size_t count;
+			glm::vec3 centroid;
+			glm::vec3 normal;
+			float sortKey;
+		};
+
+		std::vector<Cluster> clusters(clusterStarts.size());
+		glm::vec3 meshCentroid(0.0f);
+		float meshArea = 0.0f;
+		for (size_t c = 0; c < clusters.size(); c++)
+		{
+			Cluster& cluster = clusters[c];
+			cluster.first = clusterStarts[c];
+			cluster.count = (c + 1 < clusterStarts.size() ? clusterStarts[c + 1] : triangleCount) - cluster.first;
+			cluster.centroid = glm::vec3(0.0f);
+			cluster.normal = glm::vec3(0.0f);
+
+			float clusterArea = 0.0f;
+			for (size_t t = cluster.first; t < cluster.first + cluster.count; t++)
+			{
+				const glm::vec3& p0 = vertices[indices[t * 3 + 0]].Position;
+				const glm::vec3& p1 = vertices[indices[t * 3 + 1]].Position;
+				const glm::vec3& p2 = vertices[indices[t * 3 + 2]].Position;
+				glm::vec3 areaNormal = glm::cross(p1 - p0, p2 - p0);	// length is twice the area
+				float area = glm::length(areaNormal);
+
+				cluster.normal += areaNormal;
+				cluster.centroid += (p0 + p1 + p2) / 3.0f * area;
+				clusterArea += area;
+			}
+
+			meshCentroid += cluster.centroid;
+			meshArea += clusterArea;
+			if (clusterArea > 0.0f)
+				cluster.centroid /= clusterArea;
+			float normalLength = glm::length(cluster.normal);
+			if (normalLength > 0.0f)
+				cluster.normal /= normalLength;
+		}
+		if (meshArea > 0.0f)
+			meshCentroid /= meshArea;
+
+		// clusters facing away from the middle of the mesh are the likeliest occluders, so they go first
+		for (Cluster& cluster : clusters)
+			cluster.sortKey = glm::dot(cluster.centroid - meshCentroid, cluster.normal);
+		std::stable_sort(clusters.begin(), clusters.end(), [](const Cluster& a, const Cluster& b) { return a.sortKey > b.sortKey; });
+
+		std::vector<unsigned int> sorted;
+		sorted.reserve(indices.size());
+		for (const Cluster& cluster : clusters)
+			sorted.insert(sorted.end(), indices.begin() + cluster.first * 3, indices.begin() + (cluster.first + cluster.count) * 3);
+		indices.swap(sorted);
+	}
+
+	void OptimizeVertexFetch(std::vector<Vertex>& vertices, std::vector<unsigned int>& indices)
+	{
+		const unsigned int unassigned = ~0u;
+		std::vector<unsigned int> remap(vertices.size(), unassigned);
+		std::vector<Vertex> ordered;
+		ordered.reserve(vertices.size());
+
+		for (unsigned int& index : indices)
+		{
+			if (remap[index] == unassigned)
+			{
+				remap[index] = static_cast<unsigned int>(ordered.size());
+				ordered.push_back(vertices[index]);
+			}
+			index = remap[index];
+		}
+		vertices.swap(ordered);
+	}
+
+	void AnalyzeVertexCache(const std::vector<unsigned int>& indices, size_t vertexCount, float& acmr, float& atvr)
+	{
+		acmr = 0.0f;
+		atvr = 0.0f;
+		if (indices.empty())
+			return;
+
+		// FIFO cache: a vertex is resident while fewer than VERTEX_CACHE_SIZE misses happened since it was loaded
+		std::vector<size_t> loadedAt(vertexCount, 0);
+		std::vector<bool> referenced(vertexCount, false);
+		size_t misses = 0;
+		size_t uniqueVertices = 0;
+		for (unsigned int index : indices)
+		{
+			if (!referenced[index])
+			{
+				referenced[index] = true;
+				uniqueVertices++;
+			}
+			if (loadedAt[index] == 0 || misses - loadedAt[index] >= VERTEX_CACHE_SIZE)
+			{
+				misses++;
+				loadedAt[index] = misses;
+			}
+		}
+
+		acmr = float(misses) / float(indices.size() / 3);
+		atvr = float(misses) / float(uniqueVertices);
+	}
+
+	MeshOptimizationStats Optimize(MeshData& mesh)
+	{
+		MeshOptimizationStats stats;
+		stats.vertexCountBefore = mesh.vertices.size();
+		stats.triangleCount = mesh.indices.size() / 3;
+		AnalyzeVertexCache(mesh.indices, mesh.vertices.size(), stats.acmrBefore, stats.atvrBefore);
+
+		WeldVertices(mesh.vertices, mesh.indices);
+
+		std::vector<size_t> clusterStarts;
+		OptimizeVertexCache(mesh.indices, mesh.vertices.size(), clusterStarts);
+		OptimizeOverdraw(mesh.indices, mesh.vertices, clusterStarts);
+		OptimizeVertexFetch(mesh.vertices, mesh.indices);
+
+		stats.vertexCountAfter = mesh.vertices.size();
+		AnalyzeVertexCache(mesh.indices, mesh.vertices.size(), stats.acmrAfter, stats.atvrAfter);
+		return stats;
+	}
+}
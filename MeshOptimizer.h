@@ -0,0 +1,41 @@
+#pragma once
+#include "Mesh.h"
+#include <cstddef>
+#include <vector>
+
+//Post-transform cache size the optimiser targets and the statistics simulate (FIFO)
+const unsigned int VERTEX_CACHE_SIZE = 16;
+
+struct MeshOptimizationStats
+{
+	size_t vertexCountBefore = 0;
+	size_t vertexCountAfter = 0;
+	size_t triangleCount = 0;
+	float acmrBefore = 0.0f;	// average cache miss ratio: transformed vertices per triangle, 0.5 is the ideal
+	float acmrAfter = 0.0f;
+	float atvrBefore = 0.0f;	// average transform to vertex ratio: transformed vertices per unique vertex, 1.0 is the ideal
+	float atvrAfter = 0.0f;
+};
+
+//Import time geometry optimisation, run on a cold import before the mesh cache is written so warm starts get the
+//optimised buffers for free. Works in place on MeshData, which then goes straight into Mesh::setupMesh.
+namespace MeshOptimizer
+{
+	//Merges bit-identical vertices, returns how many were removed
+	size_t WeldVertices(std::vector<Vertex>& vertices, std::vector<unsigned int>& indices);
+
+	//Tipsify (Sander et al. 2007) triangle order for the post-transform vertex cache. clusterStarts receives the first
+	//triangle of every run that starts with a cold cache, the units OptimizeOverdraw is allowed to reorder
+	void OptimizeVertexCache(std::vector<unsigned int>& indices, size_t vertexCount, std::vector<size_t>& clusterStarts);
+
+	//Sorts the clusters so outward facing ones draw first, which cuts overdraw from most view directions
+	void OptimizeOverdraw(std::vector<unsigned int>& indices, const std::vector<Vertex>& vertices, const std::vector<size_t>& clusterStarts);
+
+	//Renumbers vertices in first use order so vertex fetch walks the buffer linearly, drops unreferenced vertices
+	void OptimizeVertexFetch(std::vector<Vertex>& vertices, std::vector<unsigned int>& indices);
+
+	void AnalyzeVertexCache(const std::vector<unsigned int>& indices, size_t vertexCount, float& acmr, float& atvr);
+
+	//All of the above in order
+	MeshOptimizationStats Optimize(MeshData& mesh);
+}
@@ -0,0 +1,504 @@
+#include "MeshSimplifier.h"
+#include "HashUtils.h"
+#include "MeshOptimizer.h"
+#include "ThreadPool.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <limits>
+#include <unordered_map>
+#include <unordered_set>
+
+namespace
+{
+	// attribute differences weigh against position error, in units of the mesh's bounding radius (normals) and of
+	// its UV extent (texture coordinates)
+	const float NORMAL_WEIGHT = 0.25f;
+	const float TEXCOORD_WEIGHT = 0.5f;
+	// border edges are held in place by planes through them, standing up from their triangle and weighted this much
+	// more than the triangles' own planes
+	const double BORDER_WEIGHT = 10.0;
+	// a collapse may turn a triangle's normal by no more than this cosine (about 45 degrees), looser limits let the
+	// turns of successive collapses add up to folds
+	const float MIN_NORMAL_COSINE = 0.7f;
+
+	// every level aims for this share of the previous level's triangles
+	const float LOD_REDUCTION = 0.5f;
+	// a level that can't get below this share of the previous one isn't worth its indices, the chain stops there
+	const float MIN_LOD_REDUCTION = 0.8f;
+	// meshes smaller than this only keep full detail
+	const size_t MIN_LOD_TRIANGLES = 64;
+
+	// positions: free to collapse, on an open border (only along it), or never moved
+	enum VertexKind : uint8_t
+	{
+		Manifold,
+		Border,
+		Locked
+	};
+
+	//Sum of squared distances to a set of weighted planes, as the symmetric 4x4 matrix of Garland and Heckbert
+	struct Quadric
+	{
+		double a2 = 0, b2 = 0, c2 = 0, ab = 0, ac = 0, bc = 0, ad = 0, bd = 0, cd = 0, d2 = 0;
+		double weight = 0;
+
+		void addPlane(const glm::dvec3& n, double d, double w)
+		{
+			a2 += w * n.x * n.x; b2 += w * n.y * n.y; c2 += w * n.z * n.z;
+			ab += w * n.x * n.y; ac += w * n.x * n.z; bc += w * n.y * n.z;
+			ad += w * n.x * d; bd += w * n.y * d; cd += w * n.z * d;
+			d2 += w * d * d;
+			weight += w;
+		}
+
+		void add(const Quadric& q)
+		{
+			a2 += q.a2; b2 += q.b2; c2 += q.c2;
+			ab += q.ab; ac += q.ac; bc += q.bc;
+			ad += q.ad; bd += q.bd; cd += q.cd;
+			d2 += q.d2;
+			weight += q.weight;
+		}
+
+		//weighted mean squared distance of p to the planes
+		double evaluate(const glm::vec3& point) const
+		{
+			double x = point.x, y = point.y, z = point.z;
+			double sum = a2 * x * x + b2 * y * y + c2 * z * z + 2.0 * (ab * x * y + ac * x * z + bc * y * z) +
+				2.0 * (ad * x + bd * y + cd * z) + d2;
+			return weight > 0.0 ? std::max(sum, 0.0) / weight : 0.0;
+		}
+	};
+
+	struct PositionHash
+	{
+		size_t operator()(const glm::vec3& p) const
+		{
+			return static_cast<size_t>(HashUtils::XXHash64(&p, sizeof(p)));
+		}
+	};
+
+	struct PositionEqual
+	{
+		bool operator()(const glm::vec3& a, const glm::vec3& b) const
+		{
+			return std::memcmp(&a, &b, sizeof(glm::vec3)) == 0;
+		}
+	};
+
+	uint64_t edgeKey(unsigned int from, unsigned int to)
+	{
+		return (uint64_t(from) << 32) | to;
+	}
+
+	//Edge collapse state of one mesh. Positions shared by several vertices (seams) are tracked once, the collapses
+	//themselves move whole vertices, which always sit alone at their position
+	class Simplifier
+	{
+	public:
+		Simplifier(const std::vector<Vertex>& vertices, const std::vector<unsigned int>& indices);
+
+		//Collapses until at most targetIndexCount indices are left, false if it got stuck above that
+		bool reduce(size_t targetIndexCount);
+		const std::vector<unsigned int>& getIndices() const { return indices; }
+		float getError() const { return static_cast<float>(std::sqrt(maxCost)); }
+
+	private:
+		struct Collapse
+		{
+			unsigned int from;
+			unsigned int to;
+			double cost;
+		};
+
+		const std::vector<Vertex>& vertices;
+		std::vector<unsigned int> indices;
+		std::vector<unsigned int> positions;		// per vertex, the first vertex at the same position
+		std::vector<uint8_t> kinds;					// per position
+		std::vector<Quadric> quadrics;				// per position
+		double normalWeight = 0.0;					// squared, per squared difference
+		double texCoordWeight = 0.0;
+		double maxCost = 0.0;
+		bool hasBorders = false;
+
+		// rebuilt every pass
+		std::vector<unsigned int> adjacencyOffsets;
+		std::vector<unsigned int> adjacency;
+		std::unordered_set<uint64_t> edges;			// directed, between positions
+
+		void classify();
+		void buildQuadrics();
+		void buildAdjacency();
+		bool isBorderEdge(unsigned int a, unsigned int b) const;
+		bool canCollapse(unsigned int from, unsigned int to) const;
+		double cost(unsigned int from, unsigned int to) const;
+		//false if moving from onto to would flip or squash one of from's triangles, counts the ones that disappear
+		bool keepsOrientation(unsigned int from, unsigned int to, size_t& removedTriangles) const;
+	};
+
+	Simplifier::Simplifier(const std::vector<Vertex>& vertices, const std::vector<unsigned int>& indices)
+		: vertices(vertices), indices(indices), positions(vertices.size())
+	{
+		std::unordered_map<glm::vec3, unsigned int, PositionHash, PositionEqual> firstAt;
+		firstAt.reserve(vertices.size());
+		for (size_t i = 0; i < vertices.size(); i++)
+			positions[i] = firstAt.emplace(vertices[i].Position, static_cast<unsigned int>(i)).first->second;
+
+		// attribute costs in squared distance units, relative to the size of the mesh and of its UV layout
+		glm::vec3 boundsMin(std::numeric_limits<float>::max()), boundsMax(-std::numeric_limits<float>::max());
+		glm::vec2 uvMin(std::numeric_limits<float>::max()), uvMax(-std::numeric_limits<float>::max());
+		for (unsigned int index : indices)
+		{
+			boundsMin = glm::min(boundsMin, vertices[index].Position);
+			boundsMax = glm::max(boundsMax, vertices[index].Position);
+			uvMin = glm::min(uvMin, vertices[index].TexCoords);
+			uvMax = glm::max(uvMax, vertices[index].TexCoords);
+		}
+		if (!indices.empty())
+		{
+			double radius = glm::length(boundsMax - boundsMin) * 0.5;
+			double uvExtent = std::max(uvMax.x - uvMin.x, uvMax.y - uvMin.y);
+			normalWeight = NORMAL_WEIGHT * radius * NORMAL_WEIGHT * radius;
+			texCoordWeight = uvExtent > 0.0 ? (TEXCOORD_WEIGHT * radius / uvExtent) * (TEXCOORD_WEIGHT * radius / uvExtent) : 0.0;
+		}
+
+		classify();
+		buildQuadrics();
+	}
+
+	void Simplifier::classify()
+	{
+		kinds.assign(vertices.size(), Manifold);
+
+		// a position used by more than one vertex has a seam or crease through it
+		std::vector<unsigned int> wedge(vertices.size(), ~0u);
+		for (unsigned int index : indices)
+		{
+			unsigned int position = positions[index];
+			if (wedge[position] == ~0u)
+				wedge[position] = index;
+			else if (wedge[position] != index)
+				kinds[position] = Locked;
+		}
+
+		// an edge used once in each direction is interior, once in one direction a border, anything else is locked
+		std::unordered_map<uint64_t, unsigned int> edgeUses;
+		edgeUses.reserve(indices.size());
+		for (size_t i = 0; i < indices.size(); i += 3)
+		{
+			for (int e = 0; e < 3; e++)
+				edgeUses[edgeKey(positions[indices[i + e]], positions[indices[i + (e + 1) % 3]])]++;
+		}
+		std::vector<unsigned int> borderEdges(vertices.size(), 0);
+		for (const auto& edge : edgeUses)
+		{
+			unsigned int from = static_cast<unsigned int>(edge.first >> 32);
+			unsigned int to = static_cast<unsigned int>(edge.first & 0xffffffffu);
+			if (edge.second > 1 || from == to)
+			{
+				kinds[from] = kinds[to] = Locked;
+				continue;
+			}
+			if (edgeUses.find(edgeKey(to, from)) == edgeUses.end())
+			{
+				borderEdges[from]++;
+				borderEdges[to]++;
+			}
+		}
+
+		// on a simple border loop a vertex has one edge in and one out, corners where loops touch stay put
+		for (size_t position = 0; position < vertices.size(); position++)
+		{
+			if (borderEdges[position] == 0 || kinds[position] == Locked)
+				continue;
+			kinds[position] = borderEdges[position] == 2 ? Border : Locked;
+			hasBorders = hasBorders || kinds[position] == Border;
+		}
+	}
+
+	void Simplifier::buildQuadrics()
+	{
+		quadrics.assign(vertices.size(), Quadric());
+		buildAdjacency();
+
+		for (size_t i = 0; i < indices.size(); i += 3)
+		{
+			unsigned int corners[3] = { positions[indices[i]], positions[indices[i + 1]], positions[indices[i + 2]] };
+			glm::dvec3 p0(vertices[corners[0]].Position), p1(vertices[corners[1]].Position), p2(vertices[corners[2]].Position);
+			glm::dvec3 normal = glm::cross(p1 - p0, p2 - p0);
+			double doubleArea = glm::length(normal);
+			if (doubleArea <= 0.0)
+				continue;
+			normal /= doubleArea;
+
+			// weighted by area so a few slivers can't outvote the large faces around them
+			Quadric plane;
+			plane.addPlane(normal, -glm::dot(normal, p0), doubleArea * 0.5);
+			for (unsigned int corner : corners)
+				quadrics[corner].add(plane);
+
+			for (int e = 0; e < 3 && hasBorders; e++)
+			{
+				unsigned int from = corners[e], to = corners[(e + 1) % 3];
+				if (!isBorderEdge(from, to))
+					continue;
+				glm::dvec3 a(vertices[from].Position), b(vertices[to].Position);
+				glm::dvec3 edgeNormal = glm::cross(b - a, normal);
+				double length = glm::length(edgeNormal);
+				if (length <= 0.0)
+					continue;
+				edgeNormal /= length;
+				Quadric border;
+				border.addPlane(edgeNormal, -glm::dot(edgeNormal, a), glm::dot(b - a, b - a) * BORDER_WEIGHT);
+				quadrics[from].add(border);
+				quadrics[to].add(border);
+			}
+		}
+	}
+
+	void Simplifier::buildAdjacency()
+	{
+		adjacencyOffsets.assign(vertices.size() + 1, 0);
+		for (unsigned int index : indices)
+			adjacencyOffsets[index + 1]++;
+		for (size_t v = 0; v < vertices.size(); v++)
+			adjacencyOffsets[v + 1] += adjacencyOffsets[v];
+		adjacency.resize(indices.size());
+		std::vector<unsigned int> cursor(adjacencyOffsets.begin(), adjacencyOffsets.end() - 1);
+		for (size_t i = 0; i < indices.size(); i++)
+			adjacency[cursor[indices[i]]++] = static_cast<unsigned int>(i / 3);
+
+		// only border collapses look at the edges
+		edges.clear();
+		if (!hasBorders)
+			return;
+		edges.reserve(indices.size());
+		for (size_t i = 0; i < indices.size(); i += 3)
+		{
+			for (int e = 0; e < 3; e++)
+				edges.insert(edgeKey(positions[indices[i + e]], positions[indices[i + (e + 1) % 3]]));
+		}
+	}
+
+	bool Simplifier::isBorderEdge(unsigned int a, unsigned int b) const
+	{
+		bool forward = edges.count(edgeKey(a, b)) != 0;
+		bool backward = edges.count(edgeKey(b, a)) != 0;
+		return forward != backward;
+	}
+
+	bool Simplifier::canCollapse(unsigned int from, unsigned int to) const
+	{
+		unsigned int fromPosition = positions[from];
+		if (fromPosition == positions[to])
+			return false;
+		switch (kinds[fromPosition])
+		{
+		case Manifold:
+			return true;
+		case Border:
+			return kinds[positions[to]] != Manifold && isBorderEdge(fromPosition, positions[to]);
+		default:
+			return false;
+		}
+	}
+
+	double Simplifier::cost(unsigned int from, unsigned int to) const
+	{
+		Quadric merged = quadrics[positions[from]];
+		merged.add(quadrics[positions[to]]);
+
+		// from's triangles take on to's normal and texture coordinates
+		glm::vec3 normalDelta = vertices[from].Normal - vertices[to].Normal;
+		glm::vec2 texCoordDelta = vertices[from].TexCoords - vertices[to].TexCoords;
+		return merged.evaluate(vertices[to].Position) + normalWeight * glm::dot(normalDelta, normalDelta) +
+			texCoordWeight * glm::dot(texCoordDelta, texCoordDelta);
+	}
+
+	bool Simplifier::keepsOrientation(unsigned int from, unsigned int to, size_t& removedTriangles) const
+	{
+		const unsigned int toPosition = positions[to];
+		const glm::vec3 target = vertices[to].Position;
+		removedTriangles = 0;
+		for (unsigned int t = adjacencyOffsets[from]; t < adjacencyOffsets[from + 1]; t++)
+		{
+			const unsigned int* triangle = &indices[adjacency[t] * 3];
+			if (positions[triangle[0]] == toPosition || positions[triangle[1]] == toPosition || positions[triangle[2]] == toPosition)
+			{
+				removedTriangles++;
+				continue;
+			}
+
+			glm::vec3 before[3], after[3];
+			for (int c = 0; c < 3; c++)
+			{
+				before[c] = vertices[triangle[c]].Position;
+				after[c] = triangle[c] == from ? target : before[c];
+			}
+			glm::vec3 normalBefore = glm::cross(before[1] - before[0], before[2] - before[0]);
+			glm::vec3 normalAfter = glm::cross(after[1] - after[0], after[2] - after[0]);
+			float lengths = glm::length(normalBefore) * glm::length(normalAfter);
+			if (lengths <= 0.0f || glm::dot(normalBefore, normalAfter) < MIN_NORMAL_COSINE * lengths)
+				return false;
+		}
+		return true;
+	}
+
+	bool Simplifier::reduce(size_t targetIndexCount)
+	{
+		std::vector<Collapse> collapses;
+		std::vector<unsigned int> bestTarget(vertices.size());
+		std::vector<double> bestCost(vertices.size());
+		std::vector<uint8_t> touched(vertices.size());
+		std::vector<unsigned int> collapseTo(vertices.size());
+
+		while (indices.size() > targetIndexCount)
+		{
+			buildAdjacency();
+
+			// every vertex's cheapest way out
+			std::fill(bestTarget.begin(), bestTarget.end(), ~0u);
+			std::fill(bestCost.begin(), bestCost.end(), std::numeric_limits<double>::max());
+			for (size_t i = 0; i < indices.size(); i += 3)
+			{
+				for (int e = 0; e < 6; e++)
+				{
+					unsigned int from = indices[i + e % 3];
+					unsigned int to = indices[i + (e < 3 ? (e + 1) % 3 : (e + 2) % 3)];
+					if (!canCollapse(from, to))
+						continue;
+					double c = cost(from, to);
+					if (c < bestCost[from])
+					{
+						bestCost[from] = c;
+						bestTarget[from] = to;
+					}
+				}
+			}
+			collapses.clear();
+			for (size_t v = 0; v < vertices.size(); v++)
+			{
+				if (bestTarget[v] != ~0u)
+					collapses.push_back({ static_cast<unsigned int>(v), bestTarget[v], bestCost[v] });
+			}
+			std::sort(collapses.begin(), collapses.end(), [](const Collapse& a, const Collapse& b) { return a.cost < b.cost; });
+
+			// cheapest first until enough triangles go. a collapse freezes the neighbourhood it changed for the rest
+			// of the pass, the costs and orientation checks of what's left stay exact
+			const size_t goal = (indices.size() - targetIndexCount + 2) / 3;
+			size_t removed = 0;
+			size_t performed = 0;
+			std::fill(touched.begin(), touched.end(), 0);
+			for (size_t v = 0; v < vertices.size(); v++)
+				collapseTo[v] = static_cast<unsigned int>(v);
+			for (const Collapse& collapse : collapses)
+			{
+				if (removed >= goal)
+					break;
+				if (touched[collapse.from] || touched[collapse.to])
+					continue;
+				size_t removedTriangles = 0;
+				if (!keepsOrientation(collapse.from, collapse.to, removedTriangles))
+					continue;
+
+				collapseTo[collapse.from] = collapse.to;
+				quadrics[positions[collapse.to]].add(quadrics[positions[collapse.from]]);
+				maxCost = std::max(maxCost, collapse.cost);
+				for (unsigned int t = adjacencyOffsets[collapse.from]; t < adjacencyOffsets[collapse.from + 1]; t++)
+				{
+					const unsigned int* triangle = &indices[adjacency[t] * 3];
+					touched[triangle[0]] = touched[triangle[1]] = touched[triangle[2]] = 1;
+				}
+				removed += removedTriangles;
+				performed++;
+			}
+			if (performed == 0)
+				return false;
+
+			// remap and drop the triangles that lost their area
+			size_t write = 0;
+			for (size_t i = 0; i < indices.size(); i += 3)
+			{
+				unsigned int a = collapseTo[indices[i]], b = collapseTo[indices[i + 1]], c = collapseTo[indices[i + 2]];
+				if (positions[a] == positions[b] || positions[b] == positions[c] || positions[a] == positions[c])
+					continue;
+				indices[write++] = a;
+				indices[write++] = b;
+				indices[write++] = c;
+			}
+			indices.resize(write);
+		}
+		return true;
+	}
+}
+
+namespace MeshSimplifier
+{
+	float Simplify(const std::vector<Vertex>& vertices, std::vector<unsigned int>& indices, size_t targetIndexCount)
+	{
+		Simplifier simplifier(vertices, indices);
+		simplifier.reduce(targetIndexCount);
+		indices = simplifier.getIndices();
+		return simplifier.getError();
+	}
+
+	MeshLodStats GenerateLods(MeshData& mesh)
+	{
+		MeshLodStats stats;
+		mesh.lods.clear();
+		mesh.lodIndices.clear();
+		stats.triangleCounts[0] = mesh.indices.size() / 3;
+		if (stats.triangleCounts[0] < MIN_LOD_TRIANGLES)
+			return stats;
+
+		// one run of collapses, each level is a snapshot on the way down, so the quadrics keep measuring against
+		// the full detail surface
+		Simplifier simplifier(mesh.vertices, mesh.indices);
+		size_t previousCount = mesh.indices.size();
+		for (int level = 1; level < MAX_MESH_LODS; level++)
+		{
+			size_t target = static_cast<size_t>(previousCount / 3 * LOD_REDUCTION) * 3;
+			simplifier.reduce(target);
+			std::vector<unsigned int> levelIndices = simplifier.getIndices();
+			if (levelIndices.empty() || levelIndices.size() > previousCount * MIN_LOD_REDUCTION)
+				break;
+
+			std::vector<size_t> clusterStarts;
+			MeshOptimizer::OptimizeVertexCache(levelIndices, mesh.vertices.size(), clusterStarts);
+			mesh.lods.push_back({ static_cast<uint32_t>(mesh.lodIndices.size()), static_cast<uint32_t>(levelIndices.size()), simplifier.getError() });
+			mesh.lodIndices.insert(mesh.lodIndices.end(), levelIndices.begin(), levelIndices.end());
+
+			stats.triangleCounts[level] = levelIndices.size() / 3;
+			stats.errors[level] = simplifier.getError();
+			stats.levelCount = level + 1;
+			previousCount = levelIndices.size();
+		}
+		return stats;
+	}
+
+	void GenerateLods(std::vector<MeshData>& meshes, const std::string& label)
+	{
+		auto start = std::chrono::steady_clock::now();
+		std::vector<MeshLodStats> stats(meshes.size());
+		ThreadPool::getShared().parallelFor(meshes.size(), [&](size_t i)
+			{
+				stats[i] = GenerateLods(meshes[i]);
+			});
+		std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+
+		// meshes with fewer levels count at their coarsest in the ones they lack
+		size_t triangles[MAX_MESH_LODS] = {};
+		size_t reducedMeshes = 0;
+		for (const MeshLodStats& mesh : stats)
+		{
+			for (int level = 0; level < MAX_MESH_LODS; level++)
+				triangles[level] += mesh.triangleCounts[std::min(level, static_cast<int>(mesh.levelCount) - 1)];
+			reducedMeshes += mesh.levelCount > 1 ? 1 : 0;
+		}
+		std::printf("MeshSimplifier: %s: %zu of %zu meshes reduced, LOD triangles %zu / %zu / %zu / %zu in %.1f ms\n", label.c_str(),
+			reducedMeshes, meshes.size(), triangles[0], triangles[1], triangles[2], triangles[3], elapsed.count());
+	}
+}
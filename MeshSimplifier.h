@@ -0,0 +1,33 @@
+#pragma once
+#include "Mesh.h"
+#include <cstddef>
+#include <string>
+#include <vector>
+
+//What MeshSimplifier::GenerateLods built for one mesh
+struct MeshLodStats
+{
+	size_t levelCount = 1;
+	size_t triangleCounts[MAX_MESH_LODS] = {};
+	float errors[MAX_MESH_LODS] = {};
+};
+
+//Import time level of detail generation. Edges are collapsed by quadric error (Garland and Heckbert 1997) onto one of
+//their existing vertices, so every level is just another index list over the mesh's own vertex buffer. Normal and
+//texture coordinate differences add to a collapse's cost, vertices on UV seams and normal creases (several vertices at
+//one position) never move and open borders only slide along themselves, which keeps seams, shading and the outline of
+//open meshes intact. Run after MeshOptimizer: Assimp and OBJ imports keep the levels in the mesh cache with the rest of
+//the geometry, decoded glTF primitives aren't cached and get theirs on every load
+namespace MeshSimplifier
+{
+	//Collapses edges of indices until at most targetIndexCount are left or nothing else can go within the rules above.
+	//Returns the error reached, in the mesh's local units
+	float Simplify(const std::vector<Vertex>& vertices, std::vector<unsigned int>& indices, size_t targetIndexCount);
+
+	//Replaces mesh.lods and mesh.lodIndices with up to MAX_MESH_LODS - 1 reduced levels, each about half of the one
+	//before and ordered for the vertex cache. Stops early once a level no longer pays for its indices
+	MeshLodStats GenerateLods(MeshData& mesh);
+
+	//GenerateLods on every mesh in parallel, printing the triangles per level of the lot under label
+	void GenerateLods(std::vector<MeshData>& meshes, const std::string& label);
+}
@@ -0,0 +1,268 @@
+#include "MeshletBuilder.h"
+#include "ThreadPool.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <unordered_map>
+
+namespace
+{
+	// meshes with fewer triangles than a couple of meshlets are drawn whole
+	const size_t MIN_MESHLET_MESH_TRIANGLES = MESHLET_MAX_TRIANGLES * 2;
+	// cones wider than this (cosine of the spread from the axis) can't be culled from anywhere worth testing
+	const float MIN_CONE_COSINE = 0.1f;
+
+	//vertex -> triangles that use it, as offsets into one flat array
+	struct TriangleAdjacency
+	{
+		std::vector<unsigned int> offsets;
+		std::vector<unsigned int> triangles;
+
+		TriangleAdjacency(const std::vector<unsigned int>& indices, size_t vertexCount)
+			: offsets(vertexCount + 1, 0), triangles(indices.size())
+		{
+			for (unsigned int index : indices)
+				offsets[index + 1]++;
+			for (size_t v = 0; v < vertexCount; v++)
+				offsets[v + 1] += offsets[v];
+
+			std::vector<unsigned int> cursor(offsets.begin(), offsets.end() - 1);
+			for (size_t i = 0; i < indices.size(); i++)
+				triangles[cursor[indices[i]]++] = static_cast<unsigned int>(i / 3);
+		}
+	};
+
+	// nothing turns off back faces in the renderer, so a cluster facing away only vanishes unseen when the mesh is
+	// closed (its front hides it) and wound the way its normals point (what faces away really is its back). positions
+	// are welded first, UV seams and normal creases split vertices but don't open the surface
+	bool conesAllowed(const std::vector<Vertex>& vertices, const std::vector<unsigned int>& indices)
+	{
+		std::vector<unsigned int> welded(vertices.size());
+		std::unordered_map<uint64_t, unsigned int> positions;
+		positions.reserve(vertices.size());
+		for (size_t v = 0; v < vertices.size(); v++)
+		{
+			uint32_t bits[3];
+			std::memcpy(bits, &vertices[v].Position, sizeof(bits));
+			uint64_t key = (uint64_t(bits[0]) * 0x9E3779B97F4A7C15ull) ^ (uint64_t(bits[1]) * 0xC2B2AE3D27D4EB4Full) ^ bits[2];
+			// a hash collision merges two positions, which can only hide a border and keep the cones off
+			welded[v] = positions.emplace(key, static_cast<unsigned int>(positions.size())).first->second;
+		}
+
+		std::unordered_map<uint64_t, uint32_t> edges;
+		edges.reserve(indices.size());
+		for (size_t t = 0; t + 2 < indices.size(); t += 3)
+		{
+			const glm::vec3& p0 = vertices[indices[t]].Position;
+			glm::vec3 normal = glm::cross(vertices[indices[t + 1]].Position - p0, vertices[indices[t + 2]].Position - p0);
+			glm::vec3 shading = vertices[indices[t]].Normal + vertices[indices[t + 1]].Normal + vertices[indices[t + 2]].Normal;
+			if (glm::dot(normal, shading) < 0.0f)
+				return false;
+
+			for (int c = 0; c < 3; c++)
+			{
+				uint64_t a = welded[indices[t + c]], b = welded[indices[t + (c + 1) % 3]];
+				if (a != b)
+					edges[a < b ? (a << 32) | b : (b << 32) | a]++;
+			}
+		}
+		for (const auto& edge : edges)
+		{
+			if (edge.second < 2)
+				return false;
+		}
+		return true;
+	}
+
+	// bounding sphere around the box of the vertices, and the cone around the average of the triangle normals
+	Meshlet computeBounds(const std::vector<Vertex>& vertices, const unsigned int* indices, size_t triangleCount, bool cone)
+	{
+		Meshlet meshlet = {};
+		glm::vec3 boundsMin = vertices[indices[0]].Position, boundsMax = boundsMin;
+		for (size_t i = 0; i < triangleCount * 3; i++)
+		{
+			boundsMin = glm::min(boundsMin, vertices[indices[i]].Position);
+			boundsMax = glm::max(boundsMax, vertices[indices[i]].Position);
+		}
+		meshlet.center = (boundsMin + boundsMax) * 0.5f;
+		float radiusSquared = 0.0f;
+		for (size_t i = 0; i < triangleCount * 3; i++)
+		{
+			glm::vec3 offset = vertices[indices[i]].Position - meshlet.center;
+			radiusSquared = std::max(radiusSquared, glm::dot(offset, offset));
+		}
+		meshlet.radius = std::sqrt(radiusSquared);
+
+		std::vector<glm::vec3> normals;
+		normals.reserve(triangleCount);
+		glm::vec3 normalSum(0.0f);
+		for (size_t t = 0; t < triangleCount; t++)
+		{
+			const glm::vec3& p0 = vertices[indices[t * 3]].Position;
+			glm::vec3 normal = glm::cross(vertices[indices[t * 3 + 1]].Position - p0, vertices[indices[t * 3 + 2]].Position - p0);
+			float length = glm::length(normal);
+			if (length <= 0.0f)
+				continue;	// no facing, can't be culled by it either
+			normals.push_back(normal / length);
+			normalSum += normal / length;
+		}
+
+		// the cone is never culled unless every normal is well within it
+		meshlet.coneAxis = glm::vec3(0.0f, 0.0f, 1.0f);
+		meshlet.coneCutoff = 1.0f;
+		if (!cone)
+			return meshlet;
+		float sumLength = glm::length(normalSum);
+		if (sumLength <= 0.0f)
+			return meshlet;
+		glm::vec3 axis = normalSum / sumLength;
+		float minCosine = 1.0f;
+		for (const glm::vec3& normal : normals)
+			minCosine = std::min(minCosine, glm::dot(normal, axis));
+		meshlet.coneAxis = axis;
+		if (minCosine > MIN_CONE_COSINE)
+			meshlet.coneCutoff = std::sqrt(1.0f - minCosine * minCosine);
+		return meshlet;
+	}
+}
+
+namespace MeshletBuilder
+{
+	size_t Build(MeshData& mesh)
+	{
+		mesh.meshlets.clear();
+		const size_t triangleCount = mesh.indices.size() / 3;
+		if (triangleCount < MIN_MESHLET_MESH_TRIANGLES)
+			return 0;
+
+		const std::vector<unsigned int>& indices = mesh.indices;
+		const size_t vertexCount = mesh.vertices.size();
+		TriangleAdjacency adjacency(indices, vertexCount);
+		const bool cones = conesAllowed(mesh.vertices, indices);
+
+		std::vector<glm::vec3> triangleNormals(triangleCount, glm::vec3(0.0f));
+		for (size_t t = 0; t < triangleCount; t++)
+		{
+			const glm::vec3& p0 = mesh.vertices[indices[t * 3]].Position;
+			glm::vec3 normal = glm::cross(mesh.vertices[indices[t * 3 + 1]].Position - p0, mesh.vertices[indices[t * 3 + 2]].Position - p0);
+			float length = glm::length(normal);
+			triangleNormals[t] = length > 0.0f ? normal / length : glm::vec3(0.0f);
+		}
+
+		std::vector<uint8_t> used(triangleCount, 0);
+		std::vector<unsigned int> inMeshlet(vertexCount, ~0u);	// meshlet a vertex was last added to
+		std::vector<unsigned int> reordered;
+		reordered.reserve(indices.size());
+		std::vector<unsigned int> candidates;
+		size_t seed = 0;
+
+		for (unsigned int meshletIndex = 0; ; meshletIndex++)
+		{
+			while (seed < triangleCount && used[seed])
+				seed++;
+			if (seed == triangleCount)
+				break;
+
+			const size_t firstIndex = reordered.size();
+			size_t meshletVertices = 0;
+			size_t meshletTriangles = 0;
+			glm::vec3 normalSum(0.0f);
+			candidates.clear();
+
+			auto newVertices = [&](size_t triangle)
+				{
+					size_t count = 0;
+					for (int c = 0; c < 3; c++)
+						count += inMeshlet[indices[triangle * 3 + c]] != meshletIndex ? 1 : 0;
+					return count;
+				};
+			auto add = [&](size_t triangle)
+				{
+					used[triangle] = 1;
+					for (int c = 0; c < 3; c++)
+					{
+						unsigned int vertex = indices[triangle * 3 + c];
+						reordered.push_back(vertex);
+						if (inMeshlet[vertex] == meshletIndex)
+							continue;
+						inMeshlet[vertex] = meshletIndex;
+						meshletVertices++;
+						for (unsigned int a = adjacency.offsets[vertex]; a < adjacency.offsets[vertex + 1]; a++)
+						{
+							if (!used[adjacency.triangles[a]])
+								candidates.push_back(adjacency.triangles[a]);
+						}
+					}
+					normalSum += triangleNormals[triangle];
+					meshletTriangles++;
+				};
+
+			add(seed);
+			while (meshletTriangles < MESHLET_MAX_TRIANGLES)
+			{
+				// fewest new vertices first, then the one facing most like the cluster. a triangle adding nothing
+				// new is as good as it gets
+				size_t best = ~size_t(0);
+				size_t bestNew = 4;
+				float bestFacing = -2.0f;
+				size_t write = 0;
+				for (size_t i = 0; i < candidates.size(); i++)
+				{
+					unsigned int triangle = candidates[i];
+					if (used[triangle])
+						continue;
+					candidates[write++] = triangle;
+					size_t added = newVertices(triangle);
+					if (meshletVertices + added > MESHLET_MAX_VERTICES)
+						continue;
+					float facing = glm::dot(triangleNormals[triangle], normalSum);
+					if (added < bestNew || (added == bestNew && facing > bestFacing))
+					{
+						best = triangle;
+						bestNew = added;
+						bestFacing = facing;
+					}
+				}
+				candidates.resize(write);
+				if (best == ~size_t(0))
+					break;
+				add(best);
+			}
+
+			Meshlet meshlet = computeBounds(mesh.vertices, reordered.data() + firstIndex, meshletTriangles, cones);
+			meshlet.firstIndex = static_cast<uint32_t>(firstIndex);
+			meshlet.triangleCount = static_cast<uint32_t>(meshletTriangles);
+			mesh.meshlets.push_back(meshlet);
+		}
+
+		mesh.indices.swap(reordered);
+		return mesh.meshlets.size();
+	}
+
+	void Build(std::vector<MeshData>& meshes, const std::string& label)
+	{
+		auto start = std::chrono::steady_clock::now();
+		std::vector<size_t> counts(meshes.size());
+		ThreadPool::getShared().parallelFor(meshes.size(), [&](size_t i)
+			{
+				counts[i] = Build(meshes[i]);
+			});
+		std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+
+		size_t meshlets = 0, splitMeshes = 0, triangles = 0, coneMeshlets = 0;
+		for (size_t i = 0; i < meshes.size(); i++)
+		{
+			meshlets += counts[i];
+			splitMeshes += counts[i] > 0 ? 1 : 0;
+			for (const Meshlet& meshlet : meshes[i].meshlets)
+			{
+				triangles += meshlet.triangleCount;
+				coneMeshlets += meshlet.coneCutoff < 1.0f ? 1 : 0;
+			}
+		}
+		std::printf("MeshletBuilder: %s: %zu meshlets in %zu of %zu meshes, %.1f triangles each, %zu with a cullable cone, in %.1f ms\n",
+			label.c_str(), meshlets, splitMeshes, meshes.size(), meshlets > 0 ? double(triangles) / meshlets : 0.0, coneMeshlets, elapsed.count());
+	}
+}
@@ -0,0 +1,21 @@
+#pragma once
+#include "Mesh.h"
+#include <cstddef>
+#include <string>
+#include <vector>
+
+//Import time meshlet clustering. Triangles are grown greedily into clusters of at most MESHLET_MAX_VERTICES vertices
+//and MESHLET_MAX_TRIANGLES triangles, each one started from the next unused triangle of the vertex cache order and
+//extended by the neighbouring triangle that adds the fewest new vertices, facing most like the cluster so far. The
+//full detail indices are rewritten cluster after cluster, so a meshlet is just a range of them. Run after
+//MeshOptimizer and next to MeshSimplifier, the meshlets are kept wherever the levels of detail are
+namespace MeshletBuilder
+{
+	//Reorders mesh.indices into meshlets and fills mesh.meshlets with their ranges, bounding spheres and normal cones.
+	//Cones are only given to closed meshes wound like their normals, the rest never cull as backfacing.
+	//Returns the number of meshlets, 0 for meshes too small to be worth splitting
+	size_t Build(MeshData& mesh);
+
+	//Build on every mesh in parallel, printing the totals under label
+	void Build(std::vector<MeshData>& meshes, const std::string& label);
+}
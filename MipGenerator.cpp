@@ -0,0 +1,253 @@
+#include "MipGenerator.h"
+#include <algorithm>
+#include <cmath>
+
+#if defined(_M_X64) || defined(__SSE2__)
+#include <xmmintrin.h>
+#define MIP_GENERATOR_SSE 1
+#endif
+
+namespace
+{
+	const float PI = 3.14159265359f;
+	const float FILTER_RADIUS = 2.0f;	// in destination texels, so 8 taps for a 2:1 reduction
+	const float KAISER_ALPHA = 4.0f;
+
+	//weights of one separable pass, tapCount entries per destination texel. indices are already wrapped
+	//because every model texture is sampled with GL_REPEAT
+	struct FilterTaps
+	{
+		int tapCount = 0;
+		std::vector<int> indices;
+		std::vector<float> weights;
+	};
+
+	float besselI0(float x)
+	{
+		float sum = 1.0f;
+		float term = 1.0f;
+		for (int k = 1; k < 20; k++)
+		{
+			float factor = x / (2.0f * k);
+			term *= factor * factor;
+			sum += term;
+		}
+		return sum;
+	}
+
+	float sinc(float x)
+	{
+		if (std::fabs(x) < 1e-5f)
+			return 1.0f;
+		x *= PI;
+		return std::sin(x) / x;
+	}
+
+	float kaiserSinc(float x)
+	{
+		float t = x / FILTER_RADIUS;
+		float r = 1.0f - t * t;
+		if (r <= 0.0f)
+			return 0.0f;
+		return sinc(x) * besselI0(KAISER_ALPHA * std::sqrt(r)) / besselI0(KAISER_ALPHA);
+	}
+
+	FilterTaps buildTaps(int sourceSize, int destinationSize)
+	{
+		FilterTaps taps;
+		const float scale = float(sourceSize) / destinationSize;
+		const float support = FILTER_RADIUS * scale;
+		taps.tapCount = int(std::ceil(support * 2.0f)) + 1;
+		taps.indices.resize(size_t(destinationSize) * taps.tapCount);
+		taps.weights.resize(size_t(destinationSize) * taps.tapCount);
+
+		for (int d = 0; d < destinationSize; d++)
+		{
+			const float center = (d + 0.5f) * scale;
+			const int first = int(std::floor(center - support));
+			float sum = 0.0f;
+			for (int t = 0; t < taps.tapCount; t++)
+			{
+				int i = first + t;
+				float weight = kaiserSinc(((i + 0.5f) - center) / scale);
+				taps.indices[size_t(d) * taps.tapCount + t] = ((i % sourceSize) + sourceSize) % sourceSize;
+				taps.weights[size_t(d) * taps.tapCount + t] = weight;
+				sum += weight;
+			}
+			for (int t = 0; t < taps.tapCount; t++)
+				taps.weights[size_t(d) * taps.tapCount + t] /= sum;
+		}
+		return taps;
+	}
+
+	//accumulator += weight * source, over one RGBA texel
+	inline void accumulate(float* accumulator, const float* source, float weight)
+	{
+#ifdef MIP_GENERATOR_SSE
+		_mm_storeu_ps(accumulator, _mm_add_ps(_mm_loadu_ps(accumulator), _mm_mul_ps(_mm_loadu_ps(source), _mm_set1_ps(weight))));
+#else
+		for (int c = 0; c < 4; c++)
+			accumulator[c] += source[c] * weight;
+#endif
+	}
+
+	std::vector<float> downsample(const std::vector<float>& source, int width, int height, int nextWidth, int nextHeight)
+	{
+		//horizontal pass into a nextWidth x height temporary
+		const FilterTaps horizontal = buildTaps(width, nextWidth);
+		std::vector<float> temporary(size_t(nextWidth) * height * 4, 0.0f);
+		for (int y = 0; y < height; y++)
+		{
+			const float* sourceRow = &source[size_t(y) * width * 4];
+			float* destinationRow = &temporary[size_t(y) * nextWidth * 4];
+			for (int x = 0; x < nextWidth; x++)
+			{
+				const int* indices = &horizontal.indices[size_t(x) * horizontal.tapCount];
+				const float* weights = &horizontal.weights[size_t(x) * horizontal.tapCount];
+				for (int t = 0; t < horizontal.tapCount; t++)
+					accumulate(destinationRow + x * 4, sourceRow + size_t(indices[t]) * 4, weights[t]);
+			}
+		}
+
+		//vertical pass, whole rows at a time so the loads stay sequential
+		const FilterTaps vertical = buildTaps(height, nextHeight);
+		std::vector<float> result(size_t(nextWidth) * nextHeight * 4, 0.0f);
+		for (int y = 0; y < nextHeight; y++)
+		{
+			float* destinationRow = &result[size_t(y) * nextWidth * 4];
+			for (int t = 0; t < vertical.tapCount; t++)
+			{
+				const float* sourceRow = &temporary[size_t(vertical.indices[size_t(y) * vertical.tapCount + t]) * nextWidth * 4];
+				const float weight = vertical.weights[size_t(y) * vertical.tapCount + t];
+				for (int x = 0; x < nextWidth; x++)
+					accumulate(destinationRow + x * 4, sourceRow + x * 4, weight);
+			}
+		}
+		return result;
+	}
+
+	float srgbToLinear(float value)
+	{
+		return value <= 0.04045f ? value / 12.92f : std::pow((value + 0.055f) / 1.055f, 2.4f);
+	}
+
+	float linearToSrgb(float value)
+	{
+		return value <= 0.0031308f ? value * 12.92f : 1.055f * std::pow(value, 1.0f / 2.4f) - 0.055f;
+	}
+
+	std::vector<float> toFloat(const uint8_t* rgba, size_t texelCount, MipContent content)
+	{
+		float srgbTable[256];
+		for (int i = 0; i < 256; i++)
+			srgbTable[i] = srgbToLinear(i / 255.0f);
+
+		std::vector<float> result(texelCount * 4);
+		for (size_t i = 0; i < texelCount * 4; i++)
+		{
+			const bool isAlpha = (i & 3) == 3;
+			if (content == MipContent::SRGBColor && !isAlpha)
+				result[i] = srgbTable[rgba[i]];
+			else if (content == MipContent::Normal && !isAlpha)
+				result[i] = rgba[i] / 127.5f - 1.0f;
+			else
+				result[i] = rgba[i] / 255.0f;
+		}
+		return result;
+	}
+
+	//clamps away the sinc ringing (or puts normals back on the unit sphere) so the next level starts from valid data
+	void normalizeLevel(std::vector<float>& level, MipContent content)
+	{
+		for (size_t i = 0; i < level.size(); i += 4)
+		{
+			float* texel = &level[i];
+			if (content == MipContent::Normal)
+			{
+				float length = std::sqrt(texel[0] * texel[0] + texel[1] * texel[1] + texel[2] * texel[2]);
+				if (length > 1e-6f)
+				{
+					texel[0] /= length;
+					texel[1] /= length;
+					texel[2] /= length;
+				}
+				else
+				{
+					texel[0] = texel[1] = 0.0f;
+					texel[2] = 1.0f;
+				}
+			}
+			else
+			{
+				for (int c = 0; c < 3; c++)
+					texel[c] = std::clamp(texel[c], 0.0f, 1.0f);
+			}
+			texel[3] = std::clamp(texel[3], 0.0f, 1.0f);
+		}
+	}
+
+	std::vector<uint8_t> toBytes(const std::vector<float>& level, MipContent content)
+	{
+		std::vector<uint8_t> result(level.size());
+		for (size_t i = 0; i < level.size(); i++)
+		{
+			const bool isAlpha = (i & 3) == 3;
+			float value = level[i];
+			if (content == MipContent::SRGBColor && !isAlpha)
+				value = linearToSrgb(value);
+			else if (content == MipContent::Normal && !isAlpha)
+				value = value * 0.5f + 0.5f;
+			result[i] = uint8_t(std::clamp(std::lround(value * 255.0f), 0L, 255L));
+		}
+		return result;
+	}
+}
+
+namespace MipGenerator
+{
+	MipContent ContentForType(TextureType type)
+	{
+		switch (type)
+		{
+		case TextureType::DIFFUSE:
+		case TextureType::BASE_COLOR:
+			return MipContent::SRGBColor;
+		case TextureType::NORMAL:
+		case TextureType::HEIGHT:	// bound as the normal map
+			return MipContent::Normal;
+		default:
+			return MipContent::Linear;
+		}
+	}
+
+	std::vector<MipLevel> GenerateMipChain(const uint8_t* rgbaPixels, int width, int height, MipContent content)
+	{
+		std::vector<MipLevel> levels;
+		if (rgbaPixels == nullptr || width <= 0 || height <= 0)
+			return levels;
+
+		MipLevel top;
+		top.width = width;
+		top.height = height;
+		top.rgba.assign(rgbaPixels, rgbaPixels + size_t(width) * height * 4);
+		levels.push_back(std::move(top));
+
+		std::vector<float> level = toFloat(rgbaPixels, size_t(width) * height, content);
+		while (width > 1 || height > 1)
+		{
+			int nextWidth = std::max(1, width / 2);
+			int nextHeight = std::max(1, height / 2);
+			level = downsample(level, width, height, nextWidth, nextHeight);
+			normalizeLevel(level, content);
+			width = nextWidth;
+			height = nextHeight;
+
+			MipLevel mip;
+			mip.width = width;
+			mip.height = height;
+			mip.rgba = toBytes(level, content);
+			levels.push_back(std::move(mip));
+		}
+		return levels;
+	}
+}
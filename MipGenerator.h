@@ -0,0 +1,30 @@
+#pragma once
+#include "Texture.h"
+#include <cstdint>
+#include <vector>
+
+//How a texture's texels have to be treated while filtering
+enum class MipContent
+{
+	SRGBColor,	// albedo, filtered in linear light and encoded back to sRGB
+	Linear,		// masks (roughness/metallic, AO), filtered as stored
+	Normal,		// tangent space normals, filtered as vectors and renormalised
+};
+
+struct MipLevel
+{
+	int width = 0;
+	int height = 0;
+	std::vector<uint8_t> rgba;
+};
+
+//CPU mip chain generation with a separable Kaiser windowed sinc, vectorised with SSE over the RGBA channels.
+//Meant to run on loader threads, it never touches GL.
+namespace MipGenerator
+{
+	MipContent ContentForType(TextureType type);
+
+	//Builds every level from width x height down to 1x1 from tightly packed 8 bit RGBA. Level 0 is the source itself.
+	//Each level is filtered from the previous one in float, so rounding never accumulates down the chain.
+	std::vector<MipLevel> GenerateMipChain(const uint8_t* rgbaPixels, int width, int height, MipContent content);
+}
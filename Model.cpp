@@ -1,21 +1,351 @@
 #include "Model.h"
+#include "AssimpIO.h"
+#include "BVH.h"
+#include "GltfLoader.h"
+#include "HashUtils.h"
+#include "MeshCache.h"
+#include "MeshOptimizer.h"
+#include "MeshSimplifier.h"
+#include "MeshletBuilder.h"
+#include "ObjLoader.h"
+#include "TangentSpace.h"
+#include "ThreadPool.h"
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <unordered_map>
+#include <unordered_set>
+#include <xmmintrin.h>
 
-Model::Model(std::string const& directoryOfModel, std::string const& modelPath, std::shared_ptr<ResourceManager> rManager, bool gamma)
-	: gammaCorrection(gamma),
+// Post-processing applied on a cold import. It's part of the mesh cache key, so changing it invalidates existing caches.
+// RemoveComponent strips what ImporterPool lists as unused before the other steps have to carry it. tangents are generated
+// by TangentSpace after the import, MikkTSpace style, instead of by aiProcess_CalcTangentSpace
+const unsigned int MODEL_IMPORT_FLAGS = aiProcess_RemoveComponent | aiProcess_Triangulate | aiProcess_FlipUVs;
+
+// Assimp texture type each MaterialTexturePaths slot is loaded as (albedo, normal, roughnessMetallic, ao)
+const aiTextureType MATERIAL_SLOT_TYPES[MaterialTexturePaths::SlotCount] =
+{
+	aiTextureType_BASE_COLOR,
+	aiTextureType_NORMALS,
+	aiTextureType_UNKNOWN,
+	aiTextureType_LIGHTMAP
+};
+
+// Share of getLoadProgress() taken by the import, the rest tracks the GPU uploads
+const float IMPORT_PROGRESS_SHARE = 0.25f;
+
+// Output of the CPU half of loading a model, see Model::importModel
+struct ModelImport
+{
+	explicit ModelImport(std::string const& path) : cache(path, MODEL_IMPORT_FLAGS) {}
+
+	MeshCache cache;					// mapped geometry on a warm start
+	std::vector<MeshData> meshData;		// Assimp output on a cold start
+	std::unique_ptr<GltfScene> gltf;	// native glTF import, owns the mapped buffers its views point into
+	std::vector<MeshView> meshes;		// one view per mesh into whichever of the three holds the geometry
+	glm::vec3 boundsMin = glm::vec3(0.0f);
+	glm::vec3 boundsMax = glm::vec3(0.0f);
+	size_t uploadedMeshes = 0;
+};
+
+static uint64_t hashStream(uint64_t hash, const VertexStream& stream)
+{
+	if (stream.data == nullptr)
+		return HashUtils::HashCombine(hash, 0);
+	hash = HashUtils::HashCombine(hash, HashUtils::XXHash64(stream.data, stream.byteLength));
+	hash = HashUtils::HashCombine(hash, (uint64_t(stream.stride) << 32) | (uint64_t(stream.components) << 24) | (uint64_t(stream.normalized) << 16));
+	return HashUtils::HashCombine(hash, stream.componentType);
+}
+
+// Key of a mesh's GPU geometry in the ResourceManager registry: the bytes that get uploaded plus the format they're
+// uploaded in, so the same content loaded packed and full never shares buffers
+static uint64_t hashMeshGeometry(const MeshView& view, VertexFormat vertexFormat)
+{
+	uint64_t hash;
+	if (view.streams)
+	{
+		const VertexStreams& streams = *view.streams;
+		hash = HashUtils::HashCombine(static_cast<uint64_t>(VertexFormat::Source), streams.vertexCount);
+		hash = hashStream(hash, streams.position);
+		hash = hashStream(hash, streams.normal);
+		hash = hashStream(hash, streams.texCoords);
+		hash = hashStream(hash, streams.tangent);
+		size_t indexSize = streams.indexType == GL_UNSIGNED_BYTE ? 1 : streams.indexType == GL_UNSIGNED_SHORT ? 2 : 4;
+		hash = HashUtils::HashCombine(hash, streams.indexType);
+		hash = HashUtils::HashCombine(hash, HashUtils::XXHash64(streams.indices, streams.indexCount * indexSize));
+	}
+	else
+	{
+		hash = HashUtils::HashCombine(static_cast<uint64_t>(vertexFormat), view.vertexCount);
+		hash = HashUtils::HashCombine(hash, HashUtils::XXHash64(view.vertices, view.vertexCount * sizeof(Vertex)));
+		hash = HashUtils::HashCombine(hash, HashUtils::XXHash64(view.indices, view.indexCount * sizeof(unsigned int)));
+		if (view.lodCount > 0)
+		{
+			const MeshLod& last = view.lods[view.lodCount - 1];
+			hash = HashUtils::HashCombine(hash, HashUtils::XXHash64(view.lods, view.lodCount * sizeof(MeshLod)));
+			hash = HashUtils::HashCombine(hash, HashUtils::XXHash64(view.lodIndices, (size_t(last.firstIndex) + last.indexCount) * sizeof(unsigned int)));
+		}
+		if (view.meshletCount > 0)
+			hash = HashUtils::HashCombine(hash, HashUtils::XXHash64(view.meshlets, view.meshletCount * sizeof(Meshlet)));
+	}
+	// 0 means "not registered"
+	return hash != 0 ? hash : 1;
+}
+
+// Requests the decode of every texture the meshes reference in one go, so they all run in parallel
+static void requestMaterialTextures(const std::vector<MeshView>& meshViews, ResourceManager& resourceManager, std::string const& directory)
+{
+	std::vector<TextureRequest> requests;
+	for (const MeshView& view : meshViews)
+	{
+		for (int slot = 0; slot < MaterialTexturePaths::SlotCount; slot++)
+		{
+			for (const std::string& path : view.texturePaths->slot(slot))
+			{
+				requests.push_back({ path, MATERIAL_SLOT_TYPES[slot] });
+			}
+		}
+	}
+	resourceManager.requestTextures(requests, directory);
+}
+
+static bool areMaterialTexturesReady(const MaterialTexturePaths& texturePaths, ResourceManager& resourceManager, const std::string& directory)
+{
+	for (int slot = 0; slot < MaterialTexturePaths::SlotCount; slot++)
+	{
+		for (const std::string& path : texturePaths.slot(slot))
+		{
+			if (!resourceManager.isTextureReady(path, directory, MATERIAL_SLOT_TYPES[slot]))
+				return false;
+		}
+	}
+	return true;
+}
+
+// Axis aligned box with outward normals, used as the stand-in while an async load is streaming
+static MeshData createBoxMeshData(const glm::vec3& boundsMin, const glm::vec3& boundsMax)
+{
+	const glm::vec3 faceNormals[6] = { {1, 0, 0}, {-1, 0, 0}, {0, 1, 0}, {0, -1, 0}, {0, 0, 1}, {0, 0, -1} };
+	const glm::vec3 faceTangents[6] = { {0, 0, -1}, {0, 0, 1}, {1, 0, 0}, {1, 0, 0}, {1, 0, 0}, {-1, 0, 0} };
+	const glm::vec2 corners[4] = { {0, 0}, {1, 0}, {1, 1}, {0, 1} };
+
+	glm::vec3 center = (boundsMin + boundsMax) * 0.5f;
+	glm::vec3 halfExtent = (boundsMax - boundsMin) * 0.5f;
+
+	MeshData box;
+	for (int face = 0; face < 6; face++)
+	{
+		glm::vec3 normal = faceNormals[face];
+		glm::vec3 tangent = faceTangents[face];
+		glm::vec3 bitangent = glm::cross(normal, tangent);
+		unsigned int firstVertex = static_cast<unsigned int>(box.vertices.size());
+
+		for (const glm::vec2& corner : corners)
+		{
+			glm::vec3 local = normal + tangent * (corner.x * 2.0f - 1.0f) + bitangent * (corner.y * 2.0f - 1.0f);
+			Vertex vertex;
+			vertex.Position = center + local * halfExtent;
+			vertex.Normal = normal;
+			vertex.TexCoords = corner;
+			vertex.Tangent = glm::vec4(tangent, 1.0f);
+			box.vertices.push_back(vertex);
+		}
+
+		box.indices.insert(box.indices.end(), { firstVertex, firstVertex + 1, firstVertex + 2, firstVertex, firstVertex + 2, firstVertex + 3 });
+	}
+	return box;
+}
+
+// the decoded primitives and where the scene places them, so a warm start skips the decode and post-processing
+static void writeGltfCache(std::string const& path, ModelImport& import)
+{
+	const GltfScene& scene = *import.gltf;
+	std::unordered_map<const Vertex*, uint32_t> meshIndices;
+	for (size_t i = 0; i < scene.meshData.size(); i++)
+		meshIndices.emplace(scene.meshData[i].vertices.data(), static_cast<uint32_t>(i));
+
+	std::vector<MeshCacheInstance> instances;
+	instances.reserve(scene.meshes.size());
+	for (const MeshView& view : scene.meshes)
+	{
+		auto mesh = meshIndices.find(view.vertices);
+		if (view.streams || mesh == meshIndices.end())
+			return;	// not everything was decoded, the source layout views are cheap to rebuild anyway
+
+		MeshCacheInstance instance;
+		instance.mesh = mesh->second;
+		instance.transform = view.transform;
+		if (view.factors)
+			instance.factors = *view.factors;
+		instances.push_back(instance);
+	}
+
+	if (!import.cache.write(scene.meshData, instances))
+	{
+		std::cout << "WARNING::MESH_CACHE:: Could not write cache for " << path << std::endl;
+	}
+}
+
+// glTF is read natively, the accessors are mapped and uploaded as stored so it needs neither Assimp nor the mesh cache.
+// the packed format re-encodes every vertex anyway, so it gets decoded (and optimised) primitives instead, which are
+// cached like an Assimp import
+static bool importGltf(std::string const& path, VertexFormat vertexFormat, ModelImport& import)
+{
+	auto start = std::chrono::steady_clock::now();
+	const bool decodeAll = vertexFormat == VertexFormat::Packed;
+	import.gltf = std::make_unique<GltfScene>();
+	if (!GltfLoader::Load(path, decodeAll, *import.gltf))
+	{
+		std::cout << "WARNING::GLTF:: Falling back to Assimp for " << path << std::endl;
+		import.gltf.reset();
+		return false;
+	}
+
+	import.meshes = import.gltf->meshes;
+	std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+	std::printf("GltfLoader: %s: %zu meshes from %zu primitives (%zu in source layout, %zu decoded) in %.1f ms\n",
+		path.c_str(), import.meshes.size(), import.gltf->streams.size() + import.gltf->meshData.size(),
+		import.gltf->streams.size(), import.gltf->meshData.size(), elapsed.count());
+
+	if (decodeAll)
+		writeGltfCache(path, import);
+	return true;
+}
+
+Model::Model(std::string const& directoryOfModel, std::string const& modelPath, std::shared_ptr<ResourceManager> rManager, bool gamma, ModelLoadMode loadMode,
+	VertexFormat vertexFormat)
+	: directory(directoryOfModel),
+	gammaCorrection(gamma),
 	resourceManager(rManager),
-	directory(directoryOfModel)
+	vertexFormat(vertexFormat)
 {
-	loadModel(modelPath);
+	if (loadMode == ModelLoadMode::Async)
+		loadModelAsync(modelPath);
+	else
+		loadModel(modelPath);
 	setPosition(glm::vec3(0, 0, 0));
 	setScale(glm::vec3(1, 1, 1));
 	setRotation(glm::vec3(0, 0, 0));
 
 }
 
-void Model::DrawPBR(const Shader& shader, const IBLTextures& iblTextures) const
+Model::~Model()
+{
+	// the import may still be running on the worker pool
+	if (pendingImport.valid())
+		pendingImport.wait();
+}
+
+void Model::selectLods(const glm::vec3& cameraPosition, float pixelsPerUnit, float maxPixelError, const uint8_t* meshVisibility, LodStats& stats)
+{
+	for (size_t i = 0; i < meshes.size(); i++)
+	{
+		Mesh& mesh = meshes[i];
+		if (mesh.selectLod(cameraPosition, pixelsPerUnit, maxPixelError))
+			stats.switches++;
+		if (meshVisibility && !meshVisibility[i])
+			continue;
+
+		const std::vector<MeshLod>& lods = mesh.getGeometry()->lods;
+		stats.meshes++;
+		stats.meshesPerLevel[mesh.getLod()]++;
+		stats.fullTriangles += lods[0].indexCount / 3;
+		stats.drawnTriangles += lods[mesh.getLod()].indexCount / 3;
+	}
+}
+
+size_t Model::DrawPBR(const Shader& shader, const IBLTextures& iblTextures, const uint8_t* meshVisibility) const
+{
+	// meshes in the same arena share its VAO, it's only rebound when the layout changes
+	GLuint boundVertexArray = 0;
+	size_t drawCalls = 0;
+	for (size_t i = 0; i < meshes.size(); i++)
+	{
+		if (meshVisibility && !meshVisibility[i])
+			continue;
+		meshes[i].DrawPBR(shader, iblTextures, boundVertexArray);
+		drawCalls++;
+	}
+	glBindVertexArray(0);
+
+	// drawn as a wireframe so it never hides the meshes that already arrived, or everything when the camera is inside it
+	if (placeholder)
+	{
+		glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
+		placeholder->DrawPBR(shader, iblTextures);
+		glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+	}
+	return drawCalls + (placeholder ? 1 : 0);
+}
+
+void Model::updateStreaming(double timeBudgetMs)
+{
+	if (!streamingImport)
+	{
+		if (!pendingImport.valid() || pendingImport.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+			return;
+
+		streamingImport = pendingImport.get();
+		if (!streamingImport)
+			return; // import failed, already reported
+
+		meshes.reserve(streamingImport->meshes.size());
+		MeshData box = createBoxMeshData(streamingImport->boundsMin, streamingImport->boundsMax);
+		MaterialTexturePaths defaultMaterial;
+		MeshView boxView;
+		boxView.vertices = box.vertices.data();
+		boxView.vertexCount = box.vertices.size();
+		boxView.indices = box.indices.data();
+		boxView.indexCount = box.indices.size();
+		boxView.texturePaths = &defaultMaterial;
+		placeholder = std::make_unique<Mesh>(createMesh(boxView));
+	}
+
+	// upload meshes in order until the frame's budget is spent, at least one per frame so loading always progresses.
+	// a mesh whose textures are still decoding waits for a later frame rather than stalling this one.
+	auto start = std::chrono::steady_clock::now();
+	ModelImport& import = *streamingImport;
+	while (import.uploadedMeshes < import.meshes.size())
+	{
+		const MeshView& view = import.meshes[import.uploadedMeshes];
+		if (!areMaterialTexturesReady(*view.texturePaths, *resourceManager, directory))
+			break;
+
+		meshes.push_back(createMesh(view));
+		meshes.back().updateWorldBounds(modelMatrix);
+		import.uploadedMeshes++;
+
+		std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+		if (elapsed.count() >= timeBudgetMs)
+			break;
+	}
+
+	if (import.uploadedMeshes == import.meshes.size())
+	{
+		placeholder.reset();
+		streamingImport.reset(); // unmaps the cache / frees the CPU copies
+		reportGeometry();
+	}
+}
+
+bool Model::isLoading() const
 {
-	for (const auto& mesh : meshes)
-		mesh.DrawPBR(shader, iblTextures);
+	return pendingImport.valid() || streamingImport != nullptr;
+}
+
+float Model::getLoadProgress() const
+{
+	if (pendingImport.valid())
+		return 0.0f;
+	if (!streamingImport || streamingImport->meshes.empty())
+		return 1.0f;
+
+	float uploaded = static_cast<float>(streamingImport->uploadedMeshes) / static_cast<float>(streamingImport->meshes.size());
+	return IMPORT_PROGRESS_SHARE + (1.0f - IMPORT_PROGRESS_SHARE) * uploaded;
 }
 
 void Model::UpdateTransform()
@@ -26,6 +356,9 @@ void Model::UpdateTransform()
 	modelMatrix = glm::rotate(modelMatrix, glm::radians(rotation.x), glm::vec3(1, 0, 0));
 	modelMatrix = glm::rotate(modelMatrix, glm::radians(rotation.y), glm::vec3(0, 1, 0));
 	modelMatrix = glm::rotate(modelMatrix, glm::radians(rotation.z), glm::vec3(0, 0, 1));
+
+	for (Mesh& mesh : meshes)
+		mesh.updateWorldBounds(modelMatrix);
 }
 
 void Model::setPosition(const glm::vec3& newPosition)
@@ -49,146 +382,472 @@ void Model::setRotation(const glm::vec3& newRotation)
 
 void Model::loadModel(std::string const& path)
 {
-	// read file via ASSIMP
-	Assimp::Importer importer;
-	const aiScene* scene = importer.ReadFile(path, aiProcess_Triangulate | aiProcess_FlipUVs | aiProcess_CalcTangentSpace);//
-	// check for errors
-	if (!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE || !scene->mRootNode) // if is Not Zero
-	{
-		std::cout << "ERROR::ASSIMP:: " << importer.GetErrorString() << std::endl;
+	// retrieve the directory path of the filepath
+	modelPath = path.substr(0, path.find_last_of('/'));
+
+	std::shared_ptr<ModelImport> import = importModel(path, resourceManager, directory, vertexFormat);
+	if (!import)
 		return;
+
+	meshes.reserve(import->meshes.size());
+	for (const MeshView& view : import->meshes)
+	{
+		meshes.push_back(createMesh(view));
 	}
+	reportGeometry();
+}
+
+void Model::loadModelAsync(std::string const& path)
+{
 	// retrieve the directory path of the filepath
 	modelPath = path.substr(0, path.find_last_of('/'));
 
-	// process ASSIMP's root node recursively
-	processNode(scene->mRootNode, scene);
+	// the task only captures copies, never this, so it can't race with the model being drawn or updated
+	std::shared_ptr<ResourceManager> manager = resourceManager;
+	std::string textureDirectory = directory;
+	VertexFormat format = vertexFormat;
+	pendingImport = ThreadPool::getShared().submit([path, manager, textureDirectory, format]()
+		{
+			return importModel(path, manager, textureDirectory, format);
+		});
 }
 
-void Model::processNode(aiNode* node, const aiScene* scene)
+std::shared_ptr<ModelImport> Model::importModel(std::string const& path, const std::shared_ptr<ResourceManager>& resourceManager, std::string const& directory,
+	VertexFormat vertexFormat)
 {
-	// process each mesh located at the current node
-	for (unsigned int i = 0; i < node->mNumMeshes; i++)
+	auto import = std::make_shared<ModelImport>(path);
+	const bool gltf = GltfLoader::IsGltfPath(path);
+
+	if (gltf && vertexFormat == VertexFormat::Packed && import->cache.open())
 	{
-		// the node object only contains indices to index the actual objects in the scene. 
-		// the scene contains all the data, node is just to keep stuff organized (like relations between nodes).
-		aiMesh* mesh = scene->mMeshes[node->mMeshes[i]];
-		meshes.push_back(processMesh(mesh, scene));
+		// warm start of a decoded glTF import, the cache keeps the node transforms and material factors too
+		import->meshes = import->cache.getMeshes();
 	}
-	// after processing all of the meshes, recursively process each of the children nodes
-	for (unsigned int i = 0; i < node->mNumChildren; i++)
+	else if (gltf && importGltf(path, vertexFormat, *import))
+	{
+		// the views point into the mapped glTF buffers, or the decoded primitives
+	}
+	// warm start: geometry comes straight out of the mapped cache into the GPU buffers, Assimp is never touched
+	else if (import->cache.open())
 	{
-		processNode(node->mChildren[i], scene);
-	}
-}
-
-Mesh Model::processMesh(aiMesh* mesh, const aiScene* scene)
-{
-	// data to fill
-	std::vector<Vertex> vertices;
-	std::vector<unsigned int> indices;
-	std::vector<unsigned int> albedoMapIDs;
-	std::vector<unsigned int> normalMapIDs;
-	std::vector<unsigned int> roughnessMetallicMapIDs;
-	std::vector<unsigned int> aoMapIDs;
-	//std::vector<Texture> textures;
-
-	// Walk through each of the mesh's vertices
-	for (unsigned int i = 0; i < mesh->mNumVertices; i++)
-	{
-		Vertex vertex;
-		glm::vec3 vector; // we declare a placeholder vector since assimp uses its own vector class that doesn't directly convert to glm's vec3 class so we transfer the data to this placeholder glm::vec3 first.
-						  // positions
-		vector.x = mesh->mVertices[i].x;
-		vector.y = mesh->mVertices[i].y;
-		vector.z = mesh->mVertices[i].z;
-		vertex.Position = vector;
-		// normals
-		vector.x = mesh->mNormals[i].x;
-		vector.y = mesh->mNormals[i].y;
-		vector.z = mesh->mNormals[i].z;
-		vertex.Normal = vector;
-		// texture coordinates
-		if (mesh->mTextureCoords[0]) // does the mesh contain texture coordinates?
-		{
-			glm::vec2 vec;
-			// a vertex can contain up to 8 different texture coordinates. We thus make the assumption that we won't 
-			// use models where a vertex can have multiple texture coordinates so we always take the first set (0).
-			vec.x = mesh->mTextureCoords[0][i].x;
-			vec.y = mesh->mTextureCoords[0][i].y;
-			vertex.TexCoords = vec;
+		import->meshes = import->cache.getMeshes();
+	}
+	else
+	{
+		// OBJ goes through the in-house parallel parser, everything else (and any OBJ it rejects) through Assimp
+		bool parsed = false;
+		if (ObjLoader::IsObjPath(path))
+		{
+			parsed = ObjLoader::Load(path, import->meshData);
+			if (!parsed)
+			{
+				std::cout << "WARNING::OBJ:: Falling back to Assimp for " << path << std::endl;
+				import->meshData.clear();
+			}
+		}
+		if (!parsed && !importAssimp(path, import->meshData))
+			return nullptr;
+
+		// weld and reorder for the vertex cache, overdraw and fetch before the result is cached
+		std::vector<MeshOptimizationStats> optimization(import->meshData.size());
+		ThreadPool::getShared().parallelFor(import->meshData.size(), [&](size_t i)
+			{
+				optimization[i] = MeshOptimizer::Optimize(import->meshData[i]);
+			});
+		for (size_t i = 0; i < import->meshData.size(); i++)
+		{
+			const MeshOptimizationStats& stats = optimization[i];
+			std::printf("MeshOptimizer: %s mesh %zu: %zu tris, verts %zu -> %zu, ACMR %.3f -> %.3f, ATVR %.3f -> %.3f\n",
+				path.c_str(), i, stats.triangleCount, stats.vertexCountBefore, stats.vertexCountAfter,
+				stats.acmrBefore, stats.acmrAfter, stats.atvrBefore, stats.atvrAfter);
+		}
+
+		// levels of detail go into the cache with the rest, warm starts never simplify again
+		MeshSimplifier::GenerateLods(import->meshData, path);
+		// reorders the full detail indices, the levels above keep their own
+		MeshletBuilder::Build(import->meshData, path);
+
+		if (!import->cache.write(import->meshData))
+		{
+			std::cout << "WARNING::MESH_CACHE:: Could not write cache for " << path << std::endl;
+		}
+
+		import->meshes.reserve(import->meshData.size());
+		for (const MeshData& data : import->meshData)
+		{
+			MeshView view;
+			view.vertices = data.vertices.data();
+			view.vertexCount = data.vertices.size();
+			view.indices = data.indices.data();
+			view.indexCount = data.indices.size();
+			view.texturePaths = &data.texturePaths;
+			view.lodIndices = data.lodIndices.data();
+			view.lods = data.lods.data();
+			view.lodCount = data.lods.size();
+			view.meshlets = data.meshlets.data();
+			view.meshletCount = data.meshlets.size();
+			import->meshes.push_back(view);
+		}
+	}
+
+	// bounds of the whole model, used for the streaming placeholder
+	bool first = true;
+	for (const MeshView& view : import->meshes)
+	{
+		if (view.vertexCount == 0)
+			continue;
+
+		glm::vec3 meshMin, meshMax;
+		if (view.streams)
+		{
+			meshMin = view.streams->boundsMin;
+			meshMax = view.streams->boundsMax;
 		}
 		else
-			vertex.TexCoords = glm::vec2(0.0f, 0.0f);
-		// tangent
-		vector.x = mesh->mTangents[i].x;
-		vector.y = mesh->mTangents[i].y;
-		vector.z = mesh->mTangents[i].z;
-		vertex.Tangent = vector;
-		// bitangent
-		vector.x = mesh->mBitangents[i].x;
-		vector.y = mesh->mBitangents[i].y;
-		vector.z = mesh->mBitangents[i].z;
-		vertex.Bitangent = vector;
-		vertices.push_back(vertex);
-	}
-	// now walk through each of the mesh's faces (a face is a mesh its triangle) and retrieve the corresponding vertex indices.
+		{
+			meshMin = meshMax = view.vertices[0].Position;
+			for (size_t i = 1; i < view.vertexCount; i++)
+			{
+				meshMin = glm::min(meshMin, view.vertices[i].Position);
+				meshMax = glm::max(meshMax, view.vertices[i].Position);
+			}
+		}
+
+		// corners of the mesh bounds through its node transform
+		for (int corner = 0; corner < 8; corner++)
+		{
+			glm::vec3 local((corner & 1) ? meshMax.x : meshMin.x, (corner & 2) ? meshMax.y : meshMin.y, (corner & 4) ? meshMax.z : meshMin.z);
+			glm::vec3 position = glm::vec3(view.transform * glm::vec4(local, 1.0f));
+			import->boundsMin = first ? position : glm::min(import->boundsMin, position);
+			import->boundsMax = first ? position : glm::max(import->boundsMax, position);
+			first = false;
+		}
+	}
+
+	// geometry keys for the registry, hashed here so the GL thread only does a lookup per mesh, and the triangle BVHs
+	// for ray queries, which need the CPU copy that is gone once the meshes are uploaded
+	auto bvhStart = std::chrono::steady_clock::now();
+	ThreadPool::getShared().parallelFor(import->meshes.size(), [&](size_t i)
+		{
+			MeshView& view = import->meshes[i];
+			view.contentHash = hashMeshGeometry(view, vertexFormat);
+			view.triangleBVH = view.streams ? TriangleBVH::Build(*view.streams) : TriangleBVH::Build(view.vertices, view.vertexCount, view.indices, view.indexCount);
+		});
+	std::chrono::duration<double, std::milli> bvhTime = std::chrono::steady_clock::now() - bvhStart;
+	size_t bvhTriangles = 0, bvhNodes = 0, bvhBytes = 0;
+	for (const MeshView& view : import->meshes)
+	{
+		if (!view.triangleBVH)
+			continue;
+		bvhTriangles += view.triangleBVH->getTriangleCount();
+		bvhNodes += view.triangleBVH->getNodes().size();
+		bvhBytes += view.triangleBVH->getMemoryBytes();
+	}
+	std::printf("BVH: %s: %zu triangles, %zu nodes, %.2f MB, hashed and built in %.1f ms\n", path.c_str(), bvhTriangles, bvhNodes,
+		bvhBytes / (1024.0 * 1024.0), bvhTime.count());
+
+	// kick off every texture decode up front so they run in parallel while the meshes are uploaded
+	requestMaterialTextures(import->meshes, *resourceManager, directory);
+
+	return import;
+}
+
+bool Model::importAssimp(std::string const& path, std::vector<MeshData>& meshData)
+{
+	// read file via ASSIMP, with a pooled importer that maps the file instead of reading it through stdio
+	ImporterPool::Lease lease = ImporterPool::Acquire();
+	const aiScene* scene = lease.importer().ReadFile(path, MODEL_IMPORT_FLAGS);
+	// check for errors
+	if (!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE || !scene->mRootNode) // if is Not Zero
+	{
+		std::cout << "ERROR::ASSIMP:: " << lease.importer().GetErrorString() << std::endl;
+		return false;
+	}
+
+	// process ASSIMP's root node recursively
+	auto convertStart = std::chrono::steady_clock::now();
+	processNode(scene->mRootNode, scene, meshData);
+	std::chrono::duration<double, std::milli> convertTime = std::chrono::steady_clock::now() - convertStart;
+
+	const AssimpImportTimings& timings = lease.timings();
+	std::printf("Assimp: %s: read %.1f ms, post-process %.1f ms (%d steps), convert %.1f ms\n",
+		path.c_str(), timings.readMs, timings.postProcessMs, timings.postProcessSteps, convertTime.count());
+	return true;
+}
+
+// depth first, so the meshes keep the order the old recursive conversion produced them in
+static void collectNodeMeshes(const aiNode* node, const aiScene* scene, std::vector<aiMesh*>& sceneMeshes)
+{
+	// the node object only contains indices to index the actual objects in the scene. 
+	// the scene contains all the data, node is just to keep stuff organized (like relations between nodes).
+	for (unsigned int i = 0; i < node->mNumMeshes; i++)
+		sceneMeshes.push_back(scene->mMeshes[node->mMeshes[i]]);
+	for (unsigned int i = 0; i < node->mNumChildren; i++)
+		collectNodeMeshes(node->mChildren[i], scene, sceneMeshes);
+}
+
+// Assimp's streams (aiVector3D, 3 floats) into the interleaved Vertex layout with 4 wide SSE copies. each store writes
+// one float past its attribute, which the next attribute's store (or the tangent TangentSpace fills in afterwards)
+// overwrites, so every vertex but the last is three unaligned loads and stores. missing streams read as zero
+static void interleaveVertices(const aiMesh* mesh, Vertex* vertices)
+{
+	static_assert(sizeof(aiVector3D) == 3 * sizeof(float), "interleaveVertices expects single precision Assimp vectors");
+	static_assert(sizeof(Vertex) == 12 * sizeof(float) && offsetof(Vertex, Normal) == 3 * sizeof(float) && offsetof(Vertex, TexCoords) == 6 * sizeof(float) &&
+		offsetof(Vertex, Tangent) == 8 * sizeof(float), "interleaveVertices expects the tightly packed Vertex layout");
+	alignas(16) static const float ZERO[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+
+	const size_t count = mesh->mNumVertices;
+	if (count == 0)
+		return;
+
+	// stride 0 keeps reading the zero vector for streams the mesh doesn't have
+	auto stream = [](const aiVector3D* source, size_t& stride) { stride = source ? 3 : 0; return source ? &source->x : ZERO; };
+	size_t normalStride, texCoordStride;
+	const float* positions = &mesh->mVertices[0].x;
+	const float* normals = stream(mesh->mNormals, normalStride);
+	const float* texCoords = stream(mesh->mTextureCoords[0], texCoordStride);
+
+	float* out = reinterpret_cast<float*>(vertices);
+	for (size_t i = 0; i + 1 < count; i++, out += 12)
+	{
+		_mm_storeu_ps(out + 0, _mm_loadu_ps(positions + i * 3));
+		_mm_storeu_ps(out + 3, _mm_loadu_ps(normals + i * normalStride));
+		_mm_storeu_ps(out + 6, _mm_loadu_ps(texCoords + i * texCoordStride));
+	}
+
+	// the last element of each source has nothing behind it to absorb the 4th float of the load
+	const size_t last = count - 1;
+	std::memcpy(out + 0, positions + last * 3, 3 * sizeof(float));
+	std::memcpy(out + 3, normals + last * normalStride, 3 * sizeof(float));
+	std::memcpy(out + 6, texCoords + last * texCoordStride, 2 * sizeof(float));
+}
+
+void Model::processNode(aiNode* node, const aiScene* scene, std::vector<MeshData>& meshData)
+{
+	std::vector<aiMesh*> sceneMeshes;
+	collectNodeMeshes(node, scene, sceneMeshes);
+
+	// every mesh converts independently, so they are spread over the pool (importModel already runs on it when async,
+	// parallelFor has the calling thread take part rather than wait on the queue)
+	size_t first = meshData.size();
+	meshData.resize(first + sceneMeshes.size());
+	ThreadPool::getShared().parallelFor(sceneMeshes.size(), [&](size_t i)
+		{
+			meshData[first + i] = processMesh(sceneMeshes[i], scene);
+		});
+}
+
+MeshData Model::processMesh(aiMesh* mesh, const aiScene* scene)
+{
+	MeshData data;
+
+	// sized once and filled in bulk, see interleaveVertices
+	data.vertices.resize(mesh->mNumVertices);
+	interleaveVertices(mesh, data.vertices.data());
+
+	// aiProcess_Triangulate leaves triangles (and any points/lines), so reserving three per face is exact for the common case
+	data.indices.reserve(size_t(mesh->mNumFaces) * 3);
 	for (unsigned int i = 0; i < mesh->mNumFaces; i++)
 	{
-		aiFace face = mesh->mFaces[i];
-		// retrieve all indices of the face and store them in the indices vector
-		for (unsigned int j = 0; j < face.mNumIndices; j++)
-			indices.push_back(face.mIndices[j]);
+		const aiFace& face = mesh->mFaces[i];
+		data.indices.insert(data.indices.end(), face.mIndices, face.mIndices + face.mNumIndices);
 	}
+
+	// tangents come from TangentSpace rather than aiProcess_CalcTangentSpace, like every other import path
+	TangentSpace::Generate(data);
+
 	// process materials
 	aiMaterial* material = scene->mMaterials[mesh->mMaterialIndex];
-	albedoMapIDs = loadMaterialTextures(material, aiTextureType_BASE_COLOR, "albedoMap");
-	normalMapIDs = loadMaterialTextures(material, aiTextureType_NORMALS, "normalMap");
-	roughnessMetallicMapIDs = loadMaterialTextures(material, aiTextureType_UNKNOWN, "roughnessMetallicMap");
-	aoMapIDs = loadMaterialTextures(material, aiTextureType_LIGHTMAP, "aoMap");
+	for (int slot = 0; slot < MaterialTexturePaths::SlotCount; slot++)
+	{
+		data.texturePaths.slot(slot) = getMaterialTexturePaths(material, MATERIAL_SLOT_TYPES[slot]);
+	}
+
+	return data;
+}
+
+Mesh Model::createMesh(const MeshView& view)
+{
+	const MaterialTexturePaths& texturePaths = *view.texturePaths;
+
+	std::vector<unsigned int> albedoMapIDs = loadMaterialTextures(texturePaths.albedo, MATERIAL_SLOT_TYPES[0]);
+	std::vector<unsigned int> normalMapIDs = loadMaterialTextures(texturePaths.normal, MATERIAL_SLOT_TYPES[1]);
+	std::vector<unsigned int> roughnessMetallicMapIDs = loadMaterialTextures(texturePaths.roughnessMetallic, MATERIAL_SLOT_TYPES[2]);
+	std::vector<unsigned int> aoMapIDs = loadMaterialTextures(texturePaths.ao, MATERIAL_SLOT_TYPES[3]);
+
+	// glTF materials multiply their factors into the maps, so their empty slots default to white as the spec asks
+	const bool hasFactors = view.factors != nullptr;
 
 	if (albedoMapIDs.empty()) 
 	{ 
-		unsigned int defaultAlbedoID = ResourceManager::CreateDefaultTexture(128, 128, 128);
+		unsigned int defaultAlbedoID = hasFactors ? resourceManager->getDefaultTexture(255, 255, 255) : resourceManager->getDefaultTexture(128, 128, 128);
 		albedoMapIDs.push_back(defaultAlbedoID); 
 	}
 	if (normalMapIDs.empty())
 	{
-		unsigned int defaultNormalID = ResourceManager::CreateDefaultTexture(128, 128, 255);
+		unsigned int defaultNormalID = resourceManager->getDefaultTexture(128, 128, 255);
 		normalMapIDs.push_back(defaultNormalID);
 	}
 	if (roughnessMetallicMapIDs.empty())
 	{
-		unsigned int defaultRoughnessID = ResourceManager::CreateDefaultTexture(0, 0, 0);
+		unsigned int defaultRoughnessID = hasFactors ? resourceManager->getDefaultTexture(255, 255, 255) : resourceManager->getDefaultTexture(0, 0, 0);
 		roughnessMetallicMapIDs.push_back(defaultRoughnessID);
 	}
 
 	if (aoMapIDs.empty())
 	{
-		unsigned int defaultAOID = ResourceManager::CreateDefaultTexture(255, 255, 255);
+		unsigned int defaultAOID = resourceManager->getDefaultTexture(255, 255, 255);
 		aoMapIDs.push_back(defaultAOID);
 	}
 
+	// identical geometry already on the GPU (another mesh of this model, or another model) is drawn from the same buffers
+	std::shared_ptr<MeshGeometry> shared = view.contentHash != 0 ? resourceManager->findGeometry(view.contentHash) : nullptr;
+
 	// return a mesh object created from the extracted mesh data
-	return Mesh(vertices, indices, albedoMapIDs, normalMapIDs, roughnessMetallicMapIDs, aoMapIDs);
+	Mesh mesh = shared
+		? Mesh(std::move(shared), std::move(albedoMapIDs), std::move(normalMapIDs), std::move(roughnessMetallicMapIDs), std::move(aoMapIDs))
+		: view.streams
+		? Mesh(*view.streams, std::move(albedoMapIDs), std::move(normalMapIDs), std::move(roughnessMetallicMapIDs), std::move(aoMapIDs))
+		: Mesh(view.vertices, view.vertexCount, view.indices, view.indexCount, std::move(albedoMapIDs), std::move(normalMapIDs), std::move(roughnessMetallicMapIDs), std::move(aoMapIDs), vertexFormat,
+			view.lodIndices, view.lods, view.lodCount, view.meshlets, view.meshletCount);
+	if (view.contentHash != 0)
+		resourceManager->registerGeometry(view.contentHash, mesh.getGeometry());
+	if (!mesh.getGeometry()->triangleBVH)
+		mesh.getGeometry()->triangleBVH = view.triangleBVH;
+	mesh.localTransform = view.transform;
+	if (view.factors)
+		mesh.factors = *view.factors;
+	return mesh;
+}
 
+void Model::reportGeometry() const
+{
+	// shared geometry is counted once
+	std::unordered_set<const MeshGeometry*> counted;
+	size_t bytes = 0;
+	size_t sourceLayoutMeshes = 0;
+	// triangles of every mesh at each level of detail, meshes with fewer levels count at their coarsest
+	size_t lodTriangles[MAX_MESH_LODS] = {};
+	size_t reducedMeshes = 0;
+	size_t meshlets = 0;
+	for (const Mesh& mesh : meshes)
+	{
+		const MeshGeometry& geometry = *mesh.getGeometry();
+		if (counted.insert(&geometry).second)
+			bytes += geometry.geometryBytes;
+		if (geometry.vertexFormat == VertexFormat::Source)
+			sourceLayoutMeshes++;
+		for (int level = 0; level < MAX_MESH_LODS; level++)
+			lodTriangles[level] += geometry.lods[std::min<size_t>(level, geometry.lods.size() - 1)].indexCount / 3;
+		reducedMeshes += geometry.lods.size() > 1 ? 1 : 0;
+		meshlets += geometry.meshlets.size();
+	}
+	std::printf("Model %s: %zu meshes (%zu unique geometries), %.2f MB of %s geometry, %zu in source layout\n", modelPath.c_str(), meshes.size(), counted.size(),
+		bytes / (1024.0 * 1024.0), vertexFormat == VertexFormat::Packed ? "packed" : "full", sourceLayoutMeshes);
+	std::printf("Model %s: %zu meshes with levels of detail, LOD triangles %zu / %zu / %zu / %zu, %zu meshlets\n", modelPath.c_str(), reducedMeshes,
+		lodTriangles[0], lodTriangles[1], lodTriangles[2], lodTriangles[3], meshlets);
 }
 
-// checks all material textures of a given type and loads the textures if they're not loaded yet.
-	// the required info is returned as a Texture struct.
-std::vector<unsigned int> Model::loadMaterialTextures(aiMaterial* mat, aiTextureType type, const std::string& typeName, const std::string& customPath)
+std::vector<std::string> Model::getMaterialTexturePaths(aiMaterial* mat, aiTextureType type)
 {
-	std::vector<unsigned int> textureIDs;
+	std::vector<std::string> paths;
 	aiString currentPath;
 	unsigned int textureCount = mat->GetTextureCount(type);
 
-	// The original functionality: loop through all textures of the given type and load them
 	for (unsigned int i = 0; i < textureCount; i++)
 	{
 		mat->GetTexture(type, i, &currentPath);
-		Texture texture = resourceManager->getTexture(currentPath.C_Str(), this->directory, type);
-		textureIDs.push_back(texture.id);
+		paths.emplace_back(currentPath.C_Str());
+	}
+
+	return paths;
+}
+
+// checks all material textures of a given type and loads the textures if they're not loaded yet.
+	// the required info is returned as a Texture struct.
+std::vector<unsigned int> Model::loadMaterialTextures(const std::vector<std::string>& paths, aiTextureType type)
+{
+	std::vector<unsigned int> textureIDs;
+	textureIDs.reserve(paths.size());
+
+	for (const std::string& path : paths)
+	{
+		Texture texture = resourceManager->getTexture(path, this->directory, type);
+		// textures that failed to load are left out so the slot falls back to its default texture
+		if (texture.id != 0)
+			textureIDs.push_back(texture.id);
 	}
 
 	return textureIDs;
 }
+
+int Model::RunImportBenchmark(const std::vector<std::string>& arguments)
+{
+	int runs = 5;
+	std::vector<std::string> paths;
+	for (size_t i = 0; i < arguments.size(); i++)
+	{
+		if (arguments[i] == "--runs" && i + 1 < arguments.size())
+			runs = std::max(1, std::atoi(arguments[++i].c_str()));
+		else
+			paths.push_back(arguments[i]);
+	}
+	if (paths.empty())
+	{
+		paths = {
+			"Models\\ajtrackbase\\ajtrackbase.obj",
+			"Models\\fbxsign\\sign.obj",
+			"Models\\cameras\\set1\\camset1.obj",
+			"Models\\cameras\\set2\\camset2.obj",
+			"Models\\cameras\\set3\\camset3.obj",
+			"Models\\cameras\\set4\\camset4.obj"
+		};
+	}
+
+	// best of the runs, so the first run paying for the page cache doesn't skew either side
+	auto timeImport = [runs](const std::function<bool(std::vector<MeshData>&)>& import, std::vector<MeshData>& meshData)
+	{
+		double best = -1.0;
+		for (int run = 0; run < runs; run++)
+		{
+			meshData.clear();
+			auto start = std::chrono::steady_clock::now();
+			if (!import(meshData))
+				return -1.0;
+			std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+			best = best < 0.0 ? elapsed.count() : std::min(best, elapsed.count());
+		}
+		return best;
+	};
+	auto countGeometry = [](const std::vector<MeshData>& meshData, size_t& vertices, size_t& triangles)
+	{
+		vertices = triangles = 0;
+		for (const MeshData& data : meshData)
+		{
+			vertices += data.vertices.size();
+			triangles += data.indices.size() / 3;
+		}
+	};
+
+	std::printf("%-40s %12s %12s %8s   %s\n", "model", "ObjLoader ms", "Assimp ms", "speedup", "meshes / verts / tris (ObjLoader | Assimp)");
+	int failures = 0;
+	for (const std::string& path : paths)
+	{
+		std::vector<MeshData> objMeshes, assimpMeshes;
+		double objMs = timeImport([&path](std::vector<MeshData>& meshData) { return ObjLoader::Load(path, meshData); }, objMeshes);
+		double assimpMs = timeImport([&path](std::vector<MeshData>& meshData) { return importAssimp(path, meshData); }, assimpMeshes);
+		if (objMs < 0.0 || assimpMs < 0.0)
+		{
+			std::cerr << "ERROR::BENCHMARK:: Could not import " << path << std::endl;
+			failures++;
+			continue;
+		}
+
+		size_t objVertices, objTriangles, assimpVertices, assimpTriangles;
+		countGeometry(objMeshes, objVertices, objTriangles);
+		countGeometry(assimpMeshes, assimpVertices, assimpTriangles);
+		std::printf("%-40s %12.2f %12.2f %7.2fx   %zu / %zu / %zu | %zu / %zu / %zu\n", path.c_str(), objMs, assimpMs, assimpMs / objMs,
+			objMeshes.size(), objVertices, objTriangles, assimpMeshes.size(), assimpVertices, assimpTriangles);
+	}
+	return failures == 0 ? 0 : 1;
+}
@@ -7,21 +7,30 @@
 //#include <assimp/GltfMaterial.h>
 //#include <assimp/pbrmaterial.h>
 //#include "stb_image.h"
+#include <future>
 #include <map>
+#include <memory>
 
 //unsigned int TextureFromFile(const char *path, const std::string &directory, bool gamma = false, bool useAbsolutePath = false);
 //TextureType aiTextureTypeToTextureType(aiTextureType type);
 
-struct MaterialTexturePaths
+struct ModelImport;
+
+enum class ModelLoadMode
 {
-	std::vector<std::string> diffuse;
-	std::vector<std::string> normal;
-	std::vector<std::string> roughness;
-	std::vector<std::string> ao;
-	std::vector<std::string> metallic;
+	Blocking,	// the constructor returns once every mesh is on the GPU
+	Async		// the constructor returns immediately, meshes stream in through updateStreaming()
 };
 
-
+//Visible meshes and their triangles at full detail and at the levels Model::selectLods picked
+struct LodStats
+{
+	size_t meshes = 0;
+	size_t meshesPerLevel[MAX_MESH_LODS] = {};
+	size_t fullTriangles = 0;
+	size_t drawnTriangles = 0;
+	size_t switches = 0;		// of every mesh, visible or not
+};
 
 class Model
 {
@@ -45,30 +54,73 @@ public:
 	glm::vec3 rotation;
 	glm::mat4 modelMatrix;
 
-	Model(std::string const& directoryOfModel, std::string const& modelPath, std::shared_ptr<ResourceManager> rManager, bool gamma = false);
+	Model(std::string const& directoryOfModel, std::string const& modelPath, std::shared_ptr<ResourceManager> rManager, bool gamma = false, ModelLoadMode loadMode = ModelLoadMode::Blocking,
+		VertexFormat vertexFormat = VertexFormat::Full);
+	~Model();
 
-	void DrawPBR(const Shader& shader, const IBLTextures& iblTextures) const;
+	// returns the number of draw calls issued. meshVisibility (one byte per mesh, e.g. from FrustumCuller) skips the meshes marked 0
+	size_t DrawPBR(const Shader& shader, const IBLTextures& iblTextures, const uint8_t* meshVisibility = nullptr) const;
+
+	// picks every mesh's level of detail for this frame, see Mesh::selectLod. meshVisibility (as for DrawPBR) limits
+	// the meshes counted into stats
+	void selectLods(const glm::vec3& cameraPosition, float pixelsPerUnit, float maxPixelError, const uint8_t* meshVisibility, LodStats& stats);
+
+	// call once per frame on the GL thread, uploads finished meshes of an async load within the given time budget
+	void updateStreaming(double timeBudgetMs = 2.0);
+	bool isLoading() const;
+	// 0..1, the import counts for the first quarter and the GPU uploads for the rest
+	float getLoadProgress() const;
+	// rebuilds modelMatrix and the world bounds of every mesh
 	void UpdateTransform();
 
 	void setPosition(const glm::vec3& newPosition);
 	void setScale(const glm::vec3& newScale);
 	void setRotation(const glm::vec3& newRotation);
 
+	//AJGL --benchmark-import [--runs N] [obj files...]
+	//Times ObjLoader against Assimp on the same files (the track, sign and camera sets by default), best of N runs each
+	static int RunImportBenchmark(const std::vector<std::string>& arguments);
+
 
 private:
 	std::shared_ptr<ResourceManager> resourceManager;
+	VertexFormat vertexFormat;
+
+	// async loading state: the import runs on the worker pool, its result is uploaded a few meshes per frame
+	std::future<std::shared_ptr<ModelImport>> pendingImport;
+	std::shared_ptr<ModelImport> streamingImport;
+	std::unique_ptr<Mesh> placeholder;	// wireframe bounds box with the default material, drawn until every mesh is uploaded
+
 	/*  Functions   */
 	// loads a model with supported ASSIMP extensions from file and stores the resulting meshes in the meshes vector.
+	// .gltf/.glb go through GltfLoader and .obj through ObjLoader instead, both only fall back to Assimp if they can't read them.
+	// a warm start reads the post-processed meshes from the mesh cache instead, a cold start (re)writes it. glTF only
+	// goes through the cache with the packed vertex format, which decodes every primitive.
 	void loadModel(std::string const& path);
+	void loadModelAsync(std::string const& path);
+
+	// CPU half of loading, safe to run on any thread: native glTF import, cache lookup or OBJ/Assimp import, then queues the texture decodes
+	static std::shared_ptr<ModelImport> importModel(std::string const& path, const std::shared_ptr<ResourceManager>& resourceManager, std::string const& directory,
+		VertexFormat vertexFormat);
+
+	// cold import through Assimp with MODEL_IMPORT_FLAGS, false (after printing the error) if it can't read the file
+	static bool importAssimp(std::string const& path, std::vector<MeshData>& meshData);
 
 	// processes a node in a recursive fashion. Processes each individual mesh located at the node and repeats this process on its children nodes (if any).
-	void processNode(aiNode* node, const aiScene* scene);
+	static void processNode(aiNode* node, const aiScene* scene, std::vector<MeshData>& meshData);
+
+	static MeshData processMesh(aiMesh* mesh, const aiScene* scene);
+
+	// uploads one mesh worth of geometry and resolves its material textures, falling back to default textures for empty slots
+	Mesh createMesh(const MeshView& view);
+	// prints the VRAM taken by the uploaded vertex and index buffers
+	void reportGeometry() const;
 
-	Mesh processMesh(aiMesh* mesh, const aiScene* scene);
+	// collects the paths of all material textures of a given type
+	static std::vector<std::string> getMaterialTexturePaths(aiMaterial* mat, aiTextureType type);
 
 	// checks all material textures of a given type and loads the textures if they're not loaded yet.
-	// the required info is returned as a Texture struct.
-	std::vector<unsigned int> loadMaterialTextures(aiMaterial* mat, aiTextureType type, const std::string& typeName, const std::string& customPath = "");
+	std::vector<unsigned int> loadMaterialTextures(const std::vector<std::string>& paths, aiTextureType type);
 
 };
 
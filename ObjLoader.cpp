@@ -0,0 +1,625 @@
+#include "ObjLoader.h"
+#include "MappedFile.h"
+#include "TangentSpace.h"
+#include "ThreadPool.h"
+#include <algorithm>
+#include <cctype>
+#include <charconv>
+#include <chrono>
+#include <climits>
+#include <cstring>
+#include <iostream>
+#include <unordered_map>
+
+namespace
+{
+	const int32_t MISSING_INDEX = INT32_MIN;
+	const size_t MIN_CHUNK_BYTES = 256 * 1024;	// below this a chunk costs more to schedule than to parse
+
+	//one face corner. positive OBJ indices are stored 0 based, negative ones are relative to the chunk's own element
+	//count until the chunk offsets are known, flagged in relativeMask (1 position, 2 texCoord, 4 normal)
+	struct ObjCorner
+	{
+		int32_t position;
+		int32_t texCoord;
+		int32_t normal;
+		uint32_t relativeMask;
+	};
+
+	struct ObjChunk
+	{
+		const char* begin = nullptr;
+		const char* end = nullptr;
+
+		std::vector<glm::vec3> positions;
+		std::vector<glm::vec2> texCoords;
+		std::vector<glm::vec3> normals;
+		std::vector<ObjCorner> corners;
+		std::vector<uint32_t> faceSizes;
+		std::vector<std::pair<size_t, std::string>> materialChanges;	// (first face, usemtl name)
+		std::vector<std::string> libraries;
+		std::string error;
+	};
+
+	struct ObjMaterial
+	{
+		std::string name;
+		MaterialTexturePaths texturePaths;
+	};
+
+	struct ObjFace
+	{
+		uint32_t firstCorner;
+		uint32_t cornerCount;
+	};
+
+	struct CornerKey
+	{
+		int32_t position;
+		int32_t texCoord;
+		int32_t normal;
+
+		bool operator==(const CornerKey& other) const
+		{
+			return position == other.position && texCoord == other.texCoord && normal == other.normal;
+		}
+	};
+
+	struct CornerKeyHash
+	{
+		size_t operator()(const CornerKey& key) const
+		{
+			uint64_t hash = uint64_t(uint32_t(key.position)) * 0x9E3779B97F4A7C15ull;
+			hash ^= (uint64_t(uint32_t(key.texCoord)) + 0x632BE59BD9B4E019ull + (hash << 6) + (hash >> 2));
+			hash ^= (uint64_t(uint32_t(key.normal)) + 0x85EBCA77C2B2AE63ull + (hash << 6) + (hash >> 2));
+			return static_cast<size_t>(hash);
+		}
+	};
+
+	double millisecondsSince(std::chrono::steady_clock::time_point start)
+	{
+		return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	}
+
+	inline bool isBlank(char c)
+	{
+		return c == ' ' || c == '\t';
+	}
+
+	inline const char* skipBlanks(const char* cursor, const char* lineEnd)
+	{
+		while (cursor < lineEnd && isBlank(*cursor))
+			cursor++;
+		return cursor;
+	}
+
+	//line without its terminator, trailing comment or whitespace
+	inline const char* trimLineEnd(const char* lineStart, const char* lineEnd)
+	{
+		const char* comment = static_cast<const char*>(std::memchr(lineStart, '#', lineEnd - lineStart));
+		if (comment != nullptr)
+			lineEnd = comment;
+		while (lineEnd > lineStart && (isBlank(lineEnd[-1]) || lineEnd[-1] == '\r'))
+			lineEnd--;
+		return lineEnd;
+	}
+
+	inline bool parseFloat(const char*& cursor, const char* lineEnd, float& value)
+	{
+		cursor = skipBlanks(cursor, lineEnd);
+		if (cursor < lineEnd && *cursor == '+')
+			cursor++;
+		std::from_chars_result result = std::from_chars(cursor, lineEnd, value);
+		if (result.ec != std::errc())
+			return false;
+		cursor = result.ptr;
+		return true;
+	}
+
+	inline bool parseInt(const char*& cursor, const char* lineEnd, int32_t& value)
+	{
+		if (cursor < lineEnd && *cursor == '+')
+			cursor++;
+		std::from_chars_result result = std::from_chars(cursor, lineEnd, value);
+		if (result.ec != std::errc() || value == 0)
+			return false;
+		cursor = result.ptr;
+		return true;
+	}
+
+	//1 based or negative (relative) OBJ index to the ObjCorner encoding
+	inline int32_t encodeIndex(int32_t index, size_t localCount, uint32_t relativeBit, uint32_t& relativeMask)
+	{
+		if (index > 0)
+			return index - 1;
+		relativeMask |= relativeBit;
+		return static_cast<int32_t>(static_cast<int64_t>(localCount) + index);
+	}
+
+	//v, v/vt, v//vn or v/vt/vn
+	bool parseCorner(const char*& cursor, const char* lineEnd, const ObjChunk& chunk, ObjCorner& corner)
+	{
+		corner = { MISSING_INDEX, MISSING_INDEX, MISSING_INDEX, 0 };
+		int32_t index;
+		if (!parseInt(cursor, lineEnd, index))
+			return false;
+		corner.position = encodeIndex(index, chunk.positions.size(), 1, corner.relativeMask);
+
+		if (cursor < lineEnd && *cursor == '/')
+		{
+			cursor++;
+			if (cursor < lineEnd && *cursor != '/')
+			{
+				if (!parseInt(cursor, lineEnd, index))
+					return false;
+				corner.texCoord = encodeIndex(index, chunk.texCoords.size(), 2, corner.relativeMask);
+			}
+			if (cursor < lineEnd && *cursor == '/')
+			{
+				cursor++;
+				if (!parseInt(cursor, lineEnd, index))
+					return false;
+				corner.normal = encodeIndex(index, chunk.normals.size(), 4, corner.relativeMask);
+			}
+		}
+		return true;
+	}
+
+	bool startsWith(const char* cursor, const char* lineEnd, const char* keyword)
+	{
+		size_t length = std::strlen(keyword);
+		return size_t(lineEnd - cursor) >= length && std::memcmp(cursor, keyword, length) == 0 &&
+			(size_t(lineEnd - cursor) == length || isBlank(cursor[length]));
+	}
+
+	std::string restOfLine(const char* cursor, const char* lineEnd)
+	{
+		cursor = skipBlanks(cursor, lineEnd);
+		return std::string(cursor, lineEnd);
+	}
+
+	void parseChunk(ObjChunk& chunk)
+	{
+		size_t lineNumber = 0;
+		const char* lineStart = chunk.begin;
+		while (lineStart < chunk.end && chunk.error.empty())
+		{
+			const char* newline = static_cast<const char*>(std::memchr(lineStart, '\n', chunk.end - lineStart));
+			const char* nextLine = newline != nullptr ? newline + 1 : chunk.end;
+			const char* lineEnd = trimLineEnd(lineStart, newline != nullptr ? newline : chunk.end);
+			const char* cursor = skipBlanks(lineStart, lineEnd);
+			lineNumber++;
+
+			if (cursor + 1 < lineEnd && cursor[0] == 'v')
+			{
+				const char kind = cursor[1];
+				cursor += isBlank(kind) ? 1 : 2;
+				float x = 0.0f, y = 0.0f, z = 0.0f;
+				if (isBlank(kind))
+				{
+					// extra vertex colour components after xyz are ignored
+					if (!parseFloat(cursor, lineEnd, x) || !parseFloat(cursor, lineEnd, y) || !parseFloat(cursor, lineEnd, z))
+						chunk.error = "invalid vertex position";
+					chunk.positions.emplace_back(x, y, z);
+				}
+				else if (kind == 't')
+				{
+					if (!parseFloat(cursor, lineEnd, x))
+						chunk.error = "invalid texture coordinate";
+					parseFloat(cursor, lineEnd, y);	// v is optional, w is ignored
+					chunk.texCoords.emplace_back(x, y);
+				}
+				else if (kind == 'n')
+				{
+					if (!parseFloat(cursor, lineEnd, x) || !parseFloat(cursor, lineEnd, y) || !parseFloat(cursor, lineEnd, z))
+						chunk.error = "invalid vertex normal";
+					chunk.normals.emplace_back(x, y, z);
+				}
+			}
+			else if (startsWith(cursor, lineEnd, "f"))
+			{
+				cursor++;
+				uint32_t cornerCount = 0;
+				while (true)
+				{
+					cursor = skipBlanks(cursor, lineEnd);
+					if (cursor >= lineEnd)
+						break;
+					ObjCorner corner;
+					if (!parseCorner(cursor, lineEnd, chunk, corner))
+					{
+						chunk.error = "invalid face";
+						break;
+					}
+					chunk.corners.push_back(corner);
+					cornerCount++;
+				}
+				if (cornerCount >= 3)
+					chunk.faceSizes.push_back(cornerCount);
+				else
+					chunk.corners.resize(chunk.corners.size() - cornerCount);	// points and degenerate faces are dropped
+			}
+			else if (startsWith(cursor, lineEnd, "usemtl"))
+			{
+				chunk.materialChanges.emplace_back(chunk.faceSizes.size(), restOfLine(cursor + 6, lineEnd));
+			}
+			else if (startsWith(cursor, lineEnd, "mtllib"))
+			{
+				chunk.libraries.push_back(restOfLine(cursor + 6, lineEnd));
+			}
+			// o, g, s, l and anything unknown don't change the output: faces are merged per material
+
+			if (!chunk.error.empty())
+				chunk.error += " in chunk line " + std::to_string(lineNumber);
+			lineStart = nextLine;
+		}
+	}
+
+	//texture statement of an MTL file: options (-bm 1, -o u v w, ...) around a file name that may contain spaces
+	std::string parseTextureStatement(const std::string& statement)
+	{
+		std::vector<std::string> tokens;
+		size_t position = 0;
+		while (position < statement.size())
+		{
+			size_t start = statement.find_first_not_of(" \t", position);
+			if (start == std::string::npos)
+				break;
+			size_t end = statement.find_first_of(" \t", start);
+			if (end == std::string::npos)
+				end = statement.size();
+			tokens.push_back(statement.substr(start, end - start));
+			position = end;
+		}
+
+		auto isNumber = [](const std::string& token)
+		{
+			float value;
+			const char* begin = token.c_str() + (!token.empty() && token[0] == '+' ? 1 : 0);
+			std::from_chars_result result = std::from_chars(begin, token.c_str() + token.size(), value);
+			return result.ec == std::errc() && result.ptr == token.c_str() + token.size();
+		};
+
+		std::string fileName;
+		for (size_t i = 0; i < tokens.size(); i++)
+		{
+			const std::string& token = tokens[i];
+			if (token.size() > 1 && token[0] == '-' && !isNumber(token))
+			{
+				// -o/-s/-t take up to three numbers, -mm two, every other option one argument
+				size_t maxArguments = (token == "-o" || token == "-s" || token == "-t") ? 3 : token == "-mm" ? 2 : 1;
+				for (size_t argument = 0; argument < maxArguments && i + 1 < tokens.size(); argument++)
+				{
+					if (maxArguments > 1 && argument > 0 && !isNumber(tokens[i + 1]))
+						break;
+					i++;
+				}
+				continue;
+			}
+			fileName += fileName.empty() ? token : " " + token;
+		}
+		return fileName;
+	}
+
+	void loadMaterialLibrary(const std::string& path, std::vector<ObjMaterial>& materials)
+	{
+		MappedFile file;
+		if (!file.open(path))
+		{
+			std::cout << "WARNING::OBJ:: Could not open material library " << path << std::endl;
+			return;
+		}
+
+		const char* lineStart = reinterpret_cast<const char*>(file.data());
+		const char* end = lineStart + file.size();
+		ObjMaterial* current = nullptr;
+		while (lineStart < end)
+		{
+			const char* newline = static_cast<const char*>(std::memchr(lineStart, '\n', end - lineStart));
+			const char* nextLine = newline != nullptr ? newline + 1 : end;
+			const char* lineEnd = trimLineEnd(lineStart, newline != nullptr ? newline : end);
+			const char* cursor = skipBlanks(lineStart, lineEnd);
+
+			if (startsWith(cursor, lineEnd, "newmtl"))
+			{
+				materials.push_back({ restOfLine(cursor + 6, lineEnd), MaterialTexturePaths() });
+				current = &materials.back();
+			}
+			else if (current != nullptr)
+			{
+				const char* keywordEnd = cursor;
+				while (keywordEnd < lineEnd && !isBlank(*keywordEnd))
+					keywordEnd++;
+				std::string keyword(cursor, keywordEnd);
+				std::transform(keyword.begin(), keyword.end(), keyword.begin(), [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+
+				std::vector<std::string>* slot = nullptr;
+				if (keyword == "map_kd")
+					slot = &current->texturePaths.albedo;
+				else if (keyword == "norm" || keyword == "bump" || keyword == "map_bump")
+					slot = &current->texturePaths.normal;
+
+				if (slot != nullptr && slot->empty())
+				{
+					std::string fileName = parseTextureStatement(std::string(keywordEnd, lineEnd));
+					if (!fileName.empty())
+						slot->push_back(fileName);
+				}
+			}
+			lineStart = nextLine;
+		}
+	}
+
+	//resolves the chunk relative indices and range checks every corner
+	bool resolveCorners(ObjChunk& chunk, size_t positionBase, size_t texCoordBase, size_t normalBase,
+		size_t positionCount, size_t texCoordCount, size_t normalCount)
+	{
+		auto resolve = [](int32_t& index, bool relative, size_t base, size_t count)
+		{
+			if (index == MISSING_INDEX)
+				return true;
+			int64_t absolute = relative ? static_cast<int64_t>(base) + index : index;
+			if (absolute < 0 || absolute >= static_cast<int64_t>(count))
+				return false;
+			index = static_cast<int32_t>(absolute);
+			return true;
+		};
+
+		for (ObjCorner& corner : chunk.corners)
+		{
+			if (!resolve(corner.position, (corner.relativeMask & 1) != 0, positionBase, positionCount) ||
+				!resolve(corner.texCoord, (corner.relativeMask & 2) != 0, texCoordBase, texCoordCount) ||
+				!resolve(corner.normal, (corner.relativeMask & 4) != 0, normalBase, normalCount))
+			{
+				chunk.error = "face index out of range";
+				return false;
+			}
+			corner.relativeMask = 0;
+		}
+		return true;
+	}
+
+	//triangulates the faces of one material (fans, like aiProcess_Triangulate does for convex polygons) and welds
+	//corners with the same position/uv/normal triple into one vertex
+	void buildMesh(const std::vector<ObjFace>& faces, const std::vector<ObjCorner>& corners, const std::vector<glm::vec3>& positions,
+		const std::vector<glm::vec2>& texCoords, const std::vector<glm::vec3>& normals, MeshData& mesh)
+	{
+		std::unordered_map<CornerKey, unsigned int, CornerKeyHash> vertexIndices;
+		vertexIndices.reserve(faces.size() * 2);
+		bool missingNormals = false;
+
+		auto emit = [&](const ObjCorner& corner)
+		{
+			CornerKey key = { corner.position, corner.texCoord, corner.normal };
+			auto inserted = vertexIndices.emplace(key, static_cast<unsigned int>(mesh.vertices.size()));
+			if (inserted.second)
+			{
+				Vertex vertex;
+				vertex.Position = positions[corner.position];
+				// aiProcess_FlipUVs: OBJ has its V origin at the bottom
+				vertex.TexCoords = corner.texCoord != MISSING_INDEX ? glm::vec2(texCoords[corner.texCoord].x, 1.0f - texCoords[corner.texCoord].y) : glm::vec2(0.0f);
+				vertex.Normal = corner.normal != MISSING_INDEX ? normals[corner.normal] : glm::vec3(0.0f);
+				vertex.Tangent = glm::vec4(0.0f);
+				missingNormals = missingNormals || corner.normal == MISSING_INDEX;
+				mesh.vertices.push_back(vertex);
+			}
+			mesh.indices.push_back(inserted.first->second);
+		};
+
+		for (const ObjFace& face : faces)
+		{
+			const ObjCorner* faceCorners = &corners[face.firstCorner];
+			for (uint32_t i = 1; i + 1 < face.cornerCount; i++)
+			{
+				emit(faceCorners[0]);
+				emit(faceCorners[i]);
+				emit(faceCorners[i + 1]);
+			}
+		}
+
+		// vertices without a normal get the area weighted average of their triangles
+		if (missingNormals)
+		{
+			std::vector<glm::vec3> accumulated(mesh.vertices.size(), glm::vec3(0.0f));
+			for (size_t t = 0; t + 2 < mesh.indices.size(); t += 3)
+			{
+				const unsigned int i0 = mesh.indices[t], i1 = mesh.indices[t + 1], i2 = mesh.indices[t + 2];
+				glm::vec3 faceNormal = glm::cross(mesh.vertices[i1].Position - mesh.vertices[i0].Position, mesh.vertices[i2].Position - mesh.vertices[i0].Position);
+				accumulated[i0] += faceNormal;
+				accumulated[i1] += faceNormal;
+				accumulated[i2] += faceNormal;
+			}
+			for (size_t i = 0; i < mesh.vertices.size(); i++)
+			{
+				if (mesh.vertices[i].Normal == glm::vec3(0.0f))
+				{
+					float length = glm::length(accumulated[i]);
+					mesh.vertices[i].Normal = length > 0.0f ? accumulated[i] / length : glm::vec3(0.0f, 1.0f, 0.0f);
+				}
+			}
+		}
+
+		TangentSpace::Generate(mesh);
+	}
+}
+
+namespace ObjLoader
+{
+	bool IsObjPath(const std::string& path)
+	{
+		size_t dot = path.find_last_of('.');
+		if (dot == std::string::npos)
+			return false;
+		std::string extension = path.substr(dot + 1);
+		std::transform(extension.begin(), extension.end(), extension.begin(), [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+		return extension == "obj";
+	}
+
+	void ListMaterialLibraries(const std::string& path, std::vector<std::string>& libraries)
+	{
+		MappedFile file;
+		if (!file.open(path))
+			return;
+
+		std::string directory = path.substr(0, path.find_last_of("/\\") + 1);
+		const char* lineStart = reinterpret_cast<const char*>(file.data());
+		const char* end = lineStart + file.size();
+		while (lineStart < end)
+		{
+			const char* newline = static_cast<const char*>(std::memchr(lineStart, '\n', end - lineStart));
+			const char* lineEnd = trimLineEnd(lineStart, newline != nullptr ? newline : end);
+			const char* cursor = skipBlanks(lineStart, lineEnd);
+			if (startsWith(cursor, lineEnd, "mtllib"))
+				libraries.push_back(directory + restOfLine(cursor + 6, lineEnd));
+			lineStart = newline != nullptr ? newline + 1 : end;
+		}
+	}
+
+	bool Load(const std::string& path, std::vector<MeshData>& meshes, ObjLoadStats* stats)
+	{
+		auto parseStart = std::chrono::steady_clock::now();
+		MappedFile file;
+		if (!file.open(path))
+		{
+			std::cout << "ERROR::OBJ:: Could not open " << path << std::endl;
+			return false;
+		}
+
+		// line aligned chunks, about one per worker plus the calling thread
+		ThreadPool& pool = ThreadPool::getShared();
+		const char* data = reinterpret_cast<const char*>(file.data());
+		const size_t size = file.size();
+		size_t chunkCount = std::max<size_t>(1, std::min<size_t>(pool.getThreadCount() + 1, size / MIN_CHUNK_BYTES));
+
+		std::vector<ObjChunk> chunks(chunkCount);
+		const char* chunkStart = data;
+		for (size_t i = 0; i < chunkCount; i++)
+		{
+			const char* chunkEnd = data + size * (i + 1) / chunkCount;
+			if (i + 1 < chunkCount && chunkEnd > chunkStart)
+			{
+				const char* newline = static_cast<const char*>(std::memchr(chunkEnd, '\n', data + size - chunkEnd));
+				chunkEnd = newline != nullptr ? newline + 1 : data + size;
+			}
+			chunkEnd = std::max(chunkEnd, chunkStart);
+			chunks[i].begin = chunkStart;
+			chunks[i].end = chunkEnd;
+			chunkStart = chunkEnd;
+		}
+		chunks.back().end = data + size;
+
+		pool.parallelFor(chunkCount, [&chunks](size_t i) { parseChunk(chunks[i]); });
+
+		for (const ObjChunk& chunk : chunks)
+		{
+			if (!chunk.error.empty())
+			{
+				std::cout << "ERROR::OBJ:: " << path << ": " << chunk.error << std::endl;
+				return false;
+			}
+		}
+		double parseMs = millisecondsSince(parseStart);
+		auto buildStart = std::chrono::steady_clock::now();
+
+		// chunk offsets into the merged attribute arrays
+		std::vector<size_t> positionBase(chunkCount + 1, 0), texCoordBase(chunkCount + 1, 0), normalBase(chunkCount + 1, 0), cornerBase(chunkCount + 1, 0);
+		for (size_t i = 0; i < chunkCount; i++)
+		{
+			positionBase[i + 1] = positionBase[i] + chunks[i].positions.size();
+			texCoordBase[i + 1] = texCoordBase[i] + chunks[i].texCoords.size();
+			normalBase[i + 1] = normalBase[i] + chunks[i].normals.size();
+			cornerBase[i + 1] = cornerBase[i] + chunks[i].corners.size();
+		}
+		if (cornerBase[chunkCount] > UINT32_MAX || positionBase[chunkCount] > INT32_MAX)
+		{
+			std::cout << "ERROR::OBJ:: " << path << " is too large" << std::endl;
+			return false;
+		}
+
+		std::vector<glm::vec3> positions(positionBase[chunkCount]);
+		std::vector<glm::vec2> texCoords(texCoordBase[chunkCount]);
+		std::vector<glm::vec3> normals(normalBase[chunkCount]);
+		std::vector<ObjCorner> corners(cornerBase[chunkCount]);
+		bool resolved = true;
+		pool.parallelFor(chunkCount, [&](size_t i)
+			{
+				ObjChunk& chunk = chunks[i];
+				if (!resolveCorners(chunk, positionBase[i], texCoordBase[i], normalBase[i], positions.size(), texCoords.size(), normals.size()))
+					return;
+				std::copy(chunk.positions.begin(), chunk.positions.end(), positions.begin() + positionBase[i]);
+				std::copy(chunk.texCoords.begin(), chunk.texCoords.end(), texCoords.begin() + texCoordBase[i]);
+				std::copy(chunk.normals.begin(), chunk.normals.end(), normals.begin() + normalBase[i]);
+				std::copy(chunk.corners.begin(), chunk.corners.end(), corners.begin() + cornerBase[i]);
+			});
+		for (const ObjChunk& chunk : chunks)
+		{
+			if (!chunk.error.empty())
+			{
+				std::cout << "ERROR::OBJ:: " << path << ": " << chunk.error << std::endl;
+				resolved = false;
+			}
+		}
+		if (!resolved)
+			return false;
+
+		// materials: index 0 is the default for faces before any usemtl or naming an unknown material
+		std::string directory = path.substr(0, path.find_last_of("/\\") + 1);
+		std::vector<ObjMaterial> materials(1);
+		for (const ObjChunk& chunk : chunks)
+		{
+			for (const std::string& library : chunk.libraries)
+				loadMaterialLibrary(directory + library, materials);
+		}
+		std::unordered_map<std::string, size_t> materialIndices;
+		for (size_t i = materials.size(); i-- > 1;)
+			materialIndices[materials[i].name] = i;	// the first definition of a name wins
+
+		// bucket the faces by material, usemtl state carries over from one chunk into the next
+		std::vector<std::vector<ObjFace>> facesByMaterial(materials.size());
+		std::vector<size_t> materialOrder;
+		size_t currentMaterial = 0;
+		for (size_t c = 0; c < chunkCount; c++)
+		{
+			const ObjChunk& chunk = chunks[c];
+			size_t change = 0;
+			uint32_t firstCorner = static_cast<uint32_t>(cornerBase[c]);
+			for (size_t f = 0; f < chunk.faceSizes.size(); f++)
+			{
+				while (change < chunk.materialChanges.size() && chunk.materialChanges[change].first == f)
+				{
+					auto found = materialIndices.find(chunk.materialChanges[change].second);
+					currentMaterial = found != materialIndices.end() ? found->second : 0;
+					change++;
+				}
+				if (facesByMaterial[currentMaterial].empty())
+					materialOrder.push_back(currentMaterial);
+				facesByMaterial[currentMaterial].push_back({ firstCorner, chunk.faceSizes[f] });
+				firstCorner += chunk.faceSizes[f];
+			}
+			if (!chunk.materialChanges.empty())
+			{
+				auto found = materialIndices.find(chunk.materialChanges.back().second);
+				currentMaterial = found != materialIndices.end() ? found->second : 0;
+			}
+		}
+
+		// one mesh per material, in order of first use, built in parallel
+		size_t firstMesh = meshes.size();
+		meshes.resize(firstMesh + materialOrder.size());
+		pool.parallelFor(materialOrder.size(), [&](size_t i)
+			{
+				size_t material = materialOrder[i];
+				MeshData& mesh = meshes[firstMesh + i];
+				buildMesh(facesByMaterial[material], corners, positions, texCoords, normals, mesh);
+				mesh.texturePaths = materials[material].texturePaths;
+			});
+
+		if (stats != nullptr)
+		{
+			stats->chunkCount = chunkCount;
+			stats->parseMs = parseMs;
+			stats->buildMs = millisecondsSince(buildStart);
+		}
+		return true;
+	}
+}
@@ -0,0 +1,28 @@
+#pragma once
+#include "Mesh.h"
+#include <string>
+#include <vector>
+
+struct ObjLoadStats
+{
+	size_t chunkCount = 0;
+	double parseMs = 0.0;	// mapping and parsing the chunks on the workers
+	double buildMs = 0.0;	// resolving indices, per material vertex building and tangents
+};
+
+//In-house Wavefront OBJ/MTL import for cold starts of Model::importModel. The file is memory mapped and cut into
+//line aligned chunks that are parsed in parallel on the shared ThreadPool with std::from_chars, then the faces are
+//merged into one MeshData per material. The output matches what the Assimp path hands to the optimiser and the
+//mesh cache: triangulated, V flipped to the top-left origin the textures are loaded with, and with a tangent frame.
+namespace ObjLoader
+{
+	//.obj, case insensitive
+	bool IsObjPath(const std::string& path);
+
+	//Parses path and the material libraries it references. map_Kd goes to the albedo slot and norm/bump/map_bump to
+	//the normal slot. Returns false on a malformed file, the caller then falls back to Assimp
+	bool Load(const std::string& path, std::vector<MeshData>& meshes, ObjLoadStats* stats = nullptr);
+
+	//Paths of the material libraries path references, for keying caches of its import
+	void ListMaterialLibraries(const std::string& path, std::vector<std::string>& libraries);
+}
@@ -1,5 +1,6 @@
 #include "PBRTexture.h"
 #include "stb_image.h"
+#include <algorithm>
 #include <iostream>
 
 //this class exists to streamline the PBRHelper to setup IBLs easier
@@ -34,11 +35,15 @@ void PBRTexture::loadTexture(const std::string& path, bool isHDR)
 
     if (isHDR)
     {
-        stbi_set_flip_vertically_on_load(true);
         int width, height, nrComponents;
         float* data = stbi_loadf(path.c_str(), &width, &height, &nrComponents, 0);
         if (data)
         {
+            // flipped here rather than with stb_image's flip flag, which is global and would flip the model textures
+            // decoding on the worker pool at the same time
+            size_t rowFloats = size_t(width) * nrComponents;
+            for (int y = 0; y < height / 2; y++)
+                std::swap_ranges(data + y * rowFloats, data + (y + 1) * rowFloats, data + (height - 1 - y) * rowFloats);
             GLenum format = nrComponents == 3 ? GL_RGB16F : GL_RGBA16F;
             glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, GL_RGB, GL_FLOAT, data);
             glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
@@ -0,0 +1,362 @@
+#include "PotentiallyVisibleSet.h"
+#include "HashUtils.h"
+#include "ThreadPool.h"
+#include <algorithm>
+#include <bitset>
+#include <cfloat>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <unordered_map>
+
+namespace
+{
+	const char PVS_MAGIC[4] = { 'A', 'J', 'P', 'V' };
+	const uint32_t INVALID_SET = ~0u;
+	const float DEFAULT_CELLS_ACROSS = 128.0f;
+	const size_t MAX_CELLS = size_t(1) << 24;
+	const int MAX_SURFACES_PER_COLUMN = 8;		// bridges and overpasses stack surfaces in one column
+
+	struct PVSFileHeader
+	{
+		char magic[4];
+		uint32_t version;
+		uint64_t sceneHash;
+		float origin[3];
+		float cellSize;
+		int32_t dimensions[3];
+		uint32_t meshCount;
+		uint32_t setCount;
+		uint32_t reserved;
+		uint64_t cellTableOffset;	// uint32 set index per cell, x fastest then z then y
+		uint64_t setsOffset;		// setCount bitsets of (meshCount + 63) / 64 words
+	};
+
+	uint64_t alignUp(uint64_t value, uint64_t alignment)
+	{
+		return (value + alignment - 1) & ~(alignment - 1);
+	}
+
+	// what a baked file is valid for
+	uint64_t sceneHash(const std::vector<Model*>& models)
+	{
+		uint64_t hash = 0;
+		for (const Model* model : models)
+		{
+			hash = HashUtils::HashCombine(hash, HashUtils::XXHash64(model->modelPath.data(), model->modelPath.size()));
+			hash = HashUtils::HashCombine(hash, static_cast<uint64_t>(model->meshes.size()));
+			hash = HashUtils::HashCombine(hash, HashUtils::XXHash64(&model->modelMatrix, sizeof(model->modelMatrix)));
+		}
+		return hash;
+	}
+
+	size_t cellIndex(const glm::ivec3& cell, const glm::ivec3& dimensions)
+	{
+		return (static_cast<size_t>(cell.y) * dimensions.z + cell.z) * dimensions.x + cell.x;
+	}
+
+	bool boxesOverlap(const glm::vec3& minA, const glm::vec3& maxA, const glm::vec3& minB, const glm::vec3& maxB)
+	{
+		return minA.x <= maxB.x && maxA.x >= minB.x && minA.y <= maxB.y && maxA.y >= minB.y && minA.z <= maxB.z && maxA.z >= minB.z;
+	}
+}
+
+std::string PotentiallyVisibleSet::PathFor(const std::vector<Model*>& models)
+{
+	return models.empty() ? std::string() : models.front()->modelPath + ".pvs";
+}
+
+int PotentiallyVisibleSet::RunBake(const std::vector<std::string>& arguments, const std::vector<Model*>& models, const SceneBVH& bvh)
+{
+	PVSBakeSettings settings;
+	for (size_t i = 0; i < arguments.size(); i++)
+	{
+		if (arguments[i] == "--cell-size" && i + 1 < arguments.size())
+			settings.cellSize = std::max(0.0f, static_cast<float>(std::atof(arguments[++i].c_str())));
+		else if (arguments[i] == "--rays" && i + 1 < arguments.size())
+			settings.raysPerCell = std::max(1, std::atoi(arguments[++i].c_str()));
+		else if (arguments[i] == "--height" && i + 1 < arguments.size())
+			settings.cellsAboveSurface = std::max(1, std::atoi(arguments[++i].c_str()));
+	}
+	return Bake(models, bvh, settings, PathFor(models)) ? 0 : 1;
+}
+
+bool PotentiallyVisibleSet::Bake(const std::vector<Model*>& models, const SceneBVH& bvh, const PVSBakeSettings& settings, const std::string& path)
+{
+	auto start = std::chrono::steady_clock::now();
+	const size_t meshCount = bvh.getInstanceCount();
+	if (meshCount == 0 || path.empty())
+	{
+		std::cerr << "ERROR::PVS:: Nothing to bake, the models aren't loaded" << std::endl;
+		return false;
+	}
+
+	glm::vec3 sceneMin(FLT_MAX), sceneMax(-FLT_MAX);
+	for (size_t i = 0; i < meshCount; i++)
+	{
+		sceneMin = glm::min(sceneMin, bvh.getInstance(static_cast<uint32_t>(i)).boundsMin);
+		sceneMax = glm::max(sceneMax, bvh.getInstance(static_cast<uint32_t>(i)).boundsMax);
+	}
+	const glm::vec3 extent = sceneMax - sceneMin;
+	const float cellSize = settings.cellSize > 0.0f ? settings.cellSize : std::max(std::max(extent.x, extent.z) / DEFAULT_CELLS_ACROSS, 1e-3f);
+	glm::ivec3 dimensions = glm::max(glm::ivec3(glm::ceil(extent / cellSize)), glm::ivec3(1));
+	dimensions.y += settings.cellsAboveSurface;
+	const size_t totalCells = static_cast<size_t>(dimensions.x) * dimensions.y * dimensions.z;
+	if (totalCells > MAX_CELLS)
+	{
+		std::cerr << "ERROR::PVS:: " << totalCells << " cells is too many, use a larger --cell-size" << std::endl;
+		return false;
+	}
+
+	// the navigable region: every surface a ray straight down each column passes, and the cells just above it
+	std::vector<uint8_t> navigable(totalCells, 0);
+	const float top = sceneMin.y + dimensions.y * cellSize;
+	ThreadPool::getShared().parallelFor(static_cast<size_t>(dimensions.x) * dimensions.z, [&](size_t column)
+		{
+			int x = static_cast<int>(column % dimensions.x);
+			int z = static_cast<int>(column / dimensions.x);
+			Ray ray;
+			ray.origin = glm::vec3(sceneMin.x + (x + 0.5f) * cellSize, top + cellSize, sceneMin.z + (z + 0.5f) * cellSize);
+			ray.direction = glm::vec3(0.0f, -1.0f, 0.0f);
+			for (int surface = 0; surface < MAX_SURFACES_PER_COLUMN; surface++)
+			{
+				RayHit hit;
+				if (!bvh.intersect(ray, hit))
+					break;
+				float height = ray.origin.y - hit.t;
+				int first = std::max(0, static_cast<int>(std::floor((height - sceneMin.y) / cellSize)));
+				int last = std::min(dimensions.y - 1, first + settings.cellsAboveSurface);
+				for (int y = first; y <= last; y++)
+					navigable[cellIndex(glm::ivec3(x, y, z), dimensions)] = 1;
+				ray.tMin = hit.t + cellSize * 0.01f;
+			}
+		});
+
+	std::vector<uint32_t> bakedCells;
+	for (size_t i = 0; i < totalCells; i++)
+	{
+		if (navigable[i])
+			bakedCells.push_back(static_cast<uint32_t>(i));
+	}
+
+	// what rays from random points of the cell in random directions hit first. meshes touching the cell are always
+	// in, the rays start inside them as often as not
+	const size_t wordsPerSet = (meshCount + 63) / 64;
+	std::vector<uint64_t> cellBits(bakedCells.size() * wordsPerSet, 0);
+	ThreadPool::getShared().parallelFor(bakedCells.size(), [&](size_t i)
+		{
+			uint64_t* bits = &cellBits[i * wordsPerSet];
+			size_t index = bakedCells[i];
+			glm::ivec3 cell(static_cast<int>(index % dimensions.x), static_cast<int>(index / (static_cast<size_t>(dimensions.x) * dimensions.z)),
+				static_cast<int>((index / dimensions.x) % dimensions.z));
+			glm::vec3 cellMin = sceneMin + glm::vec3(cell) * cellSize;
+			glm::vec3 cellMax = cellMin + glm::vec3(cellSize);
+
+			for (size_t mesh = 0; mesh < meshCount; mesh++)
+			{
+				const BVHInstance& instance = bvh.getInstance(static_cast<uint32_t>(mesh));
+				if (boxesOverlap(instance.boundsMin, instance.boundsMax, cellMin - glm::vec3(cellSize), cellMax + glm::vec3(cellSize)))
+					bits[mesh / 64] |= uint64_t(1) << (mesh % 64);
+			}
+
+			// seeded by the cell so a bake is repeatable
+			std::mt19937 random(static_cast<uint32_t>(index));
+			std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+			for (int r = 0; r < settings.raysPerCell; r++)
+			{
+				Ray ray;
+				ray.origin = cellMin + glm::vec3(unit(random), unit(random), unit(random)) * cellSize;
+				float z = 1.0f - 2.0f * unit(random);
+				float phi = 6.2831853f * unit(random);
+				float radius = std::sqrt(std::max(0.0f, 1.0f - z * z));
+				ray.direction = glm::vec3(radius * std::cos(phi), z, radius * std::sin(phi));
+
+				RayHit hit;
+				if (bvh.intersect(ray, hit))
+					bits[hit.instance / 64] |= uint64_t(1) << (hit.instance % 64);
+			}
+		});
+
+	// neighbouring cells mostly see the same meshes, each distinct set is stored once
+	std::vector<uint32_t> cellTable(totalCells, INVALID_SET);
+	std::vector<uint64_t> sets;
+	std::unordered_map<uint64_t, std::vector<uint32_t>> setsByHash;
+	size_t visibleSum = 0;
+	for (size_t i = 0; i < bakedCells.size(); i++)
+	{
+		const uint64_t* bits = &cellBits[i * wordsPerSet];
+		for (size_t word = 0; word < wordsPerSet; word++)
+			visibleSum += static_cast<size_t>(std::bitset<64>(bits[word]).count());
+
+		uint64_t hash = HashUtils::XXHash64(bits, wordsPerSet * sizeof(uint64_t));
+		std::vector<uint32_t>& candidates = setsByHash[hash];
+		uint32_t setIndex = INVALID_SET;
+		for (uint32_t candidate : candidates)
+		{
+			if (std::memcmp(&sets[candidate * wordsPerSet], bits, wordsPerSet * sizeof(uint64_t)) == 0)
+				setIndex = candidate;
+		}
+		if (setIndex == INVALID_SET)
+		{
+			setIndex = static_cast<uint32_t>(sets.size() / wordsPerSet);
+			sets.insert(sets.end(), bits, bits + wordsPerSet);
+			candidates.push_back(setIndex);
+		}
+		cellTable[bakedCells[i]] = setIndex;
+	}
+
+	PVSFileHeader header = {};
+	std::memcpy(header.magic, PVS_MAGIC, sizeof(header.magic));
+	header.version = PVS_FILE_VERSION;
+	header.sceneHash = sceneHash(models);
+	header.origin[0] = sceneMin.x;
+	header.origin[1] = sceneMin.y;
+	header.origin[2] = sceneMin.z;
+	header.cellSize = cellSize;
+	header.dimensions[0] = dimensions.x;
+	header.dimensions[1] = dimensions.y;
+	header.dimensions[2] = dimensions.z;
+	header.meshCount = static_cast<uint32_t>(meshCount);
+	header.setCount = static_cast<uint32_t>(sets.size() / wordsPerSet);
+	header.cellTableOffset = sizeof(PVSFileHeader);
+	header.setsOffset = alignUp(header.cellTableOffset + cellTable.size() * sizeof(uint32_t), sizeof(uint64_t));
+
+	// via a temporary file like the mesh cache, a failed bake never leaves a torn file behind
+	const std::string tempPath = path + ".tmp";
+	{
+		std::ofstream out(tempPath, std::ios::binary | std::ios::trunc);
+		if (!out)
+		{
+			std::cerr << "ERROR::PVS:: Could not create " << tempPath << std::endl;
+			return false;
+		}
+		out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+		out.write(reinterpret_cast<const char*>(cellTable.data()), static_cast<std::streamsize>(cellTable.size() * sizeof(uint32_t)));
+		static const char zeros[sizeof(uint64_t)] = {};
+		out.write(zeros, static_cast<std::streamsize>(header.setsOffset - static_cast<uint64_t>(out.tellp())));
+		out.write(reinterpret_cast<const char*>(sets.data()), static_cast<std::streamsize>(sets.size() * sizeof(uint64_t)));
+		if (!out)
+		{
+			std::cerr << "ERROR::PVS:: Failed writing " << tempPath << std::endl;
+			return false;
+		}
+	}
+	std::error_code ec;
+	std::filesystem::rename(tempPath, path, ec);
+	if (ec)
+	{
+		std::cerr << "ERROR::PVS:: Could not replace " << path << ": " << ec.message() << std::endl;
+		std::filesystem::remove(tempPath, ec);
+		return false;
+	}
+
+	std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+	uint64_t fileBytes = header.setsOffset + sets.size() * sizeof(uint64_t);
+	std::printf("PVS: %zu of %zu cells of %.2f baked with %d rays each in %.1f s\n", bakedCells.size(), totalCells, cellSize,
+		settings.raysPerCell, elapsed.count());
+	std::printf("PVS: %u distinct sets, %.1f of %zu meshes visible per cell on average, %.1f KB written to %s\n", header.setCount,
+		bakedCells.empty() ? 0.0 : double(visibleSum) / bakedCells.size(), meshCount, fileBytes / 1024.0, path.c_str());
+	return true;
+}
+
+void PotentiallyVisibleSet::update(const std::vector<Model*>& models)
+{
+	bool changed = models.size() != builtModels.size();
+	for (size_t i = 0; i < models.size() && !changed; i++)
+	{
+		const Model& model = *models[i];
+		size_t meshCount = model.isLoading() ? 0 : model.meshes.size();
+		changed = builtModels[i] != &model || builtMeshCounts[i] != meshCount || builtMatrices[i] != model.modelMatrix;
+	}
+	if (changed)
+		load(models);
+}
+
+void PotentiallyVisibleSet::load(const std::vector<Model*>& models)
+{
+	builtModels.assign(models.begin(), models.end());
+	builtMatrices.clear();
+	builtMeshCounts.clear();
+	modelOffsets.clear();
+	file.close();
+	cellSets = nullptr;
+	sets = nullptr;
+
+	bool loading = false;
+	size_t meshCount = 0;
+	for (const Model* model : models)
+	{
+		builtMatrices.push_back(model->modelMatrix);
+		builtMeshCounts.push_back(model->isLoading() ? 0 : model->meshes.size());
+		modelOffsets.push_back(meshCount);
+		meshCount += model->isLoading() ? 0 : model->meshes.size();
+		loading |= model->isLoading();
+	}
+	const std::string path = PathFor(models);
+	if (loading || path.empty() || !std::filesystem::exists(path))
+		return;
+
+	PVSFileHeader header;
+	if (!file.open(path) || file.size() < sizeof(header))
+	{
+		file.close();
+		return;
+	}
+	std::memcpy(&header, file.data(), sizeof(header));
+
+	const size_t totalCells = static_cast<size_t>(std::max(header.dimensions[0], 0)) * std::max(header.dimensions[1], 0) * std::max(header.dimensions[2], 0);
+	wordsPerSet = (static_cast<size_t>(header.meshCount) + 63) / 64;
+	if (std::memcmp(header.magic, PVS_MAGIC, sizeof(header.magic)) != 0 || header.version != PVS_FILE_VERSION ||
+		header.cellTableOffset + totalCells * sizeof(uint32_t) > file.size() ||
+		header.setsOffset % sizeof(uint64_t) != 0 ||
+		header.setsOffset + static_cast<uint64_t>(header.setCount) * wordsPerSet * sizeof(uint64_t) > file.size())
+	{
+		std::cerr << "ERROR::PVS:: Invalid or outdated file " << path << ", bake it again with --bake-pvs" << std::endl;
+		file.close();
+		return;
+	}
+	if (header.sceneHash != sceneHash(models) || header.meshCount != meshCount)
+	{
+		std::printf("PVS: %s was baked for a different scene, culling dynamically\n", path.c_str());
+		file.close();
+		return;
+	}
+
+	cellSets = reinterpret_cast<const uint32_t*>(file.data() + header.cellTableOffset);
+	sets = reinterpret_cast<const uint64_t*>(file.data() + header.setsOffset);
+	origin = glm::vec3(header.origin[0], header.origin[1], header.origin[2]);
+	cellSize = header.cellSize;
+	dimensions = glm::ivec3(header.dimensions[0], header.dimensions[1], header.dimensions[2]);
+	std::printf("PVS: %u sets over %dx%dx%d cells loaded from %s\n", header.setCount, dimensions.x, dimensions.y, dimensions.z, path.c_str());
+}
+
+const uint64_t* PotentiallyVisibleSet::lookup(const glm::vec3& position) const
+{
+	if (!cellSets)
+		return nullptr;
+	glm::ivec3 cell(glm::floor((position - origin) / cellSize));
+	if (glm::any(glm::lessThan(cell, glm::ivec3(0))) || glm::any(glm::greaterThanEqual(cell, dimensions)))
+		return nullptr;
+	uint32_t set = cellSets[cellIndex(cell, dimensions)];
+	return set == INVALID_SET ? nullptr : sets + static_cast<size_t>(set) * wordsPerSet;
+}
+
+bool PotentiallyVisibleSet::isVisible(const uint64_t* cell, const Model* model, size_t mesh) const
+{
+	for (size_t i = 0; i < builtModels.size(); i++)
+	{
+		if (builtModels[i] == model)
+		{
+			size_t bit = modelOffsets[i] + mesh;
+			return (cell[bit / 64] >> (bit % 64)) & 1;
+		}
+	}
+	// not part of the baked scene
+	return true;
+}
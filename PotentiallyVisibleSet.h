@@ -0,0 +1,59 @@
+#pragma once
+#include "BVH.h"
+#include "MappedFile.h"
+#include <cstdint>
+#include <string>
+#include <vector>
+
+//Bump whenever the file layout or the baking changes
+const uint32_t PVS_FILE_VERSION = 1;
+
+struct PVSBakeSettings
+{
+	float cellSize = 0.0f;				// 0 picks the scene's larger horizontal extent / 128
+	int raysPerCell = 1024;
+	int cellsAboveSurface = 2;			// how high above a surface the navigable region reaches
+};
+
+//Potentially visible sets of a static scene. The navigable region (cells just above any surface, found by casting
+//down every column of the grid) is cut into cubic cells, each holding one bit per mesh for everything that can be
+//seen from anywhere inside it, in SceneBVH instance order. Baked offline by ray casting from random points of every
+//cell on the thread pool (AJGL --bake-pvs), written next to the first model as <model>.pvs with identical sets stored
+//once, and mapped at runtime so a lookup from the camera position is a grid index. Outside the baked cells lookup()
+//returns nullptr and the dynamic culling carries on alone.
+//The file is keyed by a hash of the models' paths, mesh counts and matrices, anything moved means baking again
+class PotentiallyVisibleSet
+{
+public:
+	//AJGL --bake-pvs [--cell-size S] [--rays N] [--height N], the models have to be loaded and in the BVH
+	static int RunBake(const std::vector<std::string>& arguments, const std::vector<Model*>& models, const SceneBVH& bvh);
+	static bool Bake(const std::vector<Model*>& models, const SceneBVH& bvh, const PVSBakeSettings& settings, const std::string& path);
+	static std::string PathFor(const std::vector<Model*>& models);
+
+	//Maps the file baked for these models once they have all loaded, again if one moves. Without a matching file
+	//nothing is loaded and lookup() always returns nullptr
+	void update(const std::vector<Model*>& models);
+
+	//Bitset of the cell holding position, nullptr outside the baked cells
+	const uint64_t* lookup(const glm::vec3& position) const;
+	//Whether mesh of model is in a cell's set
+	bool isVisible(const uint64_t* cell, const Model* model, size_t mesh) const;
+	bool isLoaded() const { return cellSets != nullptr; }
+
+private:
+	MappedFile file;
+	const uint32_t* cellSets = nullptr;		// per grid cell, index of its set or INVALID_SET
+	const uint64_t* sets = nullptr;
+	size_t wordsPerSet = 0;
+	glm::vec3 origin = glm::vec3(0.0f);
+	float cellSize = 1.0f;
+	glm::ivec3 dimensions = glm::ivec3(0);
+
+	// what the file was loaded for, to spot changes
+	std::vector<const Model*> builtModels;
+	std::vector<glm::mat4> builtMatrices;
+	std::vector<size_t> builtMeshCounts;
+	std::vector<size_t> modelOffsets;		// first bit of each model's meshes
+
+	void load(const std::vector<Model*>& models);
+};
@@ -1,80 +1,366 @@
 #include "ResourceManager.h"
+#include "Mesh.h"
 
 
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
 #include <iostream>
 #include "Shader.h"
 #include "OpenGLUtils.h"
+#include "ThreadPool.h"
+#include "HashUtils.h"
 
 GLfloat ResourceManager::maxAnisotropy = 0.0f;
+bool ResourceManager::textureCompression = true;
+
+DecodedImage::~DecodedImage()
+{
+    // decoded but never uploaded, hand the block back so the ring doesn't stall on it
+    if (staging.isValid() && StagingRing::getInstance() != nullptr)
+    {
+        StagingRing::getInstance()->release(staging);
+    }
+}
 
 Texture ResourceManager::getTexture(const std::string& path, const std::string& directory,aiTextureType type, bool isHDR)
 {
-    // Check if the texture is already loaded
-    auto it = textures.find(path);
-    if (it != textures.end())
+    const std::string filename = directory + '/' + path;
+    const std::string canonicalPath = canonicalTexturePath(filename);
+    const uint64_t key = textureKey(resolveContentHash(canonicalPath), aiTextureTypeToTextureType(type), isHDR);
+
+    // If a worker is already decoding this content, wait for it instead of decoding it a second time. The pending entry
+    // stays until the texture is in the map, so a request arriving while this decodes or uploads doesn't queue another
+    std::shared_future<std::shared_ptr<DecodedImage>> pendingDecode;
+    std::promise<std::shared_ptr<DecodedImage>> inlineDecode;
     {
-        return it->second;
+        std::lock_guard<std::mutex> lock(texturesMutex);
+
+        // Check if the texture is already loaded, possibly from a copy of the file somewhere else
+        auto it = textures.find(key);
+        if (it != textures.end())
+        {
+            pendingDecodes.erase(key);
+            it->second.paths.insert(canonicalPath);
+            return it->second.texture;
+        }
+
+        auto pending = pendingDecodes.find(key);
+        if (pending != pendingDecodes.end())
+            pendingDecode = pending->second;
+        else
+            pendingDecodes.emplace(key, inlineDecode.get_future().share());	// in flight on this thread
     }
 
     // Load the texture
-    Texture newTexture = loadTextureFromFile(path, directory,aiTextureTypeToTextureType(type), isHDR);
-    textures.insert({ path, newTexture });
-    return textures[path];
+    std::shared_ptr<DecodedImage> image;
+    if (pendingDecode.valid())
+    {
+        image = pendingDecode.get();
+    }
+    else
+    {
+        image = decodeTexture(filename, aiTextureTypeToTextureType(type), isHDR);
+        inlineDecode.set_value(image);
+    }
+    size_t vramBytes = estimateVramBytes(*image);
+    Texture newTexture = uploadTexture(*image, path, aiTextureTypeToTextureType(type));
+
+    std::lock_guard<std::mutex> lock(texturesMutex);
+    TextureEntry& entry = textures[key];
+    entry.texture = newTexture;
+    entry.vramBytes = newTexture.id != 0 ? vramBytes : 0;
+    entry.paths.insert(canonicalPath);
+    pendingDecodes.erase(key);
+    return entry.texture;
 }
 
+void ResourceManager::requestTextures(const std::vector<TextureRequest>& requests, const std::string& directory)
+{
+    for (const TextureRequest& request : requests)
+    {
+        std::string filename = directory + '/' + request.path;
+        uint64_t key = textureKey(resolveContentHash(canonicalTexturePath(filename)), aiTextureTypeToTextureType(request.type), request.isHDR);
+
+        std::lock_guard<std::mutex> lock(texturesMutex);
+        if (textures.count(key) != 0)
+        {
+            // a decode left over from before the upload would hold its staging block for good
+            pendingDecodes.erase(key);
+            continue;
+        }
+        if (pendingDecodes.count(key) != 0)
+            continue;
+
+        TextureType type = aiTextureTypeToTextureType(request.type);
+        bool isHDR = request.isHDR;
+        std::future<std::shared_ptr<DecodedImage>> decode = ThreadPool::getShared().submit([filename, type, isHDR]()
+            {
+                return decodeTexture(filename, type, isHDR);
+            });
+        pendingDecodes.emplace(key, decode.share());
+    }
+}
 
-Texture ResourceManager::loadTextureFromFile(const std::string& path, const std::string& directory, TextureType type, bool isHDR)
+bool ResourceManager::isTextureReady(const std::string& path, const std::string& directory, aiTextureType type)
 {
+    const std::string canonicalPath = canonicalTexturePath(directory + '/' + path);
 
-    std::string filename = directory + '/' + path;
+    std::lock_guard<std::mutex> lock(texturesMutex);
+    auto indexed = pathIndex.find(canonicalPath);
+    if (indexed == pathIndex.end())
+        return true;
+    auto pending = pendingDecodes.find(textureKey(indexed->second, aiTextureTypeToTextureType(type), false));
+    if (pending == pendingDecodes.end())
+        return true;
+    return pending->second.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+}
 
-    unsigned int textureID;
-    glGenTextures(1, &textureID);
+void ResourceManager::printTextureReport()
+{
+    std::lock_guard<std::mutex> lock(texturesMutex);
+
+    size_t fileCount = 0;
+    size_t duplicateCount = 0;
+    size_t totalBytes = 0;
+    size_t savedBytes = 0;
+    for (const auto& texture : textures)
+    {
+        const TextureEntry& entry = texture.second;
+        fileCount += entry.paths.size();
+        totalBytes += entry.vramBytes;
+        if (entry.paths.size() > 1)
+        {
+            duplicateCount += entry.paths.size() - 1;
+            savedBytes += (entry.paths.size() - 1) * entry.vramBytes;
+        }
+    }
 
+    const double MB = 1024.0 * 1024.0;
+    std::cout << "Textures: " << fileCount << " files -> " << textures.size() << " GL textures, " << totalBytes / MB << " MB. "
+        << duplicateCount << " duplicate files shared, saving " << savedBytes / MB << " MB of VRAM" << std::endl;
+}
 
-    int width, height, nrComponents;
+std::shared_ptr<MeshGeometry> ResourceManager::findGeometry(uint64_t contentHash)
+{
+    auto found = geometries.find(contentHash);
+    if (found == geometries.end())
+        return nullptr;
 
-    glBindTexture(GL_TEXTURE_2D, textureID);
+    std::shared_ptr<MeshGeometry> geometry = found->second.lock();
+    if (!geometry)
+        geometries.erase(found); // every mesh drawing it is gone
+    return geometry;
+}
 
-    if (isHDR)
+void ResourceManager::registerGeometry(uint64_t contentHash, const std::shared_ptr<MeshGeometry>& geometry)
+{
+    geometries[contentHash] = geometry;
+}
+
+void ResourceManager::printGeometryReport()
+{
+    size_t liveCount = 0;
+    size_t meshCount = 0;
+    size_t totalBytes = 0;
+    size_t savedBytes = 0;
+    for (auto it = geometries.begin(); it != geometries.end();)
     {
-        // Load HDR texture
-        float* hdrData = stbi_loadf(filename.c_str(), &width, &height, &nrComponents, 0);
-        if (hdrData)
+        std::shared_ptr<MeshGeometry> geometry = it->second.lock();
+        if (!geometry)
         {
-            GLenum format = (nrComponents == 3) ? GL_RGB16F : GL_RGBA16F;
-            glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, GL_RGB, GL_FLOAT, hdrData);
-            stbi_image_free(hdrData);
+            it = geometries.erase(it);
+            continue;
         }
+
+        // the local shared_ptr counts as one user
+        size_t users = static_cast<size_t>(geometry.use_count()) - 1;
+        liveCount++;
+        meshCount += users;
+        totalBytes += geometry->geometryBytes;
+        savedBytes += (users - 1) * geometry->geometryBytes;
+        ++it;
+    }
+
+    const double MB = 1024.0 * 1024.0;
+    std::cout << "Geometry: " << meshCount << " meshes -> " << liveCount << " shared buffers, " << totalBytes / MB << " MB. "
+        << meshCount - liveCount << " duplicate meshes shared, saving " << savedBytes / MB << " MB of VRAM" << std::endl;
+}
+
+std::string ResourceManager::canonicalTexturePath(const std::string& filename)
+{
+    // lexical only, this runs every frame while models stream in and mustn't touch the file system
+    std::string normalized = filename;
+    std::replace(normalized.begin(), normalized.end(), '\\', '/');
+    return std::filesystem::path(normalized).lexically_normal().generic_string();
+}
+
+uint64_t ResourceManager::textureKey(uint64_t contentHash, TextureType type, bool isHDR)
+{
+    // uncompressed uploads are the same whatever slot the image is bound to
+    if (!textureCompression || isHDR)
+        return contentHash;
+    return HashUtils::HashCombine(contentHash, TextureCompressor::GetVariant(type));
+}
+
+uint64_t ResourceManager::resolveContentHash(const std::string& canonicalPath)
+{
+    {
+        std::lock_guard<std::mutex> lock(texturesMutex);
+        auto indexed = pathIndex.find(canonicalPath);
+        if (indexed != pathIndex.end())
+            return indexed->second;
+    }
+
+    // files that can't be read are keyed by their path instead, so they still fail (and are cached) one by one
+    uint64_t contentHash;
+    if (!HashUtils::HashFile(canonicalPath, contentHash))
+        contentHash = HashUtils::XXHash64(canonicalPath.data(), canonicalPath.size());
+
+    std::lock_guard<std::mutex> lock(texturesMutex);
+    pathIndex.emplace(canonicalPath, contentHash);
+    return contentHash;
+}
+
+size_t ResourceManager::estimateVramBytes(const DecodedImage& image)
+{
+    if (image.compressed)
+    {
+        size_t bytes = 0;
+        for (size_t level = 0; level < image.compressed->mips.size(); level++)
+            bytes += image.compressed->getMipSize(level);
+        return bytes;
     }
+
+    // uploaded at the source channel count (half floats for HDR), plus a third for the generated mips
+    size_t bytes = size_t(image.width) * image.height * image.channels * (image.isHDR ? 2 : 1);
+    return bytes + bytes / 3;
+}
+
+// Runs on worker threads, so it must only touch stb_image and never GL
+std::shared_ptr<DecodedImage> ResourceManager::decodeTexture(const std::string& filename, TextureType type, bool isHDR)
+{
+    auto image = std::make_shared<DecodedImage>();
+    image->isHDR = isHDR;
+
+    // the first load of a texture compresses it and writes the cache, later loads just read the blocks back
+    if (textureCompression && !isHDR)
+    {
+        auto compressed = std::make_unique<CompressedTexture>();
+        CompressionReport report;
+        if (TextureCompressor::LoadOrCompress(filename, type, *compressed, &report))
+        {
+            if (!report.fromCache)
+            {
+                std::cout << "Compressed " << filename << " to " << TextureCompressor::FormatName(report.format) << ": "
+                    << report.uncompressedBytes / 1024 << " KB -> " << report.compressedBytes / 1024 << " KB, PSNR "
+                    << report.psnr << " dB" << std::endl;
+            }
+            image->width = report.width;
+            image->height = report.height;
+            stageCompressed(*compressed, *image);
+            image->compressed = std::move(compressed);
+            return image;
+        }
+    }
+
+    if (isHDR)
+        image->pixels.reset(stbi_loadf(filename.c_str(), &image->width, &image->height, &image->channels, 0));
     else
+        image->pixels.reset(stbi_load(filename.c_str(), &image->width, &image->height, &image->channels, 0));
+
+    if (!image->pixels)
     {
-        // Load non-HDR texture
-        unsigned char* data = stbi_load(filename.c_str(), &width, &height, &nrComponents, 0);
-        if (data)
+        const char* reason = stbi_failure_reason();
+        image->failureReason = filename + ": " + (reason ? reason : "unknown error");
+        return image;
+    }
+
+    // write the pixels into persistently mapped memory here, off the GL thread, so the upload is a PBO copy
+    if (StagingRing* ring = StagingRing::getInstance())
+    {
+        GLsizeiptr size = GLsizeiptr(image->width) * image->height * image->channels * (isHDR ? sizeof(float) : 1);
+        StagingAllocation allocation = ring->allocate(size);
+        if (allocation.isValid())
         {
-            GLenum format;
-            if (nrComponents == 1)
-                format = GL_RED;
-            else if (nrComponents == 3)
-                format = GL_RGB;
-            else if (nrComponents == 4)
-                format = GL_RGBA;
-
-            glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, data);
-            stbi_image_free(data);
+            std::memcpy(allocation.cpuPointer, image->pixels.get(), static_cast<size_t>(size));
+            image->pixels.reset();
+            image->staging = allocation;
         }
     }
-    // Check if the texture was loaded successfully
-    if (glIsTexture(textureID) == GL_FALSE)
+    return image;
+}
+
+// Worker side of the compressed upload: the mip chain goes back to back into one ring block and the CPU copies are
+// freed, the same as the stb_image pixels of an uncompressed texture
+void ResourceManager::stageCompressed(CompressedTexture& compressed, DecodedImage& image)
+{
+    StagingRing* ring = StagingRing::getInstance();
+    if (ring == nullptr)
+        return;
+
+    GLsizeiptr size = 0;
+    for (size_t level = 0; level < compressed.mips.size(); level++)
+        size += static_cast<GLsizeiptr>(compressed.getMipSize(level));
+    StagingAllocation allocation = ring->allocate(size);
+    if (!allocation.isValid())
+        return;
+
+    unsigned char* write = allocation.cpuPointer;
+    for (CompressedMip& mip : compressed.mips)
     {
-        std::cout << "Texture failed to load at path: " << filename << std::endl;
-        std::cout << "STBI Error: " << stbi_failure_reason() << std::endl;
+        std::memcpy(write, mip.data.data(), mip.data.size());
+        write += mip.data.size();
+        std::vector<uint8_t>().swap(mip.data);
+    }
+    image.staging = allocation;
+}
+
+Texture ResourceManager::uploadTexture(DecodedImage& image, const std::string& path, TextureType type)
+{
+    // Check if the texture was decoded successfully
+    if (!image.hasPixels())
+    {
+        std::cout << "Texture failed to load at path: " << path << std::endl;
+        std::cout << "STBI Error: " << image.failureReason << std::endl;
         return Texture{}; // Return an empty Texture object
     }
 
-    // Generate Mipmaps and set texture parameters
-    glGenerateMipmap(GL_TEXTURE_2D);
+    unsigned int textureID;
+    glGenTextures(1, &textureID);
+    glBindTexture(GL_TEXTURE_2D, textureID);
+
+    if (image.compressed)
+    {
+        // the cache carries the whole mip chain, so there's nothing left to generate
+        const CompressedTexture& compressed = *image.compressed;
+        GLintptr offset = 0;
+        for (size_t level = 0; level < compressed.mips.size(); level++)
+        {
+            const CompressedMip& mip = compressed.mips[level];
+            GLsizei size = static_cast<GLsizei>(compressed.getMipSize(level));
+            if (image.staging.isValid())
+                StagingRing::getInstance()->uploadCompressedTexture2D(image.staging, offset, static_cast<GLint>(level), compressed.getInternalFormat(),
+                    mip.width, mip.height, size);
+            else
+                glCompressedTexImage2D(GL_TEXTURE_2D, static_cast<GLint>(level), compressed.getInternalFormat(), mip.width, mip.height, 0,
+                    size, mip.data.data());
+            offset += size;
+        }
+        if (image.staging.isValid())
+        {
+            StagingRing::getInstance()->release(image.staging);
+            image.staging = StagingAllocation{};
+        }
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, static_cast<GLint>(compressed.mips.size()) - 1);
+    }
+    else
+    {
+        uploadUncompressed(image);
+        glGenerateMipmap(GL_TEXTURE_2D);
+    }
+
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
@@ -90,10 +376,55 @@ Texture ResourceManager::loadTextureFromFile(const std::string& path, const std:
     texture.id = textureID;
     texture.type = type;
     texture.path = path;
-    texture.isHDR = isHDR;
+    texture.isHDR = image.isHDR;
     return texture;
 }
 
+void ResourceManager::uploadUncompressed(DecodedImage& image)
+{
+    GLenum format = GL_RGB;
+    GLenum internalFormat = GL_RGB;
+    GLenum pixelType = GL_UNSIGNED_BYTE;
+    if (image.isHDR)
+    {
+        format = (image.channels == 4) ? GL_RGBA : GL_RGB;
+        internalFormat = (image.channels == 4) ? GL_RGBA16F : GL_RGB16F;
+        pixelType = GL_FLOAT;
+    }
+    else
+    {
+        if (image.channels == 1)
+            format = GL_RED;
+        else if (image.channels == 3)
+            format = GL_RGB;
+        else if (image.channels == 4)
+            format = GL_RGBA;
+        internalFormat = format;
+    }
+
+    if (image.staging.isValid())
+    {
+        StagingRing::getInstance()->uploadTexture2D(image.staging, 0, internalFormat, image.width, image.height, format, pixelType);
+        image.staging = StagingAllocation{};
+    }
+    else
+    {
+        glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, image.width, image.height, 0, format, pixelType, image.pixels.get());
+    }
+}
+
+
+unsigned int ResourceManager::getDefaultTexture(unsigned char r, unsigned char g, unsigned char b)
+{
+    uint32_t colour = (uint32_t(r) << 16) | (uint32_t(g) << 8) | b;
+    auto found = defaultTextures.find(colour);
+    if (found != defaultTextures.end())
+        return found->second;
+
+    unsigned int textureID = CreateDefaultTexture(r, g, b);
+    defaultTextures.emplace(colour, textureID);
+    return textureID;
+}
 
 unsigned int ResourceManager::CreateDefaultTexture(unsigned char r, unsigned char g, unsigned char b)
 {
@@ -114,6 +445,11 @@ unsigned int ResourceManager::CreateDefaultTexture(unsigned char r, unsigned cha
     return textureID;
 }
 
+void ResourceManager::SetTextureCompression(bool enabled)
+{
+    textureCompression = enabled;
+}
+
 void ResourceManager::InitMaxAnisotropy()
 {
     if (GLAD_GL_EXT_texture_filter_anisotropic)
@@ -142,6 +478,8 @@ TextureType ResourceManager::aiTextureTypeToTextureType(aiTextureType type)
         return TextureType::AMBIENT_OCCLUSION;
     case aiTextureType_BASE_COLOR:
         return TextureType::BASE_COLOR;
+    case aiTextureType_LIGHTMAP:
+        return TextureType::LIGHTMAP;
     case aiTextureType_UNKNOWN:
     default:
         return TextureType::UNKNOWN;
@@ -161,6 +499,7 @@ std::string ResourceManager::TextureTypeToString(TextureType type)
     case TextureType::AMBIENT: return "material.aoMap";
     case TextureType::AMBIENT_OCCLUSION: return "material.aoMap";
     case TextureType::BASE_COLOR: return "material.albedoMap";
+    case TextureType::LIGHTMAP: return "material.aoMap";
     case TextureType::UNKNOWN: return "material.roughnessMetallicMap";
     default: return "";
     }
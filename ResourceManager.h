@@ -9,22 +9,114 @@
 #include <assimp/GltfMaterial.h>
 #include <assimp/pbrmaterial.h>
 #include "stb_image.h"
+#include "StagingRing.h"
+#include "TextureCompressor.h"
+#include <future>
+#include <memory>
+#include <mutex>
 #include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+//Pixels decoded by stb_image on a worker thread, waiting for the GL thread to upload them.
+//When the staging ring has room the worker copies them (or the compressed mip chain) straight into it and frees the CPU copy.
+struct DecodedImage
+{
+	int width = 0;
+	int height = 0;
+	int channels = 0;
+	bool isHDR = false;
+	std::unique_ptr<void, void(*)(void*)> pixels{ nullptr, stbi_image_free };
+	StagingAllocation staging;
+	std::unique_ptr<CompressedTexture> compressed;	// set instead of pixels when the block compressed cache was used
+	std::string failureReason;
+
+	DecodedImage() = default;
+	DecodedImage(const DecodedImage&) = delete;
+	DecodedImage& operator=(const DecodedImage&) = delete;
+	~DecodedImage();
+
+	bool hasPixels() const { return pixels != nullptr || staging.isValid() || compressed != nullptr; }
+};
+
+struct MeshGeometry;
+
+struct TextureRequest
+{
+	std::string path;
+	aiTextureType type;
+	bool isHDR = false;
+};
 
 class ResourceManager
 {
 public:
 	Texture getTexture(const std::string& path, const std::string& directory, aiTextureType type, bool isHDR = false);
+
+	//Starts decoding every texture that isn't loaded or already in flight on the shared worker pool.
+	//The GL upload happens later on the GL thread, when getTexture is called for that path.
+	void requestTextures(const std::vector<TextureRequest>& requests, const std::string& directory);
+	//True when getTexture for this path and type won't have to wait on a decode
+	bool isTextureReady(const std::string& path, const std::string& directory, aiTextureType type);
+
+	//How many texture files turned out to be copies of one already loaded, and the VRAM that sharing saved
+	void printTextureReport();
+
+	//Shared mesh geometry keyed by Model's hash of its vertex/index content and upload format. The registry only holds
+	//weak references, the Meshes drawing a geometry own it and its buffers go when the last of them does.
+	//GL thread only, like the uploads that create the geometry.
+	std::shared_ptr<MeshGeometry> findGeometry(uint64_t contentHash);
+	void registerGeometry(uint64_t contentHash, const std::shared_ptr<MeshGeometry>& geometry);
+	//Meshes drawing each live geometry and the VRAM the sharing saved
+	void printGeometryReport();
+
+	//1x1 texture of one colour for empty material slots. Created once per colour and shared, so meshes missing the same
+	//maps still end up with identical texture IDs and batch together. GL thread only
+	unsigned int getDefaultTexture(unsigned char r, unsigned char g, unsigned char b);
+
 	static std::string TextureTypeToString(TextureType type);
-	static unsigned int CreateDefaultTexture(unsigned char r, unsigned char g, unsigned char b);
 	
 	//Static method to initialize anisotropy level
 	static void InitMaxAnisotropy();
+	//LDR textures are loaded through the BC4/BC5/BC7 cache (see TextureCompressor) unless this is turned off
+	static void SetTextureCompression(bool enabled);
 private:
-	std::unordered_map<std::string, Texture> textures;
-	Texture loadTextureFromFile(const std::string& path, const std::string& directory, TextureType type, bool isHDR = false);
-	TextureType aiTextureTypeToTextureType(aiTextureType type);
+	struct TextureEntry
+	{
+		Texture texture;
+		size_t vramBytes = 0;
+		std::unordered_set<std::string> paths;	// every canonical path that resolved to this content
+	};
+
+	//textures are keyed by an XXH64 hash of the file bytes combined with the compressed variant of the slot (see textureKey),
+	//so identical files in different directories share one GL texture, same-named files with different content never
+	//collide and an image bound as, say, a BC4 occlusion map and a BC7 roughness/metallic mask gets one texture per format.
+	//pathIndex maps a canonical path to its content hash so each file is only hashed the first time it's seen.
+	std::unordered_map<uint64_t, TextureEntry> textures;
+	std::unordered_map<std::string, uint64_t> pathIndex;
+
+	//decodes requested or running but not in textures yet, keyed the same way so the same content is only ever decoded once.
+	//an entry is only erased together with the textures insert, under the same lock.
+	//requests can come from loader threads, so all three maps are guarded by texturesMutex; uploads stay on the GL thread.
+	std::unordered_map<uint64_t, std::shared_future<std::shared_ptr<DecodedImage>>> pendingDecodes;
+	std::mutex texturesMutex;
+
+	std::unordered_map<uint64_t, std::weak_ptr<MeshGeometry>> geometries;
+	std::unordered_map<uint32_t, unsigned int> defaultTextures;	// 0xRRGGBB -> texture
+
+	uint64_t resolveContentHash(const std::string& canonicalPath);
+	static uint64_t textureKey(uint64_t contentHash, TextureType type, bool isHDR);
+	static std::string canonicalTexturePath(const std::string& filename);
+	static size_t estimateVramBytes(const DecodedImage& image);
+
+	static std::shared_ptr<DecodedImage> decodeTexture(const std::string& filename, TextureType type, bool isHDR);
+	Texture uploadTexture(DecodedImage& image, const std::string& path, TextureType type);
+	static void stageCompressed(CompressedTexture& compressed, DecodedImage& image);
+	static void uploadUncompressed(DecodedImage& image);
+	static unsigned int CreateDefaultTexture(unsigned char r, unsigned char g, unsigned char b);
+	static TextureType aiTextureTypeToTextureType(aiTextureType type);
 
 	static GLfloat maxAnisotropy;
+	static bool textureCompression;
 };
 
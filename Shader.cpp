@@ -1,4 +1,6 @@
 #include "Shader.h"
+#include "StagingRing.h"
+#include <cstring>
 #include <vector>
 
 
@@ -60,6 +62,31 @@ Shader::Shader(const char* vertexPath, const char* fragmentPath)
 	std::cout << "Shader created: " << std::endl;
 }
 
+Shader::Shader(const char* computePath)
+{
+	std::string computeCode;
+	std::ifstream cShaderFile;
+	cShaderFile.exceptions(std::ifstream::failbit | std::ifstream::badbit);
+	try
+	{
+		cShaderFile.open(computePath);
+		std::stringstream cShaderStream;
+		cShaderStream << cShaderFile.rdbuf();
+		cShaderFile.close();
+		computeCode = cShaderStream.str();
+	}
+	catch (std::ifstream::failure e)
+	{
+		std::cout << "ERROR::SHADER::FILE_NOT_SUCCESFULLY_READ" << std::endl;
+	}
+
+	unsigned int compute = compileShader(computeCode.c_str(), GL_COMPUTE_SHADER);
+	ID = linkProgram(compute);
+	glDeleteShader(compute);
+
+	std::cout << "Compute shader created: " << std::endl;
+}
+
 Shader::~Shader()
 {
 	if (ID != 0)
@@ -126,6 +153,12 @@ void Shader::setVec3(const std::string& name, const glm::vec3& value) const
 	glUniform3fv(location, 1, &value[0]);
 }
 
+void Shader::setVec4(const std::string& name, const glm::vec4& value) const
+{
+	GLint location = getUniformLocation(name);
+	glUniform4fv(location, 1, &value[0]);
+}
+
 void Shader::setMat4(const std::string& name, glm::mat4 value) const
 {
     GLint location = getUniformLocation(name);
@@ -173,7 +206,7 @@ unsigned int Shader::compileShader(const char* source, GLenum shaderType)
 	unsigned int shader = glCreateShader(shaderType);
 	glShaderSource(shader, 1, &source, NULL);
 	glCompileShader(shader);
-	checkCompileErrors(shader, shaderType == GL_VERTEX_SHADER ? "VERTEX" : "FRAGMENT");
+	checkCompileErrors(shader, shaderType == GL_VERTEX_SHADER ? "VERTEX" : shaderType == GL_COMPUTE_SHADER ? "COMPUTE" : "FRAGMENT");
 	return shader;
 }
 
@@ -187,6 +220,15 @@ unsigned int Shader::linkProgram(unsigned int vertexShader, unsigned int fragmen
 	return program;
 }
 
+unsigned int Shader::linkProgram(unsigned int computeShader)
+{
+	unsigned int program = glCreateProgram();
+	glAttachShader(program, computeShader);
+	glLinkProgram(program);
+	checkCompileErrors(program, "PROGRAM");
+	return program;
+}
+
 GLint Shader::getUniformLocation(const std::string& name) const
 {
 	//Check if location is cached
@@ -240,6 +282,18 @@ void Shader::bindUBOs()
 
 void Shader::setCameraData(const CameraData& cameraData)
 {
+	// per-frame data goes through the staging ring as a buffer-to-buffer copy when it is available
+	StagingRing* ring = StagingRing::getInstance();
+	StagingAllocation allocation = ring ? ring->allocate(2 * sizeof(glm::mat4) + sizeof(glm::vec3)) : StagingAllocation{};
+	if (allocation.isValid())
+	{
+		std::memcpy(allocation.cpuPointer, glm::value_ptr(cameraData.viewMatrix), sizeof(glm::mat4));
+		std::memcpy(allocation.cpuPointer + sizeof(glm::mat4), glm::value_ptr(cameraData.projectionMatrix), sizeof(glm::mat4));
+		std::memcpy(allocation.cpuPointer + 2 * sizeof(glm::mat4), glm::value_ptr(cameraData.camPos), sizeof(glm::vec3));
+		ring->copyToBuffer(allocation, uboCamera, 0);
+		return;
+	}
+
 	glBindBuffer(GL_UNIFORM_BUFFER, uboCamera);
 	glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(glm::mat4), glm::value_ptr(cameraData.viewMatrix));
 	glBufferSubData(GL_UNIFORM_BUFFER, sizeof(glm::mat4), sizeof(glm::mat4), glm::value_ptr(cameraData.projectionMatrix));
@@ -33,6 +33,8 @@ public:
 	//Constructor & Deconstructor
 	Shader() = delete;
 	Shader(const char* vertexPath, const char* fragmentPath);
+	//Compute program, dispatched by the caller after use()
+	explicit Shader(const char* computePath);
 	~Shader();
 	void use();
 
@@ -41,6 +43,7 @@ public:
 	void setInt(const std::string& name, int value) const;
 	void setFloat(const std::string& name, float value) const;
 	void setVec3(const std::string& name, const glm::vec3& value) const;
+	void setVec4(const std::string& name, const glm::vec4& value) const;
 	void setMat4(const std::string& name, glm::mat4 value) const;
 	void setMat3(const std::string& name, const glm::mat3& mat) const;
 
@@ -64,5 +67,6 @@ private:
 	void checkCompileErrors(unsigned int shader, std::string type);
 	unsigned int compileShader(const char* source, GLenum shaderType);
 	unsigned int linkProgram(unsigned int vertexShader, unsigned int fragmentShader);
+	unsigned int linkProgram(unsigned int computeShader);
 	
 };
@@ -0,0 +1,559 @@
+#include "SoftwareOcclusion.h"
+#include "BVH.h"
+#include "ThreadPool.h"
+#include <algorithm>
+#include <cfloat>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+
+#if defined(_M_X64) || defined(__x86_64__)
+#include <immintrin.h>
+#define SOFTWARE_OCCLUSION_AVX2 1
+#if defined(_MSC_VER)
+#define AVX2_TARGET
+#else
+#define AVX2_TARGET __attribute__((target("avx2")))
+#endif
+#endif
+
+namespace
+{
+	const size_t BATCH = 8;							// corners per AVX2 transform, pixels per AVX2 row block
+	const size_t MAX_OCCLUDERS = 32;
+	const size_t MAX_TRIANGLES_PER_OCCLUDER = 2048;
+	const float MIN_OCCLUDER_SCALE = 0.02f;			// bounding radius relative to the largest mesh's
+	const float GUARD_BAND = 2.0f;					// |x|, |y| <= GUARD_BAND * w after clipping, keeps the edge functions small
+	const float FAR_DEPTH = 1.0f;
+	// edges are pushed out by about this much of a pixel. two triangles sharing an edge evaluate it with opposite
+	// rounding, without it pixel centers right on the edge can be missed by both and leave cracks in an occluder
+	const float EDGE_BIAS = 1.0f / 256.0f;
+	const int TILES_X = SoftwareOcclusion::WIDTH / SoftwareOcclusion::TILE_WIDTH;
+	const int TILES_Y = SoftwareOcclusion::HEIGHT / SoftwareOcclusion::TILE_HEIGHT;
+
+	struct ClipVertex
+	{
+		float x, y, z, w;
+	};
+
+	struct ClipPlane
+	{
+		float x, y, z, w;
+	};
+
+	// near plane (z >= -w, GL clip space) and the guard band
+	const ClipPlane CLIP_PLANES[5] =
+	{
+		{ 0.0f, 0.0f, 1.0f, 1.0f },
+		{ 1.0f, 0.0f, 0.0f, GUARD_BAND },
+		{ -1.0f, 0.0f, 0.0f, GUARD_BAND },
+		{ 0.0f, 1.0f, 0.0f, GUARD_BAND },
+		{ 0.0f, -1.0f, 0.0f, GUARD_BAND },
+	};
+	const int MAX_CLIPPED_VERTICES = 3 + 5;
+
+	float planeDistance(const ClipPlane& plane, const ClipVertex& vertex)
+	{
+		return plane.x * vertex.x + plane.y * vertex.y + plane.z * vertex.z + plane.w * vertex.w;
+	}
+
+	// Sutherland-Hodgman against one plane, each plane adds at most one vertex
+	int clipPolygon(const ClipVertex* in, int count, const ClipPlane& plane, ClipVertex* out)
+	{
+		int outCount = 0;
+		for (int i = 0; i < count; i++)
+		{
+			const ClipVertex& a = in[i];
+			const ClipVertex& b = in[(i + 1) % count];
+			float distanceA = planeDistance(plane, a);
+			float distanceB = planeDistance(plane, b);
+			if (distanceA >= 0.0f)
+				out[outCount++] = a;
+			if ((distanceA >= 0.0f) != (distanceB >= 0.0f))
+			{
+				float t = distanceA / (distanceA - distanceB);
+				out[outCount++] = { a.x + (b.x - a.x) * t, a.y + (b.y - a.y) * t, a.z + (b.z - a.z) * t, a.w + (b.w - a.w) * t };
+			}
+		}
+		return outCount;
+	}
+
+	// pixel centers are at +0.5, bottom row first like the GL window
+	glm::vec3 toWindow(const ClipVertex& vertex)
+	{
+		float inverseW = 1.0f / vertex.w;
+		return glm::vec3((vertex.x * inverseW * 0.5f + 0.5f) * SoftwareOcclusion::WIDTH,
+			(vertex.y * inverseW * 0.5f + 0.5f) * SoftwareOcclusion::HEIGHT, vertex.z * inverseW * 0.5f + 0.5f);
+	}
+
+	// false for triangles that cover no pixel center
+	bool setupTriangle(glm::vec3 v0, glm::vec3 v1, glm::vec3 v2, SoftwareOcclusion::RasterTriangle& triangle)
+	{
+		// occluders are drawn from both sides, a road seen from below still hides what's above it
+		float area = (v1.x - v0.x) * (v2.y - v0.y) - (v1.y - v0.y) * (v2.x - v0.x);
+		if (std::abs(area) < 1e-6f)
+			return false;
+		if (area < 0.0f)
+		{
+			std::swap(v1, v2);
+			area = -area;
+		}
+
+		triangle.minX = std::max(0, static_cast<int>(std::floor(std::min({ v0.x, v1.x, v2.x }) - 0.5f)));
+		triangle.maxX = std::min(SoftwareOcclusion::WIDTH - 1, static_cast<int>(std::floor(std::max({ v0.x, v1.x, v2.x }) - 0.5f)));
+		triangle.minY = std::max(0, static_cast<int>(std::floor(std::min({ v0.y, v1.y, v2.y }) - 0.5f)));
+		triangle.maxY = std::min(SoftwareOcclusion::HEIGHT - 1, static_cast<int>(std::floor(std::max({ v0.y, v1.y, v2.y }) - 0.5f)));
+		if (triangle.minX > triangle.maxX || triangle.minY > triangle.maxY)
+			return false;
+
+		const glm::vec3* corners[3] = { &v0, &v1, &v2 };
+		for (int edge = 0; edge < 3; edge++)
+		{
+			const glm::vec3& a = *corners[edge];
+			const glm::vec3& b = *corners[(edge + 1) % 3];
+			triangle.edgeA[edge] = a.y - b.y;
+			triangle.edgeB[edge] = b.x - a.x;
+			triangle.edgeC[edge] = a.x * b.y - a.y * b.x + (std::abs(triangle.edgeA[edge]) + std::abs(triangle.edgeB[edge])) * EDGE_BIAS;
+		}
+
+		// depth / w is linear in screen space
+		triangle.depthDx = ((v1.z - v0.z) * (v2.y - v0.y) - (v2.z - v0.z) * (v1.y - v0.y)) / area;
+		triangle.depthDy = ((v1.x - v0.x) * (v2.z - v0.z) - (v1.z - v0.z) * (v2.x - v0.x)) / area;
+		triangle.depthC = v0.z - triangle.depthDx * v0.x - triangle.depthDy * v0.y;
+		return true;
+	}
+
+	void transformScalar(const glm::mat4& m, const float* x, const float* y, const float* z, size_t count, float* outX, float* outY, float* outZ, float* outW)
+	{
+		for (size_t i = 0; i < count; i++)
+		{
+			outX[i] = m[0][0] * x[i] + m[1][0] * y[i] + m[2][0] * z[i] + m[3][0];
+			outY[i] = m[0][1] * x[i] + m[1][1] * y[i] + m[2][1] * z[i] + m[3][1];
+			outZ[i] = m[0][2] * x[i] + m[1][2] * y[i] + m[2][2] * z[i] + m[3][2];
+			outW[i] = m[0][3] * x[i] + m[1][3] * y[i] + m[2][3] * z[i] + m[3][3];
+		}
+	}
+
+	// the scalar kernels do the same arithmetic in the same order as the AVX2 ones, both fill the same pixels
+	void rasterizeScalar(const SoftwareOcclusion::RasterTriangle& triangle, int minX, int maxX, int minY, int maxY, float* depth)
+	{
+		for (int y = minY; y <= maxY; y++)
+		{
+			float pixelY = static_cast<float>(y) + 0.5f;
+			float rowEdge[3];
+			for (int edge = 0; edge < 3; edge++)
+				rowEdge[edge] = triangle.edgeB[edge] * pixelY + triangle.edgeC[edge];
+			float rowDepth = triangle.depthDy * pixelY + triangle.depthC;
+
+			float* row = depth + static_cast<size_t>(y) * SoftwareOcclusion::WIDTH;
+			for (int x = minX; x <= maxX; x++)
+			{
+				float pixelX = static_cast<float>(x) + 0.5f;
+				bool inside = triangle.edgeA[0] * pixelX + rowEdge[0] > 0.0f && triangle.edgeA[1] * pixelX + rowEdge[1] > 0.0f &&
+					triangle.edgeA[2] * pixelX + rowEdge[2] > 0.0f;
+				if (inside)
+					row[x] = std::min(row[x], triangle.depthDx * pixelX + rowDepth);
+			}
+		}
+	}
+
+	bool rectOccludedScalar(const float* depth, int minX, int maxX, int minY, int maxY, float nearestDepth)
+	{
+		for (int y = minY; y <= maxY; y++)
+		{
+			const float* row = depth + static_cast<size_t>(y) * SoftwareOcclusion::WIDTH;
+			for (int x = minX; x <= maxX; x++)
+			{
+				if (row[x] >= nearestDepth)
+					return false;
+			}
+		}
+		return true;
+	}
+
+#ifdef SOFTWARE_OCCLUSION_AVX2
+	AVX2_TARGET void transformAVX2(const glm::mat4& m, const float* x, const float* y, const float* z, size_t count, float* outX, float* outY, float* outZ, float* outW)
+	{
+		float* outputs[4] = { outX, outY, outZ, outW };
+		for (size_t i = 0; i < count; i += BATCH)
+		{
+			__m256 px = _mm256_loadu_ps(x + i);
+			__m256 py = _mm256_loadu_ps(y + i);
+			__m256 pz = _mm256_loadu_ps(z + i);
+			for (int row = 0; row < 4; row++)
+			{
+				__m256 result = _mm256_mul_ps(_mm256_set1_ps(m[0][row]), px);
+				result = _mm256_add_ps(result, _mm256_mul_ps(_mm256_set1_ps(m[1][row]), py));
+				result = _mm256_add_ps(result, _mm256_mul_ps(_mm256_set1_ps(m[2][row]), pz));
+				result = _mm256_add_ps(result, _mm256_set1_ps(m[3][row]));
+				_mm256_storeu_ps(outputs[row] + i, result);
+			}
+		}
+	}
+
+	// minX has to be a multiple of 8 and the blocks up to maxX inside the row, true for rows clamped to a tile
+	AVX2_TARGET void rasterizeAVX2(const SoftwareOcclusion::RasterTriangle& triangle, int minX, int maxX, int minY, int maxY, float* depth)
+	{
+		const __m256 laneCenters = _mm256_setr_ps(0.5f, 1.5f, 2.5f, 3.5f, 4.5f, 5.5f, 6.5f, 7.5f);
+		const __m256 zero = _mm256_setzero_ps();
+		__m256 edgeA[3];
+		for (int edge = 0; edge < 3; edge++)
+			edgeA[edge] = _mm256_set1_ps(triangle.edgeA[edge]);
+		const __m256 depthDx = _mm256_set1_ps(triangle.depthDx);
+
+		for (int y = minY; y <= maxY; y++)
+		{
+			float pixelY = static_cast<float>(y) + 0.5f;
+			__m256 rowEdge[3];
+			for (int edge = 0; edge < 3; edge++)
+				rowEdge[edge] = _mm256_set1_ps(triangle.edgeB[edge] * pixelY + triangle.edgeC[edge]);
+			__m256 rowDepth = _mm256_set1_ps(triangle.depthDy * pixelY + triangle.depthC);
+
+			float* row = depth + static_cast<size_t>(y) * SoftwareOcclusion::WIDTH;
+			for (int x = minX; x <= maxX; x += static_cast<int>(BATCH))
+			{
+				__m256 pixelX = _mm256_add_ps(_mm256_set1_ps(static_cast<float>(x)), laneCenters);
+				__m256 inside = _mm256_cmp_ps(_mm256_add_ps(_mm256_mul_ps(edgeA[0], pixelX), rowEdge[0]), zero, _CMP_GT_OQ);
+				inside = _mm256_and_ps(inside, _mm256_cmp_ps(_mm256_add_ps(_mm256_mul_ps(edgeA[1], pixelX), rowEdge[1]), zero, _CMP_GT_OQ));
+				inside = _mm256_and_ps(inside, _mm256_cmp_ps(_mm256_add_ps(_mm256_mul_ps(edgeA[2], pixelX), rowEdge[2]), zero, _CMP_GT_OQ));
+				if (_mm256_movemask_ps(inside) == 0)
+					continue;
+
+				__m256 pixelDepth = _mm256_add_ps(_mm256_mul_ps(depthDx, pixelX), rowDepth);
+				__m256 current = _mm256_loadu_ps(row + x);
+				_mm256_storeu_ps(row + x, _mm256_blendv_ps(current, _mm256_min_ps(current, pixelDepth), inside));
+			}
+		}
+	}
+
+	// reads up to 7 floats past maxX, the buffer is padded for the last row
+	AVX2_TARGET bool rectOccludedAVX2(const float* depth, int minX, int maxX, int minY, int maxY, float nearestDepth)
+	{
+		const __m256i lanes = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+		const __m256 nearest = _mm256_set1_ps(nearestDepth);
+		for (int y = minY; y <= maxY; y++)
+		{
+			const float* row = depth + static_cast<size_t>(y) * SoftwareOcclusion::WIDTH;
+			for (int x = minX; x <= maxX; x += static_cast<int>(BATCH))
+			{
+				__m256 valid = _mm256_castsi256_ps(_mm256_cmpgt_epi32(_mm256_set1_epi32(maxX - x + 1), lanes));
+				__m256 showing = _mm256_and_ps(_mm256_cmp_ps(_mm256_loadu_ps(row + x), nearest, _CMP_GE_OQ), valid);
+				if (_mm256_movemask_ps(showing) != 0)
+					return false;
+			}
+		}
+		return true;
+	}
+#endif
+}
+
+SoftwareOcclusion::SoftwareOcclusion()
+	: tileTriangles(TILES_X * TILES_Y)
+	, depth(static_cast<size_t>(WIDTH) * HEIGHT + BATCH, FAR_DEPTH)
+{
+}
+
+SoftwareOcclusion::~SoftwareOcclusion()
+{
+	// the job points at this
+	wait();
+}
+
+void SoftwareOcclusion::update(const std::vector<Model*>& models)
+{
+	bool changed = models.size() != builtModels.size();
+	for (size_t i = 0; i < models.size() && !changed; i++)
+	{
+		const Model& model = *models[i];
+		size_t meshCount = model.isLoading() ? 0 : model.meshes.size();
+		changed = builtModels[i] != &model || builtMeshCounts[i] != meshCount || builtMatrices[i] != model.modelMatrix;
+	}
+	if (changed)
+	{
+		wait();
+		select(models);
+	}
+}
+
+void SoftwareOcclusion::select(const std::vector<Model*>& models)
+{
+	builtModels.assign(models.begin(), models.end());
+	builtMatrices.clear();
+	builtMeshCounts.clear();
+	cornerX.clear();
+	cornerY.clear();
+	cornerZ.clear();
+	triangleCount = 0;
+	rendered = false;
+
+	// the biggest meshes by bounding radius, skipping anything small next to the largest
+	struct Candidate
+	{
+		const Model* model;
+		const Mesh* mesh;
+		float radius;
+	};
+	std::vector<Candidate> candidates;
+	for (const Model* model : models)
+	{
+		builtMatrices.push_back(model->modelMatrix);
+		builtMeshCounts.push_back(model->isLoading() ? 0 : model->meshes.size());
+		if (model->isLoading())
+			continue;
+		for (const Mesh& mesh : model->meshes)
+		{
+			if (mesh.getGeometry()->triangleBVH)
+				candidates.push_back({ model, &mesh, mesh.worldSphere.w });
+		}
+	}
+	std::sort(candidates.begin(), candidates.end(), [](const Candidate& a, const Candidate& b) { return a.radius > b.radius; });
+	if (candidates.size() > MAX_OCCLUDERS)
+		candidates.resize(MAX_OCCLUDERS);
+	if (!candidates.empty())
+	{
+		float minRadius = candidates.front().radius * MIN_OCCLUDER_SCALE;
+		candidates.erase(std::find_if(candidates.begin(), candidates.end(), [minRadius](const Candidate& c) { return c.radius < minRadius; }), candidates.end());
+	}
+
+	stats = SoftwareOcclusionStats();
+	stats.occluders = candidates.size();
+	std::vector<glm::vec3> worldCorners;
+	std::vector<std::pair<float, uint32_t>> areas;
+	for (const Candidate& candidate : candidates)
+	{
+		const std::vector<glm::vec3>& localCorners = candidate.mesh->getGeometry()->triangleBVH->getCorners();
+		glm::mat4 transform = candidate.model->modelMatrix * candidate.mesh->localTransform;
+		size_t sourceTriangles = localCorners.size() / 3;
+		stats.sourceTriangles += sourceTriangles;
+
+		worldCorners.resize(localCorners.size());
+		areas.resize(sourceTriangles);
+		for (size_t i = 0; i < localCorners.size(); i++)
+			worldCorners[i] = glm::vec3(transform * glm::vec4(localCorners[i], 1.0f));
+		for (size_t i = 0; i < sourceTriangles; i++)
+		{
+			const glm::vec3* corner = &worldCorners[i * 3];
+			areas[i] = { glm::length(glm::cross(corner[1] - corner[0], corner[2] - corner[0])), static_cast<uint32_t>(i) };
+		}
+
+		// the largest triangles hide the most for their cost
+		size_t kept = std::min(sourceTriangles, MAX_TRIANGLES_PER_OCCLUDER);
+		std::nth_element(areas.begin(), areas.begin() + kept, areas.end(), [](const auto& a, const auto& b) { return a.first > b.first; });
+		for (size_t i = 0; i < kept; i++)
+		{
+			const glm::vec3* corner = &worldCorners[areas[i].second * 3];
+			for (int c = 0; c < 3; c++)
+			{
+				cornerX.push_back(corner[c].x);
+				cornerY.push_back(corner[c].y);
+				cornerZ.push_back(corner[c].z);
+			}
+		}
+		triangleCount += kept;
+	}
+	stats.occluderTriangles = triangleCount;
+
+	size_t padded = (cornerX.size() + BATCH - 1) / BATCH * BATCH;
+	for (std::vector<float>* component : { &cornerX, &cornerY, &cornerZ })
+		component->resize(padded, 0.0f);
+	for (std::vector<float>* component : { &clipX, &clipY, &clipZ, &clipW })
+		component->resize(padded, 0.0f);
+
+	std::printf("SoftwareOcclusion: %zu occluders, %zu of their %zu triangles kept\n", stats.occluders, stats.occluderTriangles, stats.sourceTriangles);
+}
+
+void SoftwareOcclusion::render(const glm::mat4& frameViewProjection)
+{
+	wait();
+	rendered = false;
+	stats.testedBoxes = 0;
+	stats.occludedBoxes = 0;
+	stats.waitMs = 0.0;
+	if (triangleCount == 0)
+		return;
+
+	viewProjection = frameViewProjection;
+	rendered = true;
+	job = ThreadPool::getShared().submit([this]() { rasterize(); });
+}
+
+void SoftwareOcclusion::wait()
+{
+	if (!job.valid())
+		return;
+	auto start = std::chrono::steady_clock::now();
+	job.get();
+	std::chrono::duration<double, std::milli> waited = std::chrono::steady_clock::now() - start;
+	stats.waitMs += waited.count();
+}
+
+void SoftwareOcclusion::rasterize()
+{
+	auto start = std::chrono::steady_clock::now();
+
+	const size_t cornerCount = cornerX.size();
+#ifdef SOFTWARE_OCCLUSION_AVX2
+	if (FrustumCuller::HasAVX2())
+		transformAVX2(viewProjection, cornerX.data(), cornerY.data(), cornerZ.data(), cornerCount, clipX.data(), clipY.data(), clipZ.data(), clipW.data());
+	else
+#endif
+		transformScalar(viewProjection, cornerX.data(), cornerY.data(), cornerZ.data(), cornerCount, clipX.data(), clipY.data(), clipZ.data(), clipW.data());
+
+	setupTriangles();
+	ThreadPool::getShared().parallelFor(tileTriangles.size(), [this](size_t tile) { rasterizeTile(tile); });
+
+	std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+	stats.rasterMs = elapsed.count();
+}
+
+void SoftwareOcclusion::setupTriangles()
+{
+	triangles.clear();
+	for (std::vector<uint32_t>& tile : tileTriangles)
+		tile.clear();
+
+	auto addTriangle = [this](const ClipVertex& a, const ClipVertex& b, const ClipVertex& c)
+		{
+			RasterTriangle triangle;
+			if (!setupTriangle(toWindow(a), toWindow(b), toWindow(c), triangle))
+				return;
+			uint32_t index = static_cast<uint32_t>(triangles.size());
+			triangles.push_back(triangle);
+			for (int tileY = triangle.minY / TILE_HEIGHT; tileY <= triangle.maxY / TILE_HEIGHT; tileY++)
+			{
+				for (int tileX = triangle.minX / TILE_WIDTH; tileX <= triangle.maxX / TILE_WIDTH; tileX++)
+					tileTriangles[tileY * TILES_X + tileX].push_back(index);
+			}
+		};
+
+	for (size_t t = 0; t < triangleCount; t++)
+	{
+		ClipVertex corners[3];
+		unsigned int outsideAll = ~0u, outsideAny = 0;
+		for (int c = 0; c < 3; c++)
+		{
+			size_t i = t * 3 + c;
+			corners[c] = { clipX[i], clipY[i], clipZ[i], clipW[i] };
+			// behind the near plane or outside the view on one side
+			unsigned int outside = 0;
+			outside |= corners[c].z < -corners[c].w ? 1u : 0u;
+			outside |= corners[c].x > corners[c].w ? 2u : 0u;
+			outside |= corners[c].x < -corners[c].w ? 4u : 0u;
+			outside |= corners[c].y > corners[c].w ? 8u : 0u;
+			outside |= corners[c].y < -corners[c].w ? 16u : 0u;
+			outsideAll &= outside;
+			outsideAny |= outside;
+		}
+		if (outsideAll != 0)
+			continue;
+
+		bool needsClipping = (outsideAny & 1u) != 0;
+		for (int c = 0; c < 3 && !needsClipping; c++)
+			needsClipping = std::abs(corners[c].x) > GUARD_BAND * corners[c].w || std::abs(corners[c].y) > GUARD_BAND * corners[c].w;
+		if (!needsClipping)
+		{
+			addTriangle(corners[0], corners[1], corners[2]);
+			continue;
+		}
+
+		ClipVertex polygon[MAX_CLIPPED_VERTICES], clipped[MAX_CLIPPED_VERTICES];
+		std::copy(corners, corners + 3, polygon);
+		int count = 3;
+		for (const ClipPlane& plane : CLIP_PLANES)
+		{
+			count = clipPolygon(polygon, count, plane, clipped);
+			std::copy(clipped, clipped + count, polygon);
+			if (count < 3)
+				break;
+		}
+		for (int i = 1; i + 1 < count; i++)
+			addTriangle(polygon[0], polygon[i], polygon[i + 1]);
+	}
+	stats.rasterizedTriangles = triangles.size();
+}
+
+void SoftwareOcclusion::rasterizeTile(size_t tile)
+{
+	const int tileMinX = static_cast<int>(tile % TILES_X) * TILE_WIDTH;
+	const int tileMinY = static_cast<int>(tile / TILES_X) * TILE_HEIGHT;
+	const int tileMaxX = tileMinX + TILE_WIDTH - 1;
+	const int tileMaxY = tileMinY + TILE_HEIGHT - 1;
+	for (int y = tileMinY; y <= tileMaxY; y++)
+		std::fill_n(depth.begin() + static_cast<size_t>(y) * WIDTH + tileMinX, TILE_WIDTH, FAR_DEPTH);
+
+#ifdef SOFTWARE_OCCLUSION_AVX2
+	const bool avx2 = FrustumCuller::HasAVX2();
+#endif
+	for (uint32_t index : tileTriangles[tile])
+	{
+		const RasterTriangle& triangle = triangles[index];
+		int minX = std::max(triangle.minX, tileMinX);
+		int maxX = std::min(triangle.maxX, tileMaxX);
+		int minY = std::max(triangle.minY, tileMinY);
+		int maxY = std::min(triangle.maxY, tileMaxY);
+#ifdef SOFTWARE_OCCLUSION_AVX2
+		if (avx2)
+		{
+			rasterizeAVX2(triangle, minX & ~static_cast<int>(BATCH - 1), maxX, minY, maxY, depth.data());
+			continue;
+		}
+#endif
+		rasterizeScalar(triangle, minX, maxX, minY, maxY, depth.data());
+	}
+}
+
+bool SoftwareOcclusion::rectOccluded(int minX, int maxX, int minY, int maxY, float nearestDepth) const
+{
+#ifdef SOFTWARE_OCCLUSION_AVX2
+	if (FrustumCuller::HasAVX2())
+		return rectOccludedAVX2(depth.data(), minX, maxX, minY, maxY, nearestDepth);
+#endif
+	return rectOccludedScalar(depth.data(), minX, maxX, minY, maxY, nearestDepth);
+}
+
+void SoftwareOcclusion::testBoxes(const FrustumBoxes& boxes, uint8_t* visible)
+{
+	if (!rendered)
+		return;
+	wait();
+
+	for (size_t i = 0; i < boxes.count; i++)
+	{
+		if (!visible[i])
+			continue;
+		stats.testedBoxes++;
+
+		glm::vec3 center(boxes.centerX[i], boxes.centerY[i], boxes.centerZ[i]);
+		glm::vec3 extent(boxes.extentX[i], boxes.extentY[i], boxes.extentZ[i]);
+		glm::vec3 windowMin(FLT_MAX), windowMax(-FLT_MAX);
+		bool crossesNear = false;
+		for (int corner = 0; corner < 8; corner++)
+		{
+			glm::vec3 offset((corner & 1) ? extent.x : -extent.x, (corner & 2) ? extent.y : -extent.y, (corner & 4) ? extent.z : -extent.z);
+			glm::vec4 clip = viewProjection * glm::vec4(center + offset, 1.0f);
+			// with the camera next to or inside the box it can't be hidden
+			crossesNear = clip.z < -clip.w;
+			if (crossesNear)
+				break;
+			glm::vec3 window = toWindow({ clip.x, clip.y, clip.z, clip.w });
+			windowMin = glm::min(windowMin, window);
+			windowMax = glm::max(windowMax, window);
+		}
+		if (crossesNear)
+			continue;
+
+		// every pixel the screen rect touches
+		int minX = std::max(0, static_cast<int>(std::floor(windowMin.x)));
+		int maxX = std::min(WIDTH - 1, static_cast<int>(std::floor(windowMax.x)));
+		int minY = std::max(0, static_cast<int>(std::floor(windowMin.y)));
+		int maxY = std::min(HEIGHT - 1, static_cast<int>(std::floor(windowMax.y)));
+		if (minX > maxX || minY > maxY)
+			continue;
+
+		if (rectOccluded(minX, maxX, minY, maxY, windowMin.z))
+		{
+			visible[i] = 0;
+			stats.occludedBoxes++;
+		}
+	}
+}
@@ -0,0 +1,83 @@
+#pragma once
+#include "FrustumCuller.h"
+#include <cstdint>
+#include <future>
+#include <vector>
+
+//What the software occlusion buffer did. The occluder numbers change with the selection, the rest every frame
+struct SoftwareOcclusionStats
+{
+	size_t occluders = 0;
+	size_t occluderTriangles = 0;		// kept for rasterizing
+	size_t sourceTriangles = 0;			// of the occluder meshes before they were reduced
+	size_t rasterizedTriangles = 0;		// after clipping and rejection
+	double rasterMs = 0.0;				// on the worker, from the transform to the last tile
+	double waitMs = 0.0;				// the GL thread spent blocked on the worker
+	size_t testedBoxes = 0;
+	size_t occludedBoxes = 0;
+};
+
+//CPU occlusion culling that doesn't wait on the GPU: the largest meshes of the scene are picked as occluders, cut down
+//to their biggest triangles (a subset, so they never hide more than the real mesh) and rasterized depth only into a
+//small buffer on the shared thread pool while the GL thread prepares the frame. Boxes that survive frustum culling
+//are then tested against it, see FrustumCuller::occlude. Rows of 8 pixels are filled and tested with AVX2 when the
+//CPU has it. The triangles come from the meshes' TriangleBVH, meshes without one can't be occluders
+class SoftwareOcclusion
+{
+public:
+	static const int WIDTH = 256;
+	static const int HEIGHT = 128;
+	static const int TILE_WIDTH = 64;	// a multiple of 8 so tile rows are whole AVX2 blocks
+	static const int TILE_HEIGHT = 32;
+
+	//A triangle set up for scan conversion: screen space edge functions, inside where all three are positive,
+	//window depth as a plane, and its pixel bounds
+	struct RasterTriangle
+	{
+		float edgeA[3], edgeB[3], edgeC[3];
+		float depthDx, depthDy, depthC;
+		int minX, maxX, minY, maxY;
+	};
+
+	SoftwareOcclusion();
+	~SoftwareOcclusion();
+
+	SoftwareOcclusion(const SoftwareOcclusion&) = delete;
+	SoftwareOcclusion& operator=(const SoftwareOcclusion&) = delete;
+
+	//Picks the occluders again if a model finished loading or was moved, after the frame in flight is done
+	void update(const std::vector<Model*>& models);
+	//Starts rasterizing the occluders for this view-projection on the thread pool and returns straight away
+	void render(const glm::mat4& viewProjection);
+	//Clears visible[i] of every visible box hidden behind the occluders, waiting for render() to finish first.
+	//Does nothing when there was nothing to render
+	void testBoxes(const FrustumBoxes& boxes, uint8_t* visible);
+
+	const SoftwareOcclusionStats& getStats() const { return stats; }
+
+private:
+	// world space occluder corners, 3 per triangle, padded to a multiple of 8
+	std::vector<float> cornerX, cornerY, cornerZ;
+	size_t triangleCount = 0;
+	std::vector<float> clipX, clipY, clipZ, clipW;
+	std::vector<RasterTriangle> triangles;
+	std::vector<std::vector<uint32_t>> tileTriangles;
+	std::vector<float> depth;	// WIDTH x HEIGHT window depth, bottom row first, 8 floats of padding after the last row
+
+	glm::mat4 viewProjection = glm::mat4(1.0f);
+	std::future<void> job;
+	bool rendered = false;
+	SoftwareOcclusionStats stats;
+
+	// what the occluders were picked from, to spot changes
+	std::vector<const Model*> builtModels;
+	std::vector<glm::mat4> builtMatrices;
+	std::vector<size_t> builtMeshCounts;
+
+	void select(const std::vector<Model*>& models);
+	void wait();
+	void rasterize();
+	void setupTriangles();
+	void rasterizeTile(size_t tile);
+	bool rectOccluded(int minX, int maxX, int minY, int maxY, float nearestDepth) const;
+};
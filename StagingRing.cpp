@@ -0,0 +1,174 @@
+#include "StagingRing.h"
+#include <iostream>
+
+StagingRing* StagingRing::instance = nullptr;
+
+void StagingRing::init(GLsizeiptr capacity)
+{
+	if (instance != nullptr)
+		return;
+
+	if (!GLAD_GL_VERSION_4_4)
+	{
+		std::cout << "StagingRing: GL_ARB_buffer_storage not available, uploads use client memory" << std::endl;
+		return;
+	}
+	instance = new StagingRing(capacity);
+}
+
+void StagingRing::cleanup()
+{
+	delete instance;
+	instance = nullptr;
+}
+
+StagingRing* StagingRing::getInstance()
+{
+	return instance;
+}
+
+StagingRing::StagingRing(GLsizeiptr capacity)
+	: capacity(capacity)
+{
+	const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+	glCreateBuffers(1, &buffer);
+	glNamedBufferStorage(buffer, capacity, nullptr, flags);
+	mapped = static_cast<unsigned char*>(glMapNamedBufferRange(buffer, 0, capacity, flags));
+	if (mapped == nullptr)
+	{
+		std::cerr << "ERROR::STAGING_RING:: Failed to persistently map the staging buffer" << std::endl;
+	}
+}
+
+StagingRing::~StagingRing()
+{
+	for (const FencedRange& range : fences)
+	{
+		glDeleteSync(range.fence);
+	}
+	if (mapped != nullptr)
+	{
+		glUnmapNamedBuffer(buffer);
+	}
+	glDeleteBuffers(1, &buffer);
+}
+
+StagingAllocation StagingRing::allocate(GLsizeiptr size, GLsizeiptr alignment)
+{
+	std::lock_guard<std::mutex> lock(ringMutex);
+	if (mapped == nullptr || size <= 0 || size > capacity)
+		return StagingAllocation{};
+
+	auto alignUp = [alignment](GLintptr value) { return (value + alignment - 1) / alignment * alignment; };
+
+	const bool empty = fences.empty() && blocks.empty();
+	if (empty)
+		head = 0;   // nothing in flight, start over at the beginning
+
+	// the live range runs from tail (oldest unrecycled block) round to head
+	const GLintptr tail = !fences.empty() ? fences.front().start : (!blocks.empty() ? blocks.front().start : 0);
+
+	GLintptr offset = -1;
+	if (empty || head > tail)
+	{
+		// free space is [head, capacity) followed by [0, tail)
+		if (alignUp(head) + size <= capacity)
+			offset = alignUp(head);
+		else if (empty || size <= tail)
+			offset = 0; // wrap, the skipped end of the ring is recycled together with this block
+	}
+	else if (head < tail)
+	{
+		if (alignUp(head) + size <= tail)
+			offset = alignUp(head);
+	}
+	// head == tail with blocks in flight means the ring is full
+
+	if (offset < 0)
+		return StagingAllocation{};
+
+	blocks.push_back({ head, offset + size, false });
+	head = offset + size;
+
+	StagingAllocation allocation;
+	allocation.cpuPointer = mapped + offset;
+	allocation.offset = offset;
+	allocation.size = size;
+	return allocation;
+}
+
+void StagingRing::release(const StagingAllocation& allocation)
+{
+	if (!allocation.isValid())
+		return;
+
+	std::lock_guard<std::mutex> lock(ringMutex);
+	const GLintptr end = allocation.offset + allocation.size;
+	for (Block& block : blocks)
+	{
+		if (block.end == end && !block.released)
+		{
+			block.released = true;
+			return;
+		}
+	}
+}
+
+void StagingRing::copyToBuffer(const StagingAllocation& allocation, GLuint destination, GLintptr destinationOffset)
+{
+	glCopyNamedBufferSubData(buffer, destination, allocation.offset, destinationOffset, allocation.size);
+	release(allocation);
+}
+
+void StagingRing::uploadTexture2D(const StagingAllocation& allocation, GLint level, GLint internalFormat, GLsizei width, GLsizei height, GLenum format, GLenum type)
+{
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, buffer);
+	glTexImage2D(GL_TEXTURE_2D, level, internalFormat, width, height, 0, format, type, reinterpret_cast<const void*>(allocation.offset));
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	release(allocation);
+}
+
+void StagingRing::uploadCompressedTexture2D(const StagingAllocation& allocation, GLintptr offset, GLint level, GLenum internalFormat, GLsizei width, GLsizei height, GLsizei imageSize)
+{
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, buffer);
+	glCompressedTexImage2D(GL_TEXTURE_2D, level, internalFormat, width, height, 0, imageSize, reinterpret_cast<const void*>(allocation.offset + offset));
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+}
+
+void StagingRing::endFrame()
+{
+	std::lock_guard<std::mutex> lock(ringMutex);
+
+	// fence the oldest run of released blocks. a block that is still being written stops the run,
+	// anything allocated after it waits for a later frame so the fences stay in ring order
+	size_t releasedCount = 0;
+	while (releasedCount < blocks.size() && blocks[releasedCount].released)
+	{
+		releasedCount++;
+	}
+
+	if (releasedCount > 0)
+	{
+		FencedRange range;
+		range.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		range.start = blocks.front().start;
+		range.end = blocks[releasedCount - 1].end;
+		fences.push_back(range);
+		blocks.erase(blocks.begin(), blocks.begin() + releasedCount);
+	}
+
+	retireSignaledFences();
+}
+
+void StagingRing::retireSignaledFences()
+{
+	while (!fences.empty())
+	{
+		GLenum status = glClientWaitSync(fences.front().fence, 0, 0);
+		if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+			break;
+
+		glDeleteSync(fences.front().fence);
+		fences.pop_front();
+	}
+}
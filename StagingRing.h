@@ -0,0 +1,80 @@
+#pragma once
+#include <glad/glad.h>
+#include <deque>
+#include <mutex>
+
+//A block of the staging ring. CPU writes go to cpuPointer, GL copies read from offset inside StagingRing::getBuffer()
+struct StagingAllocation
+{
+	unsigned char* cpuPointer = nullptr;
+	GLintptr offset = 0;
+	GLsizeiptr size = 0;
+
+	bool isValid() const { return cpuPointer != nullptr; }
+};
+
+//Persistently mapped (GL_ARB_buffer_storage / GL 4.4) upload ring. Any thread can allocate and write into it,
+//the GL thread then issues buffer-to-buffer or PBO copies from it and releases the block. Released blocks are
+//fenced once per frame and recycled when the GPU has passed the fence, so uploads never make the driver take a
+//synchronous copy of client memory.
+class StagingRing
+{
+public:
+	//Creates the shared ring, call on the GL thread once the context is current. Does nothing without GL 4.4
+	static void init(GLsizeiptr capacity = 64 * 1024 * 1024);
+	static void cleanup();
+	//Shared ring or nullptr if it isn't available, callers fall back to plain client memory uploads
+	static StagingRing* getInstance();
+
+	StagingRing(const StagingRing&) = delete;
+	StagingRing& operator=(const StagingRing&) = delete;
+
+	//Thread safe and non-blocking: returns an invalid allocation when the ring has no room right now
+	StagingAllocation allocate(GLsizeiptr size, GLsizeiptr alignment = 16);
+	//Hands a block back once every GL command reading it has been issued (or it was never used)
+	void release(const StagingAllocation& allocation);
+
+	//GL thread helpers, they issue the copy and release the block
+	void copyToBuffer(const StagingAllocation& allocation, GLuint destination, GLintptr destinationOffset);
+	void uploadTexture2D(const StagingAllocation& allocation, GLint level, GLint internalFormat, GLsizei width, GLsizei height, GLenum format, GLenum type);
+	//Uploads imageSize bytes at offset inside the block and keeps it, so a whole compressed mip chain can share one
+	//block. Release it after the last level
+	void uploadCompressedTexture2D(const StagingAllocation& allocation, GLintptr offset, GLint level, GLenum internalFormat, GLsizei width, GLsizei height, GLsizei imageSize);
+
+	//GL thread, once per frame: fences the released blocks and recycles the ones the GPU is done with
+	void endFrame();
+
+	GLuint getBuffer() const { return buffer; }
+	GLsizeiptr getCapacity() const { return capacity; }
+
+private:
+	StagingRing(GLsizeiptr capacity);
+	~StagingRing();
+
+	struct Block
+	{
+		GLintptr start;     // includes any padding/wrap skipped to place the block
+		GLintptr end;
+		bool released;
+	};
+
+	struct FencedRange
+	{
+		GLsync fence;
+		GLintptr start;
+		GLintptr end;
+	};
+
+	GLuint buffer = 0;
+	unsigned char* mapped = nullptr;
+	GLsizeiptr capacity = 0;
+	GLintptr head = 0;
+
+	std::deque<Block> blocks;           // allocation order, not fenced yet
+	std::deque<FencedRange> fences;     // oldest first, always older than everything in blocks
+	std::mutex ringMutex;
+
+	void retireSignaledFences();
+
+	static StagingRing* instance;
+};
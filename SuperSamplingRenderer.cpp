@@ -2,7 +2,7 @@
 #include <iostream>
 
 SuperSamplingRenderer::SuperSamplingRenderer(unsigned int screenWidth, unsigned int screenHeight, unsigned int scale)
-    : screenWidth(screenWidth), screenHeight(screenHeight), scale(scale), ssFBO(0), ssColorBuffer(0), depthBuffer(0)
+    : screenWidth(screenWidth), screenHeight(screenHeight), scale(scale), ssFBO(0), ssColorBuffer(0), depthTexture(0)
 {
     init();
 }
@@ -24,10 +24,15 @@ void SuperSamplingRenderer::init()
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
     glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, ssColorBuffer, 0);
 
-    glGenRenderbuffers(1, &depthBuffer);
-    glBindRenderbuffer(GL_RENDERBUFFER, depthBuffer);
-    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT, screenWidth * scale, screenHeight * scale);
-    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depthBuffer);
+    //Depth is a texture rather than a renderbuffer so the Hi-Z pyramid can be built from it
+    glGenTextures(1, &depthTexture);
+    glBindTexture(GL_TEXTURE_2D, depthTexture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT32F, screenWidth * scale, screenHeight * scale, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, depthTexture, 0);
 
 
 
@@ -39,13 +44,12 @@ void SuperSamplingRenderer::init()
     glBindFramebuffer(GL_FRAMEBUFFER, 0);
 
     //Clean up bindings
-    glBindRenderbuffer(GL_RENDERBUFFER, 0);
     glBindTexture(GL_TEXTURE_2D, 0);
 }
 
 void SuperSamplingRenderer::cleanup()
 {
-    glDeleteRenderbuffers(1, &depthBuffer);
+    glDeleteTextures(1, &depthTexture);
     glDeleteTextures(1, &ssColorBuffer);
     glDeleteFramebuffers(1, &ssFBO);
 }
@@ -15,11 +15,14 @@ public:
 
     void updateViewportDimensions(int width, int height);
 
+    //Depth of the supersampled frame, a texture so later passes (HiZBuffer) can sample it
+    GLuint getDepthTexture() const { return depthTexture; }
+
     void onWindowSizeChanged(int width, int height) override;
 
 private:
     //std::unique_ptr<Framebuffer> ssFramebuffer; //removed cuz it broke everything, something about opengl context being bad everytime this class in particular uses FrameBuffer class
-    GLuint ssFBO, ssColorBuffer, depthBuffer;
+    GLuint ssFBO, ssColorBuffer, depthTexture;
     GLint originalViewport[4];  // Array to store the original viewport dimensions during different glViewport calls
     unsigned int screenWidth, screenHeight, scale;
     
@@ -0,0 +1,183 @@
+#include "TangentSpace.h"
+#include "ThreadPool.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <unordered_map>
+#include <vector>
+
+namespace
+{
+	const size_t ITEMS_PER_TASK = 4096;
+	const float EPSILON = 1e-12f;
+
+	// vertices are grouped by their exact bits, like MikkTSpace welds corners before averaging
+	struct VertexKey
+	{
+		float values[8];
+
+		bool operator==(const VertexKey& other) const
+		{
+			return std::memcmp(values, other.values, sizeof(values)) == 0;
+		}
+	};
+
+	struct VertexKeyHash
+	{
+		size_t operator()(const VertexKey& key) const
+		{
+			uint32_t bits[8];
+			std::memcpy(bits, key.values, sizeof(bits));
+			uint64_t hash = 0xCBF29CE484222325ull;
+			for (uint32_t word : bits)
+				hash = (hash ^ word) * 0x100000001B3ull;
+			return static_cast<size_t>(hash);
+		}
+	};
+
+	glm::vec3 projectOntoPlane(const glm::vec3& vector, const glm::vec3& normal)
+	{
+		glm::vec3 projected = vector - normal * glm::dot(normal, vector);
+		float length = glm::length(projected);
+		return length > EPSILON ? projected / length : glm::vec3(0.0f);
+	}
+
+	glm::vec3 anyPerpendicular(const glm::vec3& normal)
+	{
+		glm::vec3 axis = std::abs(normal.x) < 0.9f ? glm::vec3(1.0f, 0.0f, 0.0f) : glm::vec3(0.0f, 1.0f, 0.0f);
+		glm::vec3 tangent = glm::cross(axis, normal);
+		float length = glm::length(tangent);
+		return length > 0.0f ? tangent / length : glm::vec3(1.0f, 0.0f, 0.0f);
+	}
+}
+
+namespace TangentSpace
+{
+	void Generate(MeshData& mesh)
+	{
+		std::vector<Vertex>& vertices = mesh.vertices;
+		std::vector<unsigned int>& indices = mesh.indices;
+		const size_t triangleCount = indices.size() / 3;
+		const size_t cornerCount = triangleCount * 3;
+
+		// welded vertex of every index
+		std::vector<uint32_t> groupOf(vertices.size());
+		{
+			std::unordered_map<VertexKey, uint32_t, VertexKeyHash> groups;
+			groups.reserve(vertices.size());
+			for (size_t i = 0; i < vertices.size(); i++)
+			{
+				const Vertex& vertex = vertices[i];
+				VertexKey key = { { vertex.Position.x, vertex.Position.y, vertex.Position.z, vertex.Normal.x, vertex.Normal.y, vertex.Normal.z,
+					vertex.TexCoords.x, vertex.TexCoords.y } };
+				groupOf[i] = groups.emplace(key, static_cast<uint32_t>(groups.size())).first->second;
+			}
+		}
+
+		// per corner: angle weighted triangle tangent in the corner's tangent plane, and the triangle's orientation
+		// (+1, -1, or 0 when its UVs are degenerate and it takes whatever its neighbours agree on)
+		std::vector<glm::vec3> contributions(cornerCount);
+		std::vector<int8_t> orientations(cornerCount);
+		size_t taskCount = (triangleCount + ITEMS_PER_TASK - 1) / ITEMS_PER_TASK;
+		ThreadPool::getShared().parallelFor(taskCount, [&](size_t task)
+			{
+				size_t end = std::min(triangleCount, (task + 1) * ITEMS_PER_TASK);
+				for (size_t t = task * ITEMS_PER_TASK; t < end; t++)
+				{
+					const Vertex* corners[3] = { &vertices[indices[t * 3]], &vertices[indices[t * 3 + 1]], &vertices[indices[t * 3 + 2]] };
+
+					// UVs are stored with a top-left origin, V is negated to work in the V up space bakers use
+					glm::vec2 t1(corners[0]->TexCoords.x, -corners[0]->TexCoords.y);
+					glm::vec2 t21 = glm::vec2(corners[1]->TexCoords.x, -corners[1]->TexCoords.y) - t1;
+					glm::vec2 t31 = glm::vec2(corners[2]->TexCoords.x, -corners[2]->TexCoords.y) - t1;
+					glm::vec3 d1 = corners[1]->Position - corners[0]->Position;
+					glm::vec3 d2 = corners[2]->Position - corners[0]->Position;
+
+					float signedArea = t21.x * t31.y - t21.y * t31.x;
+					glm::vec3 faceTangent = t31.y * d1 - t21.y * d2;
+					float tangentLength = glm::length(faceTangent);
+					bool degenerate = std::abs(signedArea) <= EPSILON || tangentLength <= EPSILON;
+					int8_t orientation = degenerate ? 0 : (signedArea > 0.0f ? 1 : -1);
+					if (!degenerate)
+						faceTangent *= float(orientation) / tangentLength;
+
+					for (int corner = 0; corner < 3; corner++)
+					{
+						size_t c = t * 3 + corner;
+						orientations[c] = orientation;
+						if (degenerate)
+						{
+							contributions[c] = glm::vec3(0.0f);
+							continue;
+						}
+
+						const glm::vec3& normal = corners[corner]->Normal;
+						glm::vec3 toPrevious = projectOntoPlane(corners[(corner + 2) % 3]->Position - corners[corner]->Position, normal);
+						glm::vec3 toNext = projectOntoPlane(corners[(corner + 1) % 3]->Position - corners[corner]->Position, normal);
+						float angle = std::acos(std::clamp(glm::dot(toPrevious, toNext), -1.0f, 1.0f));
+						contributions[c] = projectOntoPlane(faceTangent, normal) * angle;
+					}
+				}
+			});
+
+		// two slots per welded vertex, one per orientation. degenerate corners join the slot their vertex already uses
+		const size_t groupCount = vertices.empty() ? 0 : *std::max_element(groupOf.begin(), groupOf.end()) + 1;
+		std::vector<glm::vec3> slotTangents(groupCount * 2, glm::vec3(0.0f));
+		std::vector<uint8_t> slotUsed(groupCount * 2, 0);
+		for (size_t c = 0; c < cornerCount; c++)
+		{
+			if (orientations[c] == 0)
+				continue;
+			size_t slot = groupOf[indices[c]] * 2 + (orientations[c] < 0 ? 1 : 0);
+			slotTangents[slot] += contributions[c];
+			slotUsed[slot] = 1;
+		}
+
+		std::vector<uint32_t> cornerSlots(cornerCount);
+		for (size_t c = 0; c < cornerCount; c++)
+		{
+			size_t group = groupOf[indices[c]];
+			if (orientations[c] != 0)
+				cornerSlots[c] = static_cast<uint32_t>(group * 2 + (orientations[c] < 0 ? 1 : 0));
+			else
+				cornerSlots[c] = static_cast<uint32_t>(group * 2 + (!slotUsed[group * 2] && slotUsed[group * 2 + 1] ? 1 : 0));
+		}
+
+		// every corner of a vertex should land in one slot, a vertex shared across a mirror seam gets a copy per orientation
+		const uint32_t UNASSIGNED = ~uint32_t(0);
+		std::vector<uint32_t> vertexSlot(vertices.size(), UNASSIGNED);
+		std::vector<uint32_t> mirroredCopy(vertices.size(), UNASSIGNED);
+		for (size_t c = 0; c < cornerCount; c++)
+		{
+			unsigned int index = indices[c];
+			if (vertexSlot[index] == UNASSIGNED)
+				vertexSlot[index] = cornerSlots[c];
+			else if (vertexSlot[index] != cornerSlots[c])
+			{
+				if (mirroredCopy[index] == UNASSIGNED)
+				{
+					mirroredCopy[index] = static_cast<uint32_t>(vertices.size());
+					vertices.push_back(vertices[index]);
+					vertexSlot.push_back(cornerSlots[c]);
+				}
+				indices[c] = mirroredCopy[index];
+			}
+		}
+
+		ThreadPool::getShared().parallelFor((vertices.size() + ITEMS_PER_TASK - 1) / ITEMS_PER_TASK, [&](size_t task)
+			{
+				size_t end = std::min(vertices.size(), (task + 1) * ITEMS_PER_TASK);
+				for (size_t i = task * ITEMS_PER_TASK; i < end; i++)
+				{
+					Vertex& vertex = vertices[i];
+					uint32_t slot = vertexSlot[i];
+					glm::vec3 tangent = slot != UNASSIGNED ? slotTangents[slot] : glm::vec3(0.0f);
+					float length = glm::length(tangent);
+					// no usable UVs, any vector perpendicular to the normal will do
+					tangent = length > EPSILON ? tangent / length : anyPerpendicular(vertex.Normal);
+					float handedness = slot != UNASSIGNED && (slot & 1) ? -1.0f : 1.0f;
+					vertex.Tangent = glm::vec4(tangent, handedness);
+				}
+			});
+	}
+}
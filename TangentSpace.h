@@ -0,0 +1,13 @@
+#pragma once
+#include "Mesh.h"
+
+//Tangent frames for imported geometry that doesn't bring its own (Assimp imports, OBJ, glTF without TANGENT)
+namespace TangentSpace
+{
+	//MikkTSpace style generation: per triangle tangents projected into each corner's tangent plane, weighted by the
+	//corner angle and summed over every corner with the same position, normal, UV and orientation. Writes Tangent as
+	//xyz + handedness in w, with the same convention bakers and glTF use (bitangent = w * cross(Normal, Tangent), V up).
+	//A vertex used by triangles of both orientations (a mirrored UV seam) is split, so vertices and indices may grow.
+	//The triangle work is spread over the shared ThreadPool.
+	void Generate(MeshData& mesh);
+}
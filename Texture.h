@@ -32,5 +32,6 @@ enum class TextureUnit
     AmbientOcclusion = 3,
     Irradiance = 4,
     Prefilter = 5,
-    BrdfLUT = 6
+    BrdfLUT = 6,
+    HiZ = 15    // compute passes only, clear of the material and IBL units
 };
@@ -0,0 +1,566 @@
+#include "TextureCompressor.h"
+#include "AssimpIO.h"
+#include "BlockCompression.h"
+#include "HashUtils.h"
+#include "MappedFile.h"
+#include "MipGenerator.h"
+#include "ThreadPool.h"
+#include "stb_image.h"
+#include <assimp/Importer.hpp>
+#include <assimp/scene.h>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <future>
+#include <iostream>
+#include <map>
+
+namespace
+{
+	const uint8_t KTX_IDENTIFIER[12] = { 0xAB, 0x4B, 0x54, 0x58, 0x20, 0x31, 0x31, 0xBB, 0x0D, 0x0A, 0x1A, 0x0A };
+	const uint32_t KTX_ENDIANNESS = 0x04030201;
+	//key/value entry holding what the cache was built from: source hash, cache version and mip filtering
+	const char KTX_SOURCE_KEY[] = "AJGL.source";
+
+	struct KtxHeader
+	{
+		uint8_t identifier[12];
+		uint32_t endianness;
+		uint32_t glType;
+		uint32_t glTypeSize;
+		uint32_t glFormat;
+		uint32_t glInternalFormat;
+		uint32_t glBaseInternalFormat;
+		uint32_t pixelWidth;
+		uint32_t pixelHeight;
+		uint32_t pixelDepth;
+		uint32_t numberOfArrayElements;
+		uint32_t numberOfFaces;
+		uint32_t numberOfMipmapLevels;
+		uint32_t bytesOfKeyValueData;
+	};
+
+	struct KtxSourceValue
+	{
+		uint64_t sourceHash;
+		uint32_t version;
+		uint32_t mipContent;
+	};
+
+	int blockBytes(CompressedFormat format)
+	{
+		return format == CompressedFormat::BC4 ? BlockCompression::BC4_BLOCK_BYTES : BlockCompression::BC7_BLOCK_BYTES;
+	}
+
+	GLenum baseInternalFormat(CompressedFormat format)
+	{
+		switch (format)
+		{
+		case CompressedFormat::BC4: return GL_RED;
+		case CompressedFormat::BC5: return GL_RG;
+		default: return GL_RGBA;
+		}
+	}
+
+	size_t mipDataSize(CompressedFormat format, int width, int height)
+	{
+		return size_t((width + 3) / 4) * size_t((height + 3) / 4) * blockBytes(format);
+	}
+
+	void compressLevel(const std::vector<uint8_t>& rgba, int width, int height, CompressedFormat format, std::vector<uint8_t>& outData)
+	{
+		outData.resize(mipDataSize(format, width, height));
+		uint8_t* out = outData.data();
+
+		for (int blockY = 0; blockY < height; blockY += 4)
+		{
+			for (int blockX = 0; blockX < width; blockX += 4)
+			{
+				//blocks hanging over the edge of small mips repeat the last texel
+				uint8_t block[16][4];
+				for (int i = 0; i < 16; i++)
+				{
+					int x = std::min(blockX + (i & 3), width - 1);
+					int y = std::min(blockY + (i >> 2), height - 1);
+					std::memcpy(block[i], &rgba[(size_t(y) * width + x) * 4], 4);
+				}
+
+				if (format == CompressedFormat::BC7)
+				{
+					BlockCompression::EncodeBC7(block, out);
+				}
+				else
+				{
+					uint8_t red[16], green[16];
+					for (int i = 0; i < 16; i++)
+					{
+						red[i] = block[i][0];
+						green[i] = block[i][1];
+					}
+					if (format == CompressedFormat::BC4)
+						BlockCompression::EncodeBC4(red, out);
+					else
+						BlockCompression::EncodeBC5(red, green, out);
+				}
+				out += blockBytes(format);
+			}
+		}
+	}
+
+	//peak signal to noise ratio of the decoded top mip against the source, over the channels the format keeps
+	double measurePSNR(const std::vector<uint8_t>& rgba, int width, int height, CompressedFormat format, const std::vector<uint8_t>& data)
+	{
+		const int channelCount = format == CompressedFormat::BC4 ? 1 : (format == CompressedFormat::BC5 ? 2 : 4);
+		double squaredError = 0.0;
+		const uint8_t* block = data.data();
+
+		for (int blockY = 0; blockY < height; blockY += 4)
+		{
+			for (int blockX = 0; blockX < width; blockX += 4)
+			{
+				uint8_t decoded[16][4] = {};
+				if (format == CompressedFormat::BC7)
+				{
+					BlockCompression::DecodeBC7(block, decoded);
+				}
+				else
+				{
+					uint8_t red[16], green[16] = {};
+					if (format == CompressedFormat::BC4)
+						BlockCompression::DecodeBC4(block, red);
+					else
+						BlockCompression::DecodeBC5(block, red, green);
+					for (int i = 0; i < 16; i++)
+					{
+						decoded[i][0] = red[i];
+						decoded[i][1] = green[i];
+					}
+				}
+
+				for (int i = 0; i < 16; i++)
+				{
+					int x = blockX + (i & 3);
+					int y = blockY + (i >> 2);
+					if (x >= width || y >= height)
+						continue;
+					const uint8_t* source = &rgba[(size_t(y) * width + x) * 4];
+					for (int c = 0; c < channelCount; c++)
+					{
+						double difference = double(source[c]) - decoded[i][c];
+						squaredError += difference * difference;
+					}
+				}
+				block += blockBytes(format);
+			}
+		}
+
+		double mse = squaredError / (double(width) * height * channelCount);
+		return mse > 0.0 ? 10.0 * std::log10(255.0 * 255.0 / mse) : 99.0;
+	}
+
+	bool readCache(const std::string& cachePath, uint64_t sourceHash, TextureType type, CompressedTexture& outTexture)
+	{
+		if (!std::filesystem::exists(cachePath))
+			return false;
+
+		MappedFile file;
+		if (!file.open(cachePath))
+			return false;
+
+		const unsigned char* base = file.data();
+		const size_t size = file.size();
+
+		KtxHeader header;
+		if (size < sizeof(header))
+			return false;
+		std::memcpy(&header, base, sizeof(header));
+
+		const CompressedFormat format = TextureCompressor::ChooseFormat(type);
+		CompressedTexture expected;
+		expected.format = format;
+		if (std::memcmp(header.identifier, KTX_IDENTIFIER, sizeof(KTX_IDENTIFIER)) != 0 ||
+			header.endianness != KTX_ENDIANNESS ||
+			header.glInternalFormat != expected.getInternalFormat() ||
+			header.numberOfFaces != 1 ||
+			header.numberOfMipmapLevels == 0 ||
+			sizeof(header) + uint64_t(header.bytesOfKeyValueData) > size)
+		{
+			return false;
+		}
+
+		//the cache is only valid if it was built from this exact source with the current encoder
+		bool sourceMatches = false;
+		size_t cursor = sizeof(header);
+		const size_t keyValueEnd = cursor + header.bytesOfKeyValueData;
+		while (cursor + sizeof(uint32_t) <= keyValueEnd)
+		{
+			uint32_t pairSize;
+			std::memcpy(&pairSize, base + cursor, sizeof(pairSize));
+			cursor += sizeof(pairSize);
+			if (cursor + pairSize > keyValueEnd)
+				return false;
+
+			if (pairSize == sizeof(KTX_SOURCE_KEY) + sizeof(KtxSourceValue) &&
+				std::memcmp(base + cursor, KTX_SOURCE_KEY, sizeof(KTX_SOURCE_KEY)) == 0)
+			{
+				KtxSourceValue value;
+				std::memcpy(&value, base + cursor + sizeof(KTX_SOURCE_KEY), sizeof(value));
+				sourceMatches = value.sourceHash == sourceHash &&
+					value.version == TEXTURE_CACHE_VERSION &&
+					value.mipContent == static_cast<uint32_t>(MipGenerator::ContentForType(type));
+			}
+			cursor += (pairSize + 3) & ~3u;
+		}
+		if (!sourceMatches)
+			return false;
+
+		cursor = keyValueEnd;
+		outTexture.format = format;
+		outTexture.mips.clear();
+		int width = static_cast<int>(header.pixelWidth);
+		int height = static_cast<int>(header.pixelHeight);
+		for (uint32_t level = 0; level < header.numberOfMipmapLevels; level++)
+		{
+			uint32_t imageSize;
+			if (cursor + sizeof(imageSize) > size)
+				return false;
+			std::memcpy(&imageSize, base + cursor, sizeof(imageSize));
+			cursor += sizeof(imageSize);
+			if (imageSize != mipDataSize(format, width, height) || cursor + imageSize > size)
+			{
+				std::cerr << "ERROR::TEXTURE_CACHE:: Truncated cache file " << cachePath << std::endl;
+				return false;
+			}
+
+			CompressedMip mip;
+			mip.width = width;
+			mip.height = height;
+			mip.data.assign(base + cursor, base + cursor + imageSize);
+			outTexture.mips.push_back(std::move(mip));
+
+			cursor += (imageSize + 3) & ~3u;
+			width = std::max(1, width / 2);
+			height = std::max(1, height / 2);
+		}
+		return true;
+	}
+
+	bool writeCache(const std::string& cachePath, uint64_t sourceHash, TextureType type, const CompressedTexture& texture)
+	{
+		const std::string tempPath = cachePath + ".tmp";
+		{
+			std::ofstream out(tempPath, std::ios::binary | std::ios::trunc);
+			if (!out)
+			{
+				std::cerr << "ERROR::TEXTURE_CACHE:: Could not create " << tempPath << std::endl;
+				return false;
+			}
+
+			KtxSourceValue value = {};
+			value.sourceHash = sourceHash;
+			value.version = TEXTURE_CACHE_VERSION;
+			value.mipContent = static_cast<uint32_t>(MipGenerator::ContentForType(type));
+			const uint32_t pairSize = static_cast<uint32_t>(sizeof(KTX_SOURCE_KEY) + sizeof(value));
+			const uint32_t pairPadding = ((pairSize + 3) & ~3u) - pairSize;
+
+			KtxHeader header = {};
+			std::memcpy(header.identifier, KTX_IDENTIFIER, sizeof(KTX_IDENTIFIER));
+			header.endianness = KTX_ENDIANNESS;
+			header.glTypeSize = 1;
+			header.glInternalFormat = texture.getInternalFormat();
+			header.glBaseInternalFormat = baseInternalFormat(texture.format);
+			header.pixelWidth = static_cast<uint32_t>(texture.mips[0].width);
+			header.pixelHeight = static_cast<uint32_t>(texture.mips[0].height);
+			header.numberOfFaces = 1;
+			header.numberOfMipmapLevels = static_cast<uint32_t>(texture.mips.size());
+			header.bytesOfKeyValueData = sizeof(pairSize) + pairSize + pairPadding;
+			out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+			static const char zeros[4] = {};
+			out.write(reinterpret_cast<const char*>(&pairSize), sizeof(pairSize));
+			out.write(KTX_SOURCE_KEY, sizeof(KTX_SOURCE_KEY));
+			out.write(reinterpret_cast<const char*>(&value), sizeof(value));
+			out.write(zeros, pairPadding);
+
+			for (const CompressedMip& mip : texture.mips)
+			{
+				uint32_t imageSize = static_cast<uint32_t>(mip.data.size());
+				out.write(reinterpret_cast<const char*>(&imageSize), sizeof(imageSize));
+				out.write(reinterpret_cast<const char*>(mip.data.data()), imageSize);
+				out.write(zeros, ((imageSize + 3) & ~3u) - imageSize);
+			}
+
+			if (!out)
+			{
+				std::cerr << "ERROR::TEXTURE_CACHE:: Failed writing " << tempPath << std::endl;
+				return false;
+			}
+		}
+
+		std::error_code ec;
+		std::filesystem::rename(tempPath, cachePath, ec);
+		if (ec)
+		{
+			std::cerr << "ERROR::TEXTURE_CACHE:: Could not replace " << cachePath << ": " << ec.message() << std::endl;
+			std::filesystem::remove(tempPath, ec);
+			return false;
+		}
+		return true;
+	}
+}
+
+GLenum CompressedTexture::getInternalFormat() const
+{
+	switch (format)
+	{
+	case CompressedFormat::BC4: return GL_COMPRESSED_RED_RGTC1;
+	case CompressedFormat::BC5: return GL_COMPRESSED_RG_RGTC2;
+	default: return GL_COMPRESSED_RGBA_BPTC_UNORM;
+	}
+}
+
+size_t CompressedTexture::getMipSize(size_t level) const
+{
+	return mipDataSize(format, mips[level].width, mips[level].height);
+}
+
+namespace TextureCompressor
+{
+	CompressedFormat ChooseFormat(TextureType type)
+	{
+		switch (type)
+		{
+		case TextureType::NORMAL:
+		case TextureType::HEIGHT:	// bound as the normal map, see ResourceManager::TextureTypeToString
+			return CompressedFormat::BC5;
+		case TextureType::AMBIENT:
+		case TextureType::AMBIENT_OCCLUSION:
+		case TextureType::LIGHTMAP:
+			return CompressedFormat::BC4;
+		default:
+			//albedo and the packed roughness(G)/metallic(B) mask both need more than two channels
+			return CompressedFormat::BC7;
+		}
+	}
+
+	uint32_t GetVariant(TextureType type)
+	{
+		return (static_cast<uint32_t>(ChooseFormat(type)) << 8) | static_cast<uint32_t>(MipGenerator::ContentForType(type));
+	}
+
+	const char* FormatName(CompressedFormat format)
+	{
+		switch (format)
+		{
+		case CompressedFormat::BC4: return "BC4";
+		case CompressedFormat::BC5: return "BC5";
+		default: return "BC7";
+		}
+	}
+
+	bool Compress(const uint8_t* rgbaPixels, int width, int height, TextureType type, CompressedTexture& outTexture, CompressionReport* report)
+	{
+		if (rgbaPixels == nullptr || width <= 0 || height <= 0)
+			return false;
+
+		const CompressedFormat format = ChooseFormat(type);
+		outTexture.format = format;
+		outTexture.mips.clear();
+
+		const std::vector<MipLevel> levels = MipGenerator::GenerateMipChain(rgbaPixels, width, height, MipGenerator::ContentForType(type));
+		for (const MipLevel& level : levels)
+		{
+			CompressedMip mip;
+			mip.width = level.width;
+			mip.height = level.height;
+			compressLevel(level.rgba, level.width, level.height, format, mip.data);
+			outTexture.mips.push_back(std::move(mip));
+		}
+
+		if (report != nullptr)
+			report->psnr = measurePSNR(levels[0].rgba, width, height, format, outTexture.mips[0].data);
+		return true;
+	}
+
+	std::string GetCachePath(const std::string& sourcePath, TextureType type)
+	{
+		//BC7 is used both for colour, whose mips are filtered in linear light, and for masks filtered as stored
+		switch (ChooseFormat(type))
+		{
+		case CompressedFormat::BC4: return sourcePath + ".bc4.ktx";
+		case CompressedFormat::BC5: return sourcePath + ".bc5.ktx";
+		default: return sourcePath + (MipGenerator::ContentForType(type) == MipContent::SRGBColor ? ".bc7srgb.ktx" : ".bc7.ktx");
+		}
+	}
+
+	bool LoadOrCompress(const std::string& sourcePath, TextureType type, CompressedTexture& outTexture, CompressionReport* report, bool forceRebuild)
+	{
+		auto start = std::chrono::steady_clock::now();
+
+		uint64_t sourceHash;
+		if (!HashUtils::HashFile(sourcePath, sourceHash))
+			return false;
+
+		const std::string cachePath = GetCachePath(sourcePath, type);
+		bool fromCache = !forceRebuild && readCache(cachePath, sourceHash, type, outTexture);
+
+		int channels = 4;
+		if (fromCache)
+		{
+			//only the header is read, for the uncompressed size in the report
+			int width, height;
+			if (report != nullptr && !stbi_info(sourcePath.c_str(), &width, &height, &channels))
+				channels = 4;
+		}
+		else
+		{
+			//always expand to RGBA so the block encoders only deal with one layout
+			int width, height;
+			stbi_uc* pixels = stbi_load(sourcePath.c_str(), &width, &height, &channels, 4);
+			if (pixels == nullptr)
+				return false;
+
+			bool compressed = Compress(pixels, width, height, type, outTexture, report);
+			stbi_image_free(pixels);
+			if (!compressed)
+				return false;
+
+			writeCache(cachePath, sourceHash, type, outTexture);
+		}
+
+		if (report != nullptr)
+		{
+			report->path = sourcePath;
+			report->format = outTexture.format;
+			report->width = outTexture.mips[0].width;
+			report->height = outTexture.mips[0].height;
+			report->mipCount = static_cast<int>(outTexture.mips.size());
+			report->uncompressedBytes = 0;
+			report->compressedBytes = 0;
+			for (const CompressedMip& mip : outTexture.mips)
+			{
+				report->uncompressedBytes += size_t(mip.width) * mip.height * channels;
+				report->compressedBytes += mip.data.size();
+			}
+			report->fromCache = fromCache;
+			report->seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		}
+		return true;
+	}
+
+	void PrintReport(const std::vector<CompressionReport>& reports)
+	{
+		const double MB = 1024.0 * 1024.0;
+		size_t totalUncompressed = 0;
+		size_t totalCompressed = 0;
+
+		std::printf("%-60s %-4s %11s %4s %10s %10s %6s %8s %8s\n", "texture", "fmt", "size", "mips", "raw MB", "comp MB", "ratio", "PSNR dB", "time s");
+		for (const CompressionReport& report : reports)
+		{
+			std::string name = report.path.size() > 60 ? "..." + report.path.substr(report.path.size() - 57) : report.path;
+			std::string dimensions = std::to_string(report.width) + "x" + std::to_string(report.height);
+			std::string psnr = report.fromCache ? "cached" : std::to_string(report.psnr).substr(0, 5);
+			std::printf("%-60s %-4s %11s %4d %10.2f %10.2f %5.1fx %8s %8.2f\n",
+				name.c_str(), FormatName(report.format), dimensions.c_str(), report.mipCount,
+				report.uncompressedBytes / MB, report.compressedBytes / MB,
+				double(report.uncompressedBytes) / std::max<size_t>(report.compressedBytes, 1), psnr.c_str(), report.seconds);
+
+			totalUncompressed += report.uncompressedBytes;
+			totalCompressed += report.compressedBytes;
+		}
+		std::printf("%zu textures, %.2f MB -> %.2f MB (%.1fx)\n", reports.size(), totalUncompressed / MB, totalCompressed / MB,
+			double(totalUncompressed) / std::max<size_t>(totalCompressed, 1));
+	}
+
+	int RunCommandLine(const std::vector<std::string>& arguments)
+	{
+		bool forceRebuild = false;
+		std::vector<std::string> modelPaths;
+		for (const std::string& argument : arguments)
+		{
+			if (argument == "--rebuild")
+				forceRebuild = true;
+			else
+				modelPaths.push_back(argument);
+		}
+
+		if (modelPaths.empty())
+		{
+			std::cout << "usage: TextureCompressorTool [--rebuild] <model files...>" << std::endl;
+			return 1;
+		}
+
+		//material texture slots worth compressing, and the TextureType each is loaded as
+		const std::pair<aiTextureType, TextureType> materialTypes[] = {
+			{ aiTextureType_BASE_COLOR, TextureType::BASE_COLOR },
+			{ aiTextureType_DIFFUSE, TextureType::DIFFUSE },
+			{ aiTextureType_NORMALS, TextureType::NORMAL },
+			{ aiTextureType_HEIGHT, TextureType::HEIGHT },
+			{ aiTextureType_UNKNOWN, TextureType::UNKNOWN },
+			{ aiTextureType_LIGHTMAP, TextureType::LIGHTMAP },
+			{ aiTextureType_AMBIENT_OCCLUSION, TextureType::AMBIENT_OCCLUSION },
+		};
+
+		//cache file -> texture path and type, each variant of a texture shared by several materials is only compressed once
+		std::map<std::string, std::pair<std::string, TextureType>> textures;
+		for (const std::string& modelPath : modelPaths)
+		{
+			ImporterPool::Lease lease = ImporterPool::Acquire();
+			const aiScene* scene = lease.importer().ReadFile(modelPath, 0);
+			if (!scene)
+			{
+				std::cerr << "ERROR::ASSIMP:: " << lease.importer().GetErrorString() << std::endl;
+				continue;
+			}
+
+			std::string directory = modelPath.substr(0, modelPath.find_last_of("/\\"));
+			for (unsigned int m = 0; m < scene->mNumMaterials; m++)
+			{
+				const aiMaterial* material = scene->mMaterials[m];
+				for (const auto& materialType : materialTypes)
+				{
+					for (unsigned int t = 0; t < material->GetTextureCount(materialType.first); t++)
+					{
+						aiString path;
+						material->GetTexture(materialType.first, t, &path);
+						std::string texturePath = directory + '/' + path.C_Str();
+						textures.emplace(GetCachePath(texturePath, materialType.second), std::make_pair(texturePath, materialType.second));
+					}
+				}
+			}
+		}
+
+		std::vector<std::future<CompressionReport>> jobs;
+		for (const auto& texture : textures)
+		{
+			std::string path = texture.second.first;
+			TextureType type = texture.second.second;
+			jobs.push_back(ThreadPool::getShared().submit([path, type, forceRebuild]()
+				{
+					CompressionReport report;
+					CompressedTexture compressed;
+					if (!LoadOrCompress(path, type, compressed, &report, forceRebuild))
+					{
+						std::cerr << "ERROR::TEXTURE_COMPRESSOR:: Could not compress " << path << std::endl;
+						report.path.clear();
+					}
+					return report;
+				}));
+		}
+
+		std::vector<CompressionReport> reports;
+		for (std::future<CompressionReport>& job : jobs)
+		{
+			CompressionReport report = job.get();
+			if (!report.path.empty())
+				reports.push_back(report);
+		}
+
+		PrintReport(reports);
+		return reports.size() == textures.size() ? 0 : 1;
+	}
+}
@@ -0,0 +1,75 @@
+#pragma once
+#include <glad/glad.h>
+#include "Texture.h"
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+//Bump whenever the encoders or the mip generation change so stale caches are rebuilt
+const uint32_t TEXTURE_CACHE_VERSION = 2;
+
+enum class CompressedFormat
+{
+	BC4,	// single channel masks (AO)
+	BC5,	// tangent space normals, XY only, Z is rebuilt in the shader
+	BC7,	// colour and packed masks
+};
+
+struct CompressedMip
+{
+	int width = 0;
+	int height = 0;
+	std::vector<uint8_t> data;
+};
+
+//Full mip chain of one texture in a GPU block format, ready for glCompressedTexImage2D
+struct CompressedTexture
+{
+	CompressedFormat format = CompressedFormat::BC7;
+	std::vector<CompressedMip> mips;
+
+	GLenum getInternalFormat() const;
+	//Bytes of one level, also valid once its data has been moved into the staging ring
+	size_t getMipSize(size_t level) const;
+};
+
+struct CompressionReport
+{
+	std::string path;
+	CompressedFormat format = CompressedFormat::BC7;
+	int width = 0;
+	int height = 0;
+	int mipCount = 0;
+	size_t uncompressedBytes = 0;	// full mip chain at the source channel count, what the old upload path used
+	size_t compressedBytes = 0;
+	double psnr = 0.0;				// top mip, over the channels the format stores. only measured when encoding
+	double seconds = 0.0;
+	bool fromCache = false;
+};
+
+//CPU texture compressor and its on-disk cache. Each source image is compressed into the block format picked by its
+//TextureType and stored with its whole mip chain next to the source as <texture>.bc4/.bc5/.bc7/.bc7srgb.ktx (KTX 1.1),
+//keyed by a content hash of the source file. An image used in slots of different formats gets one file per format. Nothing here touches GL, so textures can be baked offline on a machine without a GPU.
+namespace TextureCompressor
+{
+	CompressedFormat ChooseFormat(TextureType type);
+	//What a TextureType is compressed to, block format and mip filtering. Equal for types that share a cache file
+	uint32_t GetVariant(TextureType type);
+	const char* FormatName(CompressedFormat format);
+
+	//Compresses tightly packed 8 bit RGBA pixels, generating the mip chain down to 1x1 with MipGenerator
+	bool Compress(const uint8_t* rgbaPixels, int width, int height, TextureType type, CompressedTexture& outTexture, CompressionReport* report = nullptr);
+
+	//One file per format and mip filtering, so the variants of a source neither evict each other nor share a temp file
+	std::string GetCachePath(const std::string& sourcePath, TextureType type);
+
+	//Loads the cached compressed texture for sourcePath, or decodes, compresses and caches it when the cache is missing or stale
+	bool LoadOrCompress(const std::string& sourcePath, TextureType type, CompressedTexture& outTexture, CompressionReport* report = nullptr, bool forceRebuild = false);
+
+	void PrintReport(const std::vector<CompressionReport>& reports);
+
+	//TextureCompressorTool [--rebuild] <model files...>
+	//Bakes the cache for every material texture of the given models and prints the quality/size report
+	int RunCommandLine(const std::vector<std::string>& arguments);
+}
@@ -0,0 +1,12 @@
+// Offline texture baker, built by TextureCompressorTool.vcxproj. Fills the .ktx cache next to each material
+// texture so AJGL only has to read the blocks back, and runs without a window or GPU
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
+#include "TextureCompressor.h"
+#include <string>
+#include <vector>
+
+int main(int argc, char* argv[])
+{
+	return TextureCompressor::RunCommandLine(std::vector<std::string>(argv + 1, argv + argc));
+}
@@ -0,0 +1,105 @@
+#include "ThreadPool.h"
+#include <algorithm>
+
+ThreadPool::ThreadPool(unsigned int threadCount)
+{
+	if (threadCount == 0)
+	{
+		unsigned int hardwareThreads = std::thread::hardware_concurrency();
+		threadCount = hardwareThreads > 1 ? hardwareThreads - 1 : 1;
+	}
+
+	workers.reserve(threadCount);
+	for (unsigned int i = 0; i < threadCount; i++)
+	{
+		workers.emplace_back(&ThreadPool::workerLoop, this);
+	}
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(queueMutex);
+		stopping = true;
+	}
+	taskAvailable.notify_all();
+
+	for (std::thread& worker : workers)
+	{
+		worker.join();
+	}
+}
+
+ThreadPool& ThreadPool::getShared()
+{
+	static ThreadPool sharedPool;
+	return sharedPool;
+}
+
+void ThreadPool::parallelFor(size_t count, const std::function<void(size_t)>& body)
+{
+	if (count == 0)
+		return;
+
+	//shared with the helper tasks, which may only get to run after this call has returned
+	struct Batch
+	{
+		std::function<void(size_t)> body;
+		size_t count;
+		std::atomic<size_t> next{ 0 };
+		std::atomic<size_t> finished{ 0 };
+		std::mutex mutex;
+		std::condition_variable allFinished;
+	};
+	auto batch = std::make_shared<Batch>();
+	batch->body = body;
+	batch->count = count;
+
+	auto work = [](Batch& state)
+	{
+		size_t index;
+		while ((index = state.next.fetch_add(1)) < state.count)
+		{
+			state.body(index);
+			if (state.finished.fetch_add(1) + 1 == state.count)
+			{
+				std::lock_guard<std::mutex> lock(state.mutex);
+				state.allFinished.notify_all();
+			}
+		}
+	};
+
+	size_t helpers = std::min<size_t>(count - 1, workers.size());
+	{
+		std::lock_guard<std::mutex> lock(queueMutex);
+		for (size_t i = 0; i < helpers; i++)
+			tasks.emplace([batch, work]() { work(*batch); });
+	}
+	if (helpers > 0)
+		taskAvailable.notify_all();
+
+	work(*batch);
+
+	std::unique_lock<std::mutex> lock(batch->mutex);
+	batch->allFinished.wait(lock, [&batch]() { return batch->finished.load() == batch->count; });
+}
+
+void ThreadPool::workerLoop()
+{
+	while (true)
+	{
+		std::function<void()> task;
+		{
+			std::unique_lock<std::mutex> lock(queueMutex);
+			taskAvailable.wait(lock, [this]() { return stopping || !tasks.empty(); });
+
+			//drain whatever is queued before shutting down so no future is left without a value
+			if (tasks.empty())
+				return;
+
+			task = std::move(tasks.front());
+			tasks.pop();
+		}
+		task();
+	}
+}
@@ -0,0 +1,55 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+//Fixed size worker pool for CPU side loading work (decoding, mesh processing). Nothing submitted here may touch GL,
+//results are handed back to the GL thread through the returned futures.
+class ThreadPool
+{
+public:
+	explicit ThreadPool(unsigned int threadCount = 0);	// 0 = one worker per hardware thread, minus the GL thread
+	~ThreadPool();
+
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+
+	template <typename Task>
+	auto submit(Task&& task) -> std::future<decltype(task())>
+	{
+		using Result = decltype(task());
+		auto packaged = std::make_shared<std::packaged_task<Result()>>(std::forward<Task>(task));
+		std::future<Result> result = packaged->get_future();
+		{
+			std::lock_guard<std::mutex> lock(queueMutex);
+			tasks.emplace([packaged]() { (*packaged)(); });
+		}
+		taskAvailable.notify_one();
+		return result;
+	}
+
+	//Runs body(i) for every i in [0, count) across the workers and the calling thread, returns when all are done.
+	//Safe to call from inside a pool task: the caller claims indices itself, so it only ever waits on work that
+	//another thread has already started, never on tasks still sitting in the queue behind it.
+	void parallelFor(size_t count, const std::function<void(size_t)>& body);
+
+	unsigned int getThreadCount() const { return static_cast<unsigned int>(workers.size()); }
+
+	//Pool shared by the loaders, created on first use
+	static ThreadPool& getShared();
+
+private:
+	std::vector<std::thread> workers;
+	std::queue<std::function<void()>> tasks;
+	std::mutex queueMutex;
+	std::condition_variable taskAvailable;
+	bool stopping = false;
+
+	void workerLoop();
+};